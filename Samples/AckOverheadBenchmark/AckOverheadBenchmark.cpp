@@ -0,0 +1,270 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Sends reliable messages through a relay on loopback, and reports how many bytes went to acknowledgements, per byte of
+// messages delivered. The relay reads the datagram headers to tell acks from data, so security must be off
+// Usage: AckOverheadBenchmark [roundTripMs] [secondsPerRun]
+
+#include "RakPeerInterface.h"
+#include "RakNetStatistics.h"
+#include "MessageIdentifiers.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include "../CongestionControlBenchmark/EmulatedLink.h"
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+
+using namespace RakNet;
+
+static const unsigned short SERVER_PORT=60200;
+// The client connects to the relay here. The server sees the client at RELAY_PORT+1
+static const unsigned short RELAY_PORT=60201;
+// Counted for every datagram, for the IP and UDP headers
+static const int IP_UDP_HEADER_SIZE=28;
+// Time after connecting before measuring
+static const RakNet::TimeMS WARMUP_TIME=2000;
+
+// First byte of a datagram
+static const unsigned char HEADER_IS_ACK=0x40;
+static const unsigned char HEADER_HAS_B_AND_AS=0x20;
+static const unsigned char HEADER_HAS_DATA=0x10;
+
+struct DirectionCounters
+{
+	std::atomic<uint64_t> datagrams;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> ackDatagrams;
+	std::atomic<uint64_t> ackBytes;
+};
+
+// Reads a number written seven bits per byte, as the ack ranges are. Returns the offset after it
+static int SkipVariableLength(const unsigned char *data, int offset, int length, uint32_t *value)
+{
+	*value=0;
+	for (int shift=0; offset < length && shift < 32; shift+=7)
+	{
+		unsigned char byte=data[offset++];
+		*value|=(uint32_t) (byte & 0x7F) << shift;
+		if ((byte & 0x80)==0)
+			return offset;
+	}
+	return length;
+}
+
+// Bytes of a datagram spent on acks, counting the whole datagram if it has nothing else
+static int GetAckBytes(const unsigned char *data, int length)
+{
+	if ((data[0] & HEADER_IS_ACK)==0)
+		return 0;
+	if ((data[0] & HEADER_HAS_DATA)==0)
+		return length+IP_UDP_HEADER_SIZE;
+
+	// Acks sent with data are the ranges after the data header, and the header bytes a data datagram would not have
+	int offset=1;
+	if (data[0] & HEADER_HAS_B_AND_AS)
+		offset+=sizeof(float);
+	int rangesStart=offset+1+3;
+	uint32_t count, value;
+	offset=SkipVariableLength(data, rangesStart, length, &count);
+	for (uint32_t i=0; i < count && offset < length; i++)
+	{
+		if (i==0)
+			offset+=3;
+		else
+			offset=SkipVariableLength(data, offset, length, &value);
+		offset=SkipVariableLength(data, offset, length, &value);
+	}
+	return rangesStart-4+(std::min(offset, length)-rangesStart);
+}
+
+// An emulated link with no bottleneck, that counts the datagrams it forwards
+class Relay : public EmulatedLink
+{
+public:
+	void Start(RakNet::TimeMS oneWayDelay)
+	{
+		LinkSettings settings={"", 0.0, oneWayDelay, 0.0, 0.0};
+		for (int i=0; i < 2; i++)
+		{
+			counters[i].datagrams=0;
+			counters[i].bytes=0;
+			counters[i].ackDatagrams=0;
+			counters[i].ackBytes=0;
+		}
+		EmulatedLink::Start(settings, RELAY_PORT, SERVER_PORT);
+	}
+
+	// Client to server, then server to client
+	DirectionCounters counters[2];
+
+protected:
+	virtual void OnDatagram(const Datagram &datagram, bool toServer)
+	{
+		if (!measuring)
+			return;
+		DirectionCounters &c=counters[toServer ? 0 : 1];
+		c.datagrams++;
+		c.bytes+=datagram.length+IP_UDP_HEADER_SIZE;
+		if (datagram.length < 2 || (datagram.data[0] & 0x80)==0)
+			return;
+		int ackBytes=GetAckBytes((const unsigned char*) datagram.data, datagram.length);
+		if (ackBytes==datagram.length+IP_UDP_HEADER_SIZE)
+			c.ackDatagrams++;
+		c.ackBytes+=ackBytes;
+	}
+};
+
+struct Scenario
+{
+	const char *name;
+	int messageSize;
+	// 0 to keep the send buffer full
+	int messagesPerSecond;
+	bool bothWays;
+};
+
+static void Run(const Scenario &scenario, RakNet::TimeMS roundTrip, int seconds)
+{
+	Relay relay;
+	relay.Start(roundTrip/2);
+
+	RakPeerInterface *server=RakPeerInterface::GetInstance();
+	RakPeerInterface *client=RakPeerInterface::GetInstance();
+	SocketDescriptor serverSocketDescriptor(SERVER_PORT,"127.0.0.1");
+	server->Startup(1, &serverSocketDescriptor, 1);
+	server->SetMaximumIncomingConnections(1);
+	SocketDescriptor clientSocketDescriptor(0,"127.0.0.1");
+	client->Startup(1, &clientSocketDescriptor, 1);
+	client->Connect("127.0.0.1", RELAY_PORT, 0, 0);
+
+	SystemAddress serverAddress=UNASSIGNED_SYSTEM_ADDRESS, clientAddress=UNASSIGNED_SYSTEM_ADDRESS;
+	RakNet::TimeMS timeout=RakNet::GetTimeMS()+5000;
+	while ((serverAddress==UNASSIGNED_SYSTEM_ADDRESS || clientAddress==UNASSIGNED_SYSTEM_ADDRESS) && RakNet::GetTimeMS() < timeout)
+	{
+		Packet *p;
+		for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+				serverAddress=p->systemAddress;
+		}
+		for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+		{
+			if (p->data[0]==ID_NEW_INCOMING_CONNECTION)
+				clientAddress=p->systemAddress;
+		}
+		RakSleep(1);
+	}
+	if (serverAddress==UNASSIGNED_SYSTEM_ADDRESS || clientAddress==UNASSIGNED_SYSTEM_ADDRESS)
+	{
+		printf("%-24s failed to connect\n", scenario.name);
+		relay.Stop();
+		RakPeerInterface::DestroyInstance(client);
+		RakPeerInterface::DestroyInstance(server);
+		return;
+	}
+
+	char message[1200];
+	memset(message, 0, sizeof(message));
+	message[0]=ID_USER_PACKET_ENUM;
+
+	RakNet::TimeMS startTime=RakNet::GetTimeMS();
+	RakNet::TimeMS measureTime=startTime+WARMUP_TIME;
+	RakNet::TimeMS endTime=measureTime+seconds*1000;
+	RakNet::TimeMS nextSendTime=startTime;
+	uint64_t bytesReceived=0;
+	RakNetStatistics statistics;
+	while (RakNet::GetTimeMS() < endTime)
+	{
+		RakNet::TimeMS now=RakNet::GetTimeMS();
+		if (now>=measureTime && !relay.measuring)
+			relay.measuring=true;
+
+		if (scenario.messagesPerSecond==0)
+		{
+			client->GetStatistics(serverAddress, &statistics);
+			double buffered=0.0;
+			for (int i=0; i < NUMBER_OF_PRIORITIES; i++)
+				buffered+=statistics.bytesInSendBuffer[i];
+			for (; buffered < 256*1024; buffered+=scenario.messageSize)
+				client->Send(message, scenario.messageSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+		}
+		else
+		{
+			for (; nextSendTime <= now; nextSendTime+=1000/scenario.messagesPerSecond)
+			{
+				client->Send(message, scenario.messageSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+				if (scenario.bothWays)
+					server->Send(message, scenario.messageSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, clientAddress, false);
+			}
+		}
+
+		Packet *p;
+		for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+		{
+			if (p->data[0]==ID_USER_PACKET_ENUM && relay.measuring)
+				bytesReceived+=p->length;
+		}
+		for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]==ID_USER_PACKET_ENUM && relay.measuring)
+				bytesReceived+=p->length;
+		}
+		RakSleep(1);
+	}
+
+	relay.measuring=false;
+
+	relay.Stop();
+	client->Shutdown(0);
+	server->Shutdown(0);
+	RakPeerInterface::DestroyInstance(client);
+	RakPeerInterface::DestroyInstance(server);
+
+	uint64_t bytes=0, ackBytes=0, ackDatagrams=0;
+	for (int i=0; i < 2; i++)
+	{
+		bytes+=relay.counters[i].bytes;
+		ackBytes+=relay.counters[i].ackBytes;
+		ackDatagrams+=relay.counters[i].ackDatagrams;
+	}
+	if (bytesReceived==0)
+		bytesReceived=1;
+	printf("%-24s %9.0f KB/s delivered | ack bytes per data byte %.4f | %6.0f ack-only datagrams/s | wire bytes per data byte %.3f\n",
+		scenario.name, bytesReceived/1000.0/seconds, (double) ackBytes/bytesReceived, (double) ackDatagrams/seconds,
+		(double) bytes/bytesReceived);
+}
+
+int main(int argc, char **argv)
+{
+	RakNet::TimeMS roundTrip=40;
+	int seconds=5;
+	if (argc>1)
+		roundTrip=atoi(argv[1]);
+	if (argc>2)
+		seconds=atoi(argv[2]);
+
+	printf("%u ms round trip, %i seconds per run\n", roundTrip, seconds);
+
+	const Scenario scenarios[]=
+	{
+		{"Bulk, one way", 1200, 0, false},
+		{"60 Hz, one way", 100, 60, false},
+		{"60 Hz, both ways", 100, 60, true},
+		{"500 Hz, both ways", 100, 500, true},
+	};
+	for (unsigned int i=0; i < sizeof(scenarios)/sizeof(scenarios[0]); i++)
+		Run(scenarios[i], roundTrip, seconds);
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures the server socket of one RakPeer talking to many loopback clients, with and without batched datagram I/O,
+// then a bulk transfer to one client, with and without UDP segmentation offload
+// Usage: BatchedIOBenchmark [numClients] [secondsPerPhase]
+
+#include "RakPeerInterface.h"
+#include "RakNetSocket2.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdlib.h>
+
+using namespace RakNet;
+
+static const unsigned short SERVER_PORT=60000;
+static const int MESSAGE_SIZE=32;
+static const int BULK_MESSAGE_SIZE=256*1024;
+
+static void GetServerSocketStatistics(RakPeerInterface *server, RNS2SocketStatistics *rns2s)
+{
+	memset(rns2s, 0, sizeof(RNS2SocketStatistics));
+	DataStructures::List<RakNetSocket2*> sockets;
+	server->GetSockets(sockets);
+	for (unsigned int i=0; i < sockets.Size(); i++)
+	{
+		if (sockets[i]->IsBerkleySocket()==false)
+			continue;
+		RNS2SocketStatistics s;
+		((RNS2_Berkley*) sockets[i])->GetSocketStatistics(&s);
+		rns2s->datagramsSent+=s.datagramsSent;
+		rns2s->sendCalls+=s.sendCalls;
+		rns2s->datagramsReceived+=s.datagramsReceived;
+		rns2s->recvCalls+=s.recvCalls;
+	}
+}
+
+static void DrainPackets(RakPeerInterface *peer)
+{
+	Packet *p;
+	for (p=peer->Receive(); p; peer->DeallocatePacket(p), p=peer->Receive())
+		;
+}
+
+static void RunPhase(const char *name, RakPeerInterface *server, RakPeerInterface **clients, int numClients, int seconds)
+{
+	char message[MESSAGE_SIZE];
+	memset(message, 0, sizeof(message));
+	message[0]=ID_USER_PACKET_ENUM;
+
+	RNS2SocketStatistics before, after;
+	GetServerSocketStatistics(server, &before);
+
+	RakNet::TimeMS startTime=RakNet::GetTimeMS();
+	RakNet::TimeMS endTime=startTime+seconds*1000;
+	while (RakNet::GetTimeMS() < endTime)
+	{
+		// Every client sends to the server, and the server sends to every client, so each update cycle of the server has numClients datagrams to read and write
+		for (int i=0; i < numClients; i++)
+		{
+			clients[i]->Send(message, MESSAGE_SIZE, HIGH_PRIORITY, UNRELIABLE, 0, UNASSIGNED_SYSTEM_ADDRESS, true);
+			DrainPackets(clients[i]);
+		}
+		server->Send(message, MESSAGE_SIZE, HIGH_PRIORITY, UNRELIABLE, 0, UNASSIGNED_SYSTEM_ADDRESS, true);
+		DrainPackets(server);
+		RakSleep(1);
+	}
+	RakNet::TimeMS elapsed=RakNet::GetTimeMS()-startTime;
+
+	GetServerSocketStatistics(server, &after);
+	uint64_t sent=after.datagramsSent-before.datagramsSent;
+	uint64_t sendCalls=after.sendCalls-before.sendCalls;
+	uint64_t received=after.datagramsReceived-before.datagramsReceived;
+	uint64_t recvCalls=after.recvCalls-before.recvCalls;
+	double elapsedSeconds=elapsed/1000.0;
+
+	printf("%s\n", name);
+	printf("  Sent:     %10.0f datagrams/sec, %6.3f syscalls/datagram\n", sent/elapsedSeconds, sent ? (double) sendCalls/sent : 0.0);
+	printf("  Received: %10.0f datagrams/sec, %6.3f syscalls/datagram\n", received/elapsedSeconds, received ? (double) recvCalls/received : 0.0);
+}
+
+// The server sends large reliable messages to one client, which are split into runs of equal size datagrams.
+// Reports system calls per datagram for the server writing and the client reading, CPU time of the whole process per datagram,
+// and checks every message arrives intact
+static void RunBulkPhase(const char *name, RakPeerInterface *server, RakPeerInterface *client, int seconds)
+{
+	// Let the small messages of the earlier phases arrive first
+	RakSleep(500);
+	DrainPackets(client);
+	DrainPackets(server);
+
+	char *message=new char[BULK_MESSAGE_SIZE];
+	message[0]=ID_USER_PACKET_ENUM;
+	for (int i=1; i < BULK_MESSAGE_SIZE; i++)
+		message[i]=(char) (i*7);
+
+	RNS2SocketStatistics serverBefore, serverAfter, clientBefore, clientAfter;
+	GetServerSocketStatistics(server, &serverBefore);
+	GetServerSocketStatistics(client, &clientBefore);
+
+	SystemAddress clientAddress=server->GetSystemAddressFromGuid(client->GetMyGUID());
+	std::clock_t startClock=std::clock();
+	int messagesSent=0, messagesReceived=0, messagesCorrupt=0;
+	RakNet::TimeMS startTime=RakNet::GetTimeMS();
+	RakNet::TimeMS endTime=startTime+seconds*1000;
+	while (RakNet::GetTimeMS() < endTime || messagesReceived < messagesSent)
+	{
+		// Keep a few messages in flight
+		if (messagesSent-messagesReceived < 4 && RakNet::GetTimeMS() < endTime)
+		{
+			server->Send(message, BULK_MESSAGE_SIZE, HIGH_PRIORITY, RELIABLE_ORDERED, 0, clientAddress, false);
+			messagesSent++;
+		}
+
+		Packet *p;
+		for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]!=ID_USER_PACKET_ENUM)
+				continue;
+			messagesReceived++;
+			if (p->length!=(unsigned int) BULK_MESSAGE_SIZE || memcmp(p->data, message, BULK_MESSAGE_SIZE)!=0)
+				messagesCorrupt++;
+		}
+		DrainPackets(server);
+		if (RakNet::GetTimeMS() > endTime+10000)
+			break;
+		RakSleep(0);
+	}
+	RakNet::TimeMS elapsed=RakNet::GetTimeMS()-startTime;
+	double cpuSeconds=(double) (std::clock()-startClock)/CLOCKS_PER_SEC;
+
+	GetServerSocketStatistics(server, &serverAfter);
+	GetServerSocketStatistics(client, &clientAfter);
+	uint64_t sent=serverAfter.datagramsSent-serverBefore.datagramsSent;
+	uint64_t sendCalls=serverAfter.sendCalls-serverBefore.sendCalls;
+	uint64_t received=clientAfter.datagramsReceived-clientBefore.datagramsReceived;
+	uint64_t recvCalls=clientAfter.recvCalls-clientBefore.recvCalls;
+	double elapsedSeconds=elapsed/1000.0;
+
+	printf("%s\n", name);
+	printf("  Server sent:     %10.0f datagrams/sec, %6.3f syscalls/datagram\n", sent/elapsedSeconds, sent ? (double) sendCalls/sent : 0.0);
+	printf("  Client received: %10.0f datagrams/sec, %6.3f syscalls/datagram\n", received/elapsedSeconds, received ? (double) recvCalls/received : 0.0);
+	printf("  CPU:             %10.2f microseconds/datagram\n", sent ? cpuSeconds*1000000.0/sent : 0.0);
+	printf("  %i of %i messages of %i bytes arrived, %i corrupt, %.1f MB/sec\n", messagesReceived, messagesSent, BULK_MESSAGE_SIZE, messagesCorrupt,
+		(double) messagesReceived*BULK_MESSAGE_SIZE/elapsedSeconds/1000000.0);
+	delete [] message;
+}
+
+int main(int argc, char **argv)
+{
+	int numClients=32;
+	int seconds=5;
+	if (argc > 1)
+		numClients=atoi(argv[1]);
+	if (argc > 2)
+		seconds=atoi(argv[2]);
+	if (numClients < 1)
+		numClients=1;
+	if (seconds < 1)
+		seconds=1;
+
+	printf("Measures datagrams per second and system calls per datagram on a server\nwith %i loopback clients, with and without batched datagram I/O.\n", numClients);
+	printf("Difficulty: Intermediate\n\n");
+
+	RakPeerInterface *server=RakPeerInterface::GetInstance();
+	SocketDescriptor serverSocketDescriptor(SERVER_PORT,0);
+	if (server->Startup(numClients, &serverSocketDescriptor, 1)!=CRABNET_STARTED)
+	{
+		printf("Server failed to start on port %i.\n", SERVER_PORT);
+		RakPeerInterface::DestroyInstance(server);
+		return 1;
+	}
+	server->SetMaximumIncomingConnections(numClients);
+
+	RakPeerInterface **clients=new RakPeerInterface*[numClients];
+	for (int i=0; i < numClients; i++)
+	{
+		clients[i]=RakPeerInterface::GetInstance();
+		SocketDescriptor socketDescriptor;
+		clients[i]->Startup(1, &socketDescriptor, 1);
+		clients[i]->Connect("127.0.0.1", SERVER_PORT, 0, 0);
+	}
+
+	RakNet::TimeMS timeout=RakNet::GetTimeMS()+10000;
+	while (server->NumberOfConnections() < (unsigned int) numClients && RakNet::GetTimeMS() < timeout)
+	{
+		for (int i=0; i < numClients; i++)
+			DrainPackets(clients[i]);
+		DrainPackets(server);
+		RakSleep(10);
+	}
+	printf("%i of %i clients connected.\n\n", server->NumberOfConnections(), numClients);
+
+	server->SetBatchedDatagramIO(false);
+	RunPhase("sendto/recvfrom per datagram", server, clients, numClients, seconds);
+	server->SetBatchedDatagramIO(true);
+	RunPhase("Batched (sendmmsg/recvmmsg)", server, clients, numClients, seconds);
+#if CRABNET_SUPPORT_BATCHED_IO!=1
+	printf("Batched datagram I/O is not supported on this platform, both runs used one system call per datagram.\n");
+#endif
+
+	// Each bulk run uses its own client, so the congestion window one run leaves behind does not carry over to the other
+	RakPeerInterface *bulkClient=clients[0];
+	RakPeerInterface *offloadClient=clients[numClients > 1 ? 1 : 0];
+	bulkClient->SetBatchedDatagramIO(true);
+	RunBulkPhase("Bulk transfer, batched", server, bulkClient, seconds);
+	offloadClient->SetBatchedDatagramIO(true);
+	offloadClient->SetUDPSegmentationOffload(true);
+	server->SetUDPSegmentationOffload(true);
+	RunBulkPhase("Bulk transfer, batched with UDP_SEGMENT/UDP_GRO", server, offloadClient, seconds);
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD!=1
+	printf("UDP segmentation offload is not supported on this platform, both bulk runs wrote one datagram per message.\n");
+#endif
+
+	for (int i=0; i < numClients; i++)
+		RakPeerInterface::DestroyInstance(clients[i]);
+	delete [] clients;
+	RakPeerInterface::DestroyInstance(server);
+	return 0;
+}
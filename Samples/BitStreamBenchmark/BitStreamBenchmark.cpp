@@ -0,0 +1,186 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures the BitStream bit copying paths: WriteBits and ReadBits at byte aligned and unaligned positions,
+// WriteCompressed and ReadCompressed, and Write(BitStream*, numberOfBits)
+// Usage: BitStreamBenchmark [millisecondsPerTest]
+
+#include "BitStream.h"
+#include "RakNetDefines.h"
+#include <chrono>
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+typedef std::chrono::steady_clock Clock;
+
+static const BitSize_t BIT_COUNTS[]={1, 7, 8, 13, 32, 64, 100, 256, 1024, 4096};
+static const int NUM_BIT_COUNTS=sizeof(BIT_COUNTS)/sizeof(BIT_COUNTS[0]);
+// Operations between reading the clock
+static const int OPERATIONS_PER_BATCH=256;
+
+static int millisecondsPerTest=200;
+static unsigned char source[4096/8+1];
+static unsigned char destination[4096/8+1];
+static volatile unsigned int sink;
+
+// Repeats operation in batches for millisecondsPerTest and returns nanoseconds per operation
+template <class Operation>
+static double Measure(Operation operation)
+{
+	Clock::time_point startTime=Clock::now();
+	Clock::time_point endTime=startTime+std::chrono::milliseconds(millisecondsPerTest);
+	Clock::time_point now;
+	unsigned long long operations=0;
+	do
+	{
+		for (int i=0; i < OPERATIONS_PER_BATCH; i++)
+			operation();
+		operations+=OPERATIONS_PER_BATCH;
+		now=Clock::now();
+	} while (now < endTime);
+	return std::chrono::duration<double, std::nano>(now-startTime).count()/operations;
+}
+
+static void PrintResult(const char *name, BitSize_t numberOfBits, double nanoseconds)
+{
+	printf("  %-34s %5i bits %9.1f ns %9.1f MB/s\n", name, (int) numberOfBits, nanoseconds, numberOfBits/8.0/nanoseconds*1000.0);
+}
+
+static void MeasureWriteBits(BitSize_t startOffset)
+{
+	char name[64];
+	sprintf(name, "WriteBits, starting at bit %i", (int) startOffset);
+	BitStream bitStream;
+	for (int i=0; i < NUM_BIT_COUNTS; i++)
+	{
+		BitSize_t numberOfBits=BIT_COUNTS[i];
+		PrintResult(name, numberOfBits, Measure([&]()
+		{
+			bitStream.Reset();
+			bitStream.WriteBits(source, startOffset, true);
+			bitStream.WriteBits(source, numberOfBits, true);
+			sink+=bitStream.GetData()[0];
+		}));
+	}
+}
+
+static void MeasureReadBits(BitSize_t startOffset)
+{
+	char name[64];
+	sprintf(name, "ReadBits, starting at bit %i", (int) startOffset);
+	BitStream bitStream;
+	bitStream.WriteBits(source, startOffset, true);
+	bitStream.Write((const char*) source, sizeof(source));
+	for (int i=0; i < NUM_BIT_COUNTS; i++)
+	{
+		BitSize_t numberOfBits=BIT_COUNTS[i];
+		PrintResult(name, numberOfBits, Measure([&]()
+		{
+			bitStream.SetReadOffset(startOffset);
+			bitStream.ReadBits(destination, numberOfBits, true);
+			sink+=destination[0];
+		}));
+	}
+}
+
+static void MeasureWriteBitStream(BitSize_t sourceOffset, BitSize_t destinationOffset)
+{
+	char name[64];
+	sprintf(name, "Write(BitStream*), bit %i to bit %i", (int) sourceOffset, (int) destinationOffset);
+	BitStream input, output;
+	input.WriteBits(source, sourceOffset, true);
+	input.Write((const char*) source, sizeof(source));
+	for (int i=0; i < NUM_BIT_COUNTS; i++)
+	{
+		BitSize_t numberOfBits=BIT_COUNTS[i];
+		PrintResult(name, numberOfBits, Measure([&]()
+		{
+			input.SetReadOffset(sourceOffset);
+			output.Reset();
+			output.WriteBits(source, destinationOffset, true);
+			output.Write(&input, numberOfBits);
+			sink+=output.GetData()[0];
+		}));
+	}
+}
+
+// Writes then reads back 8 values of templateType, starting at bit 3 so the paths are not byte aligned
+template <class templateType>
+static void MeasureCompressed(const char *name, const templateType *values)
+{
+	BitStream bitStream;
+	double writeTime=Measure([&]()
+	{
+		bitStream.Reset();
+		bitStream.WriteBits(source, 3, true);
+		for (int i=0; i < 8; i++)
+			bitStream.WriteCompressed(values[i]);
+	});
+	double readTime=Measure([&]()
+	{
+		bitStream.SetReadOffset(3);
+		templateType value=0;
+		for (int i=0; i < 8; i++)
+			bitStream.ReadCompressed(value);
+		sink+=(unsigned int) value;
+	});
+	printf("  %-34s %5i bits %9.1f ns write %9.1f ns read\n", name, (int) bitStream.GetNumberOfBitsUsed()-3, writeTime/8, readTime/8);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		millisecondsPerTest=atoi(argv[1]);
+	if (millisecondsPerTest < 1)
+		millisecondsPerTest=1;
+
+	printf("Measures the time of BitStream bit copies of 1 to 4096 bits at aligned and\nunaligned positions, and of compressed integers.\n");
+	printf("BITSTREAM_USE_SIMD=%i", BITSTREAM_USE_SIMD);
+#if defined(__AVX2__)
+	printf(" (AVX2)");
+#endif
+	printf("\nDifficulty: Intermediate\n\n");
+
+	for (unsigned int i=0; i < sizeof(source); i++)
+		source[i]=(unsigned char) (i*37+11);
+
+	printf("WriteBits\n");
+	MeasureWriteBits(0);
+	MeasureWriteBits(3);
+	printf("ReadBits\n");
+	MeasureReadBits(0);
+	MeasureReadBits(3);
+	printf("Write(BitStream*, numberOfBits)\n");
+	MeasureWriteBitStream(0, 0);
+	MeasureWriteBitStream(0, 3);
+	MeasureWriteBitStream(5, 3);
+
+	printf("Compressed integers, per value\n");
+	const uint16_t smallUnsigned16[8]={0, 1, 5, 9, 12, 15, 3, 7};
+	const int16_t smallSigned16[8]={-1, -5, 3, -8, 0, 7, -2, 4};
+	const uint32_t smallUnsigned32[8]={0, 1, 5, 100, 12, 200, 3, 7};
+	const uint32_t largeUnsigned32[8]={100000, 7000000, 65536, 400000000, 123456789, 99999, 3000000000u, 70000};
+	const int32_t smallSigned32[8]={-1, -100, 3, -8, 0, 70, -2, 4};
+	const uint64_t smallUnsigned64[8]={0, 1, 5, 100, 12, 200, 3, 7};
+	const uint64_t largeUnsigned64[8]={1ull<<40, 1ull<<50, 123456789012ull, 1ull<<63, 99999ull<<20, 5, 1ull<<33, 70000};
+	MeasureCompressed("uint16_t, 0 to 15", smallUnsigned16);
+	MeasureCompressed("int16_t, -8 to 7", smallSigned16);
+	MeasureCompressed("uint32_t, 0 to 255", smallUnsigned32);
+	MeasureCompressed("uint32_t, 2^16 to 2^32", largeUnsigned32);
+	MeasureCompressed("int32_t, -128 to 127", smallSigned32);
+	MeasureCompressed("uint64_t, 0 to 255", smallUnsigned64);
+	MeasureCompressed("uint64_t, up to 2^64", largeUnsigned64);
+
+	return 0;
+}
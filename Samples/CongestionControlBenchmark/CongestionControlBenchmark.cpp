@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Sends a bulk transfer over an emulated link on loopback with each congestion control algorithm, and reports
+// the throughput, the queueing delay at the bottleneck, and the cost of tracking the messages in flight
+// Usage: CongestionControlBenchmark [secondsPerRun] [megabitsPerSecond] [roundTripMs]
+// The last two set the link with a high bandwidth-delay product, 1000 Mbit/s and 100 ms by default
+
+#include "RakPeerInterface.h"
+#include "RakNetStatistics.h"
+#include "MessageIdentifiers.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include "EmulatedLink.h"
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+using namespace RakNet;
+
+static const unsigned short SERVER_PORT=60000;
+static const unsigned short LINK_PORT=60001;
+static const int MESSAGE_SIZE=1000;
+// Kept waiting in the send buffer of the client, so it always has data to send. Raised to twice the bandwidth-delay
+// product on links where that is more
+static const double SEND_BUFFER_BYTES=256*1024;
+// Time after connecting before measuring, for the congestion control to find the link. Raised to 30 round trips on
+// links where that is longer
+static const RakNet::TimeMS WARMUP_TIME=2000;
+
+static void Run(const LinkSettings &settings, CongestionControlAlgorithm algorithm, const char *algorithmName, int seconds)
+{
+	EmulatedLink link;
+	link.Start(settings, LINK_PORT, SERVER_PORT);
+
+	RakPeerInterface *server=RakPeerInterface::GetInstance();
+	RakPeerInterface *client=RakPeerInterface::GetInstance();
+	SocketDescriptor serverSocketDescriptor(SERVER_PORT,"127.0.0.1");
+	server->Startup(1, &serverSocketDescriptor, 1);
+	server->SetMaximumIncomingConnections(1);
+	SocketDescriptor clientSocketDescriptor(0,"127.0.0.1");
+	client->Startup(1, &clientSocketDescriptor, 1);
+	server->SetCongestionControl(algorithm, UNASSIGNED_SYSTEM_ADDRESS);
+	client->SetCongestionControl(algorithm, UNASSIGNED_SYSTEM_ADDRESS);
+	client->SetTickProfiling(true);
+	client->Connect("127.0.0.1", LINK_PORT, 0, 0);
+
+	SystemAddress serverAddress=UNASSIGNED_SYSTEM_ADDRESS;
+	RakNet::TimeMS timeout=RakNet::GetTimeMS()+5000;
+	while (serverAddress==UNASSIGNED_SYSTEM_ADDRESS && RakNet::GetTimeMS() < timeout)
+	{
+		Packet *p;
+		for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+				serverAddress=p->systemAddress;
+		}
+		RakSleep(1);
+	}
+	if (serverAddress==UNASSIGNED_SYSTEM_ADDRESS)
+	{
+		printf("%-16s failed to connect\n", algorithmName);
+		link.Stop();
+		RakPeerInterface::DestroyInstance(client);
+		RakPeerInterface::DestroyInstance(server);
+		return;
+	}
+
+	char message[MESSAGE_SIZE];
+	memset(message, 0, sizeof(message));
+	message[0]=ID_USER_PACKET_ENUM;
+
+	const RakNet::TimeMS roundTrip=settings.oneWayDelay*2;
+	const double sendBufferBytes=std::max(SEND_BUFFER_BYTES, 2.0*settings.bytesPerSecond*roundTrip/1000.0);
+	RakNet::TimeMS startTime=RakNet::GetTimeMS();
+	RakNet::TimeMS measureTime=startTime+std::max(WARMUP_TIME, roundTrip*30);
+	RakNet::TimeMS endTime=measureTime+seconds*1000;
+	uint64_t bytesReceived=0;
+	unsigned int maxMessagesInResendBuffer=0;
+	RakNetStatistics statistics, startStatistics;
+	RakNetTickProfile profile, startProfile;
+	client->GetStatistics(serverAddress, &startStatistics);
+	client->GetTickProfile(serverAddress, &startProfile);
+	while (RakNet::GetTimeMS() < endTime)
+	{
+		RakNet::TimeMS now=RakNet::GetTimeMS();
+		client->GetStatistics(serverAddress, &statistics);
+		if (now>=measureTime && !link.measuring)
+		{
+			link.measuring=true;
+			startStatistics=statistics;
+			client->GetTickProfile(serverAddress, &startProfile);
+		}
+		if (link.measuring && statistics.messagesInResendBuffer > maxMessagesInResendBuffer)
+			maxMessagesInResendBuffer=statistics.messagesInResendBuffer;
+
+		double buffered=0.0;
+		for (int i=0; i < NUMBER_OF_PRIORITIES; i++)
+			buffered+=statistics.bytesInSendBuffer[i];
+		for (; buffered < sendBufferBytes; buffered+=MESSAGE_SIZE)
+			client->Send(message, MESSAGE_SIZE, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+
+		Packet *p;
+		for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+		{
+			if (p->data[0]==ID_USER_PACKET_ENUM && link.measuring)
+				bytesReceived+=p->length;
+		}
+		for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+			;
+		RakSleep(1);
+	}
+	link.measuring=false;
+	client->GetStatistics(serverAddress, &statistics);
+	client->GetTickProfile(serverAddress, &profile);
+
+	link.Stop();
+	client->Shutdown(0);
+	server->Shutdown(0);
+	RakPeerInterface::DestroyInstance(client);
+	RakPeerInterface::DestroyInstance(server);
+
+	std::vector<double> &delays=link.queueDelays;
+	double meanDelay=0.0, p95Delay=0.0;
+	if (!delays.empty())
+	{
+		for (size_t i=0; i < delays.size(); i++)
+			meanDelay+=delays[i];
+		meanDelay/=delays.size();
+		std::sort(delays.begin(), delays.end());
+		p95Delay=delays[delays.size()*95/100];
+	}
+	double throughput=bytesReceived/(double) seconds;
+	unsigned int arrived=link.forwarded+link.queueDrops;
+	// Time the client spent on acks and on finding messages to resend, per megabyte it sent
+	double megabytesSent=(statistics.runningTotal[ACTUAL_BYTES_SENT]-startStatistics.runningTotal[ACTUAL_BYTES_SENT])/1000000.0;
+	if (megabytesSent <= 0.0)
+		megabytesSent=1.0;
+	double ackTime=(double) (profile.phaseTimeUS[TICK_PHASE_ACK_PROCESSING]-startProfile.phaseTimeUS[TICK_PHASE_ACK_PROCESSING]);
+	double resendTime=(double) (profile.phaseTimeUS[TICK_PHASE_RESEND_SCAN]-startProfile.phaseTimeUS[TICK_PHASE_RESEND_SCAN]);
+	printf("%-16s %7.0f KB/s %5.1f%% of link | queue delay %6.2f ms mean %6.2f ms p95 | queue drops %5.2f%% | "
+		"%6u awaiting ack at most | per MB sent: acks %6.0f us, resends %6.0f us\n",
+		algorithmName, throughput/1000.0, 100.0*throughput/settings.bytesPerSecond, meanDelay, p95Delay,
+		arrived ? 100.0*link.queueDrops/arrived : 0.0, maxMessagesInResendBuffer, ackTime/megabytesSent,
+		resendTime/megabytesSent);
+}
+
+int main(int argc, char **argv)
+{
+	int seconds=5;
+	double megabitsPerSecond=1000.0;
+	RakNet::TimeMS roundTrip=100;
+	if (argc>1)
+		seconds=atoi(argv[1]);
+	if (argc>2)
+		megabitsPerSecond=atof(argv[2]);
+	if (argc>3)
+		roundTrip=atoi(argv[3]);
+
+	// The queue of the high bandwidth-delay link holds one bandwidth-delay product
+	const double bytesPerSecond=megabitsPerSecond*1000000.0/8.0;
+	const double bandwidthDelayProduct=bytesPerSecond*roundTrip/1000.0;
+	char highBandwidthDelayName[128];
+	sprintf(highBandwidthDelayName, "%.0f Mbit/s, %u ms round trip, %.0f KB queue (one bandwidth-delay product)",
+		megabitsPerSecond, roundTrip, bandwidthDelayProduct/1000.0);
+
+	const LinkSettings links[]=
+	{
+		// name, bytes per second, one way delay, queue, random loss
+		{"2 MB/s, 20 ms round trip, 100 KB queue", 2000000.0, 10, 100000.0, 0.0},
+		{"2 MB/s, 20 ms round trip, 100 KB queue, 1% loss", 2000000.0, 10, 100000.0, 0.01},
+		{"500 KB/s, 100 ms round trip, 200 KB queue, 2% loss", 500000.0, 50, 200000.0, 0.02},
+		{highBandwidthDelayName, bytesPerSecond, roundTrip/2, bandwidthDelayProduct, 0.0},
+	};
+	const CongestionControlAlgorithm algorithms[]={CC_SLIDING_WINDOW, CC_UDT, CC_BBR};
+	const char *algorithmNames[]={"Sliding window", "UDT", "BBR"};
+
+	for (size_t i=0; i < sizeof(links)/sizeof(links[0]); i++)
+	{
+		printf("%s\n", links[i].name);
+		for (int j=0; j < 3; j++)
+			Run(links[i], algorithms[j], algorithmNames[j], seconds);
+		printf("\n");
+	}
+
+	return 0;
+}
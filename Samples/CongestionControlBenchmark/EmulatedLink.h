@@ -0,0 +1,239 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// An emulated network link on loopback for the benchmark samples. Also used by AckOverheadBenchmark
+
+#ifndef __EMULATED_LINK_H
+#define __EMULATED_LINK_H
+
+#include "GetTime.h"
+#include "Rand.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include "WindowsIncludes.h"
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define closesocket close
+typedef int SOCKET;
+#endif
+
+struct LinkSettings
+{
+	const char *name;
+	// Client to server only. The acks coming back are only delayed. 0 for no bottleneck
+	double bytesPerSecond;
+	RakNet::TimeMS oneWayDelay;
+	double queueBytes;
+	double loss;
+};
+
+struct Datagram
+{
+	RakNet::TimeUS deliverTime;
+	SOCKET s;
+	sockaddr_in to;
+	int length;
+	char data[1500];
+};
+
+// Forwards datagrams between the client and the server through a drop-tail queue drained at a fixed rate.
+// The client connects to linkPort. The server sees the client at linkPort+1. That must not be the address the client
+// connected to, or the client takes it for its own external address and sends to itself
+class EmulatedLink
+{
+public:
+	virtual ~EmulatedLink() {}
+
+	void Start(const LinkSettings &_settings, unsigned short linkPort, unsigned short serverPort)
+	{
+		settings=_settings;
+		measuring=false;
+		running=true;
+		hasClientAddress=false;
+		bottleneckFreeTime=0;
+		forwarded=queueDrops=0;
+		queueDelays.clear();
+
+		clientSide=OpenSocket(linkPort);
+		serverSide=OpenSocket(linkPort+1);
+		memset(&serverAddress, 0, sizeof(serverAddress));
+		serverAddress.sin_family=AF_INET;
+		serverAddress.sin_addr.s_addr=inet_addr("127.0.0.1");
+		serverAddress.sin_port=htons(serverPort);
+
+		thread=std::thread(&EmulatedLink::Run, this);
+	}
+
+	void Stop(void)
+	{
+		running=false;
+		thread.join();
+		closesocket(clientSide);
+		closesocket(serverSide);
+	}
+
+	LinkSettings settings;
+	std::atomic<bool> measuring;
+	unsigned int forwarded, queueDrops;
+	// Milliseconds each datagram waited at the bottleneck
+	std::vector<double> queueDelays;
+
+protected:
+	// Called on the link thread for every datagram read, before it is dropped or queued
+	virtual void OnDatagram(const Datagram &datagram, bool toServer) {(void) datagram; (void) toServer;}
+
+private:
+	void Run(void)
+	{
+		Datagram in;
+		while (running)
+		{
+			RakNet::TimeUS now=RakNet::GetTimeUS();
+			SendDue(toServer, now);
+			SendDue(toClient, now);
+
+			RakNet::TimeUS wait=1000;
+			if (!toServer.empty() && toServer.front().deliverTime-now < wait)
+				wait=toServer.front().deliverTime-now;
+			if (!toClient.empty() && toClient.front().deliverTime-now < wait)
+				wait=toClient.front().deliverTime-now;
+
+			fd_set readSet;
+			FD_ZERO(&readSet);
+			FD_SET(clientSide, &readSet);
+			FD_SET(serverSide, &readSet);
+			timeval timeout;
+			timeout.tv_sec=0;
+			timeout.tv_usec=(long) wait;
+			if (select((int) std::max(clientSide, serverSide)+1, &readSet, 0, 0, &timeout)<=0)
+				continue;
+			now=RakNet::GetTimeUS();
+
+			// The sockets are non-blocking, so everything waiting is read. At high rates one datagram per select
+			// cannot keep up, and the socket buffer drops what the link should have queued
+			sockaddr_in from;
+			socklen_t fromLength;
+			while (FD_ISSET(serverSide, &readSet))
+			{
+				fromLength=sizeof(from);
+				in.length=recvfrom(serverSide, in.data, sizeof(in.data), 0, (sockaddr*) &from, &fromLength);
+				if (in.length<=0)
+					break;
+				if (!hasClientAddress)
+					continue;
+				OnDatagram(in, false);
+				in.s=clientSide;
+				in.to=clientAddress;
+				in.deliverTime=now+settings.oneWayDelay*1000;
+				toClient.push_back(in);
+			}
+
+			while (FD_ISSET(clientSide, &readSet))
+			{
+				fromLength=sizeof(from);
+				in.length=recvfrom(clientSide, in.data, sizeof(in.data), 0, (sockaddr*) &from, &fromLength);
+				if (in.length<=0)
+					break;
+				clientAddress=from;
+				hasClientAddress=true;
+				OnDatagram(in, true);
+				Forward(in, now);
+			}
+		}
+	}
+
+	void Forward(Datagram &in, RakNet::TimeUS now)
+	{
+		if (settings.loss > 0.0 && frandomMT() < settings.loss)
+			return;
+
+		RakNet::TimeUS start=now;
+		if (settings.bytesPerSecond > 0.0)
+		{
+			// Bytes still waiting for the bottleneck, from how long it is busy for
+			double queued=bottleneckFreeTime > now ? (bottleneckFreeTime-now)*settings.bytesPerSecond/1000000.0 : 0.0;
+			if (queued+in.length > settings.queueBytes)
+			{
+				if (measuring)
+					queueDrops++;
+				return;
+			}
+
+			if (bottleneckFreeTime > now)
+				start=bottleneckFreeTime;
+			bottleneckFreeTime=start+(RakNet::TimeUS) (in.length*1000000.0/settings.bytesPerSecond);
+		}
+		else
+			bottleneckFreeTime=now;
+		if (measuring)
+		{
+			queueDelays.push_back((double) (start-now)/1000.0);
+			forwarded++;
+		}
+		in.s=serverSide;
+		in.to=serverAddress;
+		in.deliverTime=bottleneckFreeTime+settings.oneWayDelay*1000;
+		toServer.push_back(in);
+	}
+
+	SOCKET OpenSocket(unsigned short port)
+	{
+		SOCKET s=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family=AF_INET;
+		addr.sin_addr.s_addr=inet_addr("127.0.0.1");
+		addr.sin_port=htons(port);
+		bind(s, (sockaddr*) &addr, sizeof(addr));
+		// Large enough for bursts on a link of a gigabit per second
+		int bufferSize=16*1024*1024;
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*) &bufferSize, sizeof(bufferSize));
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*) &bufferSize, sizeof(bufferSize));
+#ifdef _WIN32
+		u_long nonBlocking=1;
+		ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+		return s;
+	}
+
+	void SendDue(std::deque<Datagram> &queue, RakNet::TimeUS now)
+	{
+		while (!queue.empty() && queue.front().deliverTime<=now)
+		{
+			sendto(queue.front().s, queue.front().data, queue.front().length, 0, (sockaddr*) &queue.front().to, sizeof(sockaddr_in));
+			queue.pop_front();
+		}
+	}
+
+	std::atomic<bool> running;
+	SOCKET clientSide, serverSide;
+	sockaddr_in serverAddress, clientAddress;
+	bool hasClientAddress;
+	RakNet::TimeUS bottleneckFreeTime;
+	std::deque<Datagram> toServer, toClient;
+	std::thread thread;
+};
+
+#endif
@@ -19,7 +19,7 @@
 #include "SuperFastHash.h"
 #include "RakAssert.h"
 #include "BitStream.h"
-#include "IncrementalReadInterface.h"
+#include "CachedIncrementalReadInterface.h"
 #include "PacketizedTCP.h"
 #include "SocketLayer.h"
 #include <stdio.h>
@@ -163,7 +163,9 @@ int main()
 	// Run incremental reads in a thread so the read does not block the main thread
 	flt1.StartIncrementalReadThreads(1);
 	RakNet::FileList fileList;
-	RakNet::IncrementalReadInterface incrementalReadInterface;
+	// Keeps the file open between chunks. Nothing writes to the file while it is sent, so send it from a mapping without copying
+	RakNet::CachedIncrementalReadInterface incrementalReadInterface;
+	incrementalReadInterface.SetMapFiles(true);
 	printf("Enter complete filename with path to test:\n");
 	char str[256];
 	Gets(str, sizeof(str));
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures handing pointers from recvfrom threads to an update thread, as RakPeer does with received datagrams,
+// with DataStructures::LocklessQueue and with a DataStructures::Queue protected by a SimpleMutex
+// Usage: LocklessQueueBenchmark [itemsPerProducer] [contendedProducers]
+
+#include "DS_LocklessQueue.h"
+#include "DS_Queue.h"
+#include "SimpleMutex.h"
+#include "RakNetDefines.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace RakNet;
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned int POP_BATCH=32;
+
+// Stands in for RNS2RecvStruct, carrying the time it was pushed so the consumer can measure the handoff latency
+struct Item
+{
+	Clock::time_point timePushed;
+};
+
+class LocklessHandoff
+{
+public:
+	LocklessHandoff() {queue.Init(BUFFERED_PACKETS_QUEUE_SIZE);}
+	bool Push(Item *item) {return queue.Push(item);}
+	unsigned int Pop(Item **output) {return queue.PopMultiple(output, POP_BATCH);}
+	static const char *Name() {return "LocklessQueue";}
+	DataStructures::LocklessQueue<Item*> queue;
+};
+
+class MutexHandoff
+{
+public:
+	bool Push(Item *item)
+	{
+		mutex.Lock();
+		queue.Push(item);
+		mutex.Unlock();
+		return true;
+	}
+	unsigned int Pop(Item **output)
+	{
+		// Same as the old PopBufferedPacket(), one lock per item
+		unsigned int count=0;
+		while (count < POP_BATCH)
+		{
+			mutex.Lock();
+			if (queue.Size()==0)
+			{
+				mutex.Unlock();
+				break;
+			}
+			output[count++]=queue.Pop();
+			mutex.Unlock();
+		}
+		return count;
+	}
+	static const char *Name() {return "Queue+SimpleMutex";}
+	DataStructures::Queue<Item*> queue;
+	SimpleMutex mutex;
+};
+
+template <class Handoff>
+static void RunTest(int numProducers, int itemsPerProducer)
+{
+	Handoff handoff;
+	std::vector<Item> items((size_t) numProducers*itemsPerProducer);
+	std::vector<double> latencies;
+	latencies.reserve(items.size());
+	std::atomic<int> producersReady(0);
+	std::atomic<bool> start(false);
+
+	std::vector<std::thread> producers;
+	for (int p=0; p < numProducers; p++)
+	{
+		producers.push_back(std::thread([&, p]()
+		{
+			producersReady++;
+			while (start==false)
+				std::this_thread::yield();
+			Item *item=&items[(size_t) p*itemsPerProducer];
+			for (int i=0; i < itemsPerProducer; i++, item++)
+			{
+				item->timePushed=Clock::now();
+				while (handoff.Push(item)==false)
+					std::this_thread::yield();
+			}
+		}));
+	}
+
+	while (producersReady < numProducers)
+		std::this_thread::yield();
+	Clock::time_point startTime=Clock::now();
+	start=true;
+
+	Item *output[POP_BATCH];
+	size_t received=0;
+	while (received < items.size())
+	{
+		unsigned int count=handoff.Pop(output);
+		if (count==0)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		Clock::time_point now=Clock::now();
+		for (unsigned int i=0; i < count; i++)
+			latencies.push_back(std::chrono::duration<double, std::nano>(now-output[i]->timePushed).count());
+		received+=count;
+	}
+	double elapsedSeconds=std::chrono::duration<double>(Clock::now()-startTime).count();
+
+	for (size_t p=0; p < producers.size(); p++)
+		producers[p].join();
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("  %-18s %12.0f items/sec, latency median %8.0f ns, p99 %10.0f ns\n", Handoff::Name(), received/elapsedSeconds,
+		latencies[latencies.size()/2], latencies[latencies.size()*99/100]);
+}
+
+int main(int argc, char **argv)
+{
+	int itemsPerProducer=1000000;
+	int contendedProducers=4;
+	if (argc > 1)
+		itemsPerProducer=atoi(argv[1]);
+	if (argc > 2)
+		contendedProducers=atoi(argv[2]);
+	if (itemsPerProducer < 1)
+		itemsPerProducer=1;
+	if (contendedProducers < 2)
+		contendedProducers=2;
+
+	printf("Measures throughput and latency of passing received datagrams to the update thread.\n");
+	printf("Difficulty: Intermediate\n\n");
+
+	printf("1 producer, 1 consumer\n");
+	RunTest<LocklessHandoff>(1, itemsPerProducer);
+	RunTest<MutexHandoff>(1, itemsPerProducer);
+
+	printf("%i producers, 1 consumer\n", contendedProducers);
+	RunTest<LocklessHandoff>(contendedProducers, itemsPerProducer);
+	RunTest<MutexHandoff>(contendedProducers, itemsPerProducer);
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Trains a compression dictionary from a PacketLogger capture, then reports the compression ratio and CPU cost of each codec
+// on small state updates, chat lines and bulk transfers, first on the messages alone and then over a loopback connection
+// Usage: MessageCompressionBenchmark [messagesPerRun]
+
+#include "RakPeerInterface.h"
+#include "RakNetStatistics.h"
+#include "MessageIdentifiers.h"
+#include "MessageCompressor.h"
+#include "PacketLogger.h"
+#include "BitStream.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <vector>
+
+using namespace RakNet;
+
+static const unsigned short SERVER_PORT=60210;
+static const char *DICTIONARY_FILE="MessageCompressionDictionary.bin";
+
+enum Traffic
+{
+	TRAFFIC_STATE_UPDATE,
+	TRAFFIC_CHAT,
+	TRAFFIC_BULK,
+	TRAFFIC_COUNT
+};
+
+static const char *trafficNames[TRAFFIC_COUNT]={"State updates","Chat lines","Bulk transfer"};
+static const char *codecNames[MC_CODEC_COUNT]={"None","Huffman","bzip2"};
+
+static unsigned int Random(unsigned int *seed)
+{
+	*seed=*seed*1103515245+12345;
+	return (*seed>>16)&0x7FFF;
+}
+
+// Message n of a kind of traffic. The same seed gives the same messages
+static void MakeMessage(Traffic traffic, unsigned int n, unsigned int seed, std::vector<unsigned char> &message)
+{
+	static const char *words[]={"the","north","gate","is","open","anyone","want","to","trade","iron","ore","for","wood","meet","me","at","market","ok","thanks","see","you","there"};
+	unsigned int s=seed+n*7919;
+	message.clear();
+	message.push_back((unsigned char) (ID_USER_PACKET_ENUM+traffic));
+	if (traffic==TRAFFIC_STATE_UPDATE)
+	{
+		// Entity id, quantized position and velocity of an entity moving slowly, health and flags
+		uint32_t values[]={n%64, 5000+n%64*100+Random(&s)%16, 200, 3000+Random(&s)%32, Random(&s)%4, 0, Random(&s)%3, 100-n%64/8, 1};
+		for (uint32_t value : values)
+			for (int i=0; i < 4; i++)
+				message.push_back((unsigned char) (value>>(8*i)));
+	}
+	else if (traffic==TRAFFIC_CHAT)
+	{
+		int wordCount=4+Random(&s)%8;
+		for (int i=0; i < wordCount; i++)
+		{
+			const char *word=words[Random(&s)%(sizeof(words)/sizeof(words[0]))];
+			message.insert(message.end(), word, word+strlen(word));
+			message.push_back(' ');
+		}
+	}
+	else
+	{
+		// Lines of a level file
+		char line[128];
+		for (int i=0; message.size() < 65536; i++)
+		{
+			int length=sprintf(line, "object %u type=%s x=%u y=%u rotation=%u\n", i, words[Random(&s)%8], Random(&s)%4096, Random(&s)%4096, Random(&s)%360);
+			message.insert(message.end(), line, line+length);
+		}
+	}
+}
+
+// Logs nothing, only captures what is sent for the dictionary
+class CaptureLogger : public PacketLogger
+{
+public:
+	virtual void WriteLog(const char *str) {(void) str;}
+};
+
+static bool Connect(RakPeerInterface *server, RakPeerInterface *client, SystemAddress *serverAddress)
+{
+	SocketDescriptor serverSocket(SERVER_PORT, "127.0.0.1");
+	SocketDescriptor clientSocket(0, "127.0.0.1");
+	if (server->Startup(1, &serverSocket, 1)!=CRABNET_STARTED || client->Startup(1, &clientSocket, 1)!=CRABNET_STARTED)
+		return false;
+	server->SetMaximumIncomingConnections(1);
+	client->Connect("127.0.0.1", SERVER_PORT, 0, 0);
+	RakNet::TimeMS timeout=RakNet::GetTimeMS()+5000;
+	while (RakNet::GetTimeMS() < timeout)
+	{
+		for (Packet *p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+			{
+				*serverAddress=p->systemAddress;
+				client->DeallocatePacket(p);
+				return true;
+			}
+		}
+		RakSleep(10);
+	}
+	return false;
+}
+
+// Sends the messages of every kind of traffic, each on its own ordering channel, and waits until the server has them
+static bool SendTraffic(RakPeerInterface *server, RakPeerInterface *client, SystemAddress serverAddress, unsigned int messagesPerRun, unsigned int seed)
+{
+	std::vector<unsigned char> message;
+	unsigned int received=0, expected=0;
+	for (int traffic=0; traffic < TRAFFIC_COUNT; traffic++)
+	{
+		unsigned int count=traffic==TRAFFIC_BULK ? messagesPerRun/500+1 : messagesPerRun;
+		for (unsigned int n=0; n < count; n++)
+		{
+			MakeMessage((Traffic) traffic, n, seed, message);
+			client->Send((const char*) &message[0], (int) message.size(), HIGH_PRIORITY, RELIABLE_ORDERED, (char) traffic, serverAddress, false);
+			expected++;
+			if (n%64==63)
+				RakSleep(1);
+		}
+	}
+
+	RakNet::TimeMS timeout=RakNet::GetTimeMS()+30000;
+	while (received < expected && RakNet::GetTimeMS() < timeout)
+	{
+		for (Packet *p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+			if (p->data[0] >= ID_USER_PACKET_ENUM)
+				received++;
+		RakSleep(1);
+	}
+	return received==expected;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int messagesPerRun=argc > 1 ? (unsigned int) atoi(argv[1]) : 5000;
+
+	// Capture a session without compression, and train the dictionary from it
+	MessageCompressor trainer;
+	{
+		RakPeerInterface *server=RakPeerInterface::GetInstance();
+		RakPeerInterface *client=RakPeerInterface::GetInstance();
+		CaptureLogger logger;
+		logger.SetCompressionTrainer(&trainer);
+		client->AttachPlugin(&logger);
+		SystemAddress serverAddress;
+		bool ok=Connect(server, client, &serverAddress) && SendTraffic(server, client, serverAddress, messagesPerRun/4, 1);
+		client->DetachPlugin(&logger);
+		RakPeerInterface::DestroyInstance(client);
+		RakPeerInterface::DestroyInstance(server);
+		if (!ok)
+		{
+			printf("Capture failed\n");
+			return 1;
+		}
+	}
+	trainer.GenerateDictionary();
+	MessageCompressor compressor;
+	if (!trainer.SaveDictionary(DICTIONARY_FILE) || !compressor.LoadDictionary(DICTIONARY_FILE))
+	{
+		printf("Could not save and load %s\n", DICTIONARY_FILE);
+		return 1;
+	}
+	printf("Dictionary trained from a capture of %u messages of each kind, saved to %s\n\n", messagesPerRun/4, DICTIONARY_FILE);
+
+	// Each codec on each kind of traffic, with messages other than the ones trained on
+	printf("%-14s %-8s %8s %12s %14s %16s\n", "Traffic", "Codec", "Ratio", "Not smaller", "Compress us", "Decompress us");
+	for (int traffic=0; traffic < TRAFFIC_COUNT; traffic++)
+	{
+		for (int codec=MC_HUFFMAN; codec < MC_CODEC_COUNT; codec++)
+		{
+			if (!MessageCompressor::IsCodecAvailable((MessageCompressionCodec) codec))
+			{
+				printf("%-14s %-8s   not compiled in, set CRABNET_ENABLE_BZIP2\n", trafficNames[traffic], codecNames[codec]);
+				continue;
+			}
+			unsigned int count=traffic==TRAFFIC_BULK ? messagesPerRun/500+1 : messagesPerRun;
+			uint64_t bytesIn=0, bytesOut=0, compressTime=0, decompressTime=0;
+			unsigned int notSmaller=0;
+			std::vector<unsigned char> message, decompressed;
+			for (unsigned int n=0; n < count; n++)
+			{
+				MakeMessage((Traffic) traffic, n, 2, message);
+				BitStream compressed;
+				RakNet::TimeUS startTime=RakNet::GetTimeUS();
+				bool smaller=compressor.Compress((MessageCompressionCodec) codec, &message[0], (unsigned int) message.size(), &compressed);
+				compressTime+=RakNet::GetTimeUS()-startTime;
+				bytesIn+=message.size();
+				if (!smaller)
+				{
+					notSmaller++;
+					bytesOut+=message.size();
+					continue;
+				}
+				bytesOut+=compressed.GetNumberOfBytesUsed();
+
+				decompressed.resize(message.size());
+				startTime=RakNet::GetTimeUS();
+				bool same=compressor.Decompress((MessageCompressionCodec) codec, compressed.GetData(), (unsigned int) compressed.GetNumberOfBytesUsed(), &decompressed[0], (unsigned int) decompressed.size());
+				decompressTime+=RakNet::GetTimeUS()-startTime;
+				if (!same || decompressed!=message)
+				{
+					printf("%s did not decompress to the original\n", codecNames[codec]);
+					return 1;
+				}
+			}
+			printf("%-14s %-8s %8.3f %12u %14.2f %16.2f\n", trafficNames[traffic], codecNames[codec], (double) bytesOut/bytesIn, notSmaller,
+				(double) compressTime/count, count > notSmaller ? (double) decompressTime/(count-notSmaller) : 0.0);
+		}
+	}
+
+	// Over a connection, state updates and chat with the dictionary, and bulk transfers with bzip2 when it is compiled in
+	printf("\n%-26s %14s %14s %12s\n", "Connection", "Bytes sent", "Ratio", "CPU ms");
+	for (int compress=0; compress < 2; compress++)
+	{
+		RakPeerInterface *server=RakPeerInterface::GetInstance();
+		RakPeerInterface *client=RakPeerInterface::GetInstance();
+		server->SetCompressionDictionary(compressor.GetDictionary());
+		client->SetCompressionDictionary(compressor.GetDictionary());
+		if (compress)
+		{
+			client->SetChannelCompression(TRAFFIC_STATE_UPDATE, MC_HUFFMAN);
+			client->SetChannelCompression(TRAFFIC_CHAT, MC_HUFFMAN);
+			client->SetChannelCompression(TRAFFIC_BULK, MessageCompressor::IsCodecAvailable(MC_BZIP2) ? MC_BZIP2 : MC_HUFFMAN);
+		}
+		SystemAddress serverAddress;
+		bool ok=Connect(server, client, &serverAddress) && SendTraffic(server, client, serverAddress, messagesPerRun, 2);
+		RakNetStatistics clientStatistics, serverStatistics;
+		client->GetStatistics(serverAddress, &clientStatistics);
+		server->GetStatistics(server->GetSystemAddressFromIndex(0), &serverStatistics);
+		if (ok)
+		{
+			printf("%-26s %14llu %14.3f %12.1f\n", compress ? "Compressed" : "Uncompressed",
+				(unsigned long long) clientStatistics.runningTotal[ACTUAL_BYTES_SENT],
+				clientStatistics.compressionBytesIn ? (double) clientStatistics.compressionBytesOut/clientStatistics.compressionBytesIn : 1.0,
+				(clientStatistics.compressionTimeUS+serverStatistics.decompressionTimeUS)/1000.0);
+		}
+		else
+			printf("%-26s did not deliver every message\n", compress ? "Compressed" : "Uncompressed");
+		RakPeerInterface::DestroyInstance(client);
+		RakPeerInterface::DestroyInstance(server);
+	}
+
+	remove(DICTIONARY_FILE);
+	return 0;
+}
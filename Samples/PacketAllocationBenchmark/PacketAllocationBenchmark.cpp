@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Counts heap allocations per message sent over loopback and returned by Receive(), and times
+// Packet allocation from PacketArena on one thread and across threads
+// Usage: PacketAllocationBenchmark [numberOfMessages]
+
+#include "RakPeerInterface.h"
+#include "MessageIdentifiers.h"
+#include "PacketArena.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace RakNet;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<unsigned long long> mallocCount(0);
+
+#if defined(__GLIBC__)
+// Counts every call to malloc in the process, including those made by the library
+#define COUNTS_ALLOCATIONS 1
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *malloc(size_t size)
+{
+	mallocCount.fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+#else
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+static const unsigned short SERVER_PORT=61236;
+static const unsigned int MESSAGE_SIZES[]={16, 200, 1000};
+static const int NUM_MESSAGE_SIZES=sizeof(MESSAGE_SIZES)/sizeof(MESSAGE_SIZES[0]);
+
+static void MeasureLoopback(unsigned int messageSize, int numberOfMessages)
+{
+	RakPeerInterface *server=RakPeerInterface::GetInstance();
+	RakPeerInterface *client=RakPeerInterface::GetInstance();
+	SocketDescriptor serverSocket(SERVER_PORT, 0);
+	SocketDescriptor clientSocket;
+	server->Startup(1, &serverSocket, 1);
+	server->SetMaximumIncomingConnections(1);
+	client->Startup(1, &clientSocket, 1);
+	client->Connect("127.0.0.1", SERVER_PORT, 0, 0);
+
+	SystemAddress serverAddress=UNASSIGNED_SYSTEM_ADDRESS;
+	for (int i=0; i < 500 && serverAddress==UNASSIGNED_SYSTEM_ADDRESS; i++)
+	{
+		RakSleep(10);
+		for (Packet *p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+		{
+			if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+				serverAddress=p->systemAddress;
+		}
+		for (Packet *p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+			;
+	}
+	if (serverAddress==UNASSIGNED_SYSTEM_ADDRESS)
+	{
+		printf("  Could not connect over loopback\n");
+		RakPeerInterface::DestroyInstance(client);
+		RakPeerInterface::DestroyInstance(server);
+		return;
+	}
+	// Let the pings after connecting go out first
+	RakSleep(100);
+	for (Packet *p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+		;
+
+	std::vector<char> message(messageSize, 1);
+	message[0]=(char) ID_USER_PACKET_ENUM;
+
+	unsigned long long startCount=mallocCount.load();
+	Clock::time_point startTime=Clock::now();
+	int received=0;
+	for (int sent=0; sent < numberOfMessages || received < numberOfMessages;)
+	{
+		// Keep a bounded number in flight so this measures the steady state, not a growing send queue
+		for (int i=0; i < 64 && sent < numberOfMessages && sent-received < 256; i++, sent++)
+			client->Send(&message[0], (int) messageSize, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+		for (Packet *p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+		{
+			if (p->data[0]==ID_USER_PACKET_ENUM)
+				received++;
+		}
+		for (Packet *p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+			;
+		if (Clock::now()-startTime > std::chrono::seconds(30))
+			break;
+		RakSleep(0);
+	}
+	double seconds=std::chrono::duration<double>(Clock::now()-startTime).count();
+	unsigned long long allocations=mallocCount.load()-startCount;
+
+	printf("  %5u bytes: %7i messages in %6.3f s", messageSize, received, seconds);
+	if (COUNTS_ALLOCATIONS && received > 0)
+		printf(", %6.2f mallocs per message, both peers", (double) allocations/received);
+	printf("\n");
+
+	RakPeerInterface::DestroyInstance(client);
+	RakPeerInterface::DestroyInstance(server);
+}
+
+// Allocates and frees on one thread
+static double MeasureSameThread(unsigned int dataSize)
+{
+	const int iterations=1000000;
+	Clock::time_point startTime=Clock::now();
+	for (int i=0; i < iterations; i++)
+	{
+		Packet *packet=PacketArena::Allocate(dataSize);
+		packet->data[0]=(unsigned char) i;
+		PacketArena::Free(packet);
+	}
+	return std::chrono::duration<double, std::nano>(Clock::now()-startTime).count()/iterations;
+}
+
+// Allocates on one thread and frees on another, the way the update thread hands packets to the user
+static double MeasureCrossThread(unsigned int dataSize)
+{
+	const int batchSize=256;
+	const int batches=4000;
+	std::vector<Packet*> slots[2];
+	slots[0].resize(batchSize);
+	slots[1].resize(batchSize);
+	std::atomic<int> produced(0), consumed(0);
+
+	Clock::time_point startTime=Clock::now();
+	std::thread consumer([&]()
+	{
+		for (int batch=0; batch < batches; batch++)
+		{
+			while (produced.load(std::memory_order_acquire) <= batch)
+				std::this_thread::yield();
+			for (int i=0; i < batchSize; i++)
+				PacketArena::Free(slots[batch&1][i]);
+			consumed.store(batch+1, std::memory_order_release);
+		}
+	});
+	for (int batch=0; batch < batches; batch++)
+	{
+		// Wait until the consumer is done with the slots from two batches ago
+		while (consumed.load(std::memory_order_acquire) < batch-1)
+			std::this_thread::yield();
+		for (int i=0; i < batchSize; i++)
+			slots[batch&1][i]=PacketArena::Allocate(dataSize);
+		produced.store(batch+1, std::memory_order_release);
+	}
+	consumer.join();
+	return std::chrono::duration<double, std::nano>(Clock::now()-startTime).count()/(batches*batchSize);
+}
+
+int main(int argc, char **argv)
+{
+	int numberOfMessages=20000;
+	if (argc > 1)
+		numberOfMessages=atoi(argv[1]);
+	if (numberOfMessages < 1)
+		numberOfMessages=1;
+
+	printf("Counts heap allocations per message received over loopback, and times\nPacketArena allocation on one thread and across threads.\n");
+	printf("Difficulty: Intermediate\n\n");
+
+	printf("Loopback, RELIABLE_ORDERED%s\n", COUNTS_ALLOCATIONS ? "" : " (allocation counting needs glibc)");
+	for (int i=0; i < NUM_MESSAGE_SIZES; i++)
+		MeasureLoopback(MESSAGE_SIZES[i], numberOfMessages);
+
+	printf("PacketArena, per Allocate() and Free()\n");
+	for (int i=0; i < NUM_MESSAGE_SIZES; i++)
+		printf("  %5u bytes: %6.1f ns same thread, %6.1f ns freed on another thread\n", MESSAGE_SIZES[i], MeasureSameThread(MESSAGE_SIZES[i]), MeasureCrossThread(MESSAGE_SIZES[i]));
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Replicates the same objects to the same clients over loopback, once serializing on the update thread alone and once with
+// ReplicaManager3::SetNumberOfUpdateThreads(), checks that every client deserialized the same messages in the same order both times,
+// and reports how long the serialization took per tick
+// Usage: ReplicaManager3ThreadsBenchmark [threads] [clients] [objects] [bytesPerObject] [ticks]
+
+#include "RakPeerInterface.h"
+#include "ReplicaManager3.h"
+#include "NetworkIDManager.h"
+#include "MessageIdentifiers.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include <cstdio>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+using namespace RakNet;
+
+static const unsigned short SERVER_PORT=60220;
+
+struct BenchmarkSettings
+{
+	int clients;
+	int objects;
+	int bytesPerObject;
+	int ticks;
+};
+
+// What a client deserialized, in order: the object index, its state, the view class it was serialized for, and which channels were written.
+// Negative entries mark the start of each tick
+typedef std::vector<long long> DeserializeLog;
+
+class BenchmarkReplica : public Replica3
+{
+public:
+	BenchmarkReplica() : isServerObject(false), index(0), state(0), bytesPerObject(0), log(0) {}
+
+	virtual void WriteAllocationID(RakNet::Connection_RM3 *destinationConnection, RakNet::BitStream *allocationIdBitstream) const
+	{
+		(void) destinationConnection;
+		allocationIdBitstream->Write(RakNet::RakString("BenchmarkReplica"));
+	}
+	virtual RM3ConstructionState QueryConstruction(RakNet::Connection_RM3 *destinationConnection, ReplicaManager3 *replicaManager3)
+	{
+		(void) replicaManager3;
+		return QueryConstruction_ServerConstruction(destinationConnection, isServerObject);
+	}
+	virtual bool QueryRemoteConstruction(RakNet::Connection_RM3 *sourceConnection) {return QueryRemoteConstruction_ServerConstruction(sourceConnection, isServerObject);}
+	virtual void SerializeConstruction(RakNet::BitStream *constructionBitstream, RakNet::Connection_RM3 *destinationConnection)
+	{
+		(void) destinationConnection;
+		constructionBitstream->Write(index);
+		constructionBitstream->Write(state);
+	}
+	virtual bool DeserializeConstruction(RakNet::BitStream *constructionBitstream, RakNet::Connection_RM3 *sourceConnection)
+	{
+		(void) sourceConnection;
+		return constructionBitstream->Read(index) && constructionBitstream->Read(state);
+	}
+	virtual void SerializeDestruction(RakNet::BitStream *destructionBitstream, RakNet::Connection_RM3 *destinationConnection) {(void) destructionBitstream; (void) destinationConnection;}
+	virtual bool DeserializeDestruction(RakNet::BitStream *destructionBitstream, RakNet::Connection_RM3 *sourceConnection) {(void) destructionBitstream; (void) sourceConnection; return true;}
+	virtual RakNet::RM3ActionOnPopConnection QueryActionOnPopConnection(RakNet::Connection_RM3 *droppedConnection) const {return QueryActionOnPopConnection_Server(droppedConnection);}
+	virtual void DeallocReplica(RakNet::Connection_RM3 *sourceConnection) {(void) sourceConnection; delete this;}
+	virtual RakNet::RM3QuerySerializationResult QuerySerialization(RakNet::Connection_RM3 *destinationConnection) {return QuerySerialization_ServerSerializable(destinationConnection, isServerObject);}
+	virtual RM3SerializationResult Serialize(RakNet::SerializeParameters *serializeParameters)
+	{
+		// Each view class gets its own data, and view class 1 also gets a second, low priority channel
+		uint32_t viewClass=serializeParameters->destinationConnection->QueryViewClass();
+		serializeParameters->outputBitstream[0].Write(state);
+		serializeParameters->outputBitstream[0].Write(viewClass);
+		unsigned int hash=(unsigned int) state;
+		for (int i=0; i < bytesPerObject; i++)
+		{
+			hash=hash*2654435761u+i;
+			serializeParameters->outputBitstream[0].Write((unsigned char) hash);
+		}
+		if (viewClass==1)
+			serializeParameters->outputBitstream[1].Write(state*3);
+		serializeParameters->pro[1].priority=LOW_PRIORITY;
+		return RM3SR_SERIALIZED_UNIQUELY;
+	}
+	virtual void Deserialize(RakNet::DeserializeParameters *deserializeParameters)
+	{
+		long long entry=(long long) index << 40;
+		if (deserializeParameters->bitstreamWrittenTo[0])
+		{
+			uint32_t viewClass;
+			deserializeParameters->serializationBitstream[0].Read(state);
+			deserializeParameters->serializationBitstream[0].Read(viewClass);
+			bool corrupt=false;
+			unsigned int hash=(unsigned int) state;
+			for (int i=0; i < bytesPerObject; i++)
+			{
+				hash=hash*2654435761u+i;
+				unsigned char byte;
+				if (!deserializeParameters->serializationBitstream[0].Read(byte) || byte!=(unsigned char) hash)
+					corrupt=true;
+			}
+			entry|=((long long) state << 8) | (viewClass << 4) | (corrupt ? 4 : 0) | 1;
+		}
+		if (deserializeParameters->bitstreamWrittenTo[1])
+		{
+			int tripleState;
+			deserializeParameters->serializationBitstream[1].Read(tripleState);
+			entry|=2 | (tripleState%3!=0 ? 8 : 0);
+		}
+		log->push_back(entry);
+	}
+
+	bool isServerObject;
+	int index;
+	int state;
+	int bytesPerObject;
+	DeserializeLog *log;
+};
+
+class BenchmarkConnection : public Connection_RM3
+{
+public:
+	BenchmarkConnection(const SystemAddress &_systemAddress, RakNetGUID _guid, uint32_t _viewClass) : Connection_RM3(_systemAddress, _guid), viewClass(_viewClass) {}
+	virtual Replica3 *AllocReplica(RakNet::BitStream *allocationId, ReplicaManager3 *replicaManager3);
+	virtual uint32_t QueryViewClass(void) const {return viewClass;}
+
+	uint32_t viewClass;
+};
+
+class BenchmarkReplicaManager : public ReplicaManager3
+{
+public:
+	BenchmarkReplicaManager() : viewClass(0), clientViewClasses(0), bytesPerObject(0), log(0) {}
+	virtual Connection_RM3 *AllocConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID) const
+	{
+		// The server looks up the view class of each client, so both runs use the same one for the same client
+		uint32_t connectionViewClass=viewClass;
+		if (clientViewClasses && clientViewClasses->count(rakNetGUID.g))
+			connectionViewClass=clientViewClasses->find(rakNetGUID.g)->second;
+		return new BenchmarkConnection(systemAddress, rakNetGUID, connectionViewClass);
+	}
+	virtual void DeallocConnection(Connection_RM3 *connection) const {delete connection;}
+
+	uint32_t viewClass;
+	std::map<uint64_t, uint32_t> *clientViewClasses;
+	int bytesPerObject;
+	DeserializeLog *log;
+};
+
+Replica3 *BenchmarkConnection::AllocReplica(RakNet::BitStream *allocationId, ReplicaManager3 *replicaManager3)
+{
+	(void) allocationId;
+	BenchmarkReplicaManager *manager=(BenchmarkReplicaManager *) replicaManager3;
+	BenchmarkReplica *replica=new BenchmarkReplica;
+	replica->bytesPerObject=manager->bytesPerObject;
+	replica->log=manager->log;
+	return replica;
+}
+
+static void ReceiveAll(RakPeerInterface *peer)
+{
+	for (Packet *packet=peer->Receive(); packet; packet=peer->Receive())
+		peer->DeallocatePacket(packet);
+}
+
+// Returns false if the clients did not connect or did not keep up. serializeTime is the time spent in the server's ReplicaManager3 update
+static bool Run(int threads, const BenchmarkSettings &settings, std::vector<DeserializeLog> &logs, RakNet::TimeUS *serializeTime)
+{
+	std::map<uint64_t, uint32_t> clientViewClasses;
+	logs.assign(settings.clients, DeserializeLog());
+	*serializeTime=0;
+
+	RakPeerInterface *server=RakPeerInterface::GetInstance();
+	NetworkIDManager serverNetworkIdManager;
+	BenchmarkReplicaManager serverReplicaManager;
+	serverReplicaManager.clientViewClasses=&clientViewClasses;
+	serverReplicaManager.SetNetworkIDManager(&serverNetworkIdManager);
+	// Serialize on every Receive() call, so each tick below is one update
+	serverReplicaManager.SetAutoSerializeInterval(0);
+	serverReplicaManager.SetNumberOfUpdateThreads(threads);
+	server->AttachPlugin(&serverReplicaManager);
+	SocketDescriptor serverSocket(SERVER_PORT, "127.0.0.1");
+	server->Startup(settings.clients, &serverSocket, 1);
+	server->SetMaximumIncomingConnections((unsigned short) settings.clients);
+
+	std::vector<RakPeerInterface *> clients;
+	std::vector<NetworkIDManager *> clientNetworkIdManagers;
+	std::vector<BenchmarkReplicaManager *> clientReplicaManagers;
+	for (int i=0; i < settings.clients; i++)
+	{
+		RakPeerInterface *client=RakPeerInterface::GetInstance();
+		SocketDescriptor clientSocket(0, "127.0.0.1");
+		client->Startup(1, &clientSocket, 1);
+		NetworkIDManager *networkIdManager=new NetworkIDManager;
+		BenchmarkReplicaManager *replicaManager=new BenchmarkReplicaManager;
+		replicaManager->viewClass=i%2;
+		replicaManager->bytesPerObject=settings.bytesPerObject;
+		replicaManager->log=&logs[i];
+		replicaManager->SetNetworkIDManager(networkIdManager);
+		client->AttachPlugin(replicaManager);
+		clientViewClasses[client->GetMyGUID().g]=i%2;
+		clients.push_back(client);
+		clientNetworkIdManagers.push_back(networkIdManager);
+		clientReplicaManagers.push_back(replicaManager);
+	}
+
+	std::vector<BenchmarkReplica *> objects;
+	for (int i=0; i < settings.objects; i++)
+	{
+		BenchmarkReplica *replica=new BenchmarkReplica;
+		replica->isServerObject=true;
+		replica->index=i;
+		replica->bytesPerObject=settings.bytesPerObject;
+		objects.push_back(replica);
+		serverReplicaManager.Reference(replica);
+	}
+	for (int i=0; i < settings.clients; i++)
+		clients[i]->Connect("127.0.0.1", SERVER_PORT, 0, 0);
+
+	// Wait until every client constructed every object
+	bool ok=false;
+	RakNet::TimeMS quitTime=RakNet::GetTimeMS()+20000;
+	while (!ok && RakNet::GetTimeMS() < quitTime)
+	{
+		ReceiveAll(server);
+		ok=true;
+		for (int i=0; i < settings.clients; i++)
+		{
+			ReceiveAll(clients[i]);
+			if (clientReplicaManagers[i]->GetReplicaCount() < (unsigned int) settings.objects)
+				ok=false;
+		}
+		RakSleep(1);
+	}
+	// Then let the first serialization of every object arrive too, so only the ticks below are logged
+	for (int i=0; ok && i < 20; i++)
+	{
+		ReceiveAll(server);
+		for (int j=0; j < settings.clients; j++)
+			ReceiveAll(clients[j]);
+		RakSleep(5);
+	}
+	for (int i=0; i < settings.clients; i++)
+		logs[i].clear();
+
+	for (int tick=0; ok && tick < settings.ticks; tick++)
+	{
+		for (int i=0; i < settings.objects; i++)
+		{
+			if ((i*7+tick)%3==0)
+				objects[i]->state++;
+		}
+
+		RakNet::TimeUS startTime=RakNet::GetTimeUS();
+		Packet *packet=server->Receive();
+		*serializeTime+=RakNet::GetTimeUS()-startTime;
+		if (packet)
+			server->DeallocatePacket(packet);
+		for (int i=0; i < settings.clients; i++)
+			logs[i].push_back(-1-tick);
+
+		// Wait for the tick to arrive before changing anything, so the logs do not depend on timing
+		bool arrived=false;
+		quitTime=RakNet::GetTimeMS()+5000;
+		while (!arrived && RakNet::GetTimeMS() < quitTime)
+		{
+			arrived=true;
+			for (int i=0; i < settings.clients; i++)
+			{
+				ReceiveAll(clients[i]);
+				for (unsigned int j=0; arrived && j < clientReplicaManagers[i]->GetReplicaCount(); j++)
+				{
+					BenchmarkReplica *replica=(BenchmarkReplica *) clientReplicaManagers[i]->GetReplicaAtIndex(j);
+					if (replica->state!=objects[replica->index]->state)
+						arrived=false;
+				}
+			}
+			RakSleep(1);
+		}
+		// The low priority channel can trail the state
+		for (int i=0; i < 5; i++)
+		{
+			for (int j=0; j < settings.clients; j++)
+				ReceiveAll(clients[j]);
+			RakSleep(1);
+		}
+		ok=arrived;
+	}
+
+	for (int i=0; i < settings.objects; i++)
+	{
+		objects[i]->BroadcastDestruction();
+		delete objects[i];
+	}
+	for (int i=0; i < settings.clients; i++)
+	{
+		clients[i]->Shutdown(100);
+		RakPeerInterface::DestroyInstance(clients[i]);
+		delete clientReplicaManagers[i];
+		delete clientNetworkIdManagers[i];
+	}
+	server->Shutdown(100);
+	RakPeerInterface::DestroyInstance(server);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int threads=argc > 1 ? atoi(argv[1]) : 4;
+	BenchmarkSettings settings;
+	settings.clients=argc > 2 ? atoi(argv[2]) : 8;
+	settings.objects=argc > 3 ? atoi(argv[3]) : 300;
+	settings.bytesPerObject=argc > 4 ? atoi(argv[4]) : 64;
+	settings.ticks=argc > 5 ? atoi(argv[5]) : 40;
+
+	std::vector<DeserializeLog> serialLogs, threadedLogs;
+	RakNet::TimeUS serialTime, threadedTime;
+	if (!Run(1, settings, serialLogs, &serialTime) || !Run(threads, settings, threadedLogs, &threadedTime))
+	{
+		printf("The clients did not keep up\n");
+		return 1;
+	}
+
+	size_t entries=0;
+	unsigned int corrupt=0;
+	for (size_t i=0; i < serialLogs.size(); i++)
+	{
+		entries+=serialLogs[i].size();
+		for (size_t j=0; j < serialLogs[i].size(); j++)
+		{
+			if (serialLogs[i][j] >= 0 && (serialLogs[i][j] & 12))
+				corrupt++;
+		}
+	}
+	bool same=serialLogs==threadedLogs;
+
+	printf("%d clients, %d objects of %d bytes, %d ticks\n", settings.clients, settings.objects, settings.bytesPerObject, settings.ticks);
+	printf("Serialize time per tick: %.2f ms on the update thread, %.2f ms with %d threads\n", serialTime/1000.0/settings.ticks, threadedTime/1000.0/settings.ticks, threads);
+	printf("%u deserialized messages, %u corrupt. With %d threads they %s\n", (unsigned int) (entries-settings.ticks*serialLogs.size()), corrupt, threads,
+		same ? "match the update thread run" : "DO NOT match the update thread run");
+	return same && corrupt==0 ? 0 : 1;
+}
@@ -33,11 +33,75 @@
 #include <cfloat>
 #include <algorithm>
 
+#if BITSTREAM_USE_SIMD==1
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
 // MSWin uses _copysign, others use copysign...
 #ifndef _WIN32
 #define _copysign copysign
 #endif
 
+// Big endian loads and stores, so that shifting the word moves bits from one byte to the next in stream order
+static inline uint64_t LoadBigEndian64(const unsigned char *in)
+{
+    return ((uint64_t) in[0] << 56) | ((uint64_t) in[1] << 48) | ((uint64_t) in[2] << 40) | ((uint64_t) in[3] << 32) |
+           ((uint64_t) in[4] << 24) | ((uint64_t) in[5] << 16) | ((uint64_t) in[6] << 8) | (uint64_t) in[7];
+}
+
+static inline void StoreBigEndian64(unsigned char *out, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        out[i] = (unsigned char) value;
+        value >>= 8;
+    }
+}
+
+// Sets out[i] to the 8 bits starting shift bits into in[i], for i from 0 to count-1. Reads in[0] to in[count]
+// shift must be 1 to 7. Copies to or from an unaligned position in the stream are this shift with shift or 8-shift
+static void ShiftBytesLeft(unsigned char *out, const unsigned char *in, size_t count, unsigned int shift)
+{
+    size_t i = 0;
+
+#if BITSTREAM_USE_SIMD==1
+    // There are no 8 bit shifts, so shift 16 bit lanes and mask off the bits that crossed into the other byte of the lane
+    const __m128i leftShift = _mm_cvtsi32_si128((int) shift);
+    const __m128i rightShift = _mm_cvtsi32_si128((int) (8 - shift));
+#if defined(__AVX2__)
+    const __m256i highBits256 = _mm256_set1_epi8((char) (0xFF << shift));
+    const __m256i lowBits256 = _mm256_set1_epi8((char) (0xFF >> (8 - shift)));
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i current = _mm256_loadu_si256((const __m256i *) (in + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *) (in + i + 1));
+        __m256i high = _mm256_and_si256(_mm256_sll_epi16(current, leftShift), highBits256);
+        __m256i low = _mm256_and_si256(_mm256_srl_epi16(next, rightShift), lowBits256);
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_or_si256(high, low));
+    }
+#endif
+    const __m128i highBits = _mm_set1_epi8((char) (0xFF << shift));
+    const __m128i lowBits = _mm_set1_epi8((char) (0xFF >> (8 - shift)));
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i current = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128i next = _mm_loadu_si128((const __m128i *) (in + i + 1));
+        __m128i high = _mm_and_si128(_mm_sll_epi16(current, leftShift), highBits);
+        __m128i low = _mm_and_si128(_mm_srl_epi16(next, rightShift), lowBits);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_or_si128(high, low));
+    }
+#endif
+
+    for (; i + 8 <= count; i += 8)
+        StoreBigEndian64(out + i, (LoadBigEndian64(in + i) << shift) | (in[i + 8] >> (8 - shift)));
+    for (; i < count; i++)
+        out[i] = (unsigned char) ((in[i] << shift) | (in[i + 1] >> (8 - shift)));
+}
+
 using namespace RakNet;
 
 #ifdef _MSC_VER
@@ -168,41 +232,60 @@ void BitStream::Write(BitStream *bitStream)
 void BitStream::Write(BitStream *bitStream, BitSize_t numberOfBits)
 {
     AddBitsAndReallocate(numberOfBits);
-    BitSize_t numberOfBitsMod8;
 
-    if ((bitStream->GetReadOffset() & 7) == 0 && (numberOfBitsUsed & 7) == 0)
-    {
-        BitSize_t readOffsetBytes = bitStream->GetReadOffset() / 8;
-        BitSize_t numBytes = numberOfBits / 8;
-        memcpy(data + (numberOfBitsUsed >> 3), bitStream->GetData() + readOffsetBytes, numBytes);
-        numberOfBits -= BYTES_TO_BITS(numBytes);
-        bitStream->SetReadOffset(BYTES_TO_BITS(numBytes + readOffsetBytes));
-        numberOfBitsUsed += BYTES_TO_BITS(numBytes);
-    }
+    // Copy no more than what is left to read
+    if (numberOfBits > bitStream->GetNumberOfUnreadBits())
+        numberOfBits = bitStream->GetNumberOfUnreadBits();
 
-    while (numberOfBits-- > 0 && bitStream->readOffset + 1 <= bitStream->numberOfBitsUsed)
+    if ((bitStream->readOffset & 7) != 0)
     {
-        numberOfBitsMod8 = numberOfBitsUsed & 7;
-        if (numberOfBitsMod8 == 0)
+        // Realign the source through a buffer, then copy it at the destination's alignment
+        unsigned char buffer[256];
+        while (numberOfBits >= 8)
         {
-            // New byte
-            if (bitStream->data[bitStream->readOffset >> 3] & (0x80 >> (bitStream->readOffset & 7)))
-                data[numberOfBitsUsed >> 3] = 0x80; // Write 1
-            else
-                data[numberOfBitsUsed >> 3] = 0; // Write 0
-
+            BitSize_t numberOfBitsToCopy = std::min(numberOfBits & ~(BitSize_t) 7, (BitSize_t) BYTES_TO_BITS(sizeof(buffer)));
+            bitStream->ReadBits(buffer, numberOfBitsToCopy, false);
+            WriteBits(buffer, numberOfBitsToCopy, false);
+            numberOfBits -= numberOfBitsToCopy;
         }
-        else
+    }
+    else if (numberOfBits >= 8)
+    {
+        const unsigned char *source = bitStream->data + (bitStream->readOffset >> 3);
+        const BitSize_t numberOfBytes = numberOfBits >> 3;
+        if ((numberOfBitsUsed & 7) == 0)
         {
-            // Existing byte
-            if (bitStream->data[bitStream->readOffset >> 3] & (0x80 >> (bitStream->readOffset & 7)))
-                data[numberOfBitsUsed >> 3] |= 0x80 >> (numberOfBitsMod8); // Set the bit to 1
-            // else 0, do nothing
+            memcpy(data + (numberOfBitsUsed >> 3), source, (size_t) numberOfBytes);
+            numberOfBitsUsed += BYTES_TO_BITS(numberOfBytes);
         }
+        else
+            WriteBits(source, BYTES_TO_BITS(numberOfBytes), false);
+        bitStream->readOffset += BYTES_TO_BITS(numberOfBytes);
+        numberOfBits -= BYTES_TO_BITS(numberOfBytes);
+    }
+
+    if (numberOfBits == 0)
+        return;
 
-        bitStream->readOffset++;
-        numberOfBitsUsed++;
+    // Less than a byte is left. The source bits after it may be set, so mask them off
+    const BitSize_t sourceOffsetMod8 = bitStream->readOffset & 7;
+    unsigned int lastBits = (unsigned int) bitStream->data[bitStream->readOffset >> 3] << sourceOffsetMod8;
+    if (sourceOffsetMod8 + numberOfBits > 8)
+        lastBits |= bitStream->data[(bitStream->readOffset >> 3) + 1] >> (8 - sourceOffsetMod8);
+    const unsigned char lastByte = (unsigned char) (lastBits & (0xFF << (8 - numberOfBits)));
+
+    const BitSize_t numberOfBitsUsedMod8 = numberOfBitsUsed & 7;
+    if (numberOfBitsUsedMod8 == 0)
+        data[numberOfBitsUsed >> 3] = lastByte;
+    else
+    {
+        data[numberOfBitsUsed >> 3] |= lastByte >> numberOfBitsUsedMod8;
+        if (numberOfBitsUsedMod8 + numberOfBits > 8)
+            data[(numberOfBitsUsed >> 3) + 1] = (unsigned char) (lastByte << (8 - numberOfBitsUsedMod8));
     }
+
+    bitStream->readOffset += numberOfBits;
+    numberOfBitsUsed += numberOfBits;
 }
 
 void BitStream::Write(BitStream &bitStream, BitSize_t numberOfBits)
@@ -404,6 +487,25 @@ void BitStream::WriteBits(const unsigned char *inByteArray, BitSize_t numberOfBi
 
     const unsigned char *inputPtr = inByteArray;
 
+    // Write the whole bytes in bulk, 64 bits or more at a time. The loop below finishes any partial byte and short writes
+    if (numberOfBitsToWrite >= 64)
+    {
+        const BitSize_t numberOfBytes = numberOfBitsToWrite >> 3;
+        unsigned char *outputPtr = data + (numberOfBitsUsed >> 3);
+        if (numberOfBitsUsedMod8 == 0)
+            memcpy(outputPtr, inputPtr, (size_t) numberOfBytes);
+        else
+        {
+            outputPtr[0] |= inputPtr[0] >> numberOfBitsUsedMod8;
+            ShiftBytesLeft(outputPtr + 1, inputPtr, (size_t) numberOfBytes - 1, 8 - numberOfBitsUsedMod8);
+            outputPtr[numberOfBytes] = (unsigned char) (inputPtr[numberOfBytes - 1] << (8 - numberOfBitsUsedMod8));
+        }
+
+        inputPtr += numberOfBytes;
+        numberOfBitsUsed += BYTES_TO_BITS(numberOfBytes);
+        numberOfBitsToWrite -= BYTES_TO_BITS(numberOfBytes);
+    }
+
     // Faster to put the while at the top surprisingly enough
     while (numberOfBitsToWrite > 0)
     {
@@ -464,35 +566,61 @@ void BitStream::WriteCompressed(const unsigned char *inByteArray, unsigned int s
     // Write upper bytes with a single 1
     // From high byte to low byte, if high byte is a byteMatch then write a 1 bit.
     // Otherwise write a 0 bit and then write the remaining bytes
-    while (currentByte > 0)
+    // Count the matching bytes first, so the 1 bits can be written up to 8 at a time
+    BitSize_t matchingBytes = 0;
+    while (currentByte > 0 && inByteArray[currentByte] == byteMatch)
     {
-        // If high byte is byteMatch (0 of 0xff) then it would have the same value shifted
-        if (inByteArray[currentByte] == byteMatch)
-            Write(true);
+        matchingBytes++;
+        currentByte--;
+    }
+
+    const unsigned char allOnes = 0xFF;
+    for (; matchingBytes >= 8; matchingBytes -= 8)
+        WriteBits(&allOnes, 8, true);
+
+    if (currentByte > 0)
+    {
+        // Write the remainder of the data after writing 0
+        if (matchingBytes == 0)
+            Write0();
         else
         {
-            // Write the remainder of the data after writing 0
-            Write(false);
-
-            WriteBits(inByteArray, (currentByte + 1) << 3, true);
-            return;
+            const unsigned char flags = (unsigned char) (((1 << matchingBytes) - 1) << 1);
+            WriteBits(&flags, matchingBytes + 1, true);
         }
-        currentByte--;
+
+        WriteBits(inByteArray, (currentByte + 1) << 3, true);
+        return;
     }
 
     // If the upper half of the last byte is a 0 (positive) or 16 (negative) then write a 1 and the remaining 4 bits.
     // Otherwise write a 0 and the 8 bites.
-    if ((unsignedData && ((*(inByteArray + currentByte)) & 0xF0) == 0x00) ||
-        (!unsignedData && ((*(inByteArray + currentByte)) & 0xF0) == 0xF0))
+    // Together with the 1 bits for the matching bytes this is at most 16 bits, so put them all in one write
+    const unsigned char lastByte = inByteArray[currentByte];
+    unsigned int bits = (1 << matchingBytes) - 1;
+    BitSize_t numberOfBits = matchingBytes;
+    if ((unsignedData && (lastByte & 0xF0) == 0x00) ||
+        (!unsignedData && (lastByte & 0xF0) == 0xF0))
     {
-        Write(true);
-        WriteBits(inByteArray + currentByte, 4, true);
+        bits = (bits << 5) | 0x10 | (lastByte & 0x0F);
+        numberOfBits += 5;
     }
     else
     {
-        Write(false);
-        WriteBits(inByteArray + currentByte, 8, true);
+        bits = (bits << 9) | lastByte;
+        numberOfBits += 9;
     }
+
+    // WriteBits takes whole bytes first, then the remaining bits right aligned in the last byte
+    unsigned char output[2];
+    if (numberOfBits > 8)
+    {
+        output[0] = (unsigned char) (bits >> (numberOfBits - 8));
+        output[1] = (unsigned char) (bits & ((1 << (numberOfBits - 8)) - 1));
+    }
+    else
+        output[0] = (unsigned char) bits;
+    WriteBits(output, numberOfBits, true);
 }
 
 // Read numberOfBitsToRead bits to the output source
@@ -518,7 +646,22 @@ bool BitStream::ReadBits(unsigned char *inOutByteArray, BitSize_t numberOfBitsTo
 
     BitSize_t offset = 0;
 
-    memset(inOutByteArray, 0, (size_t) BITS_TO_BYTES(numberOfBitsToRead));
+    // Read the whole bytes in bulk, 64 bits or more at a time. The loop below finishes any partial byte and short reads
+    if (numberOfBitsToRead >= 64)
+    {
+        const BitSize_t numberOfBytes = numberOfBitsToRead >> 3;
+        const unsigned char *inputPtr = data + (readOffset >> 3);
+        if (readOffsetMod8 == 0)
+            memcpy(inOutByteArray, inputPtr, (size_t) numberOfBytes);
+        else
+            ShiftBytesLeft(inOutByteArray, inputPtr, (size_t) numberOfBytes, readOffsetMod8);
+
+        offset = numberOfBytes;
+        readOffset += BYTES_TO_BITS(numberOfBytes);
+        numberOfBitsToRead -= BYTES_TO_BITS(numberOfBytes);
+    }
+
+    memset(inOutByteArray + offset, 0, (size_t) BITS_TO_BYTES(numberOfBitsToRead));
 
     while (numberOfBitsToRead > 0)
     {
@@ -579,6 +722,48 @@ bool BitStream::ReadCompressed(unsigned char *inOutByteArray, unsigned int size,
     // From high byte to low byte, if high byte is a byteMatch then write a 1 bit.
     // Otherwise write a 0 bit and then write the remaining bytes
     unsigned int currentByte = (size >> 3) - 1;
+
+    // Types up to 64 bits have at most 7 of these bits, plus the 0 bit before the remaining bytes, or the 1 or 0 bit and the last 4 or 8 bits.
+    // Read all of that from the next 16 bits at once when the stream has them
+    const BitSize_t numberOfBitsAvailable = readOffset < numberOfBitsUsed ? numberOfBitsUsed - readOffset : 0;
+    if (currentByte <= 7 && numberOfBitsAvailable >= currentByte + 1)
+    {
+        const BitSize_t byteOffset = readOffset >> 3;
+        const BitSize_t numberOfBytesUsed = BITS_TO_BYTES(numberOfBitsUsed);
+        unsigned int bits = (unsigned int) data[byteOffset] << 16;
+        if (byteOffset + 1 < numberOfBytesUsed)
+            bits |= (unsigned int) data[byteOffset + 1] << 8;
+        if (byteOffset + 2 < numberOfBytesUsed)
+            bits |= data[byteOffset + 2];
+        bits = ((bits << (readOffset & 7)) >> 8) & 0xFFFF;
+
+        unsigned int matchingBytes = 0;
+        while (matchingBytes < currentByte && (bits & (0x8000 >> matchingBytes)))
+            matchingBytes++;
+
+        if (matchingBytes < currentByte)
+        {
+            // Read the rest of the bytes
+            memset(inOutByteArray + currentByte + 1 - matchingBytes, byteMatch, matchingBytes);
+            readOffset += matchingBytes + 1;
+            return ReadBits(inOutByteArray, (currentByte + 1 - matchingBytes) << 3);
+        }
+
+        const BitSize_t numberOfBitsInLastByte = (bits & (0x8000 >> matchingBytes)) ? 4 : 8;
+        if (numberOfBitsAvailable >= matchingBytes + 1 + numberOfBitsInLastByte)
+        {
+            unsigned char lastByte = (unsigned char) (bits >> (16 - (matchingBytes + 1 + numberOfBitsInLastByte)));
+            if (numberOfBitsInLastByte == 4)
+                lastByte = (lastByte & 0x0F) | halfByteMatch;
+
+            memset(inOutByteArray + 1, byteMatch, currentByte);
+            inOutByteArray[0] = lastByte;
+            readOffset += matchingBytes + 1 + numberOfBitsInLastByte;
+            return true;
+        }
+        // Otherwise the stream ends early, which the code below reports
+    }
+
     while (currentByte > 0)
     {
         // If we read a 1 then the data is byteMatch.
@@ -0,0 +1,452 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "CCRakNetBBR.h"
+#include "Rand.h"
+#include <climits>
+#include <string.h>
+
+// Times are in microseconds
+static const double STARTUP_GAIN = 2.885; // 2/ln(2), the smallest gain that doubles the delivery rate each round trip
+static const double PROBE_BANDWIDTH_CWND_GAIN = 2.0;
+static const double PROBE_BANDWIDTH_PACING_GAINS[8] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+static const double FULL_BANDWIDTH_GROWTH = 1.25;
+static const uint32_t FULL_BANDWIDTH_ROUNDS = 3;
+static const CCTimeType MIN_RTT_EXPIRY = 10000000;
+static const CCTimeType PROBE_RTT_TIME = 200000;
+static const uint32_t INITIAL_CWND_DATAGRAMS = 10;
+static const uint32_t MIN_CWND_DATAGRAMS = 4;
+// Round trip time assumed for the initial pacing rate, until one is measured
+static const CCTimeType INITIAL_RTT = 1000;
+// The update thread sleeps in whole milliseconds, so up to this much sending time can build up between ticks
+static const CCTimeType PACING_BURST_TIME = 2000;
+// Acks are held for at most 25 ms in CCRakNetSlidingWindow, so longer gaps are from loss or from the remote system being busy
+static const CCTimeType MAX_ACK_INTERVAL = 30000;
+
+using namespace RakNet;
+
+// ****************************************************** PUBLIC METHODS ******************************************************
+
+void CCRakNetBBR::Init(CCTimeType curTime, uint32_t maxDatagramPayload)
+{
+    CCRakNetSlidingWindow::Init(curTime, maxDatagramPayload);
+
+    cwnd = (double) INITIAL_CWND_DATAGRAMS * MAXIMUM_MTU_INCLUDING_UDP_HEADER;
+    mode = MODE_STARTUP;
+    SetGains();
+    pacingRate = pacingGain * cwnd / (double) INITIAL_RTT;
+    pacingBudget = 0.0;
+    lastPacingTime = curTime;
+
+    sendStates.Clear(0);
+    sendStatesBegin = 0;
+    delivered = 0.0;
+    deliveredTime = firstSentTime = curTime;
+    tickTime = curTime;
+    bytesInFlight = 0;
+
+    roundCount = 0;
+    roundStartTime = curTime;
+    isRoundStart = false;
+
+    for (int i = 0; i < CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH; i++)
+    {
+        bandwidthSamples[i] = 0.0;
+        ackIntervalSamples[i] = 0;
+    }
+    bottleneckBandwidth = 0.0;
+    maxAckInterval = 0;
+    lastAckTime = 0;
+
+    minRtt = minRttTime = 0;
+    hasMinRtt = false;
+
+    fullBandwidth = 0.0;
+    fullBandwidthRounds = 0;
+    isPipeFilled = false;
+
+    cycleIndex = 0;
+    cycleStartTime = curTime;
+
+    probeRttDoneTime = 0;
+    probeRttRoundCount = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+int CCRakNetBBR::GetRetransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick,
+                                            uint32_t unacknowledgedBytes, bool isContinuousSend)
+{
+    (void) timeSinceLastTick;
+    (void) unacknowledgedBytes;
+    (void) isContinuousSend;
+
+    UpdatePacingBudget(curTime);
+    if (pacingBudget <= 0.0)
+        return 0;
+    return pacingBudget < (double) INT_MAX ? (int) pacingBudget : INT_MAX;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+int CCRakNetBBR::GetTransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick,
+                                          uint32_t unacknowledgedBytes, bool isContinuousSend)
+{
+    (void) timeSinceLastTick;
+
+    _isContinuousSend = isContinuousSend;
+    tickTime = curTime;
+    bytesInFlight = unacknowledgedBytes;
+
+    UpdatePacingBudget(curTime);
+    if (pacingBudget <= 0.0 || unacknowledgedBytes >= cwnd)
+        return 0;
+
+    double bandwidth = cwnd - unacknowledgedBytes;
+    if (bandwidth > pacingBudget)
+        bandwidth = pacingBudget;
+    return bandwidth < (double) INT_MAX ? (int) bandwidth : INT_MAX;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+bool CCRakNetBBR::GetTimeToSendData(CCTimeType curTime, CCTimeType *sendTime) const
+{
+    // Waits on acks to open the window
+    if (bytesInFlight >= cwnd)
+        return false;
+
+    if (pacingBudget > 0.0)
+        *sendTime = curTime;
+    else
+        *sendTime = lastPacingTime + (CCTimeType) (-pacingBudget / pacingRate) + 1;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+DatagramSequenceNumberType CCRakNetBBR::GetAndIncrementNextDatagramSequenceNumber(void)
+{
+    DatagramSequenceNumberType datagramNumber = CCRakNetSlidingWindow::GetAndIncrementNextDatagramSequenceNumber();
+
+    // Nothing in flight, so the delivery rate is measured from now rather than from the last ack
+    if (bytesInFlight == 0)
+        deliveredTime = firstSentTime = tickTime;
+
+    TrimSendStates();
+    if (sendStates.IsEmpty())
+        sendStatesBegin = datagramNumber;
+    else if (sendStates.Size() >= CC_CRABNET_BBR_SEND_HISTORY_LENGTH)
+    {
+        sendStates.Pop();
+        sendStatesBegin++;
+    }
+
+    SendState state;
+    state.datagramNumber = datagramNumber;
+    state.sentTime = tickTime;
+    state.firstSentTime = firstSentTime;
+    state.deliveredTime = deliveredTime;
+    state.delivered = delivered;
+    state.isAppLimited = !_isContinuousSend;
+    state.isValid = true;
+    sendStates.Push(state);
+    return datagramNumber;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::OnSendBytes(CCTimeType curTime, uint32_t numBytes)
+{
+    CCRakNetSlidingWindow::OnSendBytes(curTime, numBytes);
+
+    pacingBudget -= (double) numBytes;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::OnResend(CCTimeType curTime, RakNet::TimeUS nextActionTime)
+{
+    (void) curTime;
+    (void) nextActionTime;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::OnNAK(CCTimeType curTime, DatagramSequenceNumberType nakSequenceNumber)
+{
+    (void) curTime;
+
+    // Lost, so it will not be acked
+    SendState *state = GetSendState(nakSequenceNumber);
+    if (state != 0)
+        state->isValid = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::OnAck(CCTimeType curTime, CCTimeType rtt, bool hasBAndAS, BytesPerMicrosecond _B,
+                        BytesPerMicrosecond _AS, double totalUserDataBytesAcked, bool isContinuousSend,
+                        DatagramSequenceNumberType sequenceNumber)
+{
+    (void) hasBAndAS;
+    (void) _B;
+    (void) _AS;
+
+    UpdateRTT(rtt);
+    _isContinuousSend = isContinuousSend;
+    delivered = totalUserDataBytesAcked;
+
+    // Every datagram in one ack has the same time. Only the time between acks shows how long the remote system holds them
+    if (curTime != lastAckTime)
+    {
+        if (lastAckTime != 0 && isContinuousSend)
+        {
+            CCTimeType ackInterval = curTime - lastAckTime;
+            if (ackInterval > MAX_ACK_INTERVAL)
+                ackInterval = MAX_ACK_INTERVAL;
+            CCTimeType &sample = ackIntervalSamples[roundCount % CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH];
+            if (ackInterval > sample)
+                sample = ackInterval;
+            if (ackInterval > maxAckInterval)
+                maxAckInterval = ackInterval;
+        }
+        lastAckTime = curTime;
+    }
+
+    SendState *sendState = GetSendState(sequenceNumber);
+    isRoundStart = false;
+    if (sendState != 0 && sendState->isValid)
+    {
+        const SendState &state = *sendState;
+        sendState->isValid = false;
+        UpdateBandwidth(curTime, state);
+        deliveredTime = curTime;
+        firstSentTime = state.sentTime;
+
+        // Startup is over once three round trips in a row sending continuously did not grow the bandwidth by 25%
+        if (isRoundStart && !isPipeFilled && !state.isAppLimited)
+        {
+            if (bottleneckBandwidth >= fullBandwidth * FULL_BANDWIDTH_GROWTH)
+            {
+                fullBandwidth = bottleneckBandwidth;
+                fullBandwidthRounds = 0;
+            }
+            else if (++fullBandwidthRounds >= FULL_BANDWIDTH_ROUNDS)
+                isPipeFilled = true;
+        }
+    }
+
+    UpdateMinRTT(curTime, rtt);
+    UpdateMode(curTime);
+    SetGains();
+
+    if (bottleneckBandwidth > 0.0)
+    {
+        double rate = pacingGain * bottleneckBandwidth;
+        // Until the pipe is full the estimate is still growing, so do not slow down on a low sample
+        if (isPipeFilled || rate > pacingRate)
+            pacingRate = rate;
+    }
+
+    double minCwnd = (double) MIN_CWND_DATAGRAMS * MAXIMUM_MTU_INCLUDING_UDP_HEADER;
+    if (mode == MODE_PROBE_RTT)
+        cwnd = minCwnd;
+    else if (hasMinRtt && bottleneckBandwidth > 0.0)
+    {
+        // Enough for the round trip, for the acks being held, and for the datagrams the pacing budget allows at once
+        double target = GetBDP(cwndGain) + bottleneckBandwidth * (double) maxAckInterval +
+                        3.0 * MAXIMUM_MTU_INCLUDING_UDP_HEADER;
+        if (isPipeFilled || target > cwnd)
+            cwnd = target;
+    }
+    if (cwnd < minCwnd)
+        cwnd = minCwnd;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+uint64_t CCRakNetBBR::GetBytesPerSecondLimitByCongestionControl(void) const
+{
+    return (uint64_t) (pacingRate * 1000000.0);
+}
+
+// ****************************************************** PROTECTED METHODS ******************************************************
+
+double CCRakNetBBR::GetBDP(double gain) const
+{
+    return gain * bottleneckBandwidth * (double) minRtt;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::UpdateBandwidth(CCTimeType curTime, const SendState &state)
+{
+    // A round trip ends when a datagram sent after the last one ended is acked
+    if (state.sentTime > roundStartTime)
+    {
+        roundCount++;
+        roundStartTime = curTime;
+        isRoundStart = true;
+
+        int slot = roundCount % CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH;
+        bandwidthSamples[slot] = 0.0;
+        ackIntervalSamples[slot] = 0;
+        maxAckInterval = 0;
+        for (int i = 0; i < CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH; i++)
+        {
+            if (ackIntervalSamples[i] > maxAckInterval)
+                maxAckInterval = ackIntervalSamples[i];
+        }
+    }
+
+    // Over the longer of the send and ack intervals, so acks arriving together do not overstate the rate
+    CCTimeType sendInterval = state.sentTime - state.firstSentTime;
+    CCTimeType ackInterval = curTime - state.deliveredTime;
+    CCTimeType interval = sendInterval > ackInterval ? sendInterval : ackInterval;
+    if (interval == 0 || (hasMinRtt && interval < minRtt))
+        return;
+
+    BytesPerMicrosecond rate = (delivered - state.delivered) / (double) interval;
+    // A sample sent with nothing queued measures how fast the application sent, unless it is faster than the estimate
+    if (state.isAppLimited && rate <= bottleneckBandwidth)
+        return;
+
+    BytesPerMicrosecond &sample = bandwidthSamples[roundCount % CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH];
+    if (rate > sample)
+        sample = rate;
+
+    bottleneckBandwidth = 0.0;
+    for (int i = 0; i < CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH; i++)
+    {
+        if (bandwidthSamples[i] > bottleneckBandwidth)
+            bottleneckBandwidth = bandwidthSamples[i];
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::UpdateMinRTT(CCTimeType curTime, CCTimeType rtt)
+{
+    bool isExpired = hasMinRtt && curTime - minRttTime > MIN_RTT_EXPIRY;
+    if (rtt > 0 && (!hasMinRtt || rtt <= minRtt || isExpired))
+    {
+        minRtt = rtt;
+        minRttTime = curTime;
+        hasMinRtt = true;
+    }
+
+    // If the application is not sending enough to queue anything, the samples are already of an empty queue
+    if (isExpired && mode != MODE_PROBE_RTT && _isContinuousSend)
+    {
+        mode = MODE_PROBE_RTT;
+        probeRttDoneTime = 0;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::UpdateMode(CCTimeType curTime)
+{
+    if (mode == MODE_STARTUP && isPipeFilled)
+        mode = MODE_DRAIN;
+
+    // Startup queued up to a round trip of data at the bottleneck. Send slower until it is gone
+    if (mode == MODE_DRAIN && bytesInFlight <= GetBDP(1.0))
+        EnterProbeBandwidth(curTime);
+
+    if (mode == MODE_PROBE_BANDWIDTH && curTime - cycleStartTime > minRtt)
+    {
+        cycleIndex = (cycleIndex + 1) % 8;
+        cycleStartTime = curTime;
+    }
+
+    if (mode == MODE_PROBE_RTT)
+    {
+        double minCwnd = (double) MIN_CWND_DATAGRAMS * MAXIMUM_MTU_INCLUDING_UDP_HEADER;
+        if (probeRttDoneTime == 0 && bytesInFlight <= minCwnd)
+        {
+            probeRttDoneTime = curTime + PROBE_RTT_TIME;
+            probeRttRoundCount = roundCount;
+        }
+        else if (probeRttDoneTime != 0 && roundCount > probeRttRoundCount && curTime >= probeRttDoneTime)
+        {
+            minRttTime = curTime;
+            if (isPipeFilled)
+                EnterProbeBandwidth(curTime);
+            else
+                mode = MODE_STARTUP;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::EnterProbeBandwidth(CCTimeType curTime)
+{
+    mode = MODE_PROBE_BANDWIDTH;
+    // Start anywhere but the phase that sends slower, so connections sharing a link do not probe at the same time
+    cycleIndex = randomMT() % 7;
+    if (cycleIndex > 0)
+        cycleIndex++;
+    cycleStartTime = curTime;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::SetGains(void)
+{
+    switch (mode)
+    {
+        case MODE_STARTUP:
+            pacingGain = STARTUP_GAIN;
+            cwndGain = STARTUP_GAIN;
+            break;
+        case MODE_DRAIN:
+            pacingGain = 1.0 / STARTUP_GAIN;
+            cwndGain = STARTUP_GAIN;
+            break;
+        case MODE_PROBE_BANDWIDTH:
+            pacingGain = PROBE_BANDWIDTH_PACING_GAINS[cycleIndex];
+            cwndGain = PROBE_BANDWIDTH_CWND_GAIN;
+            break;
+        case MODE_PROBE_RTT:
+            pacingGain = 1.0;
+            cwndGain = 1.0;
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::UpdatePacingBudget(CCTimeType curTime)
+{
+    if (curTime > lastPacingTime)
+        pacingBudget += pacingRate * (double) (curTime - lastPacingTime);
+    lastPacingTime = curTime;
+
+    // Time spent idle is not saved up to send later as a burst
+    double maxBudget = pacingRate * (double) PACING_BURST_TIME;
+    if (maxBudget < 2.0 * MAXIMUM_MTU_INCLUDING_UDP_HEADER)
+        maxBudget = 2.0 * MAXIMUM_MTU_INCLUDING_UDP_HEADER;
+    if (pacingBudget > maxBudget)
+        pacingBudget = maxBudget;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+CCRakNetBBR::SendState *CCRakNetBBR::GetSendState(DatagramSequenceNumberType datagramNumber)
+{
+    DatagramSequenceNumberType offset = datagramNumber - sendStatesBegin;
+    if (sendStates.IsEmpty() || LessThan(datagramNumber, sendStatesBegin) || offset >= sendStates.Size())
+        return 0;
+    return &sendStates[sendStates.Begin() + offset];
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetBBR::TrimSendStates(void)
+{
+    // A datagram neither acked nor NAKed by twice the retransmission timeout was lost without the remote system noticing
+    const CCTimeType expiry = 2 * GetRTOForRetransmission(0);
+    while (!sendStates.IsEmpty())
+    {
+        const SendState &oldest = sendStates[sendStates.Begin()];
+        if (oldest.isValid && tickTime - oldest.sentTime < expiry)
+            break;
+        sendStates.Pop();
+        sendStatesBegin++;
+    }
+}
+// ----------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "CCRakNetInterface.h"
+#include "CCRakNetSlidingWindow.h"
+#include "CCRakNetUDT.h"
+#include "CCRakNetBBR.h"
+
+using namespace RakNet;
+
+// ----------------------------------------------------------------------------------------------------------------------------
+CCRakNetInterface *CCRakNetInterface::Allocate(CongestionControlAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+        case CC_UDT:
+            return new CCRakNetUDT;
+        case CC_BBR:
+            return new CCRakNetBBR;
+        case CC_SLIDING_WINDOW:
+        default:
+            return new CCRakNetSlidingWindow;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+void CCRakNetInterface::ContinueFrom(const CCRakNetInterface &previous)
+{
+    nextDatagramSequenceNumber = previous.nextDatagramSequenceNumber;
+    expectedNextSequenceNumber = previous.expectedNextSequenceNumber;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+DatagramSequenceNumberType CCRakNetInterface::GetAndIncrementNextDatagramSequenceNumber(void)
+{
+    DatagramSequenceNumberType dsnt = nextDatagramSequenceNumber;
+    nextDatagramSequenceNumber++;
+    return dsnt;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+bool CCRakNetInterface::GreaterThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b)
+{
+    // a > b?
+    const DatagramSequenceNumberType halfSpan = (DatagramSequenceNumberType) (
+            ((DatagramSequenceNumberType) (uint32_t) -1) / (DatagramSequenceNumberType) 2);
+    return b != a && b - a > halfSpan;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------
+bool CCRakNetInterface::LessThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b)
+{
+    // a < b?
+    const DatagramSequenceNumberType halfSpan =
+            ((DatagramSequenceNumberType) (uint32_t) -1) / (DatagramSequenceNumberType) 2;
+    return b != a && b - a < halfSpan;
+}
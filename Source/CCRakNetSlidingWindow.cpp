@@ -11,20 +11,21 @@
 
 #include "CCRakNetSlidingWindow.h"
 
-#if USE_SLIDING_WINDOW_CONGESTION_CONTROL == 1
-
 static const double UNSET_TIME_US = -1;
 
 #if CC_TIME_TYPE_BYTES == 4
 static const CCTimeType SYN = 10;
+static const CCTimeType MAX_ACK_DELAY = 25;
 #else
 static const CCTimeType SYN = 10000;
+static const CCTimeType MAX_ACK_DELAY = 25000;
 #endif
 
 #include "MTUSize.h"
 #include <cstdio>
 #include <cmath>
 #include <cstdlib>
+#include <climits>
 #include "RakAssert.h"
 #include "RakAlloca.h"
 
@@ -42,6 +43,8 @@ void CCRakNetSlidingWindow::Init(CCTimeType curTime, uint32_t maxDatagramPayload
     cwnd = maxDatagramPayload;
     ssThresh = 0.0;
     oldestUnsentAck = 0;
+    lastDataSendTime = 0;
+    dataSendInterval = 0;
     nextDatagramSequenceNumber = 0;
     nextCongestionControlBlock = 0;
     backoffThisBlock = speedUpThisBlock = false;
@@ -77,7 +80,11 @@ int CCRakNetSlidingWindow::GetTransmissionBandwidth(CCTimeType curTime, CCTimeTy
     _isContinuousSend = isContinuousSend;
 
     if (unacknowledgedBytes <= cwnd)
-        return (int) (cwnd - unacknowledgedBytes);
+    {
+        // cwnd grows for as long as nothing is lost, and on a fast enough link passes INT_MAX
+        double bandwidth = cwnd - unacknowledgedBytes;
+        return bandwidth < (double) INT_MAX ? (int) bandwidth : INT_MAX;
+    }
     else
         return 0;
 }
@@ -94,28 +101,35 @@ bool CCRakNetSlidingWindow::ShouldSendACKs(CCTimeType curTime, CCTimeType estima
         return true;
     }
 
-    return curTime >= oldestUnsentAck + SYN;
+    return curTime >= GetAckDeadline();
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-DatagramSequenceNumberType CCRakNetSlidingWindow::GetNextDatagramSequenceNumber(void)
+CCTimeType CCRakNetSlidingWindow::GetTimeToSendACKs(CCTimeType curTime) const
 {
-    return nextDatagramSequenceNumber;
-}
+    if (GetSenderRTOForACK() == (CCTimeType) UNSET_TIME_US)
+        return curTime;
 
-// ----------------------------------------------------------------------------------------------------------------------------
-DatagramSequenceNumberType CCRakNetSlidingWindow::GetAndIncrementNextDatagramSequenceNumber(void)
-{
-    DatagramSequenceNumberType dsnt = nextDatagramSequenceNumber;
-    nextDatagramSequenceNumber++;
-    return dsnt;
+    return GetAckDeadline();
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
 void CCRakNetSlidingWindow::OnSendBytes(CCTimeType curTime, uint32_t numBytes)
 {
-    (void) curTime;
     (void) numBytes;
+
+    // Called for each message, so only count the first one sent at each time
+    if (curTime == lastDataSendTime)
+        return;
+    if (lastDataSendTime != 0)
+    {
+        CCTimeType interval = curTime - lastDataSendTime;
+        if (dataSendInterval == 0)
+            dataSendInterval = interval;
+        else
+            dataSendInterval = (dataSendInterval * 7 + interval) / 8;
+    }
+    lastDataSendTime = curTime;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -212,21 +226,8 @@ void CCRakNetSlidingWindow::OnAck(CCTimeType curTime, CCTimeType rtt, bool hasBA
     (void) _AS;
     (void) hasBAndAS;
     (void) curTime;
-    (void) rtt;
 
-    lastRtt = (double) rtt;
-    if (estimatedRTT == UNSET_TIME_US)
-    {
-        estimatedRTT = (double) rtt;
-        deviationRtt = (double) rtt;
-    }
-    else
-    {
-        double d = .05;
-        double difference = rtt - estimatedRTT;
-        estimatedRTT = estimatedRTT + d * difference;
-        deviationRtt = deviationRtt + d * (std::abs(difference) - deviationRtt);
-    }
+    UpdateRTT(rtt);
 
     _isContinuousSend = isContinuousSend;
 
@@ -356,27 +357,27 @@ double CCRakNetSlidingWindow::GetRTT() const
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-bool CCRakNetSlidingWindow::GreaterThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b)
-{
-    // a > b?
-    const DatagramSequenceNumberType halfSpan = (DatagramSequenceNumberType) (
-            ((DatagramSequenceNumberType) (const uint32_t) -1) / (DatagramSequenceNumberType) 2);
-    return b != a && b - a > halfSpan;
-}
-
-// ----------------------------------------------------------------------------------------------------------------------------
-bool CCRakNetSlidingWindow::LessThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b)
+uint64_t CCRakNetSlidingWindow::GetBytesPerSecondLimitByCongestionControl() const
 {
-    // a < b?
-    const DatagramSequenceNumberType halfSpan =
-            ((DatagramSequenceNumberType) (const uint32_t) -1) / (DatagramSequenceNumberType) 2;
-    return b != a && b - a < halfSpan;
+    return 0; // TODO
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
-uint64_t CCRakNetSlidingWindow::GetBytesPerSecondLimitByCongestionControl() const
+void CCRakNetSlidingWindow::UpdateRTT(CCTimeType rtt)
 {
-    return 0; // TODO
+    lastRtt = (double) rtt;
+    if (estimatedRTT == UNSET_TIME_US)
+    {
+        estimatedRTT = (double) rtt;
+        deviationRtt = (double) rtt;
+    }
+    else
+    {
+        double d = .05;
+        double difference = rtt - estimatedRTT;
+        estimatedRTT = estimatedRTT + d * difference;
+        deviationRtt = deviationRtt + d * (std::abs(difference) - deviationRtt);
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------
@@ -387,10 +388,27 @@ CCTimeType CCRakNetSlidingWindow::GetSenderRTOForACK() const
     return (CCTimeType) (lastRtt + SYN);
 }
 
+// ----------------------------------------------------------------------------------------------------------------------------
+CCTimeType CCRakNetSlidingWindow::GetAckDeadline() const
+{
+    CCTimeType deadline = oldestUnsentAck + SYN;
+
+    // If data is sent regularly, but less often than every SYN, wait for the next send, and send the acks with the data
+    if (dataSendInterval > 0 && dataSendInterval <= MAX_ACK_DELAY)
+    {
+        CCTimeType nextDataSendTime = lastDataSendTime + dataSendInterval + SYN / 4;
+        if (nextDataSendTime > oldestUnsentAck + MAX_ACK_DELAY)
+            nextDataSendTime = oldestUnsentAck + MAX_ACK_DELAY;
+        if (nextDataSendTime > deadline)
+            deadline = nextDataSendTime;
+    }
+
+    return deadline;
+}
+
 // ----------------------------------------------------------------------------------------------------------------------------
 bool CCRakNetSlidingWindow::IsInSlowStart() const
 {
     return cwnd <= ssThresh || ssThresh == 0;
 }
 // ----------------------------------------------------------------------------------------------------------------------------
-#endif
@@ -0,0 +1,347 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "DS_BanTable.h"
+#include "RakAssert.h"
+#include "RakSleep.h"
+#include <string.h>
+#include <stdlib.h>
+
+using namespace DataStructures;
+
+static inline int GetKeyBit(const unsigned char *key, unsigned int bitIndex)
+{
+    return (key[bitIndex >> 3] >> (7 - (bitIndex & 7))) & 1;
+}
+
+BanTable::Node::Node()
+{
+    children[0].store(0, std::memory_order_relaxed);
+    children[1].store(0, std::memory_order_relaxed);
+    timeout.store(0, std::memory_order_relaxed);
+    banned.store(false, std::memory_order_relaxed);
+}
+
+BanTable::BanTable()
+{
+    numBans.store(0, std::memory_order_relaxed);
+    epoch.store(0, std::memory_order_relaxed);
+    readers[0].store(0, std::memory_order_relaxed);
+    readers[1].store(0, std::memory_order_relaxed);
+    retired = 0;
+    retiredSize = 0;
+    retiredCapacity = 0;
+}
+
+BanTable::~BanTable()
+{
+    // No lookups can be running once the owner is destroyed
+    for (int i = 0; i < 2; i++)
+    {
+        FreeSubtree(root4.children[i].load(std::memory_order_relaxed));
+        FreeSubtree(root6.children[i].load(std::memory_order_relaxed));
+    }
+    FreeRetired();
+    free(retired);
+}
+
+BanTable::Node *BanTable::GetRoot(const RakNet::SystemAddress &address, unsigned char key[16], unsigned int &keyBits) const
+{
+#if CRABNET_SUPPORT_IPV6 == 1
+    if (address.address.addr4.sin_family == AF_INET6)
+    {
+        const unsigned char *bytes = (const unsigned char *) &address.address.addr6.sin6_addr;
+        static const unsigned char v4MappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+        if (memcmp(bytes, v4MappedPrefix, sizeof(v4MappedPrefix)) != 0)
+        {
+            memcpy(key, bytes, 16);
+            keyBits = 128;
+            return const_cast<Node *>(&root6);
+        }
+
+        memcpy(key, bytes + 12, 4);
+        keyBits = 32;
+        return const_cast<Node *>(&root4);
+    }
+#endif
+
+    // s_addr is in network order, so its bytes are already most significant first
+    memcpy(key, &address.address.addr4.sin_addr.s_addr, 4);
+    keyBits = 32;
+    return const_cast<Node *>(&root4);
+}
+
+void BanTable::Add(const RakNet::SystemAddress &address, unsigned int prefixLength, RakNet::TimeMS timeout)
+{
+    unsigned char key[16];
+    unsigned int keyBits;
+    Node *node = GetRoot(address, key, keyBits);
+    if (prefixLength > keyBits)
+        prefixLength = keyBits;
+
+    for (unsigned int bitIndex = 0; bitIndex < prefixLength; bitIndex++)
+    {
+        int bit = GetKeyBit(key, bitIndex);
+        Node *child = node->children[bit].load(std::memory_order_relaxed);
+        if (child == 0)
+        {
+            // Fully built before it is published, so a lookup either sees all of it or none of it
+            child = new Node;
+            node->children[bit].store(child, std::memory_order_release);
+        }
+        node = child;
+    }
+
+    node->timeout.store(timeout, std::memory_order_relaxed);
+    if (!node->banned.load(std::memory_order_relaxed))
+    {
+        node->banned.store(true, std::memory_order_release);
+        numBans.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool BanTable::Remove(const RakNet::SystemAddress &address, unsigned int prefixLength)
+{
+    unsigned char key[16];
+    unsigned int keyBits;
+    Node *path[129];
+    path[0] = GetRoot(address, key, keyBits);
+    if (prefixLength > keyBits)
+        prefixLength = keyBits;
+
+    for (unsigned int bitIndex = 0; bitIndex < prefixLength; bitIndex++)
+    {
+        path[bitIndex + 1] = path[bitIndex]->children[GetKeyBit(key, bitIndex)].load(std::memory_order_relaxed);
+        if (path[bitIndex + 1] == 0)
+            return false;
+    }
+
+    Node *node = path[prefixLength];
+    if (!node->banned.load(std::memory_order_relaxed))
+        return false;
+    node->banned.store(false, std::memory_order_relaxed);
+    numBans.fetch_sub(1, std::memory_order_relaxed);
+
+    // Detach the nodes that no longer lead to a ban, from the bottom up. The roots are never freed
+    bool detached = false;
+    for (unsigned int depth = prefixLength; depth > 0 && IsEmpty(path[depth]); depth--)
+    {
+        path[depth - 1]->children[GetKeyBit(key, depth - 1)].store(0, std::memory_order_release);
+        Retire(path[depth]);
+        detached = true;
+    }
+
+    if (detached)
+    {
+        WaitForReaders();
+        FreeRetired();
+    }
+    return true;
+}
+
+bool BanTable::RemoveExpiredRecursive(Node *node, RakNet::TimeMS time, unsigned int &numRemoved)
+{
+    if (node->banned.load(std::memory_order_relaxed))
+    {
+        RakNet::TimeMS timeout = node->timeout.load(std::memory_order_relaxed);
+        if (timeout > 0 && timeout < time)
+        {
+            node->banned.store(false, std::memory_order_relaxed);
+            numBans.fetch_sub(1, std::memory_order_relaxed);
+            numRemoved++;
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        Node *child = node->children[i].load(std::memory_order_relaxed);
+        if (child != 0 && RemoveExpiredRecursive(child, time, numRemoved))
+        {
+            node->children[i].store(0, std::memory_order_release);
+            Retire(child);
+        }
+    }
+
+    return IsEmpty(node);
+}
+
+unsigned int BanTable::RemoveExpired(RakNet::TimeMS time)
+{
+    if (numBans.load(std::memory_order_relaxed) == 0)
+        return 0;
+
+    unsigned int numRemoved = 0;
+    RemoveExpiredRecursive(&root4, time, numRemoved);
+    RemoveExpiredRecursive(&root6, time, numRemoved);
+
+    if (retiredSize > 0)
+    {
+        WaitForReaders();
+        FreeRetired();
+    }
+    return numRemoved;
+}
+
+void BanTable::Clear(void)
+{
+    Node *roots[2] = {&root4, &root6};
+    for (int rootIndex = 0; rootIndex < 2; rootIndex++)
+    {
+        roots[rootIndex]->banned.store(false, std::memory_order_relaxed);
+        for (int i = 0; i < 2; i++)
+        {
+            Node *child = roots[rootIndex]->children[i].exchange(0, std::memory_order_acq_rel);
+            if (child != 0)
+                Retire(child);
+        }
+    }
+    numBans.store(0, std::memory_order_relaxed);
+
+    if (retiredSize > 0)
+    {
+        WaitForReaders();
+        FreeRetired();
+    }
+}
+
+bool BanTable::IsBanned(const RakNet::SystemAddress &address, RakNet::TimeMS time) const
+{
+    // Skip registering as a reader if possible
+    if (numBans.load(std::memory_order_relaxed) == 0)
+        return false;
+
+    unsigned int readerEpoch;
+    while (true)
+    {
+        readerEpoch = epoch.load();
+        readers[readerEpoch & 1].fetch_add(1);
+        // A writer advanced the epoch in between, and may not have seen this reader. Register again in the new epoch
+        if (epoch.load() == readerEpoch)
+            break;
+        readers[readerEpoch & 1].fetch_sub(1, std::memory_order_release);
+    }
+
+    unsigned char key[16];
+    unsigned int keyBits;
+    const Node *node = GetRoot(address, key, keyBits);
+    bool isBanned = false;
+    for (unsigned int bitIndex = 0; ; bitIndex++)
+    {
+        if (node->banned.load(std::memory_order_acquire))
+        {
+            RakNet::TimeMS timeout = node->timeout.load(std::memory_order_relaxed);
+            if (timeout == 0 || timeout >= time)
+            {
+                isBanned = true;
+                break;
+            }
+        }
+
+        if (bitIndex == keyBits)
+            break;
+        node = node->children[GetKeyBit(key, bitIndex)].load(std::memory_order_acquire);
+        if (node == 0)
+            break;
+    }
+
+    readers[readerEpoch & 1].fetch_sub(1, std::memory_order_release);
+    return isBanned;
+}
+
+unsigned int BanTable::Size(void) const
+{
+    return numBans.load(std::memory_order_relaxed);
+}
+
+void BanTable::WaitForReaders(void)
+{
+    // Lookups that start from now on register in the other counter, and cannot reach the detached nodes
+    unsigned int oldEpoch = epoch.fetch_add(1);
+    while (readers[oldEpoch & 1].load() != 0)
+        RakSleep(0);
+}
+
+void BanTable::Retire(Node *node)
+{
+    if (retiredSize == retiredCapacity)
+    {
+        retiredCapacity = retiredCapacity == 0 ? 16 : retiredCapacity * 2;
+        retired = (Node **) realloc(retired, retiredCapacity * sizeof(Node *));
+        RakAssert(retired);
+    }
+    retired[retiredSize++] = node;
+}
+
+void BanTable::FreeRetired(void)
+{
+    for (unsigned int i = 0; i < retiredSize; i++)
+        FreeSubtree(retired[i]);
+    retiredSize = 0;
+}
+
+void BanTable::FreeSubtree(Node *node)
+{
+    if (node == 0)
+        return;
+    FreeSubtree(node->children[0].load(std::memory_order_relaxed));
+    FreeSubtree(node->children[1].load(std::memory_order_relaxed));
+    delete node;
+}
+
+bool BanTable::IsEmpty(const Node *node)
+{
+    return !node->banned.load(std::memory_order_relaxed) &&
+           node->children[0].load(std::memory_order_relaxed) == 0 &&
+           node->children[1].load(std::memory_order_relaxed) == 0;
+}
+
+bool BanTable::ParseIPv4Prefix(const char *str, RakNet::SystemAddress &address, unsigned int &prefixLength)
+{
+    unsigned char octets[4] = {0, 0, 0, 0};
+    unsigned int numOctets = 0;
+    const char *c = str;
+
+    while (true)
+    {
+        // Anything after the first wildcard is ignored, the same as when matching the string
+        if (*c == '*' && numOctets > 0)
+        {
+            prefixLength = numOctets * 8;
+            break;
+        }
+
+        unsigned int value = 0, numDigits = 0;
+        while (*c >= '0' && *c <= '9' && numDigits < 4)
+        {
+            value = value * 10 + (unsigned int) (*c - '0');
+            c++;
+            numDigits++;
+        }
+        if (numDigits == 0 || numDigits > 3 || value > 255)
+            return false;
+        octets[numOctets++] = (unsigned char) value;
+
+        if (numOctets == 4)
+        {
+            if (*c != 0)
+                return false;
+            prefixLength = 32;
+            break;
+        }
+        if (*c != '.')
+            return false;
+        c++;
+    }
+
+    address = RakNet::SystemAddress();
+    memcpy(&address.address.addr4.sin_addr.s_addr, octets, 4);
+    return true;
+}
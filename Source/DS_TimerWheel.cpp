@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "DS_TimerWheel.h"
+#include "RakAssert.h"
+
+using namespace DataStructures;
+
+// Marks the end of a slot list, and timers that are not in any slot
+static const unsigned int NO_TIMER = (unsigned int) -1;
+
+TimerWheel::TimerWheel()
+{
+    timers = 0;
+    numTimers = 0;
+    slots = 0;
+    slotMask = 0;
+    tickLength = 1;
+    currentTick = 0;
+}
+
+TimerWheel::~TimerWheel()
+{
+    Clear();
+}
+
+void TimerWheel::Init(unsigned int _numTimers, RakNet::TimeUS _tickLength, unsigned int numSlots, RakNet::TimeUS time)
+{
+    RakAssert(_tickLength > 0);
+    Clear();
+
+    unsigned int size = 2;
+    while (size < numSlots)
+        size <<= 1;
+
+    numTimers = _numTimers;
+    timers = new Timer[numTimers];
+    for (unsigned int i = 0; i < numTimers; i++)
+    {
+        timers[i].slot = NO_TIMER;
+        timers[i].next = timers[i].prev = NO_TIMER;
+    }
+
+    slots = new unsigned int[size];
+    for (unsigned int i = 0; i < size; i++)
+        slots[i] = NO_TIMER;
+    slotMask = size - 1;
+    tickLength = _tickLength;
+    currentTick = time / tickLength;
+}
+
+void TimerWheel::Clear(void)
+{
+    delete[] timers;
+    timers = 0;
+    numTimers = 0;
+    delete[] slots;
+    slots = 0;
+    slotMask = 0;
+}
+
+void TimerWheel::Schedule(unsigned int timer, RakNet::TimeUS time)
+{
+    RakAssert(timer < numTimers);
+    if (timers[timer].slot != NO_TIMER)
+    {
+        if (timers[timer].fireTime <= time)
+            return;
+        Unlink(timer);
+    }
+
+    // Timers already due go in the slot PopExpired() looks at first
+    RakNet::TimeUS tick = time / tickLength;
+    if (tick < currentTick)
+        tick = currentTick;
+
+    timers[timer].fireTime = time;
+    Link(timer, (unsigned int) (tick & slotMask));
+}
+
+void TimerWheel::Cancel(unsigned int timer)
+{
+    RakAssert(timer < numTimers);
+    if (timers[timer].slot != NO_TIMER)
+        Unlink(timer);
+}
+
+bool TimerWheel::IsScheduled(unsigned int timer) const
+{
+    RakAssert(timer < numTimers);
+    return timers[timer].slot != NO_TIMER;
+}
+
+unsigned int TimerWheel::PopExpired(RakNet::TimeUS time, unsigned int *output)
+{
+    RakNet::TimeUS lastTick = time / tickLength;
+    if (slots == 0 || lastTick < currentTick)
+        return 0;
+
+    // One revolution visits every slot
+    RakNet::TimeUS ticks = lastTick - currentTick + 1;
+    if (ticks > (RakNet::TimeUS) slotMask + 1)
+        ticks = (RakNet::TimeUS) slotMask + 1;
+
+    unsigned int count = 0;
+    for (RakNet::TimeUS tick = currentTick; tick < currentTick + ticks; tick++)
+    {
+        unsigned int timer = slots[tick & slotMask];
+        while (timer != NO_TIMER)
+        {
+            unsigned int next = timers[timer].next;
+            if (timers[timer].fireTime <= time)
+            {
+                Unlink(timer);
+                output[count++] = timer;
+            }
+            timer = next;
+        }
+    }
+
+    // The last tick may still have timers later in the same tick, so it is visited again next time
+    currentTick = lastTick;
+    return count;
+}
+
+RakNet::TimeUS TimerWheel::GetTimeUntilNextTimer(RakNet::TimeUS time, RakNet::TimeUS maxTime) const
+{
+    RakNet::TimeUS limit = time + maxTime;
+    RakNet::TimeUS lastTick = limit / tickLength;
+    if (slots == 0 || lastTick < currentTick)
+        return maxTime;
+
+    RakNet::TimeUS ticks = lastTick - currentTick + 1;
+    if (ticks > (RakNet::TimeUS) slotMask + 1)
+        ticks = (RakNet::TimeUS) slotMask + 1;
+
+    RakNet::TimeUS earliest = limit;
+    for (RakNet::TimeUS tick = currentTick; tick < currentTick + ticks; tick++)
+    {
+        for (unsigned int timer = slots[tick & slotMask]; timer != NO_TIMER; timer = timers[timer].next)
+        {
+            if (timers[timer].fireTime < earliest)
+                earliest = timers[timer].fireTime;
+        }
+
+        // Timers in later slots fire after the end of this tick, unless they are a revolution or more ahead
+        if (earliest < (tick + 1) * tickLength)
+            break;
+    }
+
+    if (earliest >= limit)
+        return maxTime;
+    return earliest > time ? earliest - time : 0;
+}
+
+void TimerWheel::Link(unsigned int timer, unsigned int slot)
+{
+    timers[timer].slot = slot;
+    timers[timer].prev = NO_TIMER;
+    timers[timer].next = slots[slot];
+    if (slots[slot] != NO_TIMER)
+        timers[slots[slot]].prev = timer;
+    slots[slot] = timer;
+}
+
+void TimerWheel::Unlink(unsigned int timer)
+{
+    Timer &t = timers[timer];
+    if (t.prev != NO_TIMER)
+        timers[t.prev].next = t.next;
+    else
+        slots[t.slot] = t.next;
+    if (t.next != NO_TIMER)
+        timers[t.next].prev = t.prev;
+    t.slot = NO_TIMER;
+    t.next = t.prev = NO_TIMER;
+}
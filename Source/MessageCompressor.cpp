@@ -0,0 +1,208 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "MessageCompressor.h"
+#include "DS_HuffmanEncodingTree.h"
+#include "BitStream.h"
+#include "RakAssert.h"
+#include <string.h> // Use string.h rather than memory.h for a console
+#include <stdio.h>
+#include <cstdlib>
+#if CRABNET_SUPPORT_BZIP2==1
+#include "bzip2-1.0.6/bzlib.h"
+#endif
+
+using namespace RakNet;
+
+STATIC_FACTORY_DEFINITIONS(MessageCompressor,MessageCompressor)
+
+// Counts are scaled down to this before building the tree, so the weights of its nodes can't overflow
+static const unsigned int MAX_DICTIONARY_FREQUENCY = 1 << 20;
+
+// bzip2 adds about 40 bytes of headers, and allocates about a megabyte per call, so smaller messages are not worth trying
+static const unsigned int BZIP2_MIN_MESSAGE_SIZE = 128;
+
+// The smallest bzip2 block, 100 KB. Larger blocks need more memory and only help messages larger than this
+static const int BZIP2_BLOCK_SIZE_100K = 1;
+
+MessageCompressor::MessageCompressor()
+{
+    huffmanTree = 0;
+    ClearTraining();
+    memset(frequencyTable, 0, sizeof(frequencyTable));
+}
+
+MessageCompressor::~MessageCompressor()
+{
+    delete huffmanTree;
+}
+
+void MessageCompressor::Train(const unsigned char *data, unsigned int length)
+{
+    for (unsigned int i = 0; i < length; i++)
+        trainingCounts[data[i]]++;
+}
+
+void MessageCompressor::ClearTraining(void)
+{
+    memset(trainingCounts, 0, sizeof(trainingCounts));
+}
+
+void MessageCompressor::GenerateDictionary(void)
+{
+    uint64_t maxCount = 0;
+    for (unsigned int i = 0; i < 256; i++)
+        if (trainingCounts[i] > maxCount)
+            maxCount = trainingCounts[i];
+
+    unsigned int shift = 0;
+    while ((maxCount >> shift) > MAX_DICTIONARY_FREQUENCY)
+        shift++;
+
+    unsigned int table[256];
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        // A value that was seen stays more likely than one that wasn't
+        table[i] = (unsigned int) (trainingCounts[i] >> shift);
+        if (table[i] == 0 && trainingCounts[i] != 0)
+            table[i] = 1;
+    }
+    SetDictionary(table);
+}
+
+void MessageCompressor::SetDictionary(const unsigned int _frequencyTable[256])
+{
+    memcpy(frequencyTable, _frequencyTable, sizeof(frequencyTable));
+    if (huffmanTree == 0)
+        huffmanTree = new HuffmanEncodingTree;
+    huffmanTree->GenerateFromFrequencyTable(frequencyTable);
+}
+
+const unsigned int *MessageCompressor::GetDictionary(void) const
+{
+    return huffmanTree ? frequencyTable : 0;
+}
+
+bool MessageCompressor::HasDictionary(void) const
+{
+    return huffmanTree != 0;
+}
+
+void MessageCompressor::WriteDictionary(RakNet::BitStream *output) const
+{
+    for (unsigned int i = 0; i < 256; i++)
+        output->WriteCompressed(frequencyTable[i]);
+}
+
+bool MessageCompressor::ReadDictionary(RakNet::BitStream *input)
+{
+    unsigned int table[256];
+    for (unsigned int &frequency : table)
+    {
+        if (!input->ReadCompressed(frequency))
+            return false;
+    }
+    SetDictionary(table);
+    return true;
+}
+
+bool MessageCompressor::SaveDictionary(const char *filename) const
+{
+    RakNet::BitStream bitStream;
+    WriteDictionary(&bitStream);
+    FILE *fp = fopen(filename, "wb");
+    if (fp == 0)
+        return false;
+    size_t written = fwrite(bitStream.GetData(), 1, (size_t) bitStream.GetNumberOfBytesUsed(), fp);
+    fclose(fp);
+    return written == (size_t) bitStream.GetNumberOfBytesUsed();
+}
+
+bool MessageCompressor::LoadDictionary(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == 0)
+        return false;
+    // Each frequency is at most 5 bytes
+    unsigned char data[256 * 5];
+    size_t length = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
+    RakNet::BitStream bitStream(data, (unsigned int) length, false);
+    return ReadDictionary(&bitStream);
+}
+
+bool MessageCompressor::Compress(MessageCompressionCodec codec, const unsigned char *input, unsigned int length,
+                                 RakNet::BitStream *output) const
+{
+    output->AlignWriteToByteBoundary();
+    BitSize_t start = output->GetNumberOfBitsUsed();
+    switch (codec)
+    {
+        case MC_HUFFMAN:
+            if (huffmanTree == 0)
+                return false;
+            huffmanTree->EncodeArray((unsigned char *) input, length, output);
+            break;
+#if CRABNET_SUPPORT_BZIP2==1
+        case MC_BZIP2:
+        {
+            if (length < BZIP2_MIN_MESSAGE_SIZE)
+                return false;
+            // Only room for less than the input, so bzip2 gives up as soon as it can't make it smaller
+            unsigned int compressedLength = length - 1;
+            output->AddBitsAndReallocate(BYTES_TO_BITS(compressedLength));
+            if (BZ2_bzBuffToBuffCompress((char *) output->GetData() + BITS_TO_BYTES(start), &compressedLength,
+                                         (char *) input, length, BZIP2_BLOCK_SIZE_100K, 0, 0) != BZ_OK)
+                return false;
+            output->SetWriteOffset(start + BYTES_TO_BITS(compressedLength));
+            break;
+        }
+#endif
+        default:
+            return false;
+    }
+    return output->GetNumberOfBitsUsed() - start < BYTES_TO_BITS(length);
+}
+
+bool MessageCompressor::Decompress(MessageCompressionCodec codec, const unsigned char *input, unsigned int inputLength,
+                                   unsigned char *output, unsigned int length) const
+{
+    switch (codec)
+    {
+        case MC_HUFFMAN:
+        {
+            // No code is shorter than a bit
+            if (huffmanTree == 0 || length > BYTES_TO_BITS(inputLength))
+                return false;
+            RakNet::BitStream bitStream((unsigned char *) input, inputLength, false);
+            return huffmanTree->DecodeArray(&bitStream, BYTES_TO_BITS(inputLength), length, output) == length;
+        }
+#if CRABNET_SUPPORT_BZIP2==1
+        case MC_BZIP2:
+        {
+            unsigned int decompressedLength = length;
+            return BZ2_bzBuffToBuffDecompress((char *) output, &decompressedLength, (char *) input, inputLength, 0, 0) == BZ_OK &&
+                   decompressedLength == length;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+bool MessageCompressor::IsCodecAvailable(MessageCompressionCodec codec)
+{
+#if CRABNET_SUPPORT_BZIP2==1
+    return codec < MC_CODEC_COUNT;
+#else
+    return codec < MC_CODEC_COUNT && codec != MC_BZIP2;
+#endif
+}
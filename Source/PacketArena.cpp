@@ -0,0 +1,283 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "PacketArena.h"
+#include "RakAssert.h"
+#include "RakNetDefines.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+using namespace RakNet;
+
+namespace
+{
+    // Largest data each size class holds. Datagrams fit in the fourth class, so only reassembled split messages are larger
+    const unsigned int SIZE_CLASS_COUNT = 5;
+    const unsigned int sizeClassCapacity[SIZE_CLASS_COUNT] = {64, 256, 1024, 2048, 8192};
+    // Blocks larger than every size class
+    const unsigned int UNCACHED_SIZE_CLASS = SIZE_CLASS_COUNT;
+
+    struct ThreadCache;
+
+    struct BlockHeader
+    {
+        // 0 if the block is not kept for reuse
+        ThreadCache *owner;
+        BlockHeader *next;
+        unsigned int sizeClass;
+    };
+
+    // Rounded up so the Packet after the header is as aligned as memory from malloc
+    const size_t BLOCK_HEADER_SIZE = (sizeof(BlockHeader) + 15) & ~(size_t) 15;
+
+    struct ThreadCache
+    {
+        BlockHeader *freeList[SIZE_CLASS_COUNT];
+        unsigned int freeListSize[SIZE_CLASS_COUNT];
+
+        // Blocks freed on other threads, pushed from any thread and taken all at once by the owning thread
+        std::atomic<BlockHeader*> remoteFreeList;
+        // Set when the owning thread exits. Blocks freed after that go back to the system
+        std::atomic<bool> orphaned;
+        // One for each block allocated and not yet returned to the system, plus one while the owning thread runs
+        std::atomic<unsigned int> refCount;
+    };
+
+    struct ThreadCacheOwner
+    {
+        ThreadCache *cache;
+        bool destroyed;
+
+        ~ThreadCacheOwner();
+    };
+
+    thread_local ThreadCacheOwner threadCacheOwner = {0, false};
+
+    inline BlockHeader *GetBlock(Packet *packet)
+    {
+        return (BlockHeader *) ((unsigned char *) packet - BLOCK_HEADER_SIZE);
+    }
+
+    inline Packet *GetBlockPacket(BlockHeader *block)
+    {
+        return (Packet *) ((unsigned char *) block + BLOCK_HEADER_SIZE);
+    }
+
+    inline unsigned char *GetBlockData(BlockHeader *block)
+    {
+        return (unsigned char *) (GetBlockPacket(block) + 1);
+    }
+
+    unsigned int GetSizeClass(unsigned int dataSize)
+    {
+        for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++)
+        {
+            if (dataSize <= sizeClassCapacity[i])
+                return i;
+        }
+        return UNCACHED_SIZE_CLASS;
+    }
+
+    unsigned int GetMaxFreeListSize(unsigned int sizeClass)
+    {
+        unsigned int maxSize = PACKET_ARENA_MAX_CACHED_BYTES / sizeClassCapacity[sizeClass];
+        return maxSize < 4 ? 4 : maxSize;
+    }
+
+    void ReleaseCache(ThreadCache *cache)
+    {
+        if (cache->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete cache;
+    }
+
+    // Returns a block to the system. The cache it came from may be deleted by this
+    void FreeBlock(BlockHeader *block)
+    {
+        ThreadCache *owner = block->owner;
+        free(block);
+        if (owner)
+            ReleaseCache(owner);
+    }
+
+    void FreeBlockList(BlockHeader *block)
+    {
+        while (block)
+        {
+            BlockHeader *next = block->next;
+            FreeBlock(block);
+            block = next;
+        }
+    }
+
+    ThreadCache *GetThreadCache(void)
+    {
+        if (threadCacheOwner.cache == 0 && !threadCacheOwner.destroyed)
+        {
+            ThreadCache *cache = new ThreadCache;
+            for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++)
+            {
+                cache->freeList[i] = 0;
+                cache->freeListSize[i] = 0;
+            }
+            cache->remoteFreeList.store(0, std::memory_order_relaxed);
+            cache->orphaned.store(false, std::memory_order_relaxed);
+            cache->refCount.store(1, std::memory_order_relaxed);
+            threadCacheOwner.cache = cache;
+        }
+        return threadCacheOwner.cache;
+    }
+
+    // Puts a block freed by or handed back to the owning thread on its free list, or returns it to the system if the list is full
+    void PushLocal(ThreadCache *cache, BlockHeader *block)
+    {
+        unsigned int sizeClass = block->sizeClass;
+        if (cache->freeListSize[sizeClass] >= GetMaxFreeListSize(sizeClass))
+        {
+            FreeBlock(block);
+            return;
+        }
+        block->next = cache->freeList[sizeClass];
+        cache->freeList[sizeClass] = block;
+        cache->freeListSize[sizeClass]++;
+    }
+
+    ThreadCacheOwner::~ThreadCacheOwner()
+    {
+        destroyed = true;
+        if (cache == 0)
+            return;
+
+        // After this, threads freeing our blocks return them to the system themselves.
+        // Anything they pushed before seeing the flag is taken below
+        cache->orphaned.store(true);
+        for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++)
+        {
+            FreeBlockList(cache->freeList[i]);
+            cache->freeList[i] = 0;
+        }
+        FreeBlockList(cache->remoteFreeList.exchange(0));
+
+        ThreadCache *released = cache;
+        cache = 0;
+        ReleaseCache(released);
+    }
+
+    BlockHeader *AllocateBlock(unsigned int dataSize)
+    {
+        unsigned int sizeClass = GetSizeClass(dataSize);
+        ThreadCache *cache = sizeClass == UNCACHED_SIZE_CLASS ? 0 : GetThreadCache();
+        if (cache)
+        {
+            if (cache->freeList[sizeClass] == 0 && cache->remoteFreeList.load(std::memory_order_relaxed) != 0)
+            {
+                // Take back what other threads freed since the last time
+                BlockHeader *block = cache->remoteFreeList.exchange(0, std::memory_order_acquire);
+                while (block)
+                {
+                    BlockHeader *next = block->next;
+                    PushLocal(cache, block);
+                    block = next;
+                }
+            }
+
+            BlockHeader *block = cache->freeList[sizeClass];
+            if (block)
+            {
+                cache->freeList[sizeClass] = block->next;
+                cache->freeListSize[sizeClass]--;
+                return block;
+            }
+        }
+
+        size_t capacity = sizeClass == UNCACHED_SIZE_CLASS ? dataSize : sizeClassCapacity[sizeClass];
+        BlockHeader *block = (BlockHeader *) malloc(BLOCK_HEADER_SIZE + sizeof(Packet) + capacity);
+        if (block == 0)
+            return 0;
+        block->owner = cache;
+        block->next = 0;
+        block->sizeClass = sizeClass;
+        if (cache)
+            cache->refCount.fetch_add(1, std::memory_order_relaxed);
+        return block;
+    }
+
+    void ReleaseBlock(BlockHeader *block)
+    {
+        ThreadCache *owner = block->owner;
+        if (owner == 0)
+        {
+            free(block);
+            return;
+        }
+
+        if (owner == threadCacheOwner.cache)
+        {
+            PushLocal(owner, block);
+            return;
+        }
+
+        // Once pushed, the block may be freed by the owner as it exits, so hold the cache until done with it
+        owner->refCount.fetch_add(1, std::memory_order_relaxed);
+        BlockHeader *head = owner->remoteFreeList.load(std::memory_order_relaxed);
+        do
+        {
+            block->next = head;
+        } while (!owner->remoteFreeList.compare_exchange_weak(head, block));
+
+        // If the owner exited before it could see our push, take the list back and free it ourselves
+        if (owner->orphaned.load())
+            FreeBlockList(owner->remoteFreeList.exchange(0));
+        ReleaseCache(owner);
+    }
+}
+
+Packet *PacketArena::Allocate(unsigned int dataSize)
+{
+    unsigned char *data = AllocateData(dataSize);
+    if (data == 0)
+        return 0;
+    return GetPacket(data, dataSize);
+}
+
+unsigned char *PacketArena::AllocateData(unsigned int dataSize)
+{
+    BlockHeader *block = AllocateBlock(dataSize);
+    if (block == 0)
+        return 0;
+    return GetBlockData(block);
+}
+
+Packet *PacketArena::GetPacket(unsigned char *data, unsigned int dataSize)
+{
+    Packet *packet = new((void *) ((Packet *) data - 1)) Packet;
+    RakAssert(dataSize <= (GetBlock(packet)->sizeClass == UNCACHED_SIZE_CLASS ? dataSize : sizeClassCapacity[GetBlock(packet)->sizeClass]));
+    packet->data = data;
+    packet->length = dataSize;
+    packet->bitSize = BYTES_TO_BITS(dataSize);
+    packet->deleteData = true;
+    return packet;
+}
+
+void PacketArena::Free(Packet *packet)
+{
+    if (packet == 0)
+        return;
+    packet->~Packet();
+    ReleaseBlock(GetBlock(packet));
+}
+
+void PacketArena::FreeData(unsigned char *data)
+{
+    if (data == 0)
+        return;
+    ReleaseBlock(GetBlock((Packet *) data - 1));
+}
@@ -14,6 +14,7 @@
 #include "PacketizedTCP.h"
 #include "RakPeerInterface.h"
 #include "BitStream.h"
+#include "PacketArena.h"
 
 using namespace RakNet;
 
@@ -109,13 +110,12 @@ Packet *PluginInterface2::AllocatePacketUnified(unsigned dataSize)
     }
 #endif
 
-    Packet *packet =new Packet;
-    packet->data = (unsigned char*) malloc(dataSize);
-    packet->bitSize=BYTES_TO_BITS(dataSize);
-    packet->deleteData=true;
+    // From the same allocator as RakPeer, so the packet can still be pushed to a RakPeerInterface attached later
+    Packet *packet = PacketArena::Allocate(dataSize);
     packet->guid=UNASSIGNED_CRABNET_GUID;
     packet->systemAddress=UNASSIGNED_SYSTEM_ADDRESS;
     packet->wasGeneratedLocally=false;
+    packet->timeRead=0;
     return packet;
 }
 void PluginInterface2::PushBackPacketUnified(Packet *packet, bool pushAtHead)
@@ -151,8 +151,7 @@ void PluginInterface2::DeallocPacketUnified(Packet *packet)
     }
 #endif
 
-    free(packet->data);
-    delete packet;
+    PacketArena::Free(packet);
 }
 bool PluginInterface2::SendListUnified( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast )
 {
@@ -108,6 +108,8 @@ FileListTransfer::~FileListTransfer()
 {
     threadPool.StopThreads();
     Clear();
+    for (unsigned int i=0; i < chunkBufferPool.Size(); i++)
+        free(chunkBufferPool[i].data);
 }
 void FileListTransfer::StartIncrementalReadThreads(int numThreads, int threadPriority)
 {
@@ -945,8 +947,8 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
 
     // Was previously using GetStatistics to get outgoing buffer size, but TCP with UnifiedSend doesn't have this
     unsigned int bytesRead;
-    const char *dataBlocks[2];
-    int lengths[2];
+    const char *chunk;
+    void *partContext;
     unsigned int smallFileTotalSize=0;
     RakNet::BitStream outBitstream;
     unsigned int ftpIndex;
@@ -968,7 +970,8 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
             ////ftpr->filesToPushMutex.Unlock();
 
             // Read and send chunk. If done, delete at this index
-            void *buff = malloc(ftp->chunkSize);
+            unsigned int buffSize = ftp->chunkSize;
+            char *buff = fileListTransfer->AllocateChunkBuffer(buffSize);
             if (buff==0)
             {
                 ////ftpr->filesToPushMutex.Lock();
@@ -981,7 +984,7 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
             }
 
             // Read the next file chunk
-            bytesRead=ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, buff, ftp->fileListNode.context);
+            bytesRead=fileListTransfer->ReadFilePart(ftp, buff, buffSize, &chunk, &partContext);
 
             bool done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
             while (done && ftp->currentOffset==0 && smallFileTotalSize<ftp->chunkSize)
@@ -1005,12 +1008,8 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
                 outBitstream.WriteCompressed(ftp->setIndex);
                 outBitstream.WriteCompressed(ftp->fileListNode.dataLengthBytes); // Original length in bytes
                 outBitstream.AlignWriteToByteBoundary();
-                dataBlocks[0]=(char*) outBitstream.GetData();
-                lengths[0]=outBitstream.GetNumberOfBytesUsed();
-                dataBlocks[1]=(const char*) buff;
-                lengths[1]=bytesRead;
 
-                fileListTransfer->SendListUnified(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, systemAddress, false);
+                fileListTransfer->SendFilePart(&outBitstream, chunk, bytesRead, ftp->incrementalReadInterface, partContext, ftp->packetPriority, ftp->orderingChannel, systemAddress);
 
                 // LWS : fixed freed pointer reference
 //                unsigned int chunkSize = ftp->chunkSize;
@@ -1021,7 +1020,7 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
                 ftp = ftpr->filesToPush.Pop();
                 ////ftpr->filesToPushMutex.Unlock();
 
-                bytesRead=ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, buff, ftp->fileListNode.context);
+                bytesRead=fileListTransfer->ReadFilePart(ftp, buff, buffSize, &chunk, &partContext);
                 done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
             }
 
@@ -1042,13 +1041,10 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
             for (unsigned int flpcIndex=0; flpcIndex < fileListTransfer->fileListProgressCallbacks.Size(); flpcIndex++)
                 fileListTransfer->fileListProgressCallbacks[flpcIndex]->OnFilePush(ftp->fileListNode.filename, ftp->fileListNode.fileLengthBytes, ftp->currentOffset-bytesRead, bytesRead, done, systemAddress, setId);
 
-            dataBlocks[0]=(char*) outBitstream.GetData();
-            lengths[0]=outBitstream.GetNumberOfBytesUsed();
-            dataBlocks[1]=(char*) buff;
-            lengths[1]=bytesRead;
             //rakPeerInterface->SendList(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, ftp->systemAddress, false);
             char orderingChannel = ftp->orderingChannel;
             PacketPriority packetPriority = ftp->packetPriority;
+            IncrementalReadInterface *incrementalReadInterface = ftp->incrementalReadInterface;
 
             // Mutex state: FileToPushRecipient (ftpr) has AddRef. fileToPushRecipientListMutex not locked.
             if (done)
@@ -1084,9 +1080,9 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
 
             // 2/12/2012 Moved this line at after the if (done) block above.
             // See http://www.jenkinssoftware.com/forum/index.php?topic=4768.msg19738#msg19738
-            fileListTransfer->SendListUnified(dataBlocks,lengths,2, packetPriority, RELIABLE_ORDERED, orderingChannel, systemAddress, false);
+            fileListTransfer->SendFilePart(&outBitstream, chunk, bytesRead, incrementalReadInterface, partContext, packetPriority, orderingChannel, systemAddress);
 
-            free(buff);
+            fileListTransfer->DeallocateChunkBuffer(buff, buffSize);
             return 0;
         }
         else
@@ -1101,6 +1097,89 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
     return 0;
 }
 }
+char *FileListTransfer::AllocateChunkBuffer(unsigned int size)
+{
+    chunkBufferPoolMutex.Lock();
+    for (unsigned int i=0; i < chunkBufferPool.Size(); i++)
+    {
+        if (chunkBufferPool[i].size==size)
+        {
+            char *data = chunkBufferPool[i].data;
+            chunkBufferPool.RemoveAtIndexFast(i);
+            chunkBufferPoolMutex.Unlock();
+            return data;
+        }
+    }
+    chunkBufferPoolMutex.Unlock();
+    return (char*) malloc(size);
+}
+void FileListTransfer::DeallocateChunkBuffer(char *data, unsigned int size)
+{
+    // One buffer is in use per thread sending, so more than this were for another chunk size
+    static const unsigned int MAX_POOLED_CHUNK_BUFFERS=16;
+
+    chunkBufferPoolMutex.Lock();
+    if (chunkBufferPool.Size() >= MAX_POOLED_CHUNK_BUFFERS)
+    {
+        free(chunkBufferPool[0].data);
+        chunkBufferPool.RemoveAtIndexFast(0);
+    }
+    ChunkBuffer chunkBuffer;
+    chunkBuffer.data=data;
+    chunkBuffer.size=size;
+    chunkBufferPool.Push(chunkBuffer);
+    chunkBufferPoolMutex.Unlock();
+}
+unsigned int FileListTransfer::ReadFilePart(FileToPush *ftp, char *buffer, unsigned int bufferSize, const char **data, void **partContext)
+{
+    unsigned int bytesRead;
+    if (ftp->incrementalReadInterface->GetFilePartReference(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, data, &bytesRead, partContext, ftp->fileListNode.context))
+        return bytesRead;
+
+    *data=buffer;
+    *partContext=0;
+    return ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize < bufferSize ? ftp->chunkSize : bufferSize, buffer, ftp->fileListNode.context);
+}
+struct FilePartSend
+{
+    RakNet::BitStream header;
+    IncrementalReadInterface *incrementalReadInterface;
+    void *partContext;
+};
+static void ReleaseFilePartCB(void *context)
+{
+    FilePartSend *filePartSend = (FilePartSend*) context;
+    filePartSend->incrementalReadInterface->ReleaseFilePart(filePartSend->partContext);
+    delete filePartSend;
+}
+void FileListTransfer::SendFilePart(RakNet::BitStream *header, const char *data, unsigned int length, IncrementalReadInterface *incrementalReadInterface, void *partContext, PacketPriority priority, char orderingChannel, SystemAddress systemAddress)
+{
+    if (partContext && rakPeerInterface)
+    {
+        // The header is reused for the next chunk, so only it is copied. The chunk is released once every system has it
+        FilePartSend *filePartSend = new FilePartSend;
+        filePartSend->header.WriteAlignedBytes(header->GetData(), header->GetNumberOfBytesUsed());
+        filePartSend->incrementalReadInterface=incrementalReadInterface;
+        filePartSend->partContext=partContext;
+        SendBuffer buffers[2];
+        buffers[0].data=(const char*) filePartSend->header.GetData();
+        buffers[0].length=filePartSend->header.GetNumberOfBytesUsed();
+        buffers[1].data=data;
+        buffers[1].length=length;
+        rakPeerInterface->SendGather(buffers, 2, priority, RELIABLE_ORDERED, orderingChannel, systemAddress, false, ReleaseFilePartCB, filePartSend);
+        return;
+    }
+
+    const char *dataBlocks[2];
+    int lengths[2];
+    dataBlocks[0]=(const char*) header->GetData();
+    lengths[0]=header->GetNumberOfBytesUsed();
+    dataBlocks[1]=data;
+    lengths[1]=length;
+    SendListUnified(dataBlocks,lengths,2, priority, RELIABLE_ORDERED, orderingChannel, systemAddress, false);
+    if (partContext)
+        incrementalReadInterface->ReleaseFilePart(partContext);
+}
 void FileListTransfer::SendIRIToAddress(SystemAddress systemAddress, unsigned short setId)
 {
     ThreadData threadData;
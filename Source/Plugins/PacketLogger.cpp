@@ -20,6 +20,7 @@
 #include "MessageIdentifiers.h"
 #include "StringCompressor.h"
 #include "GetTime.h"
+#include "MessageCompressor.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -43,6 +44,7 @@ PacketLogger::PacketLogger()
     prefix[0]=0;
     suffix[0]=0;
     logDirectMessages=true;
+    compressionTrainer=0;
 }
 PacketLogger::~PacketLogger()
 {
@@ -209,6 +211,15 @@ void PacketLogger::OnInternalPacket(InternalPacket *internalPacket, unsigned fra
         "Err6",
     };
     const char *sendType = sendTypes[isSend];
+
+    if (compressionTrainer && internalPacket->compressionCodec==MC_NONE)
+    {
+        // Called from several threads when RakPeer updates connections on more than one
+        compressionTrainerMutex.Lock();
+        compressionTrainer->Train(internalPacket->data, (unsigned int) BITS_TO_BYTES(internalPacket->dataBitLength));
+        compressionTrainerMutex.Unlock();
+    }
+
     SystemAddress localSystemAddress = rakPeerInterface->GetExternalID(remoteSystemAddress);
 
     unsigned int reliableMessageNumber;
@@ -398,11 +409,11 @@ const char* PacketLogger::BaseIDTOString(unsigned char Id)
         "ID_NAT_REQUEST_BOUND_ADDRESSES",
         "ID_NAT_RESPOND_BOUND_ADDRESSES",
         "ID_FCM2_UPDATE_USER_CONTEXT",
-        "ID_RESERVED_3",
-        "ID_RESERVED_4",
-        "ID_RESERVED_5",
-        "ID_RESERVED_6",
-        "ID_RESERVED_7",
+        "ID_SESSION_TOKEN",
+        "ID_SESSION_RESUME_REQUEST",
+        "ID_SESSION_RESUMED",
+        "ID_REPLICA_MANAGER_SNAPSHOT",
+        "ID_REPLICA_MANAGER_SNAPSHOT_RESET",
         "ID_RESERVED_8",
         "ID_RESERVED_9",
         "ID_USER_PACKET_ENUM"
@@ -473,6 +484,10 @@ void PacketLogger::SetLogDirectMessages(bool send)
 {
     logDirectMessages=send;
 }
+void PacketLogger::SetCompressionTrainer(MessageCompressor *trainer)
+{
+    compressionTrainer=trainer;
+}
 
 #ifdef _MSC_VER
 #pragma warning( pop )
@@ -17,6 +17,8 @@
 #include "MessageIdentifiers.h"
 #include "RakPeerInterface.h"
 #include "NetworkIDManager.h"
+#include <math.h>
+#include <algorithm>
 
 using namespace RakNet;
 
@@ -56,16 +58,33 @@ int Connection_RM3::Replica3LSRComp( Replica3 * const &replica3, LastSerializati
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+int Connection_RM3::SnapshotReceiptComp( const uint32_t &sendReceipt, const RM3SnapshotReceipt &data )
+{
+    if (sendReceipt < data.sendReceipt)
+        return -1;
+    if (sendReceipt > data.sendReceipt)
+        return 1;
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
 LastSerializationResult::LastSerializationResult()
 {
     replica=0;
     lastSerializationResultBS=0;
+    snapshotHistory=0;
     whenLastSerialized = RakNet::GetTime();
+    accumulatedPriority = 0.0f;
+    sentViewClassState=false;
+    viewClass=0;
 }
 LastSerializationResult::~LastSerializationResult()
 {
     if (lastSerializationResultBS)
         delete lastSerializationResultBS;
+    if (snapshotHistory)
+        delete snapshotHistory;
 }
 void LastSerializationResult::AllocBS(void)
 {
@@ -74,6 +93,13 @@ void LastSerializationResult::AllocBS(void)
         lastSerializationResultBS=new LastSerializationResultBS;
     }
 }
+void LastSerializationResult::AllocSnapshotHistory(void)
+{
+    if (snapshotHistory==0)
+    {
+        snapshotHistory=new RM3SnapshotHistory;
+    }
+}
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
 ReplicaManager3::ReplicaManager3()
@@ -88,6 +114,13 @@ ReplicaManager3::ReplicaManager3()
     autoCreateConnections = true;
     autoDestroyConnections = true;
     currentlyDeallocatingReplica = nullptr;
+    serializeOncePerViewClass = false;
+    serializeTick = 0;
+    interestCellSize = 0.0f;
+    snapshotReplication = false;
+    numberOfUpdateThreads = 1;
+    updateJobsRemaining = 0;
+    updateJobsDoneEvent.InitEvent();
 
     for (auto &world : worldsArray)
         world = nullptr;
@@ -107,6 +140,8 @@ ReplicaManager3::~ReplicaManager3()
         }
     }
     Clear(true);
+    updateThreadPool.StopThreads();
+    updateJobsDoneEvent.CloseEvent();
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -349,6 +384,19 @@ void ReplicaManager3::Dereference(RakNet::Replica3 *replica3, WorldId worldId)
         if (world->userReplicaList[index]==replica3)
         {
             world->userReplicaList.RemoveAtIndex(index);
+            if (replica3->interestCell)
+            {
+                replica3->interestCell->replicas.RemoveAtIndexFast(replica3->interestCell->replicas.GetIndexOf(replica3));
+                replica3->interestCell=0;
+            }
+            for (index2=0; index2 < world->interestMoves.Size(); index2++)
+            {
+                if (world->interestMoves[index2].replica==replica3)
+                {
+                    world->interestMoves.RemoveAtIndexFast(index2);
+                    break;
+                }
+            }
             break;
         }
     }
@@ -510,6 +558,96 @@ void ReplicaManager3::SetAutoSerializeInterval(RakNet::Time intervalMS)
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+void ReplicaManager3::SetSerializeOncePerViewClass(bool enabled)
+{
+    serializeOncePerViewClass=enabled;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+bool ReplicaManager3::GetSerializeOncePerViewClass(void) const
+{
+    return serializeOncePerViewClass;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::SetInterestManagement(float cellSize)
+{
+    interestCellSize=cellSize;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+float ReplicaManager3::GetInterestCellSize(void) const
+{
+    return interestCellSize;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::SetNumberOfUpdateThreads(int numThreads)
+{
+    if (numThreads < 1)
+        numThreads=1;
+    if (numThreads==numberOfUpdateThreads)
+        return;
+    updateThreadPool.StopThreads();
+    numberOfUpdateThreads=numThreads;
+    if (numberOfUpdateThreads > 1 && updateThreadPool.StartThreads(numberOfUpdateThreads-1, 0)==false)
+        numberOfUpdateThreads=1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int ReplicaManager3::GetNumberOfUpdateThreads(void) const
+{
+    return numberOfUpdateThreads;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::SetSnapshotReplication(bool enabled)
+{
+    snapshotReplication=enabled;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+bool ReplicaManager3::GetSnapshotReplication(void) const
+{
+    return snapshotReplication;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::UpdateInterestGrid(RM3World *world)
+{
+    for (unsigned int index=0; index < world->userReplicaList.Size(); index++)
+    {
+        Replica3 *replica = world->userReplicaList[index];
+        RM3InterestCell *cell;
+        if (replica->QueryInterestPosition(&replica->interestX, &replica->interestY))
+            cell=world->GetInterestCell((int) floorf(replica->interestX/interestCellSize), (int) floorf(replica->interestY/interestCellSize), true);
+        else
+            cell=&world->interestEverywhere;
+        if (cell==replica->interestCell)
+            continue;
+
+        if (replica->interestCell)
+            replica->interestCell->replicas.RemoveAtIndexFast(replica->interestCell->replicas.GetIndexOf(replica));
+        cell->replicas.Push(replica);
+        RM3InterestMove move;
+        move.replica=replica;
+        move.from=replica->interestCell;
+        move.to=cell;
+        world->interestMoves.Push(move);
+        replica->interestCell=cell;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
 void ReplicaManager3::GetConnectionsThatHaveReplicaConstructed(Replica3 *replica, DataStructures::List<Connection_RM3*> &connectionsThatHaveConstructedThisReplica, WorldId worldId)
 {
     RakAssert(worldsArray[worldId]!=0 && "World not in use");
@@ -563,6 +701,67 @@ ReplicaManager3::RM3World::RM3World()
 {
     worldId = 0;
     networkIDManager = nullptr;
+    interestEverywhere.x = 0;
+    interestEverywhere.y = 0;
+    interestEverywhere.everywhere = true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+ReplicaManager3::RM3World::~RM3World()
+{
+    ClearInterest();
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::RM3World::ClearInterest(void)
+{
+    for (unsigned int i=0; i < userReplicaList.Size(); i++)
+        userReplicaList[i]->interestCell=0;
+    for (unsigned int i=0; i < interestGrid.Size(); i++)
+        delete interestGrid[i];
+    interestGrid.Clear(false);
+    interestEverywhere.replicas.Clear(false);
+    interestMoves.Clear(false);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+static uint64_t InterestCellKey(int x, int y)
+{
+    return ((uint64_t) (uint32_t) x << 32) | (uint32_t) y;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+int ReplicaManager3::RM3World::InterestCellComp( const uint64_t &key, RM3InterestCell * const &data )
+{
+    uint64_t dataKey = InterestCellKey(data->x, data->y);
+    if (key < dataKey)
+        return -1;
+    if (key > dataKey)
+        return 1;
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3InterestCell *ReplicaManager3::RM3World::GetInterestCell(int x, int y, bool create)
+{
+    uint64_t key = InterestCellKey(x, y);
+    bool objectExists;
+    unsigned int index = interestGrid.GetIndexFromKey(key, &objectExists);
+    if (objectExists)
+        return interestGrid[index];
+    if (create==false)
+        return 0;
+    RM3InterestCell *cell = new RM3InterestCell;
+    cell->x=x;
+    cell->y=y;
+    cell->everywhere=false;
+    interestGrid.InsertAtIndex(cell, index);
+    return cell;
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -581,6 +780,7 @@ void ReplicaManager3::RM3World::Clear(ReplicaManager3 *replicaManager3)
             connectionList[i]->ClearDownloadGroup(replicaManager3->GetRakPeerInterface());
     }
 
+    ClearInterest();
     for (unsigned int i=0; i < userReplicaList.Size(); i++)
     {
         userReplicaList[i]->replicaManager=0;
@@ -654,6 +854,9 @@ PluginReceiveResult ReplicaManager3::OnReceive(Packet *packet)
     if (packet->length<2)
         return RR_CONTINUE_PROCESSING;
 
+    if (packet->data[0]==ID_SND_RECEIPT_ACKED || packet->data[0]==ID_SND_RECEIPT_LOSS)
+        return OnSnapshotReceipt(packet);
+
     WorldId incomingWorldId;
 
     RakNet::Time timestamp=0;
@@ -692,6 +895,10 @@ PluginReceiveResult ReplicaManager3::OnReceive(Packet *packet)
         return OnConstruction(packet, packet->data, packet->length, packet->guid, packetDataOffset, incomingWorldId);
     case ID_REPLICA_MANAGER_SERIALIZE:
         return OnSerialize(packet, packet->data, packet->length, packet->guid, timestamp, packetDataOffset, incomingWorldId);
+    case ID_REPLICA_MANAGER_SNAPSHOT:
+        return OnSnapshot(packet, packet->data, packet->length, packet->guid, timestamp, packetDataOffset, incomingWorldId);
+    case ID_REPLICA_MANAGER_SNAPSHOT_RESET:
+        return OnSnapshotReset(packet, packet->data, packet->length, packet->guid, packetDataOffset, incomingWorldId);
     case ID_REPLICA_MANAGER_DOWNLOAD_STARTED:
         if (packet->wasGeneratedLocally==false)
         {
@@ -856,6 +1063,7 @@ void Connection_RM3::AutoConstructByQuery(ReplicaManager3 *replicaManager3, Worl
             idx1=constructedReplicaList.GetIndexFromKey(destroyedReplicasCulled[idx2], &objectExists);
             if (objectExists)
             {
+                lsr=constructedReplicaList[idx1];
                 constructedReplicaList.RemoveAtIndex(idx1);
 
                 unsigned int j;
@@ -867,6 +1075,7 @@ void Connection_RM3::AutoConstructByQuery(ReplicaManager3 *replicaManager3, Worl
                         break;
                     }
                 }
+                delete lsr;
             }
         }
     }
@@ -875,17 +1084,36 @@ void Connection_RM3::AutoConstructByQuery(ReplicaManager3 *replicaManager3, Worl
 }
 void ReplicaManager3::Update(void)
 {
-    unsigned int index,index2,index3;
+    unsigned int index,index3;
 
     WorldId worldId;
     RM3World *world;
     RakNet::Time time = RakNet::GetTime();
 
+    if (numberOfUpdateThreads > 1)
+    {
+        UpdateOnThreads(time);
+        return;
+    }
+
     for (index3=0; index3 < worldsList.Size(); index3++)
     {
         world = worldsList[index3];
         worldId = world->worldId;
 
+        if (interestCellSize > 0.0f && time - lastAutoSerializeOccurance >= autoSerializeInterval)
+        {
+            UpdateInterestGrid(world);
+            for (index=0; index < world->connectionList.Size(); index++)
+            {
+                if (world->connectionList[index]->isValidated==false ||
+                    world->connectionList[index]->QueryConstructionMode()!=Connection_RM3::QUERY_CONNECTION_FOR_REPLICA_LIST)
+                    continue;
+                world->connectionList[index]->UpdateInterest(world, interestCellSize);
+            }
+            world->interestMoves.Clear(true);
+        }
+
         for (index=0; index < world->connectionList.Size(); index++)
         {
             if (world->connectionList[index]->isValidated==false)
@@ -896,6 +1124,7 @@ void ReplicaManager3::Update(void)
 
     if (time - lastAutoSerializeOccurance >= autoSerializeInterval)
     {
+        serializeTick++;
         for (index3=0; index3 < worldsList.Size(); index3++)
         {
             world = worldsList[index3];
@@ -907,78 +1136,227 @@ void ReplicaManager3::Update(void)
                 world->userReplicaList[index]->OnUserReplicaPreSerializeTick();
             }
 
-            unsigned int index;
             SerializeParameters sp;
             sp.curTime=time;
-            Connection_RM3 *connection;
-            SendSerializeIfChangedResult ssicr;
-            LastSerializationResult *lsr;
-
             sp.messageTimestamp=0;
             for (int i=0; i < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; i++)
                 sp.pro[i]=defaultSendParameters;
-            index2=0;
             for (index=0; index < world->connectionList.Size(); index++)
+                SerializeToConnection(world->connectionList[index], &sp, worldId, time);
+        }
+
+        lastAutoSerializeOccurance=time;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::SerializeToConnection(Connection_RM3 *connection, SerializeParameters *sp, WorldId worldId, RakNet::Time time)
+{
+    unsigned int index2=0;
+    SendSerializeIfChangedResult ssicr;
+    LastSerializationResult *lsr;
+
+    sp->bitsWrittenSoFar=0;
+    sp->destinationConnection=connection;
+
+    DataStructures::List<Replica3*> replicasToSerialize;
+    replicasToSerialize.Clear(true);
+    if (connection->QuerySerializationList(replicasToSerialize))
+    {
+        // User is manually specifying list of replicas to serialize
+        // lsr is per connection / per replica, so is looked up in this connection rather than stored in the replica
+        while (index2 < replicasToSerialize.Size())
+        {
+            bool objectExists;
+            unsigned int lsrIndex = connection->constructedReplicaList.GetIndexFromKey(replicasToSerialize[index2], &objectExists);
+            index2++;
+            if (objectExists==false)
+                continue;
+            lsr=connection->constructedReplicaList[lsrIndex];
+
+            sp->whenLastSerialized=lsr->whenLastSerialized;
+            ssicr=connection->SendSerializeIfChanged(lsr, sp, GetRakPeerInterface(), worldId, this, time);
+            if (ssicr==SSICR_SENT_DATA)
+                lsr->whenLastSerialized=time;
+        }
+    }
+    else if (connection->QueryBytesPerTickBudget()>0)
+    {
+        connection->SerializeByPriority(sp, this, worldId, time);
+    }
+    else
+    {
+        while (index2 < connection->queryToSerializeReplicaList.Size())
+        {
+            lsr=connection->queryToSerializeReplicaList[index2];
+
+            sp->destinationConnection=connection;
+            sp->whenLastSerialized=lsr->whenLastSerialized;
+            ssicr=connection->SendSerializeIfChanged(lsr, sp, GetRakPeerInterface(), worldId, this, time);
+            if (ssicr==SSICR_SENT_DATA)
             {
-                connection = world->connectionList[index];
-                sp.bitsWrittenSoFar=0;
-                index2=0;
-                sp.destinationConnection=connection;
+                lsr->whenLastSerialized=time;
+                index2++;
+            }
+            else if (ssicr==SSICR_NEVER_SERIALIZE)
+            {
+                // Removed from the middle of the list
+            }
+            else
+                index2++;
+        }
+    }
+}
 
-                DataStructures::List<Replica3*> replicasToSerialize;
-                replicasToSerialize.Clear(true);
-                if (connection->QuerySerializationList(replicasToSerialize))
-                {
-                    // Update replica->lsr so we can lookup in the next block
-                    // lsr is per connection / per replica
-                    while (index2 < connection->queryToSerializeReplicaList.Size())
-                    {
-                        connection->queryToSerializeReplicaList[index2]->replica->lsr=connection->queryToSerializeReplicaList[index2];
-                        index2++;
-                    }
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+void ReplicaManager3::UpdateOnThreads(RakNet::Time time)
+{
+    unsigned int index,index3;
+    RM3World *world;
+    bool autoSerialize = time - lastAutoSerializeOccurance >= autoSerializeInterval;
+    bool updateInterest = interestCellSize > 0.0f && autoSerialize;
+    UpdateJob job;
+    job.replicaManager=this;
+    job.time=time;
+    job.updateInterest=updateInterest;
+
+    // Interest management and construction. The grid is shared by every connection, so it is updated first
+    updateJobs.Clear(true);
+    for (index3=0; index3 < worldsList.Size(); index3++)
+    {
+        world = worldsList[index3];
+        if (updateInterest)
+            UpdateInterestGrid(world);
 
-                    // User is manually specifying list of replicas to serialize
-                    index2=0;
-                    while (index2 < replicasToSerialize.Size())
-                    {
-                        lsr=replicasToSerialize[index2]->lsr;
-                        RakAssert(lsr->replica==replicasToSerialize[index2]);
-
-                        sp.whenLastSerialized=lsr->whenLastSerialized;
-                        ssicr=connection->SendSerializeIfChanged(lsr, &sp, GetRakPeerInterface(), worldId, this, time);
-                        if (ssicr==SSICR_SENT_DATA)
-                            lsr->whenLastSerialized=time;
-                        index2++;
-                    }
-                }
-                else
-                {
-                    while (index2 < connection->queryToSerializeReplicaList.Size())
-                    {
-                        lsr=connection->queryToSerializeReplicaList[index2];
-
-                        sp.destinationConnection=connection;
-                        sp.whenLastSerialized=lsr->whenLastSerialized;
-                        ssicr=connection->SendSerializeIfChanged(lsr, &sp, GetRakPeerInterface(), worldId, this, time);
-                        if (ssicr==SSICR_SENT_DATA)
-                        {
-                            lsr->whenLastSerialized=time;
-                            index2++;
-                        }
-                        else if (ssicr==SSICR_NEVER_SERIALIZE)
-                        {
-                            // Removed from the middle of the list
-                        }
-                        else
-                            index2++;
-                    }
-                }
+        job.world=world;
+        for (index=0; index < world->connectionList.Size(); index++)
+        {
+            if (world->connectionList[index]->isValidated==false)
+                continue;
+            job.connection=world->connectionList[index];
+            updateJobs.Push(job);
+        }
+    }
+    RunUpdateJobs(ConstructOnUpdateThread);
+    if (updateInterest)
+    {
+        for (index3=0; index3 < worldsList.Size(); index3++)
+            worldsList[index3]->interestMoves.Clear(true);
+    }
+
+    if (autoSerialize)
+    {
+        serializeTick++;
+        updateJobs.Clear(true);
+        for (index3=0; index3 < worldsList.Size(); index3++)
+        {
+            world = worldsList[index3];
+            for (index=0; index < world->userReplicaList.Size(); index++)
+            {
+                world->userReplicaList[index]->forceSendUntilNextUpdate=false;
+                world->userReplicaList[index]->OnUserReplicaPreSerializeTick();
+            }
+
+            job.world=world;
+            for (index=0; index < world->connectionList.Size(); index++)
+            {
+                job.connection=world->connectionList[index];
+                updateJobs.Push(job);
             }
         }
+        RunUpdateJobs(SerializeOnUpdateThread);
 
         lastAutoSerializeOccurance=time;
     }
+
+    // Each connection gets its messages in the order they were written
+    for (index3=0; index3 < worldsList.Size(); index3++)
+    {
+        world = worldsList[index3];
+        for (index=0; index < world->connectionList.Size(); index++)
+            world->connectionList[index]->SendDeferredMessages(rakPeerInterface);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void ReplicaManager3::RunUpdateJobs(UpdateJob* (*jobFunction)(UpdateJob*, bool*, void*))
+{
+    if (updateJobs.Size()==0)
+        return;
+
+    updateJobsRemaining=updateJobs.Size();
+    unsigned int index;
+    for (index=0; index < updateJobs.Size(); index++)
+        updateThreadPool.AddInput(jobFunction, &updateJobs[index]);
+
+    // Work on the jobs the pool has not started yet
+    bool returnOutput;
+    while (true)
+    {
+        UpdateJob *job=0;
+        updateThreadPool.LockInput();
+        if (updateThreadPool.InputSize()>0)
+        {
+            job=updateThreadPool.GetInputAtIndex(0);
+            updateThreadPool.RemoveInputAtIndex(0);
+        }
+        updateThreadPool.UnlockInput();
+
+        if (job==0)
+            break;
+        jobFunction(job, &returnOutput, 0);
+    }
+
+    // Then wait for the pool to finish the rest. The job that finishes last sets the event, so this only wakes when it does.
+    // The counter is checked again because the event may still be set from an update in which it reached 0 before the wait
+    while (updateJobsRemaining > 0)
+        updateJobsDoneEvent.WaitOnEvent(1000);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+ReplicaManager3::UpdateJob* ReplicaManager3::ConstructOnUpdateThread(UpdateJob *job, bool *returnOutput, void *perThreadData)
+{
+    (void) perThreadData;
+    ReplicaManager3 *replicaManager = job->replicaManager;
+    Connection_RM3 *connection = job->connection;
+
+    connection->updatingOnThread=true;
+    if (job->updateInterest && connection->QueryConstructionMode()==Connection_RM3::QUERY_CONNECTION_FOR_REPLICA_LIST)
+        connection->UpdateInterest(job->world, replicaManager->interestCellSize);
+    connection->AutoConstructByQuery(replicaManager, job->world->worldId);
+    connection->updatingOnThread=false;
+
+    if (--replicaManager->updateJobsRemaining==0)
+        replicaManager->updateJobsDoneEvent.SetEvent();
+    *returnOutput=false;
+    return job;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+ReplicaManager3::UpdateJob* ReplicaManager3::SerializeOnUpdateThread(UpdateJob *job, bool *returnOutput, void *perThreadData)
+{
+    (void) perThreadData;
+    ReplicaManager3 *replicaManager = job->replicaManager;
+
+    SerializeParameters sp;
+    sp.curTime=job->time;
+    sp.messageTimestamp=0;
+    for (int i=0; i < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; i++)
+        sp.pro[i]=replicaManager->defaultSendParameters;
+
+    job->connection->updatingOnThread=true;
+    replicaManager->SerializeToConnection(job->connection, &sp, job->world->worldId, job->time);
+    job->connection->updatingOnThread=false;
+
+    if (--replicaManager->updateJobsRemaining==0)
+        replicaManager->updateJobsDoneEvent.SetEvent();
+    *returnOutput=false;
+    return job;
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1206,6 +1584,8 @@ PluginReceiveResult ReplicaManager3::OnConstruction(Packet *packet, unsigned cha
     }
 
     // Destructions
+    // Aligned by the sender after the post construction flags
+    bsIn.AlignReadToByteBoundary();
     bool b = bsIn.Read(destructionObjectListSize);
     (void) b;
     RakAssert(b);
@@ -1248,44 +1628,110 @@ PluginReceiveResult ReplicaManager3::OnConstruction(Packet *packet, unsigned cha
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-PluginReceiveResult ReplicaManager3::OnSerialize(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, RakNet::Time timestamp, unsigned char packetDataOffset, WorldId worldId)
+// Reads the channels as written by Connection_RM3::WriteSerialize()
+static bool ReadSerializationChannels(RakNet::BitStream *bsIn, DeserializeParameters *ds)
 {
-    Connection_RM3 *connection = GetConnectionByGUID(senderGuid, worldId);
-    if (connection==0)
-        return RR_CONTINUE_PROCESSING;
-    if (connection->groupConstructionAndSerialize)
+    BitSize_t bitsUsed;
+    for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
     {
-        connection->downloadGroup.Push(packet);
-        return RR_STOP_PROCESSING;
+        if (bsIn->Read(ds->bitstreamWrittenTo[z])==false)
+            return false;
+        if (ds->bitstreamWrittenTo[z])
+        {
+            bsIn->ReadCompressed(bitsUsed);
+            bsIn->AlignReadToByteBoundary();
+            if (bsIn->Read(ds->serializationBitstream[z], bitsUsed)==false)
+                return false;
+        }
     }
+    return true;
+}
 
-    RM3World *world = worldsArray[worldId];
-    RakAssert(world->networkIDManager);
-    RakNet::BitStream bsIn(packetData,packetDataLength,false);
-    bsIn.IgnoreBytes(packetDataOffset);
-
-    struct DeserializeParameters ds;
-    ds.timeStamp=timestamp;
-    ds.sourceConnection=connection;
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-    Replica3 *replica;
-    NetworkID networkId;
-    BitSize_t bitsUsed;
-    bsIn.Read(networkId);
-    //printf("OnSerialize: %i\n",networkId.guid.g); // Removeme
-    replica = world->networkIDManager->GET_OBJECT_FROM_ID<Replica3*>(networkId);
-    if (replica)
+// Writes the length of the state, then for every 8 bytes a byte with a bit set for each byte that differs from baseline, followed by those bytes
+// Bytes past the end of baseline are compared against 0, so the whole state is sent against an empty baseline
+static void WriteSnapshotDelta(const RM3Snapshot *baseline, const unsigned char *data, unsigned int length, RakNet::BitStream *out)
+{
+    unsigned char changed[8];
+    out->WriteCompressed(length);
+    out->AlignWriteToByteBoundary();
+    for (unsigned int blockStart=0; blockStart < length; blockStart+=8)
     {
-        for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
+        unsigned char mask=0;
+        unsigned int changedCount=0;
+        for (unsigned int i=blockStart; i < blockStart+8 && i < length; i++)
         {
-            bsIn.Read(ds.bitstreamWrittenTo[z]);
-            if (ds.bitstreamWrittenTo[z])
+            unsigned char baselineByte = i < baseline->length ? baseline->data[i] : 0;
+            if (data[i]!=baselineByte)
             {
-                bsIn.ReadCompressed(bitsUsed);
-                bsIn.AlignReadToByteBoundary();
-                bsIn.Read(ds.serializationBitstream[z], bitsUsed);
+                mask|=(unsigned char) (1 << (i-blockStart));
+                changed[changedCount++]=data[i];
             }
         }
+        out->Write(mask);
+        if (changedCount>0)
+            out->WriteAlignedBytes(changed, changedCount);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+static bool ReadSnapshotDelta(const RM3Snapshot *baseline, RakNet::BitStream *bsIn, RakNet::BitStream *state)
+{
+    unsigned int length;
+    if (bsIn->ReadCompressed(length)==false)
+        return false;
+    bsIn->AlignReadToByteBoundary();
+    // Every 8 bytes take at least their mask
+    if (length > BITS_TO_BYTES(bsIn->GetNumberOfUnreadBits())*8)
+        return false;
+    for (unsigned int blockStart=0; blockStart < length; blockStart+=8)
+    {
+        unsigned char mask;
+        if (bsIn->Read(mask)==false)
+            return false;
+        for (unsigned int i=blockStart; i < blockStart+8 && i < length; i++)
+        {
+            unsigned char stateByte = i < baseline->length ? baseline->data[i] : 0;
+            if ((mask & (1 << (i-blockStart))) && bsIn->Read(stateByte)==false)
+                return false;
+            state->Write(stateByte);
+        }
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+PluginReceiveResult ReplicaManager3::OnSerialize(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, RakNet::Time timestamp, unsigned char packetDataOffset, WorldId worldId)
+{
+    Connection_RM3 *connection = GetConnectionByGUID(senderGuid, worldId);
+    if (connection==0)
+        return RR_CONTINUE_PROCESSING;
+    if (connection->groupConstructionAndSerialize)
+    {
+        connection->downloadGroup.Push(packet);
+        return RR_STOP_PROCESSING;
+    }
+
+    RM3World *world = worldsArray[worldId];
+    RakAssert(world->networkIDManager);
+    RakNet::BitStream bsIn(packetData,packetDataLength,false);
+    bsIn.IgnoreBytes(packetDataOffset);
+
+    struct DeserializeParameters ds;
+    ds.timeStamp=timestamp;
+    ds.sourceConnection=connection;
+
+    Replica3 *replica;
+    NetworkID networkId;
+    bsIn.Read(networkId);
+    //printf("OnSerialize: %i\n",networkId.guid.g); // Removeme
+    replica = world->networkIDManager->GET_OBJECT_FROM_ID<Replica3*>(networkId);
+    if (replica)
+    {
+        ReadSerializationChannels(&bsIn, &ds);
         replica->Deserialize(&ds);
     }
     return RR_CONTINUE_PROCESSING;
@@ -1349,6 +1795,126 @@ PluginReceiveResult ReplicaManager3::OnDownloadComplete(Packet *packet, unsigned
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+PluginReceiveResult ReplicaManager3::OnSnapshot(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, RakNet::Time timestamp, unsigned char packetDataOffset, WorldId worldId)
+{
+    Connection_RM3 *connection = GetConnectionByGUID(senderGuid, worldId);
+    if (connection==0)
+        return RR_CONTINUE_PROCESSING;
+    if (connection->groupConstructionAndSerialize)
+    {
+        connection->downloadGroup.Push(packet);
+        return RR_STOP_PROCESSING;
+    }
+
+    RM3World *world = worldsArray[worldId];
+    RakAssert(world->networkIDManager);
+    RakNet::BitStream bsIn(packetData,packetDataLength,false);
+    bsIn.IgnoreBytes(packetDataOffset);
+
+    NetworkID networkId;
+    uint32_t sequence, baselineSequence;
+    bsIn.Read(networkId);
+    bsIn.Read(sequence);
+    if (bsIn.Read(baselineSequence)==false || sequence==0)
+        return RR_STOP_PROCESSING_AND_DEALLOCATE;
+    bsIn.AlignReadToByteBoundary();
+
+    // The replica may not be constructed yet, as snapshots are unreliable, or the baseline may have been overwritten by a newer state that arrived first
+    // Either way the sender has to send the whole state again
+    LastSerializationResult *lsr = connection->GetConstructedReplica(networkId, world->networkIDManager);
+    RM3Snapshot emptySnapshot = {0, 0, 0};
+    RM3Snapshot *baseline = &emptySnapshot;
+    if (lsr && baselineSequence!=0)
+        baseline = lsr->snapshotHistory ? lsr->snapshotHistory->GetSnapshot(baselineSequence) : 0;
+    RakNet::BitStream state;
+    if (lsr==0 || baseline==0 || ReadSnapshotDelta(baseline, &bsIn, &state)==false)
+    {
+        connection->SendSnapshotReset(networkId, sequence, rakPeerInterface, worldId);
+        return RR_CONTINUE_PROCESSING;
+    }
+
+    // Kept even if it arrived out of order, since the sender may use any state that arrived as a baseline
+    lsr->AllocSnapshotHistory();
+    lsr->snapshotHistory->AddSnapshot(sequence, state.GetData(), (unsigned int) state.GetNumberOfBytesUsed());
+    if (sequence <= lsr->snapshotHistory->newestSequence)
+        return RR_CONTINUE_PROCESSING;
+    lsr->snapshotHistory->newestSequence=sequence;
+
+    struct DeserializeParameters ds;
+    ds.timeStamp=timestamp;
+    ds.sourceConnection=connection;
+    if (ReadSerializationChannels(&state, &ds))
+        lsr->replica->Deserialize(&ds);
+    return RR_CONTINUE_PROCESSING;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+PluginReceiveResult ReplicaManager3::OnSnapshotReset(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, unsigned char packetDataOffset, WorldId worldId)
+{
+    (void) packet;
+
+    Connection_RM3 *connection = GetConnectionByGUID(senderGuid, worldId);
+    if (connection==0)
+        return RR_STOP_PROCESSING_AND_DEALLOCATE;
+
+    RakNet::BitStream bsIn(packetData,packetDataLength,false);
+    bsIn.IgnoreBytes(packetDataOffset);
+    NetworkID networkId;
+    uint32_t sequence;
+    bsIn.Read(networkId);
+    if (bsIn.Read(sequence)==false)
+        return RR_STOP_PROCESSING_AND_DEALLOCATE;
+
+    LastSerializationResult *lsr = connection->GetConstructedReplica(networkId, worldsArray[worldId]->networkIDManager);
+    // Resets for states sent before the last reset were already handled
+    if (lsr && lsr->snapshotHistory && sequence >= lsr->snapshotHistory->firstBaselineSequence)
+    {
+        lsr->snapshotHistory->ackedSequence=0;
+        lsr->snapshotHistory->firstBaselineSequence=lsr->snapshotHistory->nextSequence;
+    }
+    return RR_STOP_PROCESSING_AND_DEALLOCATE;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+PluginReceiveResult ReplicaManager3::OnSnapshotReceipt(Packet *packet)
+{
+    if (packet->length < sizeof(MessageID)+sizeof(uint32_t))
+        return RR_CONTINUE_PROCESSING;
+    uint32_t sendReceipt;
+    memcpy(&sendReceipt, packet->data+sizeof(MessageID), sizeof(uint32_t));
+
+    for (unsigned int i=0; i < worldsList.Size(); i++)
+    {
+        Connection_RM3 *connection = GetConnectionByGUID(packet->guid, worldsList[i]->worldId);
+        if (connection==0)
+            continue;
+        bool objectExists;
+        unsigned int idx = connection->snapshotReceipts.GetIndexFromKey(sendReceipt, &objectExists);
+        if (objectExists==false)
+            continue;
+        RM3SnapshotReceipt receipt = connection->snapshotReceipts[idx];
+        connection->snapshotReceipts.RemoveAtIndex(idx);
+
+        // A lost state needs nothing, the next one is sent against the same baseline
+        if (packet->data[0]==ID_SND_RECEIPT_ACKED)
+        {
+            LastSerializationResult *lsr = connection->GetConstructedReplica(receipt.networkId, worldsList[i]->networkIDManager);
+            if (lsr && lsr->snapshotHistory &&
+                receipt.sequence >= lsr->snapshotHistory->firstBaselineSequence &&
+                receipt.sequence > lsr->snapshotHistory->ackedSequence)
+                lsr->snapshotHistory->ackedSequence=receipt.sequence;
+        }
+        return RR_STOP_PROCESSING_AND_DEALLOCATE;
+    }
+
+    // Not ours
+    return RR_CONTINUE_PROCESSING;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
 Replica3* ReplicaManager3::GetReplicaByNetworkID(NetworkID networkId, WorldId worldId)
 {
     RM3World *world = worldsArray[worldId];
@@ -1461,6 +2027,10 @@ Connection_RM3::Connection_RM3(const SystemAddress &_systemAddress, RakNetGUID _
     isFirstConstruction = true;
     groupConstructionAndSerialize = false;
     gotDownloadComplete = false;
+    hasInterestArea = false;
+    interestMinX = interestMinY = interestMaxX = interestMaxY = 0;
+    interestX = interestY = 0.0f;
+    updatingOnThread = false;
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1472,6 +2042,8 @@ Connection_RM3::~Connection_RM3()
         delete constructedReplicaList[i];
     for (i=0; i < queryToConstructReplicaList.Size(); i++)
         delete queryToConstructReplicaList[i];
+    for (i=0; i < deferredSends.Size(); i++)
+        RM3SerializedMessage::Release(deferredSends[i]);
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1518,6 +2090,47 @@ void Connection_RM3::ClearDownloadGroup(RakPeerInterface *rakPeerInterface)
 }
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 SendSerializeIfChangedResult Connection_RM3::SendSerialize(RakNet::Replica3 *replica, bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::BitStream serializationData[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::Time timestamp, PRO sendParameters[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakPeerInterface *rakPeer, unsigned char worldId, RakNet::Time curTime)
+{
+    return WriteSerialize(replica, indicesToSend, serializationData, timestamp, sendParameters, rakPeer, worldId, curTime, 0);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+static void AddSerializedMessage(RakNet::BitStream *out, const PRO &pro, DataStructures::List<RM3SerializedMessage*> *messagesOut)
+{
+    RM3SerializedMessage *message = new RM3SerializedMessage;
+    message->bitStream.Write(out);
+    message->pro=pro;
+    message->refCount=1;
+    messagesOut->Push(message);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::SendOrDefer(RakNet::BitStream *bitStream, const PRO &sendParameters, RakNet::RakPeerInterface *rakPeer)
+{
+    if (updatingOnThread)
+        AddSerializedMessage(bitStream, sendParameters, &deferredSends);
+    else
+        rakPeer->Send(bitStream,sendParameters.priority,sendParameters.reliability,sendParameters.orderingChannel,systemAddress,false,sendParameters.sendReceipt);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::SendDeferredMessages(RakNet::RakPeerInterface *rakPeer)
+{
+    for (unsigned int i=0; i < deferredSends.Size(); i++)
+    {
+        RM3SerializedMessage *message = deferredSends[i];
+        SendBuffer buffer = {(const char*) message->bitStream.GetData(), (unsigned int) message->bitStream.GetNumberOfBytesUsed()};
+        rakPeer->SendGather(&buffer,1,message->pro.priority,message->pro.reliability,message->pro.orderingChannel,systemAddress,false,RM3SerializedMessage::Release,message,message->pro.sendReceipt);
+    }
+    deferredSends.Clear(true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SendSerializeIfChangedResult Connection_RM3::WriteSerialize(RakNet::Replica3 *replica, bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::BitStream serializationData[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::Time timestamp, PRO sendParameters[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakPeerInterface *rakPeer, unsigned char worldId, RakNet::Time curTime, DataStructures::List<RM3SerializedMessage*> *messagesOut)
 {
     bool channelHasData;
     BitSize_t sum=0;
@@ -1561,7 +2174,10 @@ SendSerializeIfChangedResult Connection_RM3::SendSerialize(RakNet::Replica3 *rep
 
             // Send remainder
             replica->OnSerializeTransmission(&out, this, bitsPerChannel, curTime);
-            rakPeer->Send(&out,lastPro.priority,lastPro.reliability,lastPro.orderingChannel,systemAddress,false,lastPro.sendReceipt);
+            if (messagesOut)
+                AddSerializedMessage(&out, lastPro, messagesOut);
+            else
+                SendOrDefer(&out, lastPro, rakPeer);
 
             // If no data left to send, quit out
             bool anyData=false;
@@ -1605,7 +2221,10 @@ SendSerializeIfChangedResult Connection_RM3::SendSerialize(RakNet::Replica3 *rep
         }
     }
     replica->OnSerializeTransmission(&out, this, bitsPerChannel, curTime);
-    rakPeer->Send(&out,lastPro.priority,lastPro.reliability,lastPro.orderingChannel,systemAddress,false,lastPro.sendReceipt);
+    if (messagesOut)
+        AddSerializedMessage(&out, lastPro, messagesOut);
+    else
+        SendOrDefer(&out, lastPro, rakPeer);
     return SSICR_SENT_DATA;
 }
 
@@ -1629,6 +2248,29 @@ SendSerializeIfChangedResult Connection_RM3::SendSerializeIfChanged(LastSerializ
     if (rm3qsr==RM3QSR_DO_NOT_CALL_SERIALIZE)
         return SSICR_DID_NOT_SEND_DATA;
 
+    if (updatingOnThread)
+    {
+        // Other threads may be serializing the same replica to their connections
+        replica->serializeMutex.Lock();
+        SendSerializeIfChangedResult result = SerializeIfChanged(lsr, sp, rakPeer, worldId, replicaManager, curTime);
+        replica->serializeMutex.Unlock();
+        return result;
+    }
+    return SerializeIfChanged(lsr, sp, rakPeer, worldId, replicaManager, curTime);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SendSerializeIfChangedResult Connection_RM3::SerializeIfChanged(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime)
+{
+    RakNet::Replica3 *replica = lsr->replica;
+
+    if (replicaManager->GetSnapshotReplication())
+        return SendSnapshotSerialization(lsr, sp, rakPeer, worldId, replicaManager, curTime);
+
+    if (replicaManager->GetSerializeOncePerViewClass())
+        return SendViewClassSerialization(lsr, sp, rakPeer, worldId, replicaManager, curTime);
+
     if (replica->forceSendUntilNextUpdate)
     {
         for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
@@ -1766,6 +2408,359 @@ SendSerializeIfChangedResult Connection_RM3::SendSerializeIfChanged(LastSerializ
     return SendSerialize(replica, indicesToSend, sp->outputBitstream, sp->messageTimestamp, sp->pro, rakPeer, worldId, curTime);
 }
 
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SendSerializeIfChangedResult Connection_RM3::SendViewClassSerialization(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime)
+{
+    RakNet::Replica3 *replica = lsr->replica;
+    uint32_t viewClass = QueryViewClass();
+
+    RM3ViewClassSerialization *vcs=0;
+    for (unsigned int i=0; i < replica->viewClassSerializations.Size(); i++)
+    {
+        if (replica->viewClassSerializations[i]->viewClass==viewClass)
+        {
+            vcs=replica->viewClassSerializations[i];
+            break;
+        }
+    }
+    if (vcs==0)
+    {
+        vcs=new RM3ViewClassSerialization;
+        vcs->viewClass=viewClass;
+        vcs->serializeTick=replicaManager->serializeTick-1;
+        replica->viewClassSerializations.Push(vcs);
+    }
+
+    if (vcs->serializeTick!=replicaManager->serializeTick)
+    {
+        // First connection of this view class this tick. Serialize for all of them
+        vcs->serializeTick=replicaManager->serializeTick;
+        vcs->ClearMessages();
+        vcs->bitsWritten=0;
+        for (int i=0; i < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; i++)
+        {
+            sp->outputBitstream[i].Reset();
+            sp->lastSentBitstream[i]=&vcs->lastSentSerialization.bitStream[i];
+        }
+
+        vcs->serializationResult = replica->Serialize(sp);
+        for (int i=0; i < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; i++)
+            vcs->pro[i]=sp->pro[i];
+        vcs->messageTimestamp=sp->messageTimestamp;
+
+        if (vcs->serializationResult!=RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION && vcs->serializationResult!=RM3SR_DO_NOT_SERIALIZE)
+        {
+            bool sendAll = vcs->serializationResult==RM3SR_SERIALIZED_ALWAYS ||
+                vcs->serializationResult==RM3SR_SERIALIZED_ALWAYS_IDENTICALLY ||
+                vcs->serializationResult==RM3SR_BROADCAST_IDENTICALLY_FORCE_SERIALIZATION;
+            bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS];
+            BitSize_t sum=0;
+            for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
+            {
+                RakNet::BitStream *output = &sp->outputBitstream[z];
+                RakNet::BitStream *lastSent = &vcs->lastSentSerialization.bitStream[z];
+                output->ResetReadPointer();
+                sum+=output->GetNumberOfBitsUsed();
+                indicesToSend[z] = output->GetNumberOfBitsUsed() > 0 &&
+                    (sendAll || output->GetNumberOfBitsUsed()!=lastSent->GetNumberOfBitsUsed() ||
+                    memcmp(output->GetData(), lastSent->GetData(), output->GetNumberOfBytesUsed())!=0);
+                vcs->lastSentSerialization.indicesToSend[z]=indicesToSend[z];
+                if (indicesToSend[z])
+                {
+                    vcs->bitsWritten+=output->GetNumberOfBitsUsed();
+                    lastSent->Reset();
+                    lastSent->Write(output);
+                    output->ResetReadPointer();
+                }
+            }
+
+            if (sum>0)
+                WriteSerialize(replica, indicesToSend, sp->outputBitstream, sp->messageTimestamp, sp->pro, rakPeer, worldId, curTime, &vcs->messages);
+        }
+    }
+
+    if (vcs->serializationResult==RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION)
+    {
+        // Never again for this connection and replica pair
+        OnNeverSerialize(lsr, replicaManager);
+        return SSICR_NEVER_SERIALIZE;
+    }
+
+    if (vcs->serializationResult==RM3SR_DO_NOT_SERIALIZE)
+        return SSICR_DID_NOT_SEND_DATA;
+
+    if (lsr->sentViewClassState==false || lsr->viewClass!=viewClass)
+    {
+        // The messages only have the channels that changed, which is not enough for a connection that joined the view class
+        // after the others. It gets every channel once, from what was last sent to the view class
+        bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS];
+        bool messagesHaveAll=true;
+        BitSize_t bitsWritten=0;
+        for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
+        {
+            indicesToSend[z]=vcs->lastSentSerialization.bitStream[z].GetNumberOfBitsUsed()>0;
+            bitsWritten+=vcs->lastSentSerialization.bitStream[z].GetNumberOfBitsUsed();
+            if (indicesToSend[z] && vcs->lastSentSerialization.indicesToSend[z]==false)
+                messagesHaveAll=false;
+        }
+        if (bitsWritten==0)
+            return SSICR_DID_NOT_SEND_DATA;
+        lsr->sentViewClassState=true;
+        lsr->viewClass=viewClass;
+        if (messagesHaveAll==false)
+        {
+            sp->bitsWrittenSoFar+=bitsWritten;
+            return WriteSerialize(replica, indicesToSend, vcs->lastSentSerialization.bitStream, vcs->messageTimestamp, vcs->pro, rakPeer, worldId, curTime, 0);
+        }
+    }
+
+    if (vcs->messages.Size()==0)
+        return SSICR_DID_NOT_SEND_DATA;
+
+    // Every connection of the view class sends the same messages, so they are referenced rather than copied
+    sp->bitsWrittenSoFar+=vcs->bitsWritten;
+    for (unsigned int i=0; i < vcs->messages.Size(); i++)
+    {
+        RM3SerializedMessage *message = vcs->messages[i];
+        message->refCount++;
+        if (updatingOnThread)
+        {
+            deferredSends.Push(message);
+            continue;
+        }
+        SendBuffer buffer = {(const char*) message->bitStream.GetData(), (unsigned int) message->bitStream.GetNumberOfBytesUsed()};
+        rakPeer->SendGather(&buffer,1,message->pro.priority,message->pro.reliability,message->pro.orderingChannel,systemAddress,false,RM3SerializedMessage::Release,message,message->pro.sendReceipt);
+    }
+    return SSICR_SENT_DATA;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SendSerializeIfChangedResult Connection_RM3::SendSnapshotSerialization(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime)
+{
+    // The whole state is written every time, so there is nothing to compare against
+    RakNet::BitStream emptyBs;
+    for (int i=0; i < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; i++)
+    {
+        sp->outputBitstream[i].Reset();
+        sp->lastSentBitstream[i]=&emptyBs;
+    }
+
+    RM3SerializationResult serializationResult = lsr->replica->Serialize(sp);
+
+    if (serializationResult==RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION)
+    {
+        // Never again for this connection and replica pair
+        OnNeverSerialize(lsr, replicaManager);
+        return SSICR_NEVER_SERIALIZE;
+    }
+
+    if (serializationResult==RM3SR_DO_NOT_SERIALIZE)
+    {
+        // Don't serialize this tick only
+        return SSICR_DID_NOT_SEND_DATA;
+    }
+
+    return SendSnapshot(lsr, sp, UNRELIABLE_WITH_ACK_RECEIPT, rakPeer, worldId, curTime);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+SendSerializeIfChangedResult Connection_RM3::SendSnapshot(LastSerializationResult *lsr, SerializeParameters *sp, PacketReliability reliability, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, RakNet::Time curTime)
+{
+    RakNet::Replica3 *replica = lsr->replica;
+
+    // The state is every channel, written the same way as in ID_REPLICA_MANAGER_SERIALIZE
+    RakNet::BitStream state;
+    BitSize_t bitsPerChannel[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS];
+    BitSize_t sum=0;
+    for (int z=0; z < RM3_NUM_OUTPUT_BITSTREAM_CHANNELS; z++)
+    {
+        sp->outputBitstream[z].ResetReadPointer();
+        bitsPerChannel[z]=sp->outputBitstream[z].GetNumberOfBitsUsed();
+        sum+=bitsPerChannel[z];
+        state.Write(bitsPerChannel[z]>0);
+        if (bitsPerChannel[z]>0)
+        {
+            state.WriteCompressed(bitsPerChannel[z]);
+            state.AlignWriteToByteBoundary();
+            state.Write(&sp->outputBitstream[z]);
+            sp->outputBitstream[z].ResetReadPointer();
+        }
+    }
+
+    if (sum==0)
+    {
+        // Don't serialize this tick only
+        return SSICR_DID_NOT_SEND_DATA;
+    }
+
+    lsr->AllocSnapshotHistory();
+    RM3SnapshotHistory *history = lsr->snapshotHistory;
+    uint32_t sequence = history->nextSequence;
+    RM3Snapshot emptySnapshot = {0, 0, 0};
+    RM3Snapshot *baseline = 0;
+    // The slot of a baseline RM3_SNAPSHOT_HISTORY_LENGTH states old is about to be reused, on the remote system too
+    if (history->ackedSequence!=0 && sequence-history->ackedSequence < (uint32_t) RM3_SNAPSHOT_HISTORY_LENGTH)
+        baseline = history->GetSnapshot(history->ackedSequence);
+    if (baseline &&
+        baseline->length==state.GetNumberOfBytesUsed() &&
+        memcmp(baseline->data, state.GetData(), baseline->length)==0)
+    {
+        // The remote system already has this state
+        return SSICR_DID_NOT_SEND_DATA;
+    }
+
+    RakNet::BitStream out;
+    if (sp->messageTimestamp!=0)
+    {
+        out.Write((MessageID)ID_TIMESTAMP);
+        out.Write(sp->messageTimestamp);
+    }
+    out.Write((MessageID)ID_REPLICA_MANAGER_SNAPSHOT);
+    out.Write(worldId);
+    out.Write(replica->GetNetworkID());
+    out.Write(sequence);
+    out.Write(baseline ? baseline->sequence : (uint32_t) 0);
+    out.AlignWriteToByteBoundary();
+    WriteSnapshotDelta(baseline ? baseline : &emptySnapshot, state.GetData(), (unsigned int) state.GetNumberOfBytesUsed(), &out);
+
+    history->nextSequence++;
+    history->AddSnapshot(sequence, state.GetData(), (unsigned int) state.GetNumberOfBytesUsed());
+
+    replica->OnSerializeTransmission(&out, this, bitsPerChannel, curTime);
+
+    PRO sendParameters = sp->pro[0];
+    sendParameters.reliability = reliability;
+    sendParameters.sendReceipt = rakPeer->IncrementNextSendReceipt();
+    RM3SnapshotReceipt receipt;
+    receipt.sendReceipt = sendParameters.sendReceipt;
+    receipt.networkId = replica->GetNetworkID();
+    receipt.sequence = sequence;
+    snapshotReceipts.Insert(receipt.sendReceipt, receipt, false);
+    SendOrDefer(&out, sendParameters, rakPeer);
+
+    sp->bitsWrittenSoFar+=out.GetNumberOfBitsUsed();
+    return SSICR_SENT_DATA;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::SendSnapshotReset(NetworkID networkId, uint32_t sequence, RakNet::RakPeerInterface *rakPeer, WorldId worldId)
+{
+    RakNet::BitStream bsOut;
+    bsOut.Write((MessageID)ID_REPLICA_MANAGER_SNAPSHOT_RESET);
+    bsOut.Write(worldId);
+    bsOut.Write(networkId);
+    bsOut.Write(sequence);
+    rakPeer->Send(&bsOut,HIGH_PRIORITY,RELIABLE,0,systemAddress,false);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+LastSerializationResult* Connection_RM3::GetConstructedReplica(NetworkID networkId, NetworkIDManager *networkIDManager)
+{
+    if (networkIDManager==0)
+        return 0;
+    Replica3 *replica = networkIDManager->GET_OBJECT_FROM_ID<Replica3*>(networkId);
+    if (replica==0)
+        return 0;
+    bool objectExists;
+    unsigned int idx = constructedReplicaList.GetIndexFromKey(replica, &objectExists);
+    if (objectExists==false)
+        return 0;
+    return constructedReplicaList[idx];
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void RM3SerializedMessage::Release(void *context)
+{
+    RM3SerializedMessage *message = (RM3SerializedMessage*) context;
+    if (--message->refCount==0)
+        delete message;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3ViewClassSerialization::RM3ViewClassSerialization()
+{
+    viewClass=0;
+    serializeTick=0;
+    serializationResult=RM3SR_DO_NOT_SERIALIZE;
+    bitsWritten=0;
+    messageTimestamp=0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3ViewClassSerialization::~RM3ViewClassSerialization()
+{
+    ClearMessages();
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void RM3ViewClassSerialization::ClearMessages(void)
+{
+    for (unsigned int i=0; i < messages.Size(); i++)
+        RM3SerializedMessage::Release(messages[i]);
+    messages.Clear(true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3SnapshotHistory::RM3SnapshotHistory()
+{
+    for (int i=0; i < RM3_SNAPSHOT_HISTORY_LENGTH; i++)
+    {
+        snapshots[i].sequence=0;
+        snapshots[i].data=0;
+        snapshots[i].length=0;
+    }
+    nextSequence=1;
+    ackedSequence=0;
+    firstBaselineSequence=1;
+    newestSequence=0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3SnapshotHistory::~RM3SnapshotHistory()
+{
+    for (int i=0; i < RM3_SNAPSHOT_HISTORY_LENGTH; i++)
+        delete [] snapshots[i].data;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+RM3Snapshot *RM3SnapshotHistory::GetSnapshot(uint32_t sequence)
+{
+    RM3Snapshot *snapshot = &snapshots[sequence % RM3_SNAPSHOT_HISTORY_LENGTH];
+    if (sequence==0 || snapshot->sequence!=sequence)
+        return 0;
+    return snapshot;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void RM3SnapshotHistory::AddSnapshot(uint32_t sequence, const unsigned char *data, unsigned int length)
+{
+    RM3Snapshot *snapshot = &snapshots[sequence % RM3_SNAPSHOT_HISTORY_LENGTH];
+    // Do not replace a newer state with one that arrived late
+    if (snapshot->sequence >= sequence)
+        return;
+    if (snapshot->data==0 || snapshot->length < length)
+    {
+        delete [] snapshot->data;
+        snapshot->data = new unsigned char[length > 0 ? length : 1];
+    }
+    memcpy(snapshot->data, data, length);
+    snapshot->length=length;
+    snapshot->sequence=sequence;
+}
+
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 void Connection_RM3::OnLocalReference(Replica3* replica3, ReplicaManager3 *replicaManager)
 {
@@ -1801,6 +2796,20 @@ void Connection_RM3::OnDereference(Replica3* replica3, ReplicaManager3 *replicaM
 {
     ValidateLists(replicaManager);
 
+    // Forget it without sending a destruction, the replica is going away
+    bool wasInterested;
+    unsigned int interestIdx = interestReplicas.GetIndexFromKey(replica3, &wasInterested);
+    if (wasInterested)
+    {
+        interestReplicas.RemoveAtIndex(interestIdx);
+        interestIdx = interestToConstruct.GetIndexOf(replica3);
+        if (interestIdx!=(unsigned int)-1)
+            interestToConstruct.RemoveAtIndexFast(interestIdx);
+    }
+    interestIdx = interestToDestroy.GetIndexOf(replica3);
+    if (interestIdx!=(unsigned int)-1)
+        interestToDestroy.RemoveAtIndexFast(interestIdx);
+
     if (replica3->GetNetworkIDManager() == 0)
         return;
 
@@ -1959,6 +2968,196 @@ void Connection_RM3::OnConstructToThisConnection(Replica3 *replica, ReplicaManag
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
+void Connection_RM3::QueryReplicaList(
+    DataStructures::List<Replica3*> &newReplicasToCreate,
+    DataStructures::List<Replica3*> &existingReplicasToDestroy)
+{
+    unsigned int i;
+    for (i=0; i < interestToConstruct.Size(); i++)
+        newReplicasToCreate.Push(interestToConstruct[i]);
+    for (i=0; i < interestToDestroy.Size(); i++)
+        existingReplicasToDestroy.Push(interestToDestroy[i]);
+    interestToConstruct.Clear(true);
+    interestToDestroy.Clear(true);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::UpdateInterest(ReplicaManager3::RM3World *world, float cellSize)
+{
+    float radius;
+    if (QueryInterestArea(&interestX, &interestY, &radius)==false)
+    {
+        hasInterestArea=false;
+        return;
+    }
+
+    int minX = (int) floorf((interestX-radius)/cellSize);
+    int minY = (int) floorf((interestY-radius)/cellSize);
+    int maxX = (int) floorf((interestX+radius)/cellSize);
+    int maxY = (int) floorf((interestY+radius)/cellSize);
+    unsigned int i;
+
+    if (hasInterestArea && minX==interestMinX && minY==interestMinY && maxX==interestMaxX && maxY==interestMaxY)
+    {
+        // Same cells as last tick, so only replicas that changed cells can have entered or left the area
+        for (i=0; i < world->interestMoves.Size(); i++)
+        {
+            const RM3InterestMove &move = world->interestMoves[i];
+            if (move.replica->creatingSystemGUID==guid)
+                continue;
+            bool wasInArea = move.from!=0 && IsInInterestArea(move.from);
+            bool isInArea = IsInInterestArea(move.to);
+            if (isInArea && wasInArea==false)
+                AddInterest(move.replica);
+            else if (wasInArea && isInArea==false)
+                RemoveInterest(move.replica);
+        }
+        return;
+    }
+
+    hasInterestArea=true;
+    interestMinX=minX;
+    interestMinY=minY;
+    interestMaxX=maxX;
+    interestMaxY=maxY;
+
+    // Different cells, so find everything in the area and compare against what was in it before
+    DataStructures::OrderedList<Replica3*, Replica3*> inArea;
+    DataStructures::List<RM3InterestCell*> cells;
+    cells.Push(&world->interestEverywhere);
+    if ((uint64_t) (maxX-minX+1)*(uint64_t) (maxY-minY+1) > world->interestGrid.Size())
+    {
+        for (i=0; i < world->interestGrid.Size(); i++)
+        {
+            if (IsInInterestArea(world->interestGrid[i]))
+                cells.Push(world->interestGrid[i]);
+        }
+    }
+    else
+    {
+        for (int x=minX; x <= maxX; x++)
+        {
+            for (int y=minY; y <= maxY; y++)
+            {
+                RM3InterestCell *cell = world->GetInterestCell(x, y, false);
+                if (cell)
+                    cells.Push(cell);
+            }
+        }
+    }
+    for (i=0; i < cells.Size(); i++)
+    {
+        for (unsigned int j=0; j < cells[i]->replicas.Size(); j++)
+        {
+            Replica3 *replica = cells[i]->replicas[j];
+            if (replica->creatingSystemGUID==guid)
+                continue;
+            inArea.Insert(replica, replica, true);
+            AddInterest(replica);
+        }
+    }
+
+    i=0;
+    while (i < interestReplicas.Size())
+    {
+        if (inArea.HasData(interestReplicas[i]))
+            i++;
+        else
+            RemoveInterest(interestReplicas[i]);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::AddInterest(Replica3 *replica)
+{
+    bool objectExists;
+    unsigned int index = interestReplicas.GetIndexFromKey(replica, &objectExists);
+    if (objectExists)
+        return;
+    interestReplicas.InsertAtIndex(replica, index);
+
+    // If it left and came back before QueryReplicaList() was called, the remote system still has it
+    index = interestToDestroy.GetIndexOf(replica);
+    if (index!=(unsigned int)-1)
+        interestToDestroy.RemoveAtIndexFast(index);
+    else
+        interestToConstruct.Push(replica);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::RemoveInterest(Replica3 *replica)
+{
+    bool objectExists;
+    unsigned int index = interestReplicas.GetIndexFromKey(replica, &objectExists);
+    if (objectExists==false)
+        return;
+    interestReplicas.RemoveAtIndex(index);
+
+    index = interestToConstruct.GetIndexOf(replica);
+    if (index!=(unsigned int)-1)
+        interestToConstruct.RemoveAtIndexFast(index);
+    else
+        interestToDestroy.Push(replica);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+bool Connection_RM3::IsInInterestArea(const RM3InterestCell *cell) const
+{
+    return cell->everywhere ||
+        (cell->x >= interestMinX && cell->x <= interestMaxX && cell->y >= interestMinY && cell->y <= interestMaxY);
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+static bool HigherAccumulatedPriority(LastSerializationResult *a, LastSerializationResult *b)
+{
+    return a->accumulatedPriority > b->accumulatedPriority;
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+void Connection_RM3::SerializeByPriority(SerializeParameters *sp, ReplicaManager3 *replicaManager, WorldId worldId, RakNet::Time curTime)
+{
+    BitSize_t budget = BYTES_TO_BITS(QueryBytesPerTickBudget());
+    unsigned int i;
+
+    prioritySerializeList.Clear(true);
+    for (i=0; i < queryToSerializeReplicaList.Size(); i++)
+    {
+        LastSerializationResult *lsr = queryToSerializeReplicaList[i];
+        Replica3 *replica = lsr->replica;
+        float distance=0.0f;
+        if (hasInterestArea && replica->interestCell!=0 && replica->interestCell->everywhere==false)
+        {
+            float dx = replica->interestX-interestX;
+            float dy = replica->interestY-interestY;
+            distance = sqrtf(dx*dx+dy*dy);
+        }
+        lsr->accumulatedPriority+=replica->QueryInterestPriority(this, distance);
+        prioritySerializeList.Push(lsr);
+    }
+    if (prioritySerializeList.Size()==0)
+        return;
+    std::sort(&prioritySerializeList[0], &prioritySerializeList[0]+prioritySerializeList.Size(), HigherAccumulatedPriority);
+
+    // The first replica is always serialized, so one larger than the budget is not skipped forever
+    for (i=0; i < prioritySerializeList.Size() && sp->bitsWrittenSoFar < budget; i++)
+    {
+        LastSerializationResult *lsr = prioritySerializeList[i];
+        sp->destinationConnection=this;
+        sp->whenLastSerialized=lsr->whenLastSerialized;
+        if (SendSerializeIfChanged(lsr, sp, replicaManager->GetRakPeerInterface(), worldId, replicaManager, curTime)==SSICR_SENT_DATA)
+            lsr->whenLastSerialized=curTime;
+        lsr->accumulatedPriority=0.0f;
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
 void Connection_RM3::OnNeverSerialize(LastSerializationResult *lsr, ReplicaManager3 *replicaManager)
 {
     ValidateLists(replicaManager);
@@ -2198,12 +3397,14 @@ void Connection_RM3::SendConstruction(DataStructures::List<Replica3*> &newObject
     unsigned int newListIndex, oldListIndex;
     RakNet::BitStream bsOut;
     NetworkID networkId;
+    PRO constructionParameters=sendParameters;
+    constructionParameters.reliability=RELIABLE_ORDERED;
     if (isFirstConstruction)
     {
         bsOut.Write((MessageID)ID_REPLICA_MANAGER_DOWNLOAD_STARTED);
         bsOut.Write(worldId);
         SerializeOnDownloadStarted(&bsOut);
-        rakPeer->Send(&bsOut,sendParameters.priority,RELIABLE_ORDERED,sendParameters.orderingChannel,systemAddress,false,sendParameters.sendReceipt);
+        SendOrDefer(&bsOut, constructionParameters, rakPeer);
     }
 
     //    LastSerializationResult* lsr;
@@ -2297,8 +3498,13 @@ void Connection_RM3::SendConstruction(DataStructures::List<Replica3*> &newObject
         bsOut.Write(networkId);
         offsetStart=bsOut.GetWriteOffset();
         bsOut.Write(offsetStart);
-        deletedObjects[oldListIndex]->deletingSystemGUID=rakPeer->GetGuidFromSystemAddress(UNASSIGNED_SYSTEM_ADDRESS);
-        bsOut.Write(deletedObjects[oldListIndex]->deletingSystemGUID);
+        RakNetGUID deletingSystemGUID=rakPeer->GetGuidFromSystemAddress(UNASSIGNED_SYSTEM_ADDRESS);
+        if (updatingOnThread)
+            deletedObjects[oldListIndex]->serializeMutex.Lock();
+        deletedObjects[oldListIndex]->deletingSystemGUID=deletingSystemGUID;
+        if (updatingOnThread)
+            deletedObjects[oldListIndex]->serializeMutex.Unlock();
+        bsOut.Write(deletingSystemGUID);
         deletedObjects[oldListIndex]->SerializeDestruction(&bsOut, this);
         bsOut.AlignWriteToByteBoundary();
         offsetEnd=bsOut.GetWriteOffset();
@@ -2306,7 +3512,7 @@ void Connection_RM3::SendConstruction(DataStructures::List<Replica3*> &newObject
         bsOut.Write(offsetEnd);
         bsOut.SetWriteOffset(offsetEnd);
     }
-    rakPeer->Send(&bsOut,sendParameters.priority,RELIABLE_ORDERED,sendParameters.orderingChannel,systemAddress,false,sendParameters.sendReceipt);
+    SendOrDefer(&bsOut, constructionParameters, rakPeer);
 
     // TODO - shouldn't this be part of construction?
 
@@ -2336,8 +3542,20 @@ void Connection_RM3::SendConstruction(DataStructures::List<Replica3*> &newObject
             sp.outputBitstream[z].ResetWritePointer();
         }
 
+        if (updatingOnThread)
+            replica->serializeMutex.Lock();
         RM3SerializationResult res = replica->Serialize(&sp);
-        if (res!=RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION &&
+        if (updatingOnThread)
+            replica->serializeMutex.Unlock();
+        if (replicaManager3->GetSnapshotReplication())
+        {
+            // Sent as the first state, after the construction on the same ordering channel
+            bool objectExists;
+            unsigned int idx = constructedReplicaList.GetIndexFromKey(replica, &objectExists);
+            if (objectExists && res!=RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION && res!=RM3SR_DO_NOT_SERIALIZE)
+                SendSnapshot(constructedReplicaList[idx], &sp, RELIABLE_ORDERED_WITH_ACK_RECEIPT, rakPeer, worldId, GetTime());
+        }
+        else if (res!=RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION &&
             res!=RM3SR_DO_NOT_SERIALIZE &&
             res!=RM3SR_SERIALIZED_UNIQUELY)
         {
@@ -2360,7 +3578,7 @@ void Connection_RM3::SendConstruction(DataStructures::List<Replica3*> &newObject
         bsOut.Write((MessageID)ID_REPLICA_MANAGER_DOWNLOAD_COMPLETE);
         bsOut.Write(worldId);
         SerializeOnDownloadComplete(&bsOut);
-        rakPeer->Send(&bsOut,sendParameters.priority,RELIABLE_ORDERED,sendParameters.orderingChannel,systemAddress,false,sendParameters.sendReceipt);
+        SendOrDefer(&bsOut, constructionParameters, rakPeer);
     }
 
     isFirstConstruction=false;
@@ -2388,6 +3606,8 @@ Replica3::Replica3()
     forceSendUntilNextUpdate = false;
     lsr = 0;
     referenceIndex = (uint32_t) -1;
+    interestCell = 0;
+    interestX = interestY = 0.0f;
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -2398,6 +3618,19 @@ Replica3::~Replica3()
     {
         replicaManager->Dereference(this);
     }
+    for (unsigned int i=0; i < viewClassSerializations.Size(); i++)
+        delete viewClassSerializations[i];
+}
+
+// --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+float Replica3::QueryInterestPriority(RakNet::Connection_RM3 *destinationConnection, float distance)
+{
+    (void) destinationConnection;
+    float cellSize = replicaManager ? replicaManager->GetInterestCellSize() : 0.0f;
+    if (cellSize <= 0.0f)
+        return 1.0f;
+    return cellSize/(cellSize+distance);
 }
 
 // --------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -709,6 +709,16 @@ StatisticsHistoryPlugin::StatisticsHistoryPlugin()
 }
 StatisticsHistoryPlugin::~StatisticsHistoryPlugin()
 {
+    for (unsigned int i=0; i < tickProfileSnapshots.Size(); i++)
+        delete tickProfileSnapshots[i];
+}
+int StatisticsHistoryPlugin::TickProfileSnapshotComp( const uint64_t &key, StatisticsHistoryPlugin::TickProfileSnapshot* const &data )
+{
+    if (key < data->guid)
+        return -1;
+    if (key == data->guid)
+        return 0;
+    return 1;
 }
 void StatisticsHistoryPlugin::SetTrackConnections(bool _addNewConnections, int _newConnectionsObjectType, bool _removeLostConnections)
 {
@@ -768,6 +778,9 @@ void StatisticsHistoryPlugin::Update(void)
                 "RN_packetlossLastSecond",
                 (SHValueType) stats[idx].packetlossLastSecond,
                 curTime, false);
+
+            if (rakPeerInterface->GetTickProfiling())
+                AddTickProfileValues(guids[idx], objectIndex, curTime);
         }
 
     }
@@ -796,11 +809,75 @@ void StatisticsHistoryPlugin::OnDirectSocketReceive(const char *data, const BitS
 {
 }
 */
+void StatisticsHistoryPlugin::AddTickProfileValues(const RakNetGUID &guid, unsigned int objectIndex, Time curTime)
+{
+    static const char *phaseKeys[RNS_TICK_PHASE_COUNT] =
+    {
+        "RN_tick_datagram_parse_us",
+        "RN_tick_ack_processing_us",
+        "RN_tick_resend_scan_us",
+        "RN_tick_send_bitstream_us",
+        "RN_tick_plugin_callbacks_us",
+        "RN_tick_receive_handoff_us",
+    };
+    static const char *latencyKeys[RNS_LATENCY_METRIC_COUNT][2] =
+    {
+        {"RN_latency_send_to_wire_p50_us", "RN_latency_send_to_wire_p99_us"},
+        {"RN_latency_wire_to_receive_p50_us", "RN_latency_wire_to_receive_p99_us"},
+    };
+
+    bool objectExists;
+    unsigned int snapshotIndex = tickProfileSnapshots.GetIndexFromKey(guid.g, &objectExists);
+    if (!objectExists)
+    {
+        // The first profile only sets the baseline
+        TickProfileSnapshot *snapshot = new TickProfileSnapshot;
+        snapshot->guid = guid.g;
+        snapshot->time = curTime;
+        if (rakPeerInterface->GetTickProfile(rakPeerInterface->GetSystemAddressFromGuid(guid), &snapshot->profile))
+            tickProfileSnapshots.InsertAtIndex(snapshot, snapshotIndex);
+        else
+            delete snapshot;
+        return;
+    }
+
+    // Like valueOverLastSecond, each value covers one second
+    TickProfileSnapshot *snapshot = tickProfileSnapshots[snapshotIndex];
+    if (curTime - snapshot->time < 1000)
+        return;
+
+    RakNetTickProfile profile;
+    if (!rakPeerInterface->GetTickProfile(rakPeerInterface->GetSystemAddressFromGuid(guid), &profile))
+        return;
+    RakNetTickProfile interval = profile;
+    interval -= snapshot->profile;
+    snapshot->profile = profile;
+    snapshot->time = curTime;
+
+    for (unsigned int i = 0; i < RNS_TICK_PHASE_COUNT; i++)
+        statistics.AddValueByIndex(objectIndex, phaseKeys[i], (SHValueType) interval.phaseTimeUS[i], curTime, false);
+
+    for (unsigned int i = 0; i < RNS_LATENCY_METRIC_COUNT; i++)
+    {
+        if (interval.latency[i].totalCount == 0)
+            continue;
+        statistics.AddValueByIndex(objectIndex, latencyKeys[i][0], (SHValueType) interval.latency[i].GetPercentile(50.0), curTime, false);
+        statistics.AddValueByIndex(objectIndex, latencyKeys[i][1], (SHValueType) interval.latency[i].GetPercentile(99.0), curTime, false);
+    }
+}
 void StatisticsHistoryPlugin::OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, PI2_LostConnectionReason lostConnectionReason )
 {
     (void) lostConnectionReason;
     (void) systemAddress;
 
+    bool objectExists;
+    unsigned int snapshotIndex = tickProfileSnapshots.GetIndexFromKey(rakNetGUID.g, &objectExists);
+    if (objectExists)
+    {
+        delete tickProfileSnapshots[snapshotIndex];
+        tickProfileSnapshots.RemoveAtIndex(snapshotIndex);
+    }
+
     if (removeLostConnections)
     {
         statistics.RemoveObject(rakNetGUID.g, 0);
@@ -55,6 +55,8 @@ void RakNetSocket2Allocator::DeallocRNS2(RakNetSocket2 *s) {delete s;}
 RakNetSocket2::RakNetSocket2() : eventHandler(nullptr), socketType(RNS2Type::RNS2T_LINUX), userConnectionSocketIndex(0) {}
 RakNetSocket2::~RakNetSocket2() {}
 void RakNetSocket2::SetRecvEventHandler(RNS2EventHandler *_eventHandler) { eventHandler = _eventHandler; }
+RNS2SendResult RakNetSocket2::SendBatched( RNS2_SendParameters *sendParameters ) { return Send(sendParameters); }
+void RakNetSocket2::FlushSendBatch(void) {}
 RNS2Type RakNetSocket2::GetSocketType(void) const { return socketType; }
 void RakNetSocket2::SetSocketType(RNS2Type t) { socketType = t; }
 bool RakNetSocket2::IsBerkleySocket(void) const
@@ -304,6 +306,23 @@ unsigned RNS2_Berkley::RecvFromLoopInt(void)
 
     while ( endThreads == false )
     {
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+        if (receiveOffload)
+        {
+            ReleaseRecvBatch();
+            RecvFromCoalesced();
+            continue;
+        }
+#endif
+#if CRABNET_SUPPORT_BATCHED_IO==1
+        if (batchedIO)
+        {
+            RecvFromBatched();
+            continue;
+        }
+        ReleaseRecvBatch();
+#endif
+
         RNS2RecvStruct *recvFromStruct;
         recvFromStruct=binding.eventHandler->AllocRNS2RecvStruct();
         if (recvFromStruct != NULL)
@@ -311,8 +330,10 @@ unsigned RNS2_Berkley::RecvFromLoopInt(void)
             recvFromStruct->socket=this;
             RecvFromBlocking(recvFromStruct);
 
+            recvCalls++;
             if (recvFromStruct->bytesRead>0)
             {
+                datagramsReceived++;
                 RakAssert(recvFromStruct->systemAddress.GetPort());
                 binding.eventHandler->OnRNS2Recv(recvFromStruct);
             }
@@ -323,6 +344,9 @@ unsigned RNS2_Berkley::RecvFromLoopInt(void)
             }
         }
     }
+#if CRABNET_SUPPORT_BATCHED_IO==1
+    ReleaseRecvBatch();
+#endif
     isRecvFromLoopThreadActive--;
 
     return 0;
@@ -343,6 +367,20 @@ RNS2_Berkley::RNS2_Berkley()
     binding.remotePortRakNetWasStartedOn_PS3_PS4_PSP2 = 0;
     isRecvFromLoopThreadActive = 0;
     rns2Socket=(RNS2Socket)INVALID_SOCKET;
+    datagramsSent = 0;
+    sendCalls = 0;
+    datagramsReceived = 0;
+    recvCalls = 0;
+#if CRABNET_SUPPORT_BATCHED_IO==1
+    batchedIO = false;
+    sendBatch = 0;
+    recvBatch = 0;
+#endif
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    segmentationOffload = false;
+    receiveOffload = false;
+    coalescedRecvBatch = 0;
+#endif
 }
 RNS2_Berkley::~RNS2_Berkley()
 {
@@ -357,6 +395,13 @@ RNS2_Berkley::~RNS2_Berkley()
         closesocket__(rns2Socket);
     }
 
+#if CRABNET_SUPPORT_BATCHED_IO==1
+    delete sendBatch;
+    delete recvBatch;
+#endif
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    delete coalescedRecvBatch;
+#endif
 }
 int RNS2_Berkley::CreateRecvPollingThread(int threadPriority)
 {
@@ -393,6 +438,13 @@ void RNS2_Berkley::BlockOnStopRecvPollingThread(void)
 }
 const RNS2_BerkleyBindParameters *RNS2_Berkley::GetBindings(void) const {return &binding;}
 RNS2Socket RNS2_Berkley::GetSocket(void) const {return rns2Socket;}
+void RNS2_Berkley::GetSocketStatistics( RNS2SocketStatistics *rns2s ) const
+{
+    rns2s->datagramsSent = datagramsSent;
+    rns2s->sendCalls = sendCalls;
+    rns2s->datagramsReceived = datagramsReceived;
+    rns2s->recvCalls = recvCalls;
+}
 // See RakNetSocket2_Berkley.cpp for WriteSharedIPV4, BindSharedIPV4And6 and other implementations
 #if   defined(_WIN32)
 RNS2_Windows::RNS2_Windows() {slo=0;}
@@ -415,6 +467,8 @@ RNS2SendResult RNS2_Windows::Send( RNS2_SendParameters *sendParameters ) {
         if (len>=0)
             return len;
     }
+    datagramsSent++;
+    sendCalls++;
     return Send_Windows_Linux_360NoVDP(rns2Socket,sendParameters);
 }
 void RNS2_Windows::GetMyIP( SystemAddress addresses[MAXIMUM_NUMBER_OF_INTERNAL_IDS] ) {return GetMyIP_Windows_Linux(addresses);}
@@ -422,7 +476,11 @@ void RNS2_Windows::SetSocketLayerOverride(SocketLayerOverride *_slo) {slo = _slo
 SocketLayerOverride* RNS2_Windows::GetSocketLayerOverride(void) {return slo;}
 #else
 RNS2BindResult RNS2_Linux::Bind( RNS2_BerkleyBindParameters *bindParameters ) {return BindShared(bindParameters);}
-RNS2SendResult RNS2_Linux::Send( RNS2_SendParameters *sendParameters ) {return Send_Windows_Linux_360NoVDP(rns2Socket,sendParameters);}
+RNS2SendResult RNS2_Linux::Send( RNS2_SendParameters *sendParameters ) {
+    datagramsSent++;
+    sendCalls++;
+    return Send_Windows_Linux_360NoVDP(rns2Socket,sendParameters);
+}
 void RNS2_Linux::GetMyIP( SystemAddress addresses[MAXIMUM_NUMBER_OF_INTERNAL_IDS] ) {return GetMyIP_Windows_Linux(addresses);}
 #endif // Linux
 
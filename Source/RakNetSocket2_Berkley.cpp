@@ -309,7 +309,12 @@ void RNS2_Berkley::RecvFromBlockingIPV4And6(RNS2RecvStruct *recvFromStruct)
     socklen_t* socketlenPtr=(socklen_t*) &sockLen;
     memset(&their_addr,0,sizeof(their_addr));
     int dataOutSize;
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // Returns the whole length of a datagram too large for the buffer, which can only be one the kernel coalesced with UDP_GRO
+    const int flag=MSG_TRUNC;
+#else
     const int flag=0;
+#endif
 
     {
         sockLen=sizeof(their_addr);
@@ -319,6 +324,11 @@ void RNS2_Berkley::RecvFromBlockingIPV4And6(RNS2RecvStruct *recvFromStruct)
     dataOutSize=MAXIMUM_MTU_SIZE;
 
     recvFromStruct->bytesRead = recvfrom__(rns2Socket, recvFromStruct->data, dataOutSize, flag, sockAddrPtr, socketlenPtr );
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // Drop it rather than read part of it
+    if (recvFromStruct->bytesRead>dataOutSize)
+        recvFromStruct->bytesRead=0;
+#endif
 
 #if defined(_WIN32) && defined(_DEBUG)
     if (recvFromStruct->bytesRead==-1)
@@ -368,7 +378,12 @@ void RNS2_Berkley::RecvFromBlockingIPV4(RNS2RecvStruct *recvFromStruct)
     socklen_t* socketlenPtr=(socklen_t*) &sockLen;
     sockaddr_in sa;
     memset(&sa,0,sizeof(sockaddr_in));
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // Returns the whole length of a datagram too large for the buffer, which can only be one the kernel coalesced with UDP_GRO
+    const int flag=MSG_TRUNC;
+#else
     const int flag=0;
+#endif
 
     {
         sockLen=sizeof(sa);
@@ -378,6 +393,11 @@ void RNS2_Berkley::RecvFromBlockingIPV4(RNS2RecvStruct *recvFromStruct)
     }
 
     recvFromStruct->bytesRead = recvfrom__( GetSocket(), recvFromStruct->data, sizeof(recvFromStruct->data), flag, sockAddrPtr, socketlenPtr );
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // Drop it rather than read part of it
+    if (recvFromStruct->bytesRead>(int) sizeof(recvFromStruct->data))
+        recvFromStruct->bytesRead=0;
+#endif
 
     if (recvFromStruct->bytesRead<=0)
     {
@@ -429,6 +449,434 @@ void RNS2_Berkley::RecvFromBlocking(RNS2RecvStruct *recvFromStruct)
 #endif
 }
 
+#if CRABNET_SUPPORT_BATCHED_IO==1
+
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+#include <netinet/udp.h>
+// Older C libraries do not define these. The values are from linux/udp.h
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Limits of the kernel on one UDP_SEGMENT write: 64 segments, and a total that fits in one IP packet with any header
+static const unsigned int UDP_SEGMENT_MAX_SEGMENTS = 64;
+static const size_t UDP_SEGMENT_MAX_BYTES = 65000;
+#endif
+
+struct RNS2_Berkley::RNS2DatagramBatch
+{
+    mmsghdr msgs[BATCHED_IO_MAX_DATAGRAMS];
+    iovec iov[BATCHED_IO_MAX_DATAGRAMS];
+    sockaddr_storage addresses[BATCHED_IO_MAX_DATAGRAMS];
+    // Send batches copy the datagram, since the caller reuses its buffer
+    char data[BATCHED_IO_MAX_DATAGRAMS][MAXIMUM_MTU_SIZE];
+    // Recv batches hold structs from the event handler between calls, so they are not reallocated every recvmmsg
+    RNS2RecvStruct *recvStructs[BATCHED_IO_MAX_DATAGRAMS];
+    unsigned int count;
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // One message per run of datagrams written with UDP_SEGMENT, pointing into iov, and the index of the first datagram of each
+    mmsghdr segmentedMsgs[BATCHED_IO_MAX_DATAGRAMS];
+    unsigned int segmentedFirst[BATCHED_IO_MAX_DATAGRAMS];
+    char control[BATCHED_IO_MAX_DATAGRAMS][CMSG_SPACE(sizeof(uint16_t))];
+#endif
+};
+
+static void SetRecvAddress(RNS2RecvStruct *recvFromStruct, const sockaddr_storage *address)
+{
+#if CRABNET_SUPPORT_IPV6==1
+    if (address->ss_family == AF_INET)
+    {
+        memcpy(&recvFromStruct->systemAddress.address.addr4, address, sizeof(sockaddr_in));
+        recvFromStruct->systemAddress.debugPort = ntohs(recvFromStruct->systemAddress.address.addr4.sin_port);
+    }
+    else
+    {
+        memcpy(&recvFromStruct->systemAddress.address.addr6, address, sizeof(sockaddr_in6));
+        recvFromStruct->systemAddress.debugPort = ntohs(recvFromStruct->systemAddress.address.addr6.sin6_port);
+    }
+#else
+    const sockaddr_in *sa = (const sockaddr_in *) address;
+    recvFromStruct->systemAddress.SetPortNetworkOrder(sa->sin_port);
+    recvFromStruct->systemAddress.address.addr4.sin_addr.s_addr = sa->sin_addr.s_addr;
+#endif
+}
+
+RNS2_Berkley::RNS2DatagramBatch *RNS2_Berkley::AllocDatagramBatch(void)
+{
+    RNS2DatagramBatch *batch = new RNS2DatagramBatch;
+    memset(batch->recvStructs, 0, sizeof(batch->recvStructs));
+    batch->count = 0;
+    return batch;
+}
+
+void RNS2_Berkley::SetBatchedIO(bool enabled)
+{
+    if (enabled)
+    {
+        sendBatchMutex.Lock();
+        if (sendBatch == 0)
+            sendBatch = AllocDatagramBatch();
+        sendBatchMutex.Unlock();
+    }
+    else
+        FlushSendBatch();
+
+    batchedIO = enabled;
+}
+
+bool RNS2_Berkley::GetBatchedIO(void) const
+{
+    return batchedIO;
+}
+
+RNS2SendResult RNS2_Berkley::SendBatched(RNS2_SendParameters *sendParameters)
+{
+    if (batchedIO == false || sendParameters->ttl > 0 || sendParameters->length > MAXIMUM_MTU_SIZE)
+    {
+        // Anything queued earlier must go out first to preserve send order
+        FlushSendBatch();
+        return Send(sendParameters);
+    }
+
+    sendBatchMutex.Lock();
+    RNS2DatagramBatch *batch = sendBatch;
+    unsigned int i = batch->count;
+    memcpy(batch->data[i], sendParameters->data, sendParameters->length);
+    batch->iov[i].iov_base = batch->data[i];
+    batch->iov[i].iov_len = sendParameters->length;
+    memset(&batch->msgs[i], 0, sizeof(mmsghdr));
+    batch->msgs[i].msg_hdr.msg_name = &batch->addresses[i];
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    if (sendParameters->systemAddress.address.addr4.sin_family == AF_INET)
+    {
+        memcpy(&batch->addresses[i], &sendParameters->systemAddress.address.addr4, sizeof(sockaddr_in));
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+    else
+    {
+#if CRABNET_SUPPORT_IPV6==1
+        memcpy(&batch->addresses[i], &sendParameters->systemAddress.address.addr6, sizeof(sockaddr_in6));
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+#else
+        sendBatchMutex.Unlock();
+        return -1;
+#endif
+    }
+    bool batchFull = ++batch->count == BATCHED_IO_MAX_DATAGRAMS;
+    sendBatchMutex.Unlock();
+
+    if (batchFull)
+        FlushSendBatch();
+    return sendParameters->length;
+}
+
+void RNS2_Berkley::FlushSendBatch(void)
+{
+    if (sendBatch == 0)
+        return;
+
+    sendBatchMutex.Lock();
+    RNS2DatagramBatch *batch = sendBatch;
+    unsigned int offset = 0;
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    if (segmentationOffload)
+        offset = FlushSendBatchSegmented(batch);
+#endif
+    while (offset < batch->count)
+    {
+        int sent = sendmmsg(rns2Socket, batch->msgs + offset, batch->count - offset, 0);
+        sendCalls++;
+        if (sent <= 0)
+        {
+            // The first datagram in the range failed. Drop it, as Send() would, and write the rest
+            CRABNET_DEBUG_PRINTF("sendmmsg failed with code %i for char %i and length %i.\n", errno,
+                                 batch->data[offset][0], (int) batch->iov[offset].iov_len);
+            offset++;
+        }
+        else
+            offset += (unsigned int) sent;
+    }
+    datagramsSent += batch->count;
+    batch->count = 0;
+    sendBatchMutex.Unlock();
+}
+
+void RNS2_Berkley::RecvFromBatched(void)
+{
+    if (recvBatch == 0)
+        recvBatch = AllocDatagramBatch();
+
+    RNS2DatagramBatch *batch = recvBatch;
+    unsigned int count;
+    for (count = 0; count < BATCHED_IO_MAX_DATAGRAMS; count++)
+    {
+        if (batch->recvStructs[count] == 0)
+        {
+            batch->recvStructs[count] = binding.eventHandler->AllocRNS2RecvStruct();
+            if (batch->recvStructs[count] == 0)
+                break;
+        }
+        batch->iov[count].iov_base = batch->recvStructs[count]->data;
+        batch->iov[count].iov_len = sizeof(batch->recvStructs[count]->data);
+        memset(&batch->msgs[count], 0, sizeof(mmsghdr));
+        batch->msgs[count].msg_hdr.msg_name = &batch->addresses[count];
+        batch->msgs[count].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        batch->msgs[count].msg_hdr.msg_iov = &batch->iov[count];
+        batch->msgs[count].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (count == 0)
+    {
+        RakSleep(0);
+        return;
+    }
+
+    // Blocks until at least one datagram arrives, then takes whatever else is already queued
+    int received = recvmmsg(rns2Socket, batch->msgs, count, MSG_WAITFORONE, 0);
+    recvCalls++;
+    if (received <= 0)
+    {
+        RakSleep(0);
+        return;
+    }
+
+    RakNet::TimeUS timeRead = RakNet::GetTimeUS();
+    datagramsReceived += received;
+    for (int i = 0; i < received; i++)
+    {
+        RNS2RecvStruct *recvFromStruct = batch->recvStructs[i];
+        batch->recvStructs[i] = 0;
+        recvFromStruct->socket = this;
+        recvFromStruct->bytesRead = (int) batch->msgs[i].msg_len;
+        recvFromStruct->timeRead = timeRead;
+        // Only part of a datagram coalesced with UDP_GRO, read before the polling thread switched to RecvFromCoalesced()
+        if (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            recvFromStruct->bytesRead = 0;
+        if (recvFromStruct->bytesRead <= 0)
+        {
+            binding.eventHandler->DeallocRNS2RecvStruct(recvFromStruct);
+            continue;
+        }
+
+        SetRecvAddress(recvFromStruct, &batch->addresses[i]);
+        RakAssert(recvFromStruct->systemAddress.GetPort());
+        binding.eventHandler->OnRNS2Recv(recvFromStruct);
+    }
+}
+
+void RNS2_Berkley::ReleaseRecvBatch(void)
+{
+    if (recvBatch == 0)
+        return;
+
+    for (unsigned int i = 0; i < BATCHED_IO_MAX_DATAGRAMS; i++)
+    {
+        if (recvBatch->recvStructs[i])
+        {
+            binding.eventHandler->DeallocRNS2RecvStruct(recvBatch->recvStructs[i]);
+            recvBatch->recvStructs[i] = 0;
+        }
+    }
+}
+
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+
+struct RNS2_Berkley::RNS2CoalescedRecvBatch
+{
+    mmsghdr msgs[UDP_GRO_MAX_BUFFERS];
+    iovec iov[UDP_GRO_MAX_BUFFERS];
+    sockaddr_storage addresses[UDP_GRO_MAX_BUFFERS];
+    char control[UDP_GRO_MAX_BUFFERS][CMSG_SPACE(sizeof(int))];
+    char data[UDP_GRO_MAX_BUFFERS][65536];
+};
+
+bool RNS2_Berkley::SetSegmentationOffload(bool enabled)
+{
+    if (enabled)
+    {
+        // Fails on kernels without UDP_SEGMENT. A default segment size of 0 leaves writes without the control message unsegmented
+        int segmentSize = 0;
+        if (setsockopt(rns2Socket, SOL_UDP, UDP_SEGMENT, (char *) &segmentSize, sizeof(segmentSize)) != 0)
+            return false;
+
+        // Read into large buffers before the kernel can start coalescing
+        receiveOffload = true;
+        int gro = 1;
+        if (setsockopt(rns2Socket, SOL_UDP, UDP_GRO, (char *) &gro, sizeof(gro)) != 0)
+            receiveOffload = false;
+        else
+        {
+            // A coalesced buffer is charged to the receive buffer as a whole, so the 256 KB from SetSocketOptions() only holds a few
+            // before the kernel drops whole runs of datagrams. Make room for two recvmmsg calls of them
+            int sock_opt = 65536 * UDP_GRO_MAX_BUFFERS * 2;
+            setsockopt(rns2Socket, SOL_SOCKET, SO_RCVBUF, (char *) &sock_opt, sizeof(sock_opt));
+        }
+    }
+    else if (receiveOffload)
+    {
+        int gro = 0;
+        setsockopt(rns2Socket, SOL_UDP, UDP_GRO, (char *) &gro, sizeof(gro));
+        receiveOffload = false;
+        SetSocketOptions();
+    }
+
+    segmentationOffload = enabled;
+    return true;
+}
+
+bool RNS2_Berkley::GetSegmentationOffload(void) const
+{
+    return segmentationOffload;
+}
+
+unsigned int RNS2_Berkley::FlushSendBatchSegmented(RNS2DatagramBatch *batch)
+{
+    // Group the datagrams into runs to the same address, where each datagram but the last is the same size and the last is no larger.
+    // The kernel cuts a run back into its datagrams at that size
+    unsigned int numMsgs = 0;
+    for (unsigned int first = 0; first < batch->count; numMsgs++)
+    {
+        size_t segmentSize = batch->iov[first].iov_len;
+        socklen_t addressLength = batch->msgs[first].msg_hdr.msg_namelen;
+        unsigned int runLength = 1;
+        while (first + runLength < batch->count && runLength < UDP_SEGMENT_MAX_SEGMENTS &&
+               (runLength + 1) * segmentSize <= UDP_SEGMENT_MAX_BYTES)
+        {
+            unsigned int next = first + runLength;
+            if (batch->iov[next].iov_len > segmentSize ||
+                batch->msgs[next].msg_hdr.msg_namelen != addressLength ||
+                memcmp(&batch->addresses[next], &batch->addresses[first], addressLength) != 0)
+                break;
+            runLength++;
+            if (batch->iov[next].iov_len < segmentSize)
+                break;
+        }
+
+        mmsghdr *msg = &batch->segmentedMsgs[numMsgs];
+        *msg = batch->msgs[first];
+        msg->msg_hdr.msg_iovlen = runLength;
+        if (runLength > 1)
+        {
+            msg->msg_hdr.msg_control = batch->control[numMsgs];
+            msg->msg_hdr.msg_controllen = sizeof(batch->control[numMsgs]);
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&msg->msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gsoSize = (uint16_t) segmentSize;
+            memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+        }
+        batch->segmentedFirst[numMsgs] = first;
+        first += runLength;
+    }
+
+    unsigned int offset = 0;
+    while (offset < numMsgs)
+    {
+        int sent = sendmmsg(rns2Socket, batch->segmentedMsgs + offset, numMsgs - offset, 0);
+        sendCalls++;
+        if (sent > 0)
+        {
+            offset += (unsigned int) sent;
+            continue;
+        }
+
+        unsigned int first = batch->segmentedFirst[offset];
+        if (batch->segmentedMsgs[offset].msg_hdr.msg_iovlen > 1)
+        {
+            // Usually EIO, from a device that cannot checksum coalesced datagrams. Write this run and everything after it one datagram at a time
+            CRABNET_DEBUG_PRINTF("sendmmsg with UDP_SEGMENT failed with code %i. Writing one datagram per message from now on.\n", errno);
+            segmentationOffload = false;
+            return first;
+        }
+
+        // Drop it, as Send() would, and write the rest
+        CRABNET_DEBUG_PRINTF("sendmmsg failed with code %i for char %i and length %i.\n", errno,
+                             batch->data[first][0], (int) batch->iov[first].iov_len);
+        offset++;
+    }
+    return batch->count;
+}
+
+void RNS2_Berkley::RecvFromCoalesced(void)
+{
+    if (coalescedRecvBatch == 0)
+        coalescedRecvBatch = new RNS2CoalescedRecvBatch;
+
+    RNS2CoalescedRecvBatch *batch = coalescedRecvBatch;
+    for (unsigned int i = 0; i < UDP_GRO_MAX_BUFFERS; i++)
+    {
+        batch->iov[i].iov_base = batch->data[i];
+        batch->iov[i].iov_len = sizeof(batch->data[i]);
+        memset(&batch->msgs[i], 0, sizeof(mmsghdr));
+        batch->msgs[i].msg_hdr.msg_name = &batch->addresses[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_control = batch->control[i];
+        batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->control[i]);
+    }
+
+    // Blocks until at least one buffer arrives, then takes whatever else is already queued
+    int received = recvmmsg(rns2Socket, batch->msgs, UDP_GRO_MAX_BUFFERS, MSG_WAITFORONE, 0);
+    recvCalls++;
+    if (received <= 0)
+    {
+        RakSleep(0);
+        return;
+    }
+
+    RakNet::TimeUS timeRead = RakNet::GetTimeUS();
+    for (int i = 0; i < received; i++)
+    {
+        msghdr *hdr = &batch->msgs[i].msg_hdr;
+        unsigned int length = batch->msgs[i].msg_len;
+        if (hdr->msg_flags & MSG_TRUNC)
+            continue;
+
+        // Without a UDP_GRO control message the buffer holds a single datagram
+        unsigned int segmentSize = length;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != 0; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int gsoSize;
+                memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                if (gsoSize > 0)
+                    segmentSize = (unsigned int) gsoSize;
+            }
+        }
+
+        for (unsigned int offset = 0; offset < length; offset += segmentSize)
+        {
+            unsigned int bytesRead = length - offset < segmentSize ? length - offset : segmentSize;
+            // recvfrom would have truncated it
+            if (bytesRead > MAXIMUM_MTU_SIZE)
+                break;
+            RNS2RecvStruct *recvFromStruct = binding.eventHandler->AllocRNS2RecvStruct();
+            if (recvFromStruct == 0)
+                break;
+
+            memcpy(recvFromStruct->data, batch->data[i] + offset, bytesRead);
+            recvFromStruct->socket = this;
+            recvFromStruct->bytesRead = (int) bytesRead;
+            recvFromStruct->timeRead = timeRead;
+            SetRecvAddress(recvFromStruct, &batch->addresses[i]);
+            datagramsReceived++;
+            RakAssert(recvFromStruct->systemAddress.GetPort());
+            binding.eventHandler->OnRNS2Recv(recvFromStruct);
+        }
+    }
+}
+
+#endif // CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+
+#endif // CRABNET_SUPPORT_BATCHED_IO==1
+
 #endif // !defined(__native_client__)
 
 #endif // file header
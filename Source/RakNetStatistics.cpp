@@ -14,6 +14,7 @@
 
 #include "RakNetStatistics.h"
 #include <stdio.h> // sprintf
+#include <string.h> // memset, strcat
 #include "GetTime.h"
 #include "RakString.h"
 
@@ -148,5 +149,200 @@ void RAK_DLL_EXPORT RakNet::StatisticsToString(RakNetStatistics *s, char *buffer
             );
             strcat(buffer, buff2);
         }
+        if (s->parityDatagramsSent != 0 || s->datagramsRecovered != 0)
+        {
+            char buff2[192];
+            sprintf(buff2, "Datagram loss                        %.1f%%\n"
+                           "Parity datagrams sent                %" PRINTF_64_BIT_MODIFIER "u\n"
+                           "Datagrams recovered from parity      %" PRINTF_64_BIT_MODIFIER "u\n",
+                    s->datagramLossRate * 100.0f,
+                    (long long unsigned int) s->parityDatagramsSent,
+                    (long long unsigned int) s->datagramsRecovered
+            );
+            strcat(buffer, buff2);
+        }
+        if (s->compressionBytesIn != 0 || s->decompressionTimeUS != 0 || s->messagesNotDecompressed != 0)
+        {
+            char buff2[384];
+            sprintf(buff2, "Compression ratio                    %.3f\n"
+                           "Bytes before and after compression   %" PRINTF_64_BIT_MODIFIER "u, %" PRINTF_64_BIT_MODIFIER "u\n"
+                           "Messages not compressed              %" PRINTF_64_BIT_MODIFIER "u\n"
+                           "Messages not decompressed            %" PRINTF_64_BIT_MODIFIER "u\n"
+                           "Compression time in ms               %.1f\n"
+                           "Decompression time in ms             %.1f\n",
+                    s->compressionBytesIn != 0 ? (double) s->compressionBytesOut / (double) s->compressionBytesIn : 1.0,
+                    (long long unsigned int) s->compressionBytesIn,
+                    (long long unsigned int) s->compressionBytesOut,
+                    (long long unsigned int) s->messagesNotCompressed,
+                    (long long unsigned int) s->messagesNotDecompressed,
+                    s->compressionTimeUS / 1000.0,
+                    s->decompressionTimeUS / 1000.0
+            );
+            strcat(buffer, buff2);
+        }
+    }
+}
+
+void LatencyHistogram::Clear(void)
+{
+    memset(counts, 0, sizeof(counts));
+    totalCount=0;
+    sum=0;
+    max=0;
+}
+
+unsigned int LatencyHistogram::GetBucketIndex(uint64_t valueUS)
+{
+    if (valueUS < SUB_BUCKET_COUNT)
+        return (unsigned int) valueUS;
+    if (valueUS >> 32)
+        return BUCKET_COUNT-1;
+
+    // Index of the highest set bit, by binary search
+    unsigned int highestBit=0;
+    uint32_t v=(uint32_t) valueUS;
+    if (v >> 16) {v>>=16; highestBit+=16;}
+    if (v >> 8) {v>>=8; highestBit+=8;}
+    if (v >> 4) {v>>=4; highestBit+=4;}
+    if (v >> 2) {v>>=2; highestBit+=2;}
+    if (v >> 1) {highestBit+=1;}
+
+    // The bits just below the highest set bit pick the sub-bucket
+    unsigned int shift=highestBit-SUB_BUCKET_BITS;
+    return SUB_BUCKET_COUNT + shift*SUB_BUCKET_COUNT + (unsigned int) ((valueUS >> shift) & (SUB_BUCKET_COUNT-1));
+}
+
+uint64_t LatencyHistogram::GetBucketUpperBound(unsigned int bucketIndex)
+{
+    if (bucketIndex < SUB_BUCKET_COUNT)
+        return bucketIndex;
+    unsigned int shift=(bucketIndex-SUB_BUCKET_COUNT)/SUB_BUCKET_COUNT;
+    uint64_t subBucket=(bucketIndex-SUB_BUCKET_COUNT)%SUB_BUCKET_COUNT;
+    return ((SUB_BUCKET_COUNT+subBucket+1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t valueUS)
+{
+    counts[GetBucketIndex(valueUS)]++;
+    totalCount++;
+    sum+=valueUS;
+    if (valueUS > max)
+        max=valueUS;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (totalCount==0)
+        return 0;
+
+    uint64_t target=(uint64_t) (percentile * (double) totalCount / 100.0 + 0.5);
+    if (target < 1)
+        target=1;
+    if (target > totalCount)
+        target=totalCount;
+
+    uint64_t seen=0;
+    for (unsigned int i=0; i < BUCKET_COUNT; i++)
+    {
+        seen+=counts[i];
+        if (seen >= target)
+        {
+            uint64_t upperBound=GetBucketUpperBound(i);
+            return upperBound < max ? upperBound : max;
+        }
+    }
+    return max;
+}
+
+LatencyHistogram& LatencyHistogram::operator +=(const LatencyHistogram& other)
+{
+    for (unsigned int i=0; i < BUCKET_COUNT; i++)
+        counts[i]+=other.counts[i];
+    totalCount+=other.totalCount;
+    sum+=other.sum;
+    if (other.max > max)
+        max=other.max;
+    return *this;
+}
+
+LatencyHistogram& LatencyHistogram::operator -=(const LatencyHistogram& other)
+{
+    for (unsigned int i=0; i < BUCKET_COUNT; i++)
+        counts[i]-=other.counts[i];
+    totalCount-=other.totalCount;
+    sum-=other.sum;
+    return *this;
+}
+
+void RakNetTickProfile::Clear(void)
+{
+    for (unsigned int i=0; i < RNS_TICK_PHASE_COUNT; i++)
+    {
+        phaseTimeUS[i]=0;
+        phaseCount[i]=0;
+    }
+    for (unsigned int i=0; i < RNS_LATENCY_METRIC_COUNT; i++)
+        latency[i].Clear();
+}
+
+RakNetTickProfile& RakNetTickProfile::operator +=(const RakNetTickProfile& other)
+{
+    for (unsigned int i=0; i < RNS_TICK_PHASE_COUNT; i++)
+    {
+        phaseTimeUS[i]+=other.phaseTimeUS[i];
+        phaseCount[i]+=other.phaseCount[i];
+    }
+    for (unsigned int i=0; i < RNS_LATENCY_METRIC_COUNT; i++)
+        latency[i]+=other.latency[i];
+    return *this;
+}
+
+RakNetTickProfile& RakNetTickProfile::operator -=(const RakNetTickProfile& other)
+{
+    for (unsigned int i=0; i < RNS_TICK_PHASE_COUNT; i++)
+    {
+        phaseTimeUS[i]-=other.phaseTimeUS[i];
+        phaseCount[i]-=other.phaseCount[i];
+    }
+    for (unsigned int i=0; i < RNS_LATENCY_METRIC_COUNT; i++)
+        latency[i]-=other.latency[i];
+    return *this;
+}
+
+void RAK_DLL_EXPORT RakNet::TickProfileToString( const RakNetTickProfile *p, char *buffer )
+{
+    static const char *phaseNames[RNS_TICK_PHASE_COUNT] =
+    {
+        "Datagram parse  ",
+        "ACK processing  ",
+        "Resend scan     ",
+        "SendBitStream   ",
+        "Plugin callbacks",
+        "Receive handoff ",
+    };
+    static const char *latencyNames[RNS_LATENCY_METRIC_COUNT] =
+    {
+        "Send to wire    ",
+        "Wire to receive ",
+    };
+
+    buffer[0]=0;
+    if (p == 0)
+        return;
+
+    char line[256];
+    for (unsigned int i=0; i < RNS_TICK_PHASE_COUNT; i++)
+    {
+        sprintf(line, "%s %" PRINTF_64_BIT_MODIFIER "u us in %" PRINTF_64_BIT_MODIFIER "u calls\n", phaseNames[i],
+                (long long unsigned int) p->phaseTimeUS[i], (long long unsigned int) p->phaseCount[i]);
+        strcat(buffer, line);
+    }
+    for (unsigned int i=0; i < RNS_LATENCY_METRIC_COUNT; i++)
+    {
+        const LatencyHistogram &h=p->latency[i];
+        sprintf(line, "%s mean %" PRINTF_64_BIT_MODIFIER "u us, p50 %" PRINTF_64_BIT_MODIFIER "u us, p99 %" PRINTF_64_BIT_MODIFIER "u us, max %" PRINTF_64_BIT_MODIFIER "u us over %" PRINTF_64_BIT_MODIFIER "u messages\n",
+                latencyNames[i], (long long unsigned int) h.GetMean(), (long long unsigned int) h.GetPercentile(50.0),
+                (long long unsigned int) h.GetPercentile(99.0), (long long unsigned int) h.max, (long long unsigned int) h.totalCount);
+        strcat(buffer, line);
     }
 }
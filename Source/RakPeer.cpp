@@ -35,6 +35,7 @@
 // #endif
 
 #include <time.h>
+#include <random>
 #include <ctype.h> // toupper
 #include <string.h>
 #include "GetTime.h"
@@ -54,6 +55,7 @@
 #include "SignaledEvent.h"
 #include "SuperFastHash.h"
 #include "RakAlloca.h"
+#include "PacketArena.h"
 
 #ifdef USE_THREADED_SEND
 #include "SendToThread.h"
@@ -68,6 +70,7 @@
 namespace RakNet
 {
     RAK_THREAD_DECLARATION(UpdateNetworkLoop);
+    RAK_THREAD_DECLARATION(UpdateShardLoop);
     RAK_THREAD_DECLARATION(RecvFromLoop);
     RAK_THREAD_DECLARATION(UDTConnect);
 }
@@ -125,6 +128,9 @@ struct RakPeerAndIndex
 };
 */
 
+// Datagrams taken from bufferedPacketsQueue at a time by the update thread
+static const unsigned int BUFFERED_PACKETS_POP_BATCH = 32;
+
 static const unsigned int MAX_OFFLINE_DATA_LENGTH = 400; // I set this because I limit ID_CONNECTION_REQUEST to 512 bytes, and the password is appended to that packet.
 
 // Used to distinguish between offline messages with data, and messages from the reliability layer
@@ -137,53 +143,24 @@ static const unsigned char OFFLINE_MESSAGE_DATA_ID[16] = {
         0x00, 0xFF, 0xFF, 0x00, 0xFE, 0xFE, 0xFE, 0xFE, 0xFD, 0xFD, 0xFD, 0xFD, 0x12, 0x34, 0x56, 0x78
 };
 
-struct PacketFollowedByData
-{
-    Packet p;
-    unsigned char data[1];
-};
-
 Packet *RakPeer::AllocPacket(unsigned dataSize)
 {
-    // Crashes when dataSize is 4 bytes - not sure why
-//     unsigned char *data = (unsigned char *) malloc(sizeof(PacketFollowedByData)+dataSize);
-//     Packet *p = &((PacketFollowedByData *)data)->p;
-//     p->data=((PacketFollowedByData *)data)->data;
-//     p->length=dataSize;
-//     p->bitSize=BYTES_TO_BITS(dataSize);
-//     p->deleteData=false;
-//     p->guid=UNASSIGNED_CRABNET_GUID;
-//     return p;
-
-    RakNet::Packet *p;
-    packetAllocationPoolMutex.Lock();
-    p = packetAllocationPool.Allocate();
-    packetAllocationPoolMutex.Unlock();
-    p = new((void *) p) Packet;
-    p->data = (unsigned char *) malloc(dataSize);
-    p->length = dataSize;
-    p->bitSize = BYTES_TO_BITS(dataSize);
-    p->deleteData = true;
+    // The data follows the Packet in the same block
+    RakNet::Packet *p = PacketArena::Allocate(dataSize);
+    RakAssert(p);
     p->guid = UNASSIGNED_CRABNET_GUID;
     p->wasGeneratedLocally = false;
+    p->timeRead = 0;
     return p;
 }
 
 Packet *RakPeer::AllocPacket(unsigned dataSize, unsigned char *data)
 {
-    // Packet *p = (Packet *)malloc(sizeof(Packet));
-    RakNet::Packet *p;
-    packetAllocationPoolMutex.Lock();
-    p = packetAllocationPool.Allocate();
-    packetAllocationPoolMutex.Unlock();
-    p = new((void *) p) Packet;
-    RakAssert(p);
-    p->data = data;
-    p->length = dataSize;
-    p->bitSize = BYTES_TO_BITS(dataSize);
-    p->deleteData = true;
+    // Messages from the reliability layer already sit in a Packet block, so this only fills in the header
+    RakNet::Packet *p = PacketArena::GetPacket(data, dataSize);
     p->guid = UNASSIGNED_CRABNET_GUID;
     p->wasGeneratedLocally = false;
+    p->timeRead = 0;
     return p;
 }
 
@@ -215,7 +192,9 @@ RakPeer::RakPeer()
     remoteSystemList = 0;
     activeSystemList = 0;
     activeSystemListSize = 0;
+    remoteSystemsToUpdate = 0;
     remoteSystemLookup = 0;
+    nextBanTablePruneTime = 0;
     bytesSentPerSecond = bytesReceivedPerSecond = 0;
     endThreads = true;
     isMainLoopThreadActive = false;
@@ -231,11 +210,33 @@ RakPeer::RakPeer()
     for (unsigned int i = 0; i < MAXIMUM_NUMBER_OF_INTERNAL_IDS; i++)
         ipList[i] = UNASSIGNED_SYSTEM_ADDRESS;
     allowConnectionResponseIPMigration = false;
+    allowSessionResumption = false;
+    batchedDatagramIO = false;
+    udpSegmentationOffload = false;
+    numberOfUpdateShards = 1;
+    bufferedPacketsFreePool.Init(BUFFERED_PACKETS_QUEUE_SIZE);
+    bufferedPacketsQueue.Init(BUFFERED_PACKETS_QUEUE_SIZE);
+    bufferedPacketsOverflowQueueSize = 0;
+    endUpdateShardThreads = true;
+    updateShardsRunning = 0;
+    updateShardsTime = 0;
     //incomingPasswordLength=outgoingPasswordLength=0;
     incomingPasswordLength = 0;
     splitMessageProgressInterval = 0;
+    tickProfiling = false;
     //unreliableTimeout=0;
     unreliableTimeout = 1000;
+    forwardErrorCorrectionChannels = 0;
+#if USE_SLIDING_WINDOW_CONGESTION_CONTROL == 1
+    defaultCongestionControl = CC_SLIDING_WINDOW;
+#else
+    defaultCongestionControl = CC_UDT;
+#endif
+    defaultCoalescingWindow = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_ORDERED_STREAMS; i++)
+        channelCompression[i] = MC_NONE;
+    for (unsigned int i = 0; i < NUMBER_OF_RELIABILITIES; i++)
+        reliabilityCompression[i] = MC_NONE;
     maxOutgoingBPS = 0;
     firstExternalID = UNASSIGNED_SYSTEM_ADDRESS;
     myGuid = UNASSIGNED_CRABNET_GUID;
@@ -258,16 +259,17 @@ RakPeer::RakPeer()
     bufferedCommands.SetPageSize(sizeof(BufferedCommandStruct) * 16);
     socketQueryOutput.SetPageSize(sizeof(SocketQueryOutput) * 8);
 
-    packetAllocationPoolMutex.Lock();
-    packetAllocationPool.SetPageSize(sizeof(DataStructures::MemoryPool<Packet>::MemoryWithPage) * 32);
-    packetAllocationPoolMutex.Unlock();
-
     remoteSystemIndexPool.SetPageSize(sizeof(DataStructures::MemoryPool<RemoteSystemIndex>::MemoryWithPage) * 32);
 
     GenerateGUID();
 
     quitAndDataEvents.InitEvent();
     limitConnectionFrequencyFromTheSameIP = false;
+    useConnectionCookies = false;
+    // Not seeded from the time like randomMT(), so the key cannot be guessed from when the instance was created
+    std::random_device randomDevice;
+    for (unsigned int i = 0; i < sizeof(connectionCookieSecret); i++)
+        connectionCookieSecret[i] = (unsigned char) randomDevice();
     ResetSendReceipt();
 }
 
@@ -491,10 +493,27 @@ br == BR_REQUIRES_CRABNET_SUPPORT_IPV6_DEFINE)
 #endif
         */
 
+#if CRABNET_SUPPORT_BATCHED_IO == 1
+        if (batchedDatagramIO && r2->IsBerkleySocket())
+            ((RNS2_Berkley *) r2)->SetBatchedIO(true);
+#endif
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD == 1
+        if (udpSegmentationOffload && r2->IsBerkleySocket())
+            ((RNS2_Berkley *) r2)->SetSegmentationOffload(true);
+#endif
+
         socketList.Push(r2);
 
     }
 
+    // Before the recv threads start, since OnRNS2Recv() routes datagrams to the shards
+    if (!StartUpdateShards(threadPriority))
+    {
+        StopUpdateShards();
+        DerefAllSockets();
+        return FAILED_TO_CREATE_NETWORK_THREAD;
+    }
+
 #if !defined(__native_client__)
     for (i = 0; i < socketDescriptorCount; i++)
     {
@@ -540,6 +559,9 @@ br == BR_REQUIRES_CRABNET_SUPPORT_IPV6_DEFINE)
         remoteSystemLookup = new RemoteSystemIndex *[maximumNumberOfPeers * REMOTE_SYSTEM_LOOKUP_HASH_MULTIPLE];
 
         activeSystemList = new RemoteSystemStruct *[maximumNumberOfPeers];
+        remoteSystemsToUpdate = new unsigned int[maximumNumberOfPeers];
+        // 1 millisecond ticks, the resolution of WaitOnEvent()
+        remoteSystemUpdateTimers.Init(maximumNumberOfPeers, 1000, 256, RakNet::GetTimeUS());
 
         for (i = 0; i < maximumNumberOfPeers; i++)
             //for ( i = 0; i < remoteSystemListSize; i++ )
@@ -578,6 +600,7 @@ br == BR_REQUIRES_CRABNET_SUPPORT_IPV6_DEFINE)
 
         ClearBufferedCommands();
         ClearBufferedPackets();
+        SetupBufferedPackets();
         ClearSocketQueryOutput();
 
         if (isMainLoopThreadActive == false)
@@ -1081,6 +1104,8 @@ void RakPeer::Shutdown(unsigned int blockDuration, unsigned char orderingChannel
 
 #endif // RAKPEER_USER_THREADED!=1
 
+    StopUpdateShards();
+
 //    char c=0;
 //    unsigned int socketIndex;
     // remoteSystemList in Single thread
@@ -1107,9 +1132,6 @@ void RakPeer::Shutdown(unsigned int blockDuration, unsigned char orderingChannel
         DeallocatePacket(packetReturnQueue[i]);
     packetReturnQueue.Clear();
     packetReturnMutex.Unlock();
-    packetAllocationPoolMutex.Lock();
-    packetAllocationPool.Clear();
-    packetAllocationPoolMutex.Unlock();
 
     /*
     if (isRecvFromLoopThreadActive.GetValue()>0)
@@ -1138,6 +1160,9 @@ void RakPeer::Shutdown(unsigned int blockDuration, unsigned char orderingChannel
     delete[] temp;
     delete[] activeSystemList;
     activeSystemList = 0;
+    delete[] remoteSystemsToUpdate;
+    remoteSystemsToUpdate = 0;
+    remoteSystemUpdateTimers.Clear();
 
     ClearRemoteSystemLookup();
 
@@ -1398,6 +1423,84 @@ uint32_t RakPeer::SendList(const char **data, const int *lengths, const int numP
     return usedSendReceipt;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+uint32_t RakPeer::SendGather(const SendBuffer *buffers, const int numberOfBuffers, PacketPriority priority,
+                             PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier,
+                             bool broadcast, SendBufferReleaseCallback releaseCallback, void *releaseContext,
+                             uint32_t forceReceiptNumber)
+{
+    RakAssert(!(reliability >= NUMBER_OF_RELIABILITIES || reliability < 0));
+    RakAssert(!(priority > NUMBER_OF_PRIORITIES || priority < 0));
+    RakAssert(!(orderingChannel >= NUMBER_OF_ORDERED_STREAMS));
+
+    unsigned int totalLength = 0;
+    if (buffers != 0)
+    {
+        for (int i = 0; i < numberOfBuffers; i++)
+            totalLength += buffers[i].length;
+    }
+
+    // The buffers are released exactly once, even when they are not sent
+    if (totalLength == 0 || remoteSystemList == 0 || endThreads == true ||
+        (broadcast == false && systemIdentifier.IsUndefined()))
+    {
+        if (releaseCallback)
+            releaseCallback(releaseContext);
+        return 0;
+    }
+
+    uint32_t usedSendReceipt;
+    if (forceReceiptNumber != 0)
+        usedSendReceipt = forceReceiptNumber;
+    else
+        usedSendReceipt = IncrementNextSendReceipt();
+
+    if (broadcast == false && IsLoopbackAddress(systemIdentifier, true))
+    {
+        Packet *packet = AllocPacket(totalLength);
+        for (unsigned int i = 0, offset = 0; i < (unsigned int) numberOfBuffers; offset += buffers[i++].length)
+            memcpy(packet->data + offset, buffers[i].data, buffers[i].length);
+        packet->systemAddress = GetLoopbackAddress();
+        packet->guid = myGuid;
+        PushBackPacket(packet, false);
+        if (releaseCallback)
+            releaseCallback(releaseContext);
+
+        if (reliability >= UNRELIABLE_WITH_ACK_RECEIPT)
+        {
+            char buff[5];
+            buff[0] = ID_SND_RECEIPT_ACKED;
+            sendReceiptSerialMutex.Lock();
+            memcpy(buff + 1, &sendReceiptSerial, 4);
+            sendReceiptSerialMutex.Unlock();
+            SendLoopback(buff, 5);
+        }
+        return usedSendReceipt;
+    }
+
+    // Only the list of buffers is copied here. The reliability layers reference them until they are written to datagrams
+    BufferedCommandStruct *bcs = bufferedCommands.Allocate();
+    bcs->data = 0;
+    bcs->sharedData = ReliabilityLayer::AllocateGatherData(buffers, (unsigned int) numberOfBuffers, releaseCallback,
+                                                           releaseContext);
+    bcs->numberOfBitsToSend = BYTES_TO_BITS(totalLength);
+    bcs->priority = priority;
+    bcs->reliability = reliability;
+    bcs->orderingChannel = orderingChannel;
+    bcs->systemIdentifier = systemIdentifier;
+    bcs->broadcast = broadcast;
+    bcs->connectionMode = RemoteSystemStruct::NO_ACTION;
+    bcs->receipt = usedSendReceipt;
+    bcs->queueTime = tickProfiling ? RakNet::GetTimeUS() : 0;
+    bcs->command = BufferedCommandStruct::BCS_SEND;
+    bufferedCommands.Push(bcs);
+
+    if (priority == IMMEDIATE_PRIORITY)
+        quitAndDataEvents.SetEvent(); // Forces pending sends to go out now, rather than waiting to the next update interval
+
+    return usedSendReceipt;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Gets a packet from the incoming packet queue. Use DeallocatePacket to deallocate the packet after you are done with it.
@@ -1539,6 +1642,19 @@ Packet *RakPeer::Receive(void)
     RakAssert(packet->data);
 #endif
 
+    if (packet->timeRead != 0)
+    {
+        // Only set on user messages from connected systems, and only while tick profiling
+        unsigned int index = packet->systemAddress.systemIndex;
+        if (index < maximumNumberOfPeers && remoteSystemList[index].isActive &&
+            remoteSystemList[index].systemAddress == packet->systemAddress)
+        {
+            RakNet::TimeUS timeNS = RakNet::GetTimeUS();
+            remoteSystemList[index].reliabilityLayer.RecordLatency(LATENCY_WIRE_TO_RECEIVE,
+                                                                   timeNS > packet->timeRead ? timeNS - packet->timeRead : 0);
+        }
+    }
+
     return packet;
 }
 
@@ -1553,14 +1669,12 @@ void RakPeer::DeallocatePacket(Packet *packet)
 
     if (packet->deleteData)
     {
-        free(packet->data);
-        packet->~Packet();
-        packetAllocationPoolMutex.Lock();
-        packetAllocationPool.Release(packet);
-        packetAllocationPoolMutex.Unlock();
+        // May be on a different thread than the one that allocated it
+        PacketArena::Free(packet);
     }
     else
     {
+        // Not from AllocatePacket(), but pushed with PushBackPacket() as one block with its data, from malloc
         free(packet);
     }
 }
@@ -1813,6 +1927,15 @@ void RakPeer::AddToBanList(const char *IP, RakNet::TimeMS milliseconds)
     if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
         return;
 
+    // Dotted IPs and trailing wildcards such as 128.0.0.* are address prefixes, which IsBanned() finds without formatting the address
+    SystemAddress address;
+    unsigned int prefixLength;
+    if (DataStructures::BanTable::ParseIPv4Prefix(IP, address, prefixLength))
+    {
+        AddToBanList(address, prefixLength, milliseconds);
+        return;
+    }
+
     // If this guy is already in the ban list, do nothing
     index = 0;
 
@@ -1847,6 +1970,20 @@ void RakPeer::AddToBanList(const char *IP, RakNet::TimeMS milliseconds)
     banListMutex.Unlock();
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::AddToBanList(const SystemAddress &address, unsigned int prefixLength, RakNet::TimeMS milliseconds)
+{
+    RakNet::TimeMS timeout;
+    if (milliseconds == 0)
+        timeout = 0; // Infinite
+    else
+        timeout = RakNet::GetTimeMS() + milliseconds;
+
+    banListMutex.Lock();
+    banTable.Add(address, prefixLength, timeout);
+    banListMutex.Unlock();
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Allows a previously banned IP to connect.
@@ -1863,6 +2000,14 @@ void RakPeer::RemoveFromBanList(const char *IP)
     if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
         return;
 
+    SystemAddress address;
+    unsigned int prefixLength;
+    if (DataStructures::BanTable::ParseIPv4Prefix(IP, address, prefixLength))
+    {
+        RemoveFromBanList(address, prefixLength);
+        return;
+    }
+
     index = 0;
     temp = 0;
 
@@ -1889,6 +2034,14 @@ void RakPeer::RemoveFromBanList(const char *IP)
 
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::RemoveFromBanList(const SystemAddress &address, unsigned int prefixLength)
+{
+    banListMutex.Lock();
+    banTable.Remove(address, prefixLength);
+    banListMutex.Unlock();
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Allows all previously banned IPs to connect.
@@ -1906,6 +2059,7 @@ void RakPeer::ClearBanList(void)
     }
 
     banList.Clear(false);
+    banTable.Clear();
 
     banListMutex.Unlock();
 }
@@ -1916,6 +2070,164 @@ void RakPeer::SetLimitIPConnectionFrequency(bool b)
     limitConnectionFrequencyFromTheSameIP = b;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetConnectionCookies(bool b)
+{
+    useConnectionCookies = b;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+uint32_t RakPeer::GenerateConnectionCookie(const SystemAddress &systemAddress, uint32_t window)
+{
+    // Only the port and IP are hashed. The rest of the address union is not always zeroed
+    unsigned char input[sizeof(uint32_t) + sizeof(uint16_t) + 16];
+    unsigned int inputLength = 0;
+    memcpy(input + inputLength, &window, sizeof(window));
+    inputLength += sizeof(window);
+    memcpy(input + inputLength, &systemAddress.address.addr4.sin_port, sizeof(uint16_t));
+    inputLength += sizeof(uint16_t);
+#if CRABNET_SUPPORT_IPV6 == 1
+    if (systemAddress.GetIPVersion() == 6)
+    {
+        memcpy(input + inputLength, &systemAddress.address.addr6.sin6_addr, 16);
+        inputLength += 16;
+    }
+    else
+#endif
+    {
+        memcpy(input + inputLength, &systemAddress.address.addr4.sin_addr, 4);
+        inputLength += 4;
+    }
+
+    unsigned char hmac[SHA1_LENGTH];
+    CSHA1::HMAC(connectionCookieSecret, sizeof(connectionCookieSecret), input, (int) inputLength, hmac);
+    uint32_t cookie;
+    memcpy(&cookie, hmac, sizeof(cookie));
+    return cookie;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::VerifyConnectionCookie(const SystemAddress &systemAddress, uint32_t cookie)
+{
+    uint32_t window = RakNet::GetTimeMS() / CONNECTION_COOKIE_WINDOW_MS;
+    return cookie == GenerateConnectionCookie(systemAddress, window) ||
+           cookie == GenerateConnectionCookie(systemAddress, window - 1);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SendSessionToken(RemoteSystemStruct *remoteSystem)
+{
+    if (!allowSessionResumption || remoteSystem->sentSessionToken)
+        return;
+
+    // Not seeded from the time like randomMT(), so the token cannot be guessed from when the connection was made
+    std::random_device randomDevice;
+    for (unsigned int i = 0; i < SESSION_TOKEN_LENGTH; i++)
+        remoteSystem->sessionToken[i] = (unsigned char) randomDevice();
+    remoteSystem->sentSessionToken = true;
+
+    RakNet::BitStream bs;
+    bs.Write((MessageID) ID_SESSION_TOKEN);
+    bs.WriteAlignedBytes(remoteSystem->sessionToken, SESSION_TOKEN_LENGTH);
+    SendImmediate((char *) bs.GetData(), bs.GetNumberOfBitsUsed(), IMMEDIATE_PRIORITY, RELIABLE_ORDERED, 0,
+                  remoteSystem->systemAddress, false, false, RakNet::GetTimeUS(), 0);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SendSessionResumeRequest(RemoteSystemStruct *remoteSystem, RakNet::TimeMS timeMS)
+{
+    remoteSystem->lastSessionResumeRequestTime = timeMS;
+    remoteSystem->sessionResumeSequence++;
+
+    unsigned char proof[SHA1_LENGTH];
+    GenerateSessionResumeProof(remoteSystem->remoteSessionToken, myGuid, remoteSystem->sessionResumeSequence, proof);
+
+    RakNet::BitStream bs;
+    bs.Write((MessageID) ID_SESSION_RESUME_REQUEST);
+    bs.WriteAlignedBytes((const unsigned char *) OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
+    bs.Write(myGuid);
+    bs.Write(remoteSystem->sessionResumeSequence);
+    bs.WriteAlignedBytes(proof, SHA1_LENGTH);
+
+    for (unsigned int i = 0; i < pluginListNTS.Size(); i++)
+        pluginListNTS[i]->OnDirectSocketSend((const char *) bs.GetData(), bs.GetNumberOfBitsUsed(), remoteSystem->systemAddress);
+
+    RNS2_SendParameters bsp;
+    bsp.data = (char *) bs.GetData();
+    bsp.length = bs.GetNumberOfBytesUsed();
+    bsp.systemAddress = remoteSystem->systemAddress;
+    remoteSystem->rakNetSocket->Send(&bsp);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::OnSessionResumeRequest(const SystemAddress &systemAddress, const char *data, unsigned int length,
+                                     RakNetSocket2 *rakNetSocket)
+{
+    if (length != sizeof(MessageID) + sizeof(OFFLINE_MESSAGE_DATA_ID) + RakNetGUID::size() + sizeof(uint32_t) + SHA1_LENGTH)
+        return;
+
+    RakNet::BitStream bs((unsigned char *) data, length, false);
+    bs.IgnoreBytes(sizeof(MessageID) + sizeof(OFFLINE_MESSAGE_DATA_ID));
+    RakNetGUID guid;
+    uint32_t sequence;
+    unsigned char proof[SHA1_LENGTH];
+    bs.Read(guid);
+    bs.Read(sequence);
+    bs.ReadAlignedBytes(proof, SHA1_LENGTH);
+
+    // Sequence numbers only go up, so a request seen on the network can't be sent again from somewhere else
+    RemoteSystemStruct *remoteSystem = GetRemoteSystemFromGUID(guid, true);
+    if (remoteSystem == 0 || remoteSystem->connectMode != RemoteSystemStruct::CONNECTED || !remoteSystem->sentSessionToken ||
+        sequence <= remoteSystem->lastSessionResumeSequence)
+        return;
+
+    unsigned char expectedProof[SHA1_LENGTH];
+    GenerateSessionResumeProof(remoteSystem->sessionToken, guid, sequence, expectedProof);
+    unsigned char difference = 0;
+    for (unsigned int i = 0; i < SHA1_LENGTH; i++)
+        difference |= (unsigned char) (proof[i] ^ expectedProof[i]);
+    if (difference != 0)
+        return;
+    remoteSystem->lastSessionResumeSequence = sequence;
+
+    // Otherwise our replies were only lost or late, and the resends will get through on their own
+    if (remoteSystem->systemAddress == systemAddress)
+        return;
+
+    // Another connection is using this address
+    if (GetRemoteSystemFromSystemAddress(systemAddress, true, true) != 0)
+        return;
+
+    SystemAddress oldAddress = remoteSystem->systemAddress;
+    ReferenceRemoteSystem(systemAddress, remoteSystem->remoteSystemIndex);
+    remoteSystem->rakNetSocket = rakNetSocket;
+    RakNet::TimeUS timeNS = RakNet::GetTimeUS();
+    remoteSystem->reliabilityLayer.OnAddressChanged(timeNS);
+    ScheduleRemoteSystemUpdate(remoteSystem, timeNS);
+
+    RakNet::BitStream bsOut;
+    bsOut.Write((MessageID) ID_SESSION_RESUMED);
+    bsOut.Write(oldAddress);
+    Packet *packet = AllocPacket(bsOut.GetNumberOfBytesUsed());
+    memcpy(packet->data, bsOut.GetData(), bsOut.GetNumberOfBytesUsed());
+    packet->systemAddress = systemAddress;
+    packet->systemAddress.systemIndex = remoteSystem->remoteSystemIndex;
+    packet->guid = remoteSystem->guid;
+    packet->guid.systemIndex = packet->systemAddress.systemIndex;
+    AddPacketToProducer(packet);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::GenerateSessionResumeProof(const unsigned char *sessionToken, RakNetGUID guid, uint32_t sequence,
+                                         unsigned char proof[SHA1_LENGTH])
+{
+    // Through a BitStream, so both systems hash the same bytes whatever their endianness
+    RakNet::BitStream input;
+    input.Write(guid);
+    input.Write(sequence);
+    CSHA1::HMAC((unsigned char *) sessionToken, SESSION_TOKEN_LENGTH, input.GetData(), (int) input.GetNumberOfBytesUsed(), proof);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Determines if a particular IP is banned.
@@ -1928,12 +2240,45 @@ void RakPeer::SetLimitIPConnectionFrequency(bool b)
 // False otherwise.
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::IsBanned(const char *IP)
+{
+    if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
+        return false;
+
+    SystemAddress address;
+    unsigned int prefixLength;
+    if (banTable.Size() > 0 && DataStructures::BanTable::ParseIPv4Prefix(IP, address, prefixLength) && prefixLength == 32 &&
+        banTable.IsBanned(address, RakNet::GetTimeMS()))
+        return true;
+
+    return IsBannedByPattern(IP);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Description:
+// Determines if a particular address is banned. Address prefixes are looked up without a lock. The address is only
+// formatted as a string if the ban list holds wildcards that are not address prefixes
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::IsBanned(const SystemAddress &address)
+{
+    if (banTable.Size() > 0 && banTable.IsBanned(address, RakNet::GetTimeMS()))
+        return true;
+
+    if (banList.Size() == 0)
+        return false;
+
+    char str1[64];
+    address.ToString(false, str1);
+    return IsBannedByPattern(str1);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::IsBannedByPattern(const char *IP)
 {
     unsigned banListIndex, characterIndex;
     RakNet::TimeMS time;
     BanStruct *temp;
 
-    if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
+    if (strlen(IP) > 15)
         return false;
 
     banListIndex = 0;
@@ -2614,6 +2959,27 @@ void RakPeer::AllowConnectionResponseIPMigration(bool allow)
     allowConnectionResponseIPMigration = allow;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::AllowSessionResumption(bool allow)
+{
+    allowSessionResumption = allow;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::ResumeSession(const AddressOrGUID systemIdentifier)
+{
+    if (!IsActive())
+        return;
+
+    // The session tokens are only touched by the update thread
+    BufferedCommandStruct *bcs;
+    bcs = bufferedCommands.Allocate();
+    bcs->data = 0;
+    bcs->systemIdentifier = systemIdentifier;
+    bcs->command = BufferedCommandStruct::BCS_RESUME_SESSION;
+    bufferedCommands.Push(bcs);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Sends a message ID_ADVERTISE_SYSTEM to the remote unconnected system.
@@ -2671,74 +3037,201 @@ void RakPeer::SetUnreliableTimeout(RakNet::TimeMS timeoutMS)
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-// Send a message to host, with the IP socket option TTL set to 3
-// This message will not reach the host, but will open the router.
-// Used for NAT-Punchthrough
+// Turns forward error correction on or off for UNRELIABLE_SEQUENCED messages sent on orderingChannel
 // ---------------------------------------------------------------------------------------------------------------------
-void RakPeer::SendTTL(const char *host, unsigned short remotePort, int ttl, unsigned connectionSocketIndex)
+void RakPeer::SetForwardErrorCorrection(unsigned char orderingChannel, bool enabled)
 {
-#if !defined(__native_client__)
-    char fakeData[2];
-    fakeData[0] = 0;
-    fakeData[1] = 1;
-    unsigned int realIndex = GetRakNetSocketFromUserConnectionSocketIndex(connectionSocketIndex);
-    if (socketList[realIndex]->IsBerkleySocket())
-    {
-        RNS2_SendParameters bsp;
-        bsp.data = (char *) fakeData;
-        bsp.length = 2;
-        bsp.systemAddress.FromStringExplicitPort(host, remotePort,
-                                                 socketList[realIndex]->GetBoundAddress().GetIPVersion());
-        bsp.systemAddress.FixForIPVersion(socketList[realIndex]->GetBoundAddress());
-        bsp.ttl = ttl;
-        unsigned i;
-        for (i = 0; i < pluginListNTS.Size(); i++)
-            pluginListNTS[i]->OnDirectSocketSend((const char *) bsp.data, BYTES_TO_BITS(bsp.length), bsp.systemAddress);
-        socketList[realIndex]->Send(&bsp);
-    }
-#endif
-}
+    RakAssert(orderingChannel < NUMBER_OF_ORDERED_STREAMS);
+    if (orderingChannel >= NUMBER_OF_ORDERED_STREAMS)
+        return;
 
+    if (enabled)
+        forwardErrorCorrectionChannels |= 1u << orderingChannel;
+    else
+        forwardErrorCorrectionChannels &= ~(1u << orderingChannel);
+    for (unsigned short i = 0; i < maximumNumberOfPeers; i++)
+        remoteSystemList[i].reliabilityLayer.SetForwardErrorCorrectionChannels(forwardErrorCorrectionChannels);
+}
 
 // ---------------------------------------------------------------------------------------------------------------------
-// Attatches a Plugin interface to run code automatically on message receipt in the Receive call
-//
-// \param messageHandler Pointer to a plugin to attach
+// Chooses the congestion control for one connection, or for all current and future connections
 // ---------------------------------------------------------------------------------------------------------------------
-void RakPeer::AttachPlugin(PluginInterface2 *plugin)
+void RakPeer::SetCongestionControl(CongestionControlAlgorithm algorithm, const SystemAddress target)
 {
-    bool isNotThreadsafe = plugin->UsesReliabilityLayer();
-    if (isNotThreadsafe)
-    {
-        if (pluginListNTS.GetIndexOf(plugin) == MAX_UNSIGNED_LONG)
-        {
-            plugin->SetRakPeerInterface(this);
-            plugin->OnAttach();
-            pluginListNTS.Insert(plugin);
-        }
-    }
-    else
+    RakAssert(algorithm < CC_ALGORITHM_COUNT);
+    if (algorithm >= CC_ALGORITHM_COUNT)
+        return;
+
+    if (target == UNASSIGNED_SYSTEM_ADDRESS)
+        defaultCongestionControl = algorithm;
+
+    // The update thread is using the current one, so it makes the switch
+    if (IsActive())
     {
-        if (pluginListTS.GetIndexOf(plugin) == MAX_UNSIGNED_LONG)
-        {
-            plugin->SetRakPeerInterface(this);
-            plugin->OnAttach();
-            pluginListTS.Insert(plugin);
-        }
+        BufferedCommandStruct *bcs;
+        bcs = bufferedCommands.Allocate();
+        bcs->data = 0;
+        bcs->systemIdentifier.SetUndefined();
+        bcs->systemIdentifier.systemAddress = target;
+        bcs->congestionControl = algorithm;
+        bcs->command = BufferedCommandStruct::BCS_SET_CONGESTION_CONTROL;
+        bufferedCommands.Push(bcs);
     }
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-// Detaches a Plugin interface to run code automatically on message receipt
-//
-// \param messageHandler Pointer to a plugin to detach
+// Sends small messages to one connection, or to all current and future connections, together
 // ---------------------------------------------------------------------------------------------------------------------
-void RakPeer::DetachPlugin(PluginInterface2 *plugin)
+void RakPeer::SetMessageCoalescing(RakNet::TimeUS windowUS, const SystemAddress target)
 {
-    if (plugin == 0)
-        return;
+    if (target == UNASSIGNED_SYSTEM_ADDRESS)
+        defaultCoalescingWindow = windowUS;
 
-    unsigned int index;
+    // Through the update thread, so it applies from the sends made after this call
+    if (IsActive())
+    {
+        BufferedCommandStruct *bcs;
+        bcs = bufferedCommands.Allocate();
+        bcs->data = 0;
+        bcs->systemIdentifier.SetUndefined();
+        bcs->systemIdentifier.systemAddress = target;
+        bcs->coalescingWindow = windowUS;
+        bcs->command = BufferedCommandStruct::BCS_SET_MESSAGE_COALESCING;
+        bufferedCommands.Push(bcs);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Compresses the sequenced and ordered messages sent on orderingChannel
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetChannelCompression(unsigned char orderingChannel, MessageCompressionCodec codec)
+{
+    RakAssert(orderingChannel < NUMBER_OF_ORDERED_STREAMS && codec < MC_CODEC_COUNT);
+    if (orderingChannel >= NUMBER_OF_ORDERED_STREAMS || codec >= MC_CODEC_COUNT)
+        return;
+
+    // The update thread is compressing with the current one, so it makes the change
+    if (IsActive())
+    {
+        BufferedCommandStruct *bcs;
+        bcs = bufferedCommands.Allocate();
+        bcs->data = 0;
+        bcs->systemIdentifier.SetUndefined();
+        bcs->orderingChannel = (char) orderingChannel;
+        bcs->compressionCodec = codec;
+        bcs->command = BufferedCommandStruct::BCS_SET_CHANNEL_COMPRESSION;
+        bufferedCommands.Push(bcs);
+    }
+    else
+        channelCompression[orderingChannel] = codec;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Compresses the messages sent with reliability, unless their ordering channel has a codec
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetReliabilityCompression(PacketReliability reliability, MessageCompressionCodec codec)
+{
+    RakAssert(reliability < NUMBER_OF_RELIABILITIES && codec < MC_CODEC_COUNT);
+    if (reliability >= NUMBER_OF_RELIABILITIES || codec >= MC_CODEC_COUNT)
+        return;
+
+    // The update thread is compressing with the current one, so it makes the change
+    if (IsActive())
+    {
+        BufferedCommandStruct *bcs;
+        bcs = bufferedCommands.Allocate();
+        bcs->data = 0;
+        bcs->systemIdentifier.SetUndefined();
+        bcs->reliability = reliability;
+        bcs->compressionCodec = codec;
+        bcs->command = BufferedCommandStruct::BCS_SET_RELIABILITY_COMPRESSION;
+        bufferedCommands.Push(bcs);
+    }
+    else
+        reliabilityCompression[reliability] = codec;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Sets the dictionary of MC_HUFFMAN. The reliability layers read it without a lock, so it can't change while they run
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetCompressionDictionary(const unsigned int frequencyTable[256])
+{
+    RakAssert(!IsActive());
+    if (IsActive())
+        return;
+
+    messageCompressor.SetDictionary(frequencyTable);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Send a message to host, with the IP socket option TTL set to 3
+// This message will not reach the host, but will open the router.
+// Used for NAT-Punchthrough
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SendTTL(const char *host, unsigned short remotePort, int ttl, unsigned connectionSocketIndex)
+{
+#if !defined(__native_client__)
+    char fakeData[2];
+    fakeData[0] = 0;
+    fakeData[1] = 1;
+    unsigned int realIndex = GetRakNetSocketFromUserConnectionSocketIndex(connectionSocketIndex);
+    if (socketList[realIndex]->IsBerkleySocket())
+    {
+        RNS2_SendParameters bsp;
+        bsp.data = (char *) fakeData;
+        bsp.length = 2;
+        bsp.systemAddress.FromStringExplicitPort(host, remotePort,
+                                                 socketList[realIndex]->GetBoundAddress().GetIPVersion());
+        bsp.systemAddress.FixForIPVersion(socketList[realIndex]->GetBoundAddress());
+        bsp.ttl = ttl;
+        unsigned i;
+        for (i = 0; i < pluginListNTS.Size(); i++)
+            pluginListNTS[i]->OnDirectSocketSend((const char *) bsp.data, BYTES_TO_BITS(bsp.length), bsp.systemAddress);
+        socketList[realIndex]->Send(&bsp);
+    }
+#endif
+}
+
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Attatches a Plugin interface to run code automatically on message receipt in the Receive call
+//
+// \param messageHandler Pointer to a plugin to attach
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::AttachPlugin(PluginInterface2 *plugin)
+{
+    bool isNotThreadsafe = plugin->UsesReliabilityLayer();
+    if (isNotThreadsafe)
+    {
+        if (pluginListNTS.GetIndexOf(plugin) == MAX_UNSIGNED_LONG)
+        {
+            plugin->SetRakPeerInterface(this);
+            plugin->OnAttach();
+            pluginListNTS.Insert(plugin);
+        }
+    }
+    else
+    {
+        if (pluginListTS.GetIndexOf(plugin) == MAX_UNSIGNED_LONG)
+        {
+            plugin->SetRakPeerInterface(this);
+            plugin->OnAttach();
+            pluginListTS.Insert(plugin);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Detaches a Plugin interface to run code automatically on message receipt
+//
+// \param messageHandler Pointer to a plugin to detach
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::DetachPlugin(PluginInterface2 *plugin)
+{
+    if (plugin == 0)
+        return;
+
+    unsigned int index;
 
     bool isNotThreadsafe = plugin->UsesReliabilityLayer();
     if (isNotThreadsafe)
@@ -2952,6 +3445,48 @@ void RakPeer::SetIncomingDatagramEventHandler(bool (*_incomingDatagramEventHandl
     incomingDatagramEventHandler = _incomingDatagramEventHandler;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetBatchedDatagramIO(bool enable)
+{
+    batchedDatagramIO = enable;
+
+#if CRABNET_SUPPORT_BATCHED_IO == 1
+    for (unsigned int i = 0; i < socketList.Size(); i++)
+    {
+        if (socketList[i]->IsBerkleySocket())
+            ((RNS2_Berkley *) socketList[i])->SetBatchedIO(enable);
+    }
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetUDPSegmentationOffload(bool enable)
+{
+    udpSegmentationOffload = enable;
+
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD == 1
+    for (unsigned int i = 0; i < socketList.Size(); i++)
+    {
+        if (socketList[i]->IsBerkleySocket())
+            ((RNS2_Berkley *) socketList[i])->SetSegmentationOffload(enable);
+    }
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetNumberOfUpdateShards(unsigned int numberOfShards)
+{
+    if (numberOfShards == 0)
+        numberOfShards = 1;
+    numberOfUpdateShards = numberOfShards;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::GetNumberOfUpdateShards(void) const
+{
+    return numberOfUpdateShards;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::SendOutOfBand(const char *host, unsigned short remotePort, const char *data, BitSize_t dataLength,
                             unsigned connectionSocketIndex)
@@ -3076,6 +3611,55 @@ void RakPeer::GetStatisticsList(DataStructures::List<SystemAddress> &addresses,
     }
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetTickProfiling(bool enabled)
+{
+    // Connections made after this take it from tickProfiling
+    tickProfiling = enabled;
+
+    // The update thread is adding to the profiles, so it clears them
+    if (IsActive())
+    {
+        BufferedCommandStruct *bcs;
+        bcs = bufferedCommands.Allocate();
+        bcs->data = 0;
+        bcs->systemIdentifier.SetUndefined();
+        bcs->tickProfiling = enabled;
+        bcs->command = BufferedCommandStruct::BCS_SET_TICK_PROFILING;
+        bufferedCommands.Push(bcs);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::GetTickProfiling(void) const
+{
+    return tickProfiling;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::GetTickProfile(const SystemAddress systemAddress, RakNetTickProfile *profile)
+{
+    if (!tickProfiling || remoteSystemList == 0 || endThreads == true)
+        return false;
+
+    if (systemAddress == UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        profile->Clear();
+        for (unsigned short i = 0; i < maximumNumberOfPeers; i++)
+        {
+            if (remoteSystemList[i].isActive)
+                (*profile) += remoteSystemList[i].reliabilityLayer.GetTickProfile();
+        }
+        return true;
+    }
+
+    RemoteSystemStruct *rss = GetRemoteSystemFromSystemAddress(systemAddress, false, false);
+    if (rss == 0)
+        return false;
+    *profile = rss->reliabilityLayer.GetTickProfile();
+    return true;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::GetStatistics(const unsigned int index, RakNetStatistics *rns)
 {
@@ -3604,7 +4188,16 @@ RakPeer::AssignSystemAddressToRemoteSystemList(const SystemAddress systemAddress
             RakAssert(remoteSystem->MTUSize <= MAXIMUM_MTU_SIZE);
             remoteSystem->reliabilityLayer.Reset(true, remoteSystem->MTUSize, useSecurity);
             remoteSystem->reliabilityLayer.SetSplitMessageProgressInterval(splitMessageProgressInterval);
+            remoteSystem->reliabilityLayer.SetTickProfiling(tickProfiling);
             remoteSystem->reliabilityLayer.SetUnreliableTimeout(unreliableTimeout);
+            remoteSystem->reliabilityLayer.SetForwardErrorCorrectionChannels(forwardErrorCorrectionChannels);
+            remoteSystem->reliabilityLayer.SetCongestionControl(defaultCongestionControl);
+            remoteSystem->reliabilityLayer.SetMessageCoalescing(defaultCoalescingWindow);
+            remoteSystem->reliabilityLayer.SetMessageCompressor(&messageCompressor);
+            for (unsigned int i = 0; i < NUMBER_OF_ORDERED_STREAMS; i++)
+                remoteSystem->reliabilityLayer.SetChannelCompression((unsigned char) i, channelCompression[i]);
+            for (unsigned int i = 0; i < NUMBER_OF_RELIABILITIES; i++)
+                remoteSystem->reliabilityLayer.SetReliabilityCompression((PacketReliability) i, reliabilityCompression[i]);
             remoteSystem->reliabilityLayer.SetTimeoutTime(defaultTimeoutTime);
             AddToActiveSystemList(assignedIndex);
             if (incomingRakNetSocket->GetBoundAddress() == bindingAddress)
@@ -3632,6 +4225,11 @@ RakPeer::AssignSystemAddressToRemoteSystemList(const SystemAddress systemAddress
             remoteSystem->connectionTime = time;
             remoteSystem->myExternalSystemAddress = UNASSIGNED_SYSTEM_ADDRESS;
             remoteSystem->lastReliableSend = time;
+            remoteSystem->sentSessionToken = false;
+            remoteSystem->lastSessionResumeSequence = 0;
+            remoteSystem->hasRemoteSessionToken = false;
+            remoteSystem->sessionResumeSequence = 0;
+            remoteSystem->lastSessionResumeRequestTime = (RakNet::TimeMS) time;
 
 #ifdef _DEBUG
             int indexLoopupCheck = GetIndexFromSystemAddress(systemAddress, true);
@@ -3776,6 +4374,7 @@ void RakPeer::ClearRemoteSystemLookup(void)
 void RakPeer::AddToActiveSystemList(unsigned int remoteSystemListIndex)
 {
     activeSystemList[activeSystemListSize++] = remoteSystemList + remoteSystemListIndex;
+    ScheduleRemoteSystemUpdate(remoteSystemList + remoteSystemListIndex, 0);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3788,11 +4387,76 @@ void RakPeer::RemoveFromActiveSystemList(const SystemAddress &sa)
         {
             activeSystemList[i] = activeSystemList[activeSystemListSize - 1];
             activeSystemListSize--;
+            remoteSystemUpdateTimers.Cancel(rss->remoteSystemIndex);
             return;
         }
     }
     RakAssert("activeSystemList invalid, entry not found in RemoveFromActiveSystemList. Ensure that AddToActiveSystemList and RemoveFromActiveSystemList are called by the same thread." && 0);
 }
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::ScheduleRemoteSystemUpdate(RemoteSystemStruct *remoteSystem, RakNet::TimeUS time)
+{
+    // Update shards visit every system each cycle, and call this from their own threads
+    if (updateShards.Size() > 0)
+        return;
+
+    remoteSystemUpdateTimers.Schedule(remoteSystem->remoteSystemIndex, time);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Lowers untilNext to the time from timeMS until deadlineMS. Deadlines already passed were acted on, or wait on something else
+static void ReduceTimeUntilDeadline(RakNet::Time timeMS, RakNet::Time deadlineMS, RakNet::TimeUS &untilNext)
+{
+    if (deadlineMS > timeMS && (deadlineMS - timeMS) * (RakNet::TimeUS) 1000 < untilNext)
+        untilNext = (deadlineMS - timeMS) * (RakNet::TimeUS) 1000;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+RakNet::TimeUS RakPeer::GetTimeUntilRemoteSystemUpdate(RemoteSystemStruct *remoteSystem, RakNet::TimeUS timeNS)
+{
+    RakNet::TimeUS untilNext = remoteSystem->reliabilityLayer.GetTimeUntilNextUpdate(timeNS,
+                                                                                     (RakNet::TimeUS) REMOTE_SYSTEM_MAX_UPDATE_INTERVAL_MS * 1000);
+    RakNet::Time timeMS = (RakNet::Time) (timeNS / (RakNet::TimeUS) 1000);
+
+    // The same conditions RunUpdateCycle() checks for each remote system
+    switch (remoteSystem->connectMode)
+    {
+        case RemoteSystemStruct::CONNECTED:
+            ReduceTimeUntilDeadline(timeMS, remoteSystem->lastReliableSend + remoteSystem->reliabilityLayer.GetTimeoutTime() / 2 + 1, untilNext);
+            if (occasionalPing || remoteSystem->lowestPing == (unsigned short) -1)
+                ReduceTimeUntilDeadline(timeMS, remoteSystem->nextPingTime + 1, untilNext);
+            break;
+        case RemoteSystemStruct::REQUESTED_CONNECTION:
+        case RemoteSystemStruct::HANDLING_CONNECTION_REQUEST:
+        case RemoteSystemStruct::UNVERIFIED_SENDER:
+            ReduceTimeUntilDeadline(timeMS, remoteSystem->connectionTime + 10000 + 1, untilNext);
+            break;
+        case RemoteSystemStruct::DISCONNECT_ASAP:
+        case RemoteSystemStruct::DISCONNECT_ASAP_SILENTLY:
+        case RemoteSystemStruct::DISCONNECT_ON_NO_ACK:
+            // Closed once the last messages are sent and acknowledged, so check as often as before
+            if (untilNext > UPDATE_THREAD_MAX_SLEEP_MS * 1000)
+                untilNext = UPDATE_THREAD_MAX_SLEEP_MS * 1000;
+            break;
+        default:
+            break;
+    }
+
+    return untilNext;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int RakPeer::GetUpdateThreadSleepTime(void) const
+{
+    if (updateShards.Size() > 0)
+        return UPDATE_THREAD_MAX_SLEEP_MS;
+
+    RakNet::TimeUS untilNext = remoteSystemUpdateTimers.GetTimeUntilNextTimer(RakNet::GetTimeUS(),
+                                                                              (RakNet::TimeUS) UPDATE_THREAD_MAX_SLEEP_MS * 1000);
+    // Round up, since waking before the timer fires finds nothing to do
+    return (int) ((untilNext + 999) / 1000);
+}
 // ---------------------------------------------------------------------------------------------------------------------
 /*
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3877,69 +4541,271 @@ bool RakPeer::AllowIncomingConnections(void) const
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::DeallocRNS2RecvStruct(RNS2RecvStruct *s)
 {
-    bufferedPacketsFreePoolMutex.Lock();
-    bufferedPacketsFreePool.Push(s);
-    bufferedPacketsFreePoolMutex.Unlock();
+    if (!bufferedPacketsFreePool.Push(s))
+        delete s;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 RNS2RecvStruct *RakPeer::AllocRNS2RecvStruct()
 {
-    bufferedPacketsFreePoolMutex.Lock();
-    if (bufferedPacketsFreePool.Size() > 0)
-    {
-        RNS2RecvStruct *s = bufferedPacketsFreePool.Pop();
-        bufferedPacketsFreePoolMutex.Unlock();
+    RNS2RecvStruct *s;
+    if (bufferedPacketsFreePool.Pop(s))
         return s;
-    }
-    else
-    {
-        bufferedPacketsFreePoolMutex.Unlock();
-        return new RNS2RecvStruct;
-    }
+    return new RNS2RecvStruct;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::ClearBufferedPackets(void)
 {
-    bufferedPacketsFreePoolMutex.Lock();
-    while (bufferedPacketsFreePool.Size() > 0)
-        delete bufferedPacketsFreePool.Pop();
-    bufferedPacketsFreePoolMutex.Unlock();
+    RNS2RecvStruct *s;
+    while (bufferedPacketsFreePool.Pop(s))
+        delete s;
 
-    bufferedPacketsQueueMutex.Lock();
-    while (bufferedPacketsQueue.Size() > 0)
-        delete bufferedPacketsQueue.Pop();
-    bufferedPacketsQueueMutex.Unlock();
+    while (bufferedPacketsQueue.Pop(s))
+        delete s;
+
+    bufferedPacketsOverflowQueueMutex.Lock();
+    while (bufferedPacketsOverflowQueue.Size() > 0)
+        delete bufferedPacketsOverflowQueue.Pop();
+    bufferedPacketsOverflowQueueSize = 0;
+    bufferedPacketsOverflowQueueMutex.Unlock();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::SetupBufferedPackets(void)
 {
+    // Allocate up front so the first datagrams don't have to
+    for (unsigned int i = 0; i < BUFFERED_PACKETS_PAGE_SIZE; i++)
+        DeallocRNS2RecvStruct(new RNS2RecvStruct);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::PushBufferedPacket(RNS2RecvStruct *p)
 {
-    bufferedPacketsQueueMutex.Lock();
-    bufferedPacketsQueue.Push(p);
-    bufferedPacketsQueueMutex.Unlock();
+    if (bufferedPacketsQueue.Push(p))
+        return;
+
+    // Only when the update thread is far behind. These may be read out of order with the ones in bufferedPacketsQueue
+    bufferedPacketsOverflowQueueMutex.Lock();
+    bufferedPacketsOverflowQueue.Push(p);
+    bufferedPacketsOverflowQueueSize = bufferedPacketsOverflowQueue.Size();
+    bufferedPacketsOverflowQueueMutex.Unlock();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 RNS2RecvStruct *RakPeer::PopBufferedPacket(void)
 {
-    bufferedPacketsQueueMutex.Lock();
-    if (bufferedPacketsQueue.Size() > 0)
-    {
-        RNS2RecvStruct *s = bufferedPacketsQueue.Pop();
-        bufferedPacketsQueueMutex.Unlock();
+    RNS2RecvStruct *s;
+    if (PopBufferedPackets(&s, 1) == 1)
         return s;
-    }
-    bufferedPacketsQueueMutex.Unlock();
     return 0;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::PopBufferedPackets(RNS2RecvStruct **output, unsigned int maxPackets)
+{
+    unsigned int count = bufferedPacketsQueue.PopMultiple(output, maxPackets);
+    if (count < maxPackets && bufferedPacketsOverflowQueueSize > 0)
+    {
+        bufferedPacketsOverflowQueueMutex.Lock();
+        while (count < maxPackets && bufferedPacketsOverflowQueue.Size() > 0)
+            output[count++] = bufferedPacketsOverflowQueue.Pop();
+        bufferedPacketsOverflowQueueSize = bufferedPacketsOverflowQueue.Size();
+        bufferedPacketsOverflowQueueMutex.Unlock();
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::StartUpdateShards(int threadPriority)
+{
+    if (numberOfUpdateShards <= 1)
+        return true;
+
+    endUpdateShardThreads = false;
+    updateShardsRunning = 0;
+    updateShardsDoneEvent.InitEvent();
+    for (unsigned int i = 0; i < numberOfUpdateShards; i++)
+    {
+        UpdateShard *shard = new UpdateShard;
+        shard->rakPeer = this;
+        shard->shardIndex = i;
+        shard->updateCycle = 0;
+        shard->isThreadActive = false;
+        shard->bufferedPacketsQueue.Init(BUFFERED_PACKETS_QUEUE_SIZE);
+        shard->updateEvent.InitEvent();
+        updateShards.Push(shard);
+    }
+
+    // Shard 0 is updated by the main update thread
+    for (unsigned int i = 1; i < updateShards.Size(); i++)
+    {
+        if (RakNet::RakThread::Create(UpdateShardLoop, updateShards[i], threadPriority) != 0)
+            return false;
+
+        while (updateShards[i]->isThreadActive == false)
+            RakSleep(10);
+    }
+
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::StopUpdateShards(void)
+{
+    if (updateShards.Size() == 0)
+        return;
+
+    endUpdateShardThreads = true;
+    for (unsigned int i = 0; i < updateShards.Size(); i++)
+    {
+        updateShards[i]->updateEvent.SetEvent();
+        while (updateShards[i]->isThreadActive)
+            RakSleep(15);
+    }
+
+    for (unsigned int i = 0; i < updateShards.Size(); i++)
+    {
+        UpdateShard *shard = updateShards[i];
+        RakAssert(shard->bufferedCommands.Size() == 0);
+        RNS2RecvStruct *recvFromStruct;
+        while (shard->bufferedPacketsQueue.Pop(recvFromStruct))
+            DeallocRNS2RecvStruct(recvFromStruct);
+        shard->updateEvent.CloseEvent();
+        delete shard;
+    }
+    updateShards.Clear(false);
+    updateShardsDoneEvent.CloseEvent();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::GetUpdateShardIndex(const SystemAddress &sa) const
+{
+    // Same hash as RemoteSystemLookupHashIndex(), without depending on maximumNumberOfPeers, which is not set yet when the recv threads start
+    return (unsigned int) (SystemAddress::ToInteger(sa) % updateShards.Size());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::PushBufferedCommandToUpdateShard(BufferedCommandStruct *bcs)
+{
+    // Broadcasts touch every shard, and connection mode changes are made by the main update thread
+    if (bcs->command != BufferedCommandStruct::BCS_SEND || bcs->broadcast ||
+        bcs->connectionMode != RemoteSystemStruct::NO_ACTION)
+        return false;
+
+    unsigned int remoteSystemIndex;
+    if (bcs->systemIdentifier.systemAddress != UNASSIGNED_SYSTEM_ADDRESS)
+        remoteSystemIndex = GetIndexFromSystemAddress(bcs->systemIdentifier.systemAddress, true);
+    else if (bcs->systemIdentifier.rakNetGuid != UNASSIGNED_CRABNET_GUID)
+        remoteSystemIndex = GetSystemIndexFromGuid(bcs->systemIdentifier.rakNetGuid);
+    else
+        return false;
+
+    if (remoteSystemIndex == (unsigned int) -1)
+        return false;
+
+    updateShards[GetUpdateShardIndex(remoteSystemList[remoteSystemIndex].systemAddress)]->bufferedCommands.Push(bcs);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SendBufferedCommand(BufferedCommandStruct *bcs, RakNet::TimeUS timeNS)
+{
+    bool callerDataAllocationUsed = SendImmediate((char *) bcs->data, bcs->numberOfBitsToSend, bcs->priority,
+                                                  bcs->reliability, bcs->orderingChannel, bcs->systemIdentifier,
+                                                  bcs->broadcast, true, timeNS, bcs->receipt, bcs->queueTime,
+                                                  bcs->sharedData);
+    if (bcs->sharedData)
+        ReliabilityLayer::ReleaseSharedData(bcs->sharedData);
+    else if (!callerDataAllocationUsed)
+        free(bcs->data);
+
+#ifdef _DEBUG
+    bcs->data = 0;
+#endif
+
+    bufferedCommands.Deallocate(bcs);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::FlushUpdateShardCommands(RakNet::TimeUS timeNS)
+{
+    for (unsigned int i = 0; i < updateShards.Size(); i++)
+    {
+        UpdateShard *shard = updateShards[i];
+        for (unsigned int j = 0; j < shard->bufferedCommands.Size(); j++)
+            SendBufferedCommand(shard->bufferedCommands[j], timeNS);
+        shard->bufferedCommands.Clear(true);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::RunUpdateShards(RakNet::TimeUS timeNS, BitStream &updateBitStream)
+{
+    updateShardsTime = timeNS;
+    updateShardsRunning = updateShards.Size() - 1;
+    for (unsigned int i = 1; i < updateShards.Size(); i++)
+    {
+        updateShards[i]->updateCycle++;
+        updateShards[i]->updateEvent.SetEvent();
+    }
+
+    UpdateShardCycle(updateShards[0], timeNS, updateBitStream);
+
+    // The rest of the update cycle adds and removes remote systems, so wait for every shard to finish.
+    // The last shard to finish sets the event, so this only wakes when it does. The counter is checked again because the
+    // event may still be set from a cycle in which it reached 0 before the wait started
+    while (updateShardsRunning > 0)
+        updateShardsDoneEvent.WaitOnEvent(1000);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::UpdateShardCycle(UpdateShard *shard, RakNet::TimeUS timeNS, BitStream &updateBitStream)
+{
+    // Only the reliability layers of this shard are touched here. remoteSystemLookup and activeSystemList are read only
+    // until every shard is done, because the main update thread is waiting in RunUpdateShards()
+    RNS2RecvStruct *recvFromStructs[BUFFERED_PACKETS_POP_BATCH];
+    unsigned int recvFromStructCount;
+    while ((recvFromStructCount = shard->bufferedPacketsQueue.PopMultiple(recvFromStructs, BUFFERED_PACKETS_POP_BATCH)) > 0)
+    {
+        for (unsigned int i = 0; i < recvFromStructCount; i++)
+        {
+            RNS2RecvStruct *recvFromStruct = recvFromStructs[i];
+            RemoteSystemStruct *remoteSystem = GetRemoteSystemFromSystemAddress(recvFromStruct->systemAddress, true, true);
+            bool banned = IsBanned(recvFromStruct->systemAddress);
+
+            // Unconnected or banned senders, and systems reached through an address hashed to another shard,
+            // go through ProcessNetworkPacket() on the main update thread next cycle
+            if (remoteSystem == 0 || banned || GetUpdateShardIndex(remoteSystem->systemAddress) != shard->shardIndex)
+            {
+                PushBufferedPacket(recvFromStruct);
+                continue;
+            }
+
+            remoteSystem->reliabilityLayer.HandleSocketReceiveFromConnectedPlayer(recvFromStruct->data, recvFromStruct->bytesRead,
+                                                                                  recvFromStruct->systemAddress, pluginListNTS,
+                                                                                  remoteSystem->MTUSize, recvFromStruct->socket,
+                                                                                  &rnr, recvFromStruct->timeRead, updateBitStream);
+            DeallocRNS2RecvStruct(recvFromStruct);
+        }
+    }
+
+    for (unsigned int i = 0; i < shard->bufferedCommands.Size(); i++)
+        SendBufferedCommand(shard->bufferedCommands[i], timeNS);
+    shard->bufferedCommands.Clear(true);
+
+    for (unsigned int i = 0; i < activeSystemListSize; i++)
+    {
+        RemoteSystemStruct *remoteSystem = activeSystemList[i];
+        SystemAddress systemAddress = remoteSystem->systemAddress;
+        if (GetUpdateShardIndex(systemAddress) != shard->shardIndex)
+            continue;
+
+        remoteSystem->reliabilityLayer.Update(remoteSystem->rakNetSocket, systemAddress, remoteSystem->MTUSize, timeNS,
+                                              maxOutgoingBPS, pluginListNTS, &rnr, updateBitStream);
+    }
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::PingInternal(const SystemAddress target, bool performImmediate, PacketReliability reliability)
 {
@@ -4042,6 +4908,7 @@ void RakPeer::SendBuffered(const char *data, BitSize_t numberOfBitsToSend, Packe
     RakAssert(!(orderingChannel >= NUMBER_OF_ORDERED_STREAMS));
 
     memcpy(bcs->data, data, (size_t) BITS_TO_BYTES(numberOfBitsToSend));
+    bcs->sharedData = 0;
     bcs->numberOfBitsToSend = numberOfBitsToSend;
     bcs->priority = priority;
     bcs->reliability = reliability;
@@ -4050,6 +4917,7 @@ void RakPeer::SendBuffered(const char *data, BitSize_t numberOfBitsToSend, Packe
     bcs->broadcast = broadcast;
     bcs->connectionMode = connectionMode;
     bcs->receipt = receipt;
+    bcs->queueTime = tickProfiling ? RakNet::GetTimeUS() : 0;
     bcs->command = BufferedCommandStruct::BCS_SEND;
     bufferedCommands.Push(bcs);
 
@@ -4104,6 +4972,7 @@ void RakPeer::SendBufferedList(const char **data, const int *lengths, const int
 
     BufferedCommandStruct *bcs = bufferedCommands.Allocate();
     bcs->data = dataAggregate;
+    bcs->sharedData = 0;
     bcs->numberOfBitsToSend = BYTES_TO_BITS(totalLength);
     bcs->priority = priority;
     bcs->reliability = reliability;
@@ -4112,6 +4981,7 @@ void RakPeer::SendBufferedList(const char **data, const int *lengths, const int
     bcs->broadcast = broadcast;
     bcs->connectionMode = connectionMode;
     bcs->receipt = receipt;
+    bcs->queueTime = tickProfiling ? RakNet::GetTimeUS() : 0;
     bcs->command = BufferedCommandStruct::BCS_SEND;
     bufferedCommands.Push(bcs);
 
@@ -4122,7 +4992,8 @@ void RakPeer::SendBufferedList(const char **data, const int *lengths, const int
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability,
                             char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast,
-                            bool useCallerDataAllocation, RakNet::TimeUS currentTime, uint32_t receipt)
+                            bool useCallerDataAllocation, RakNet::TimeUS currentTime, uint32_t receipt,
+                            RakNet::TimeUS queueTime, InternalPacketSharedData *gatherData)
 {
     unsigned remoteSystemIndex; // Iterates into the list of remote systems
     if (systemIdentifier.systemAddress != UNASSIGNED_SYSTEM_ADDRESS)
@@ -4164,9 +5035,9 @@ bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPrio
 #endif
 
         // remoteSystemList in network thread
-        unsigned int idx;
-        for (idx = 0; idx < maximumNumberOfPeers; idx++)
+        for (unsigned int i = 0; i < activeSystemListSize; i++)
         {
+            unsigned int idx = activeSystemList[i]->remoteSystemIndex;
             if (remoteSystemIndex != (unsigned int) -1 && idx == remoteSystemIndex)
                 continue;
 
@@ -4183,7 +5054,33 @@ bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPrio
         return false;
     }
 
+    InternalPacketSharedData *sharedData = 0;
+    char *gatheredData = 0;
+    if (gatherData != 0 && pluginListNTS.Size() == 0)
+    {
+        // Every reliability layer references the buffers of SendGather(). The caller keeps its own reference
+        sharedData = gatherData;
+        useCallerDataAllocation = false;
+    }
+    else if (gatherData != 0)
+    {
+        // Plugins that see each InternalPacket, such as PacketLogger, read its data as one block
+        gatheredData = (char *) malloc((size_t) BITS_TO_BYTES(numberOfBitsToSend));
+        ReliabilityLayer::GatherSharedData(gatherData, 0, (unsigned int) BITS_TO_BYTES(numberOfBitsToSend),
+                                           (unsigned char *) gatheredData);
+        data = gatheredData;
+        useCallerDataAllocation = true;
+    }
+
     bool callerDataAllocationUsed = false;
+    // With more than one recipient, every reliability layer references one copy instead of making its own
+    if (sharedData == 0 && sendListSize > 1)
+    {
+        sharedData = ReliabilityLayer::AllocateSharedData(data, (unsigned int) BITS_TO_BYTES(numberOfBitsToSend), !useCallerDataAllocation);
+        data = (char *) sharedData->sharedDataBlock;
+        callerDataAllocationUsed = useCallerDataAllocation;
+    }
+
     for (unsigned sendListIndex = 0; sendListIndex < sendListSize; sendListIndex++)
     {
         // Send may split the packet and thus deallocate data.  Don't assume data is valid if we use the callerAllocationData
@@ -4191,7 +5088,8 @@ bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPrio
         remoteSystemList[sendList[sendListIndex]].reliabilityLayer.Send(data, numberOfBitsToSend, priority, reliability,
                                                                         orderingChannel, !useData,
                                                                         remoteSystemList[sendList[sendListIndex]].MTUSize,
-                                                                        currentTime, receipt);
+                                                                        currentTime, receipt, sharedData, queueTime);
+        ScheduleRemoteSystemUpdate(remoteSystemList + sendList[sendListIndex], currentTime);
         if (useData)
             callerDataAllocationUsed = true;
 
@@ -4211,6 +5109,16 @@ bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPrio
     free(sendList);
 #endif
 
+    if (sharedData && sharedData != gatherData)
+        ReliabilityLayer::ReleaseSharedData(sharedData);
+
+    if (gatheredData)
+    {
+        if (!callerDataAllocationUsed)
+            free(gatheredData);
+        return false;
+    }
+
     // Return value only meaningful if true was passed for useCallerDataAllocation.
     // Means the reliability layer used that data copy, so the caller should not deallocate it
     return callerDataAllocationUsed;
@@ -4258,6 +5166,8 @@ void RakPeer::ClearBufferedCommands(void)
     {
         if (bcs->data)
             free(bcs->data);
+        else if (bcs->command == BufferedCommandStruct::BCS_SEND && bcs->sharedData)
+            ReliabilityLayer::ReleaseSharedData(bcs->sharedData);
 
         bufferedCommands.Deallocate(bcs);
     }
@@ -4321,9 +5231,7 @@ namespace RakNet
         RakPeer::RemoteSystemStruct *remoteSystem;
         RakNet::Packet *packet;
 
-        char str1[64];
-        systemAddress.ToString(false, str1);
-        if (rakPeer->IsBanned(str1))
+        if (rakPeer->IsBanned(systemAddress))
         {
             for (unsigned i = 0; i < rakPeer->pluginListNTS.Size(); i++)
                 rakPeer->pluginListNTS[i]->OnDirectSocketReceive(data, length * 8, systemAddress);
@@ -4385,7 +5293,8 @@ namespace RakNet
                   (unsigned char) data[0] == ID_NO_FREE_INCOMING_CONNECTIONS ||
                   (unsigned char) data[0] == ID_CONNECTION_BANNED ||
                   (unsigned char) data[0] == ID_ALREADY_CONNECTED ||
-                  (unsigned char) data[0] == ID_IP_RECENTLY_CONNECTED) &&
+                  (unsigned char) data[0] == ID_IP_RECENTLY_CONNECTED ||
+                  (unsigned char) data[0] == ID_SESSION_RESUME_REQUEST) &&
                  (size_t) length >= sizeof(MessageID) + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
         {
             *isOfflineMessage = memcmp(data + sizeof(MessageID), OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
@@ -4483,6 +5392,11 @@ namespace RakNet
                 packet->guid.systemIndex = packet->systemAddress.systemIndex;
                 rakPeer->AddPacketToProducer(packet);
             }
+            else if ((unsigned char) data[0] == ID_SESSION_RESUME_REQUEST)
+            {
+                // Usually from an address no connection has yet, which is why it is an offline message
+                rakPeer->OnSessionResumeRequest(systemAddress, data, length, rakNetSocket);
+            }
             else if ((unsigned char) data[0] == ID_OUT_OF_BAND_INTERNAL &&
                      (size_t) length > sizeof(OFFLINE_MESSAGE_DATA_ID) + sizeof(MessageID) + RakNetGUID::size() &&
                      (size_t) length < MAX_OFFLINE_DATA_LENGTH + sizeof(OFFLINE_MESSAGE_DATA_ID) + sizeof(MessageID) + RakNetGUID::size())
@@ -4546,7 +5460,7 @@ namespace RakNet
                     RakPeer::RequestedConnectionStruct *rcs = rakPeer->requestedConnectionQueue[i];
                     if (rcs->systemAddress == systemAddress)
                     {
-                        if (serverHasSecurity)
+                        if (serverHasSecurity == 1)
                         {
 #ifdef LIBCAT_SECURITY
                             unsigned char public_key[cat::EasyHandshake::PUBLIC_KEY_BYTES];
@@ -4614,6 +5528,10 @@ namespace RakNet
                                 return true;
                             }
 #endif // LIBCAT_SECURITY
+
+                            // Connection cookie only. Answered in the same format as a security cookie without a challenge
+                            if (serverHasSecurity != 0)
+                                bsOut.Write((unsigned char) 0);
                         }
 
                         uint16_t mtu;
@@ -4928,6 +5846,13 @@ namespace RakNet
                 }
                 else
 #endif // LIBCAT_SECURITY
+                if (rakPeer->useConnectionCookies)
+                {
+                    // Nothing is stored. The cookie is checked again from the address and time on ID_OPEN_CONNECTION_REQUEST_2
+                    bsOut.Write((unsigned char) 2); // HasCookie Yes, without security
+                    bsOut.Write(rakPeer->GenerateConnectionCookie(systemAddress, RakNet::GetTimeMS() / CONNECTION_COOKIE_WINDOW_MS));
+                }
+                else
                     bsOut.Write((unsigned char) 0);  // HasCookie oN
 
                 // MTU. Lower MTU if it is exceeds our own limit
@@ -4990,7 +5915,17 @@ namespace RakNet
 #endif
                     }
                 }
+                else
 #endif // LIBCAT_SECURITY
+                if (rakPeer->useConnectionCookies)
+                {
+                    // Drop requests from addresses that did not get our ID_OPEN_CONNECTION_REPLY_1, before any remote system is looked up or assigned
+                    uint32_t cookie;
+                    unsigned char clientWroteChallenge;
+                    if (!bs.Read(cookie) || !rakPeer->VerifyConnectionCookie(systemAddress, cookie))
+                        return true;
+                    bs.Read(clientWroteChallenge);
+                }
 
                 SystemAddress bindingAddress;
                 bs.Read(bindingAddress);
@@ -5202,6 +6137,8 @@ namespace RakNet
             remoteSystem->reliabilityLayer.HandleSocketReceiveFromConnectedPlayer(data, length, systemAddress,
                                                                                   rakPeer->pluginListNTS, remoteSystem->MTUSize,
                                                                                   rakNetSocket, &rnr, timeRead, updateBitStream);
+            // Acks may have opened the congestion window, and messages may be waiting to be read
+            rakPeer->ScheduleRemoteSystemUpdate(remoteSystem, timeRead);
         }
     }
 
@@ -5332,25 +6269,44 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 #endif
 
 //    unsigned int socketListIndex;
-    RNS2RecvStruct *recvFromStruct;
-    while ((recvFromStruct = PopBufferedPacket()) != 0)
+    RNS2RecvStruct *recvFromStructs[BUFFERED_PACKETS_POP_BATCH];
+    unsigned int recvFromStructCount;
+    while ((recvFromStructCount = PopBufferedPackets(recvFromStructs, BUFFERED_PACKETS_POP_BATCH)) > 0)
     {
-        /*
-        for (socketListIndex=0; socketListIndex < socketList.Size(); socketListIndex++)
+        for (unsigned int i = 0; i < recvFromStructCount; i++)
         {
-            if ((RakNetSocket*) socketList[socketListIndex]==recvFromStruct->s)
-                break;
+            /*
+            for (socketListIndex=0; socketListIndex < socketList.Size(); socketListIndex++)
+            {
+                if ((RakNetSocket*) socketList[socketListIndex]==recvFromStruct->s)
+                    break;
+            }
+            if (socketListIndex!=socketList.Size())
+            */
+            ProcessNetworkPacket(recvFromStructs[i]->systemAddress, recvFromStructs[i]->data, recvFromStructs[i]->bytesRead,
+                                 this, recvFromStructs[i]->socket, recvFromStructs[i]->timeRead, updateBitStream);
+            DeallocRNS2RecvStruct(recvFromStructs[i]);
         }
-        if (socketListIndex!=socketList.Size())
-        */
-        ProcessNetworkPacket(recvFromStruct->systemAddress, recvFromStruct->data, recvFromStruct->bytesRead, this,
-                             recvFromStruct->socket, recvFromStruct->timeRead, updateBitStream);
-        DeallocRNS2RecvStruct(recvFromStruct);
     }
 
     BufferedCommandStruct *bcs;
     while ((bcs = bufferedCommands.PopInaccurate()) != 0)
     {
+        if (updateShards.Size() > 0)
+        {
+            // Unicast sends are made later this cycle, by the thread that updates the target system
+            if (PushBufferedCommandToUpdateShard(bcs))
+                continue;
+
+            // Anything else may depend on the sends read before it, so make those first
+            if (timeNS == 0)
+            {
+                timeNS = RakNet::GetTimeUS();
+                timeMS = (RakNet::TimeMS) (timeNS / (RakNet::TimeUS) 1000);
+            }
+            FlushUpdateShardCommands(timeNS);
+        }
+
         if (bcs->command == BufferedCommandStruct::BCS_SEND)
         {
             // GetTime is a very slow call so do it once and as late as possible
@@ -5362,8 +6318,11 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 
             callerDataAllocationUsed = SendImmediate((char *) bcs->data, bcs->numberOfBitsToSend, bcs->priority,
                                                      bcs->reliability, bcs->orderingChannel, bcs->systemIdentifier,
-                                                     bcs->broadcast, true, timeNS, bcs->receipt);
-            if (!callerDataAllocationUsed)
+                                                     bcs->broadcast, true, timeNS, bcs->receipt, bcs->queueTime,
+                                                     bcs->sharedData);
+            if (bcs->sharedData)
+                ReliabilityLayer::ReleaseSharedData(bcs->sharedData);
+            else if (!callerDataAllocationUsed)
                 free(bcs->data);
 
             // Set the new connection state AFTER we call sendImmediate in case we are setting it to a disconnection state, which does not allow further sends
@@ -5386,6 +6345,59 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                 ReferenceRemoteSystem(bcs->systemIdentifier.systemAddress, existingSystemIndex);
             }
         }
+        else if (bcs->command == BufferedCommandStruct::BCS_RESUME_SESSION)
+        {
+            RakPeer::RemoteSystemStruct *remoteSystem = GetRemoteSystem(bcs->systemIdentifier, true, true);
+            if (remoteSystem && remoteSystem->hasRemoteSessionToken)
+                SendSessionResumeRequest(remoteSystem, RakNet::GetTimeMS());
+        }
+        else if (bcs->command == BufferedCommandStruct::BCS_SET_CONGESTION_CONTROL)
+        {
+            if (bcs->systemIdentifier.systemAddress == UNASSIGNED_SYSTEM_ADDRESS)
+            {
+                for (unsigned int i = 0; i < activeSystemListSize; i++)
+                    activeSystemList[i]->reliabilityLayer.SetCongestionControl(bcs->congestionControl);
+            }
+            else
+            {
+                RakPeer::RemoteSystemStruct *remoteSystem = GetRemoteSystem(bcs->systemIdentifier, true, true);
+                if (remoteSystem)
+                    remoteSystem->reliabilityLayer.SetCongestionControl(bcs->congestionControl);
+            }
+        }
+        else if (bcs->command == BufferedCommandStruct::BCS_SET_MESSAGE_COALESCING)
+        {
+            if (bcs->systemIdentifier.systemAddress == UNASSIGNED_SYSTEM_ADDRESS)
+            {
+                for (unsigned int i = 0; i < activeSystemListSize; i++)
+                    activeSystemList[i]->reliabilityLayer.SetMessageCoalescing(bcs->coalescingWindow);
+            }
+            else
+            {
+                RakPeer::RemoteSystemStruct *remoteSystem = GetRemoteSystem(bcs->systemIdentifier, true, true);
+                if (remoteSystem)
+                    remoteSystem->reliabilityLayer.SetMessageCoalescing(bcs->coalescingWindow);
+            }
+        }
+        else if (bcs->command == BufferedCommandStruct::BCS_SET_CHANNEL_COMPRESSION)
+        {
+            // Also for the connections made after this
+            unsigned char orderingChannel = (unsigned char) bcs->orderingChannel;
+            channelCompression[orderingChannel] = bcs->compressionCodec;
+            for (unsigned int i = 0; i < activeSystemListSize; i++)
+                activeSystemList[i]->reliabilityLayer.SetChannelCompression(orderingChannel, bcs->compressionCodec);
+        }
+        else if (bcs->command == BufferedCommandStruct::BCS_SET_RELIABILITY_COMPRESSION)
+        {
+            reliabilityCompression[bcs->reliability] = bcs->compressionCodec;
+            for (unsigned int i = 0; i < activeSystemListSize; i++)
+                activeSystemList[i]->reliabilityLayer.SetReliabilityCompression(bcs->reliability, bcs->compressionCodec);
+        }
+        else if (bcs->command == BufferedCommandStruct::BCS_SET_TICK_PROFILING)
+        {
+            for (unsigned int i = 0; i < activeSystemListSize; i++)
+                activeSystemList[i]->reliabilityLayer.SetTickProfiling(bcs->tickProfiling);
+        }
         else if (bcs->command == BufferedCommandStruct::BCS_GET_SOCKET)
         {
             SocketQueryOutput *sqo = socketQueryOutput.Allocate();
@@ -5550,8 +6562,55 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
         requestedConnectionQueueMutex.Unlock();
     }
 
+    if (banTable.Size() > 0)
+    {
+        if (timeNS == 0)
+        {
+            timeNS = RakNet::GetTimeUS();
+            timeMS = (RakNet::TimeMS) (timeNS / (RakNet::TimeUS) 1000);
+        }
+
+        // Lookups ignore expired bans already, so this only frees their memory. It visits every ban, so it is not done every cycle
+        if ((RakNet::TimeMS) timeMS >= nextBanTablePruneTime)
+        {
+            banListMutex.Lock();
+            banTable.RemoveExpired((RakNet::TimeMS) timeMS);
+            banListMutex.Unlock();
+            nextBanTablePruneTime = (RakNet::TimeMS) timeMS + BAN_TABLE_PRUNE_INTERVAL_MS;
+        }
+    }
+
+    if (updateShards.Size() > 0)
+    {
+        if (timeNS == 0)
+        {
+            timeNS = RakNet::GetTimeUS();
+            timeMS = (RakNet::TimeMS) (timeNS / (RakNet::TimeUS) 1000);
+        }
+
+        // Reads datagrams, makes unicast sends and calls ReliabilityLayer::Update for every remote system, one thread per shard
+        RunUpdateShards(timeNS, updateBitStream);
+    }
+
+    // Update shards already updated every reliability layer, so visit every system. Otherwise only the ones that are due
+    unsigned int remoteSystemsToUpdateSize = 0;
+    if (updateShards.Size() > 0)
+    {
+        for (unsigned int i = 0; i < activeSystemListSize; i++)
+            remoteSystemsToUpdate[remoteSystemsToUpdateSize++] = activeSystemList[i]->remoteSystemIndex;
+    }
+    else if (activeSystemListSize > 0)
+    {
+        if (timeNS == 0)
+        {
+            timeNS = RakNet::GetTimeUS();
+            timeMS = (RakNet::TimeMS) (timeNS / (RakNet::TimeUS) 1000);
+        }
+        remoteSystemsToUpdateSize = remoteSystemUpdateTimers.PopExpired(timeNS, remoteSystemsToUpdate);
+    }
+
     // remoteSystemList in network thread
-    for (unsigned activeSystemListIndex = 0; activeSystemListIndex < activeSystemListSize; ++activeSystemListIndex)
+    for (unsigned remoteSystemsToUpdateIndex = 0; remoteSystemsToUpdateIndex < remoteSystemsToUpdateSize; ++remoteSystemsToUpdateIndex)
         //for ( remoteSystemIndex = 0; remoteSystemIndex < remoteSystemListSize; ++remoteSystemIndex )
     {
         // I'm using systemAddress from remoteSystemList but am not locking it because this loop is called very frequently and it doesn't
@@ -5562,7 +6621,10 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 
 
         // Found an active remote system
-        RakPeer::RemoteSystemStruct *remoteSystem = activeSystemList[activeSystemListIndex];
+        RakPeer::RemoteSystemStruct *remoteSystem = remoteSystemList + remoteSystemsToUpdate[remoteSystemsToUpdateIndex];
+        // Closed while visiting another system this cycle
+        if (!remoteSystem->isActive)
+            continue;
         systemAddress = remoteSystem->systemAddress;
         RakAssert(systemAddress != UNASSIGNED_SYSTEM_ADDRESS);
         // Update is only safe to call from the same thread that calls HandleSocketReceiveFromConnectedPlayer,
@@ -5592,9 +6654,11 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
             }
         }
 
-        remoteSystem->reliabilityLayer.Update(remoteSystem->rakNetSocket, systemAddress, remoteSystem->MTUSize, timeNS,
-                                              maxOutgoingBPS, pluginListNTS, &rnr,
-                                              updateBitStream); // systemAddress only used for the internet simulator test
+        // With update shards, this was done by RunUpdateShards()
+        if (updateShards.Size() == 0)
+            remoteSystem->reliabilityLayer.Update(remoteSystem->rakNetSocket, systemAddress, remoteSystem->MTUSize, timeNS,
+                                                  maxOutgoingBPS, pluginListNTS, &rnr,
+                                                  updateBitStream); // systemAddress only used for the internet simulator test
 
         // Check for failure conditions
         if (remoteSystem->reliabilityLayer.IsDeadConnection() ||
@@ -5649,6 +6713,17 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
             continue;
         }
 
+        // Heard nothing back while messages wait for an ack. If our address changed, this moves the connection to the new one
+        if (remoteSystem->connectMode == RemoteSystemStruct::CONNECTED && remoteSystem->hasRemoteSessionToken &&
+            !remoteSystem->reliabilityLayer.IsResendQueueEmpty())
+        {
+            RakNet::TimeMS lastDatagramArrived = remoteSystem->reliabilityLayer.GetTimeLastDatagramArrived();
+            if ((RakNet::TimeMS) timeMS > lastDatagramArrived &&
+                (RakNet::TimeMS) timeMS - lastDatagramArrived > SESSION_RESUME_SILENCE_MS &&
+                (RakNet::TimeMS) timeMS - remoteSystem->lastSessionResumeRequestTime >= SESSION_RESUME_INTERVAL_MS)
+                SendSessionResumeRequest(remoteSystem, (RakNet::TimeMS) timeMS);
+        }
+
         // Ping this guy if it is time to do so
         if (remoteSystem->connectMode == RemoteSystemStruct::CONNECTED && timeMS > remoteSystem->nextPingTime &&
             (occasionalPing || remoteSystem->lowestPing == (unsigned short) -1))
@@ -5664,9 +6739,12 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
         //if (systemAddress < authoritativeClientSystemAddress)
         // authoritativeClientSystemAddress=systemAddress;
 
+        TickPhaseScope handoffScope(&remoteSystem->reliabilityLayer, TICK_PHASE_RECEIVE_HANDOFF);
+
         // Does the reliability layer have any packets waiting for us?
         // To be thread safe, this has to be called in the same thread as HandleSocketReceiveFromConnectedPlayer
-        BitSize_t bitSize = remoteSystem->reliabilityLayer.Receive(&data);
+        RakNet::TimeUS dataTimeRead = 0;
+        BitSize_t bitSize = remoteSystem->reliabilityLayer.Receive(&data, tickProfiling ? &dataTimeRead : 0);
 
         while (bitSize > 0)
         {
@@ -5687,7 +6765,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                 if ((data)[0] == ID_CONNECTION_REQUEST)
                 {
                     ParseConnectionRequestPacket(remoteSystem, systemAddress, (const char *) data, byteSize);
-                    free(data);
+                    PacketArena::FreeData(data);
                 }
                 else
                 {
@@ -5696,11 +6774,9 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     CRABNET_DEBUG_PRINTF("Temporarily banning %i:%i for sending nonsense data\n", systemAddress);
 #endif
 
-                    char str1[64];
-                    systemAddress.ToString(false, str1);
-                    AddToBanList(str1, remoteSystem->reliabilityLayer.GetTimeoutTime());
+                    AddToBanList(systemAddress, 128, remoteSystem->reliabilityLayer.GetTimeoutTime());
 
-                    free(data);
+                    PacketArena::FreeData(data);
                 }
             }
             else
@@ -5727,7 +6803,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                         // This can happen due to race conditions with the fully connected mesh
                         OnConnectionRequest(remoteSystem, incomingTimestamp);
                     }
-                    free(data);
+                    PacketArena::FreeData(data);
                 }
                 else if (data[0] == ID_NEW_INCOMING_CONNECTION && byteSize > sizeof(unsigned char) + sizeof(unsigned int) +
                                                                              sizeof(unsigned short) + sizeof(RakNet::Time) * 2)
@@ -5736,6 +6812,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     {
                         remoteSystem->connectMode = RemoteSystemStruct::CONNECTED;
                         PingInternal(systemAddress, true, UNRELIABLE);
+                        SendSessionToken(remoteSystem);
 
                         // Update again immediately after this tick so the ping goes out right away
                         quitAndDataEvents.SetEvent();
@@ -5802,7 +6879,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 
                     OnConnectedPong(sendPingTime, sendPongTime, remoteSystem);
 
-                    free(data);
+                    PacketArena::FreeData(data);
                 }
                 else if (data[0] == ID_CONNECTED_PING && byteSize == sizeof(unsigned char) + sizeof(RakNet::Time))
                 {
@@ -5821,20 +6898,26 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     // Update again immediately after this tick so the ping goes out right away
                     quitAndDataEvents.SetEvent();
 
-                    free(data);
+                    PacketArena::FreeData(data);
                 }
                 else if (data[0] == ID_DISCONNECTION_NOTIFICATION)
                 {
                     // We shouldn't close the connection immediately because we need to ack the ID_DISCONNECTION_NOTIFICATION
                     remoteSystem->connectMode = RemoteSystemStruct::DISCONNECT_ON_NO_ACK;
-                    free(data);
+                    PacketArena::FreeData(data);
 
                     //    AddPacketToProducer(packet);
                 }
                 else if ((data)[0] == ID_DETECT_LOST_CONNECTIONS && byteSize == sizeof(unsigned char))
                 {
                     // Do nothing
-                    free(data);
+                    PacketArena::FreeData(data);
+                }
+                else if ((data)[0] == ID_SESSION_TOKEN && byteSize == sizeof(MessageID) + SESSION_TOKEN_LENGTH)
+                {
+                    memcpy(remoteSystem->remoteSessionToken, data + sizeof(MessageID), SESSION_TOKEN_LENGTH);
+                    remoteSystem->hasRemoteSessionToken = true;
+                    PacketArena::FreeData(data);
                 }
                 else if ((data)[0] == ID_INVALID_PASSWORD)
                 {
@@ -5852,7 +6935,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     }
                     else
                     {
-                        free(data);
+                        PacketArena::FreeData(data);
                     }
                 }
                 else if ((unsigned char) (data)[0] == ID_CONNECTION_REQUEST_ACCEPTED)
@@ -5932,15 +7015,16 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 
                             if (!alreadyConnected)
                                 PingInternal(systemAddress, true, UNRELIABLE);
+                            SendSessionToken(remoteSystem);
                         }
                         else
-                            free(data); // Ignore, already connected
+                            PacketArena::FreeData(data); // Ignore, already connected
                     }
                     else
                     {
                         // Version mismatch error?
                         RakAssert(0);
-                        free(data);
+                        PacketArena::FreeData(data);
                     }
                 }
                 else
@@ -5957,20 +7041,36 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                         packet->systemAddress.systemIndex = remoteSystem->remoteSystemIndex;
                         packet->guid = remoteSystem->guid;
                         packet->guid.systemIndex = packet->systemAddress.systemIndex;
+                        packet->timeRead = dataTimeRead;
                         AddPacketToProducer(packet);
                     }
                     else
-                        free(data);
+                        PacketArena::FreeData(data);
                 }
             }
 
             // Does the reliability layer have any more packets waiting for us?
             // To be thread safe, this has to be called in the same thread as HandleSocketReceiveFromConnectedPlayer
-            bitSize = remoteSystem->reliabilityLayer.Receive(&data);
+            bitSize = remoteSystem->reliabilityLayer.Receive(&data, tickProfiling ? &dataTimeRead : 0);
         }
 
     }
 
+    // Visit each system again when it next has a timer due. Sends to it and datagrams from it bring that forward
+    if (updateShards.Size() == 0)
+    {
+        for (unsigned int i = 0; i < remoteSystemsToUpdateSize; i++)
+        {
+            RakPeer::RemoteSystemStruct *remoteSystem = remoteSystemList + remoteSystemsToUpdate[i];
+            if (remoteSystem->isActive)
+                ScheduleRemoteSystemUpdate(remoteSystem, timeNS + GetTimeUntilRemoteSystemUpdate(remoteSystem, timeNS));
+        }
+    }
+
+    // Write out everything the reliability layers queued this cycle, across all remote systems
+    for (unsigned int i = 0; i < socketList.Size(); i++)
+        socketList[i]->FlushSendBatch();
+
     return true;
 }
 
@@ -5981,7 +7081,18 @@ void RakPeer::OnRNS2Recv(RNS2RecvStruct *recvStruct)
     if (incomingDatagramEventHandler && !incomingDatagramEventHandler(recvStruct))
         return;
 
-    PushBufferedPacket(recvStruct);
+    // Datagrams from connected systems have the first bit set (DatagramHeaderFormat::isValid). So does ID_SESSION_RESUME_REQUEST, but like every offline
+    // message with an identifier that high it carries OFFLINE_MESSAGE_DATA_ID right after it, and has to reach ProcessOfflineNetworkPacket() on the main update thread
+    if (updateShards.Size() > 0 && recvStruct->bytesRead > 2 && (recvStruct->data[0] & 0x80) &&
+        !(recvStruct->bytesRead >= (int) (sizeof(MessageID) + sizeof(OFFLINE_MESSAGE_DATA_ID)) &&
+          memcmp(recvStruct->data + sizeof(MessageID), OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0))
+    {
+        // If the shard is far behind, the main update thread takes the datagram instead
+        if (!updateShards[GetUpdateShardIndex(recvStruct->systemAddress)]->bufferedPacketsQueue.Push(recvStruct))
+            PushBufferedPacket(recvStruct);
+    }
+    else
+        PushBufferedPacket(recvStruct);
     quitAndDataEvents.SetEvent();
 }
 
@@ -6069,8 +7180,8 @@ RAK_THREAD_DECLARATION(RakNet::UpdateNetworkLoop)
 
         rakPeer->RunUpdateCycle(updateBitStream);
 
-        // Pending sends go out this often, unless quitAndDataEvents is set
-        rakPeer->quitAndDataEvents.WaitOnEvent(10);
+        // Until the next remote system has a timer due, or pending sends go out at UPDATE_THREAD_MAX_SLEEP_MS, unless quitAndDataEvents is set
+        rakPeer->quitAndDataEvents.WaitOnEvent(rakPeer->GetUpdateThreadSleepTime());
 
         /*
 
@@ -6118,6 +7229,42 @@ RAK_THREAD_DECLARATION(RakNet::UpdateNetworkLoop)
     return 0;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+RAK_THREAD_DECLARATION(RakNet::UpdateShardLoop)
+{
+    RakPeer::UpdateShard *shard = (RakPeer::UpdateShard *) arguments;
+    RakPeer *rakPeer = shard->rakPeer;
+
+    BitStream updateBitStream(MAXIMUM_MTU_SIZE
+#ifdef LIBCAT_SECURITY
+        + cat::AuthenticatedEncryption::OVERHEAD_BYTES
+#endif
+    );
+
+    unsigned int lastUpdateCycle = shard->updateCycle;
+    shard->isThreadActive = true;
+
+    // Finish a cycle that was started before quitting, so RunUpdateShards() never waits on a thread that is gone
+    while (true)
+    {
+        if (shard->updateCycle != lastUpdateCycle)
+        {
+            lastUpdateCycle = shard->updateCycle;
+            rakPeer->UpdateShardCycle(shard, rakPeer->updateShardsTime, updateBitStream);
+            if (--rakPeer->updateShardsRunning == 0)
+                rakPeer->updateShardsDoneEvent.SetEvent();
+        }
+        else if (rakPeer->endUpdateShardThreads)
+            break;
+        else
+            shard->updateEvent.WaitOnEvent(1000);
+    }
+
+    shard->isThreadActive = false;
+
+    return 0;
+}
+
 void RakPeer::CallPluginCallbacks(DataStructures::List<PluginInterface2 *> &pluginList, Packet *packet)
 {
     for (unsigned i = 0; i < pluginList.Size(); i++)
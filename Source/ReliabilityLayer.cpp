@@ -21,6 +21,8 @@
 #include "RakAssert.h"
 #include "Rand.h"
 #include "MessageIdentifiers.h"
+#include "PacketArena.h"
+#include "MessageCompressor.h"
 
 #ifdef USE_THREADED_SEND
 #include "SendToThread.h"
@@ -49,11 +51,17 @@ double Ceil(double d)
 #if CC_TIME_TYPE_BYTES == 4
 static const CCTimeType MAX_TIME_BETWEEN_PACKETS= 350; // 350 milliseconds
 static const CCTimeType HISTOGRAM_RESTART_CYCLE=10000; // Every 10 seconds reset the histogram
+static const CCTimeType RESEND_TIMER_WHEEL_TICK = 2; // 2 milliseconds
 #else
 static const CCTimeType MAX_TIME_BETWEEN_PACKETS = 350000; // 350 milliseconds
+static const CCTimeType RESEND_TIMER_WHEEL_TICK = 2000; // 2 milliseconds
 //static const CCTimeType HISTOGRAM_RESTART_CYCLE=10000000; // Every 10 seconds reset the histogram
 #endif
 static const int DEFAULT_HAS_RECEIVED_PACKET_QUEUE_SIZE = 512;
+// Acks are only sent with data if there is room for the count, the first index and the length of one range
+static const unsigned int PIGGYBACKED_ACK_MINIMUM_BYTES = 2 + sizeof(DatagramSequenceNumberType);
+// After n compression tries in a row that don't pay off, the next 2^n-1 messages are sent without trying. n stops growing here
+static const unsigned char COMPRESSION_MAX_BACKOFF_SHIFT = 6;
 static const CCTimeType STARTING_TIME_BETWEEN_PACKETS = MAX_TIME_BETWEEN_PACKETS;
 //static const long double TIME_BETWEEN_PACKETS_INCREASE_MULTIPLIER_DEFAULT=.02;
 //static const long double TIME_BETWEEN_PACKETS_DECREASE_MULTIPLIER_DEFAULT=1.0 / 9.0;
@@ -136,8 +144,11 @@ struct DatagramHeaderFormat
     bool isNAK;
     bool isPacketPair;
     bool hasBAndAS;
+    bool hasData; // Carries messages. An ACK can be followed by the header and messages of a data datagram, to save sending both
     bool isContinuousSend;
     bool needsBAndAs;
+    bool isProtected; // Covered by a forward error correction parity datagram
+    bool isParity; // Forward error correction parity for earlier datagrams, rather than messages
     bool isValid; // To differentiate between what I serialized, and offline data
 
     static BitSize_t GetDataHeaderBitLength()
@@ -150,7 +161,7 @@ struct DatagramHeaderFormat
         //return 2 + 3 + sizeof(RakNet::TimeMS) + sizeof(float)*2;
         return 2 + 3 +
                #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
-               sizeof(RakNetTimeMS) +
+               sizeof(RakNet::TimeMS) +
                #endif
                sizeof(float) * 1;
     }
@@ -167,6 +178,7 @@ struct DatagramHeaderFormat
         {
             b->Write(true);
             b->Write(hasBAndAS);
+            b->Write(hasData);
             b->AlignWriteToByteBoundary();
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
             RakNet::TimeMS timeMSLow=(RakNet::TimeMS) sourceSystemTime&0xFFFFFFFF; b->Write(timeMSLow);
@@ -176,6 +188,15 @@ struct DatagramHeaderFormat
                 // b->Write(B);
                 b->Write(AS);
             }
+            if (hasData)
+            {
+                // The ack ranges go after this, then the messages
+                b->Write(isPacketPair);
+                b->Write(isContinuousSend);
+                b->Write(needsBAndAs);
+                b->AlignWriteToByteBoundary();
+                b->Write(datagramNumber);
+            }
         }
         else if (isNAK)
         {
@@ -189,6 +210,8 @@ struct DatagramHeaderFormat
             b->Write(isPacketPair);
             b->Write(isContinuousSend);
             b->Write(needsBAndAs);
+            b->Write(isProtected);
+            b->Write(isParity);
             b->AlignWriteToByteBoundary();
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
             RakNet::TimeMS timeMSLow=(RakNet::TimeMS) sourceSystemTime&0xFFFFFFFF; b->Write(timeMSLow);
@@ -205,11 +228,14 @@ struct DatagramHeaderFormat
 
         b->Read(isValid);
         b->Read(isACK);
+        isProtected = false;
+        isParity = false;
         if (isACK)
         {
             isNAK = false;
             isPacketPair = false;
             b->Read(hasBAndAS);
+            b->Read(hasData);
             b->AlignReadToByteBoundary();
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
             RakNet::TimeMS timeMS; b->Read(timeMS); sourceSystemTime=(CCTimeType) timeMS;
@@ -219,10 +245,19 @@ struct DatagramHeaderFormat
                 // b->Read(B);
                 b->Read(AS);
             }
+            if (hasData)
+            {
+                b->Read(isPacketPair);
+                b->Read(isContinuousSend);
+                b->Read(needsBAndAs);
+                b->AlignReadToByteBoundary();
+                b->Read(datagramNumber);
+            }
         }
         else
         {
             b->Read(isNAK);
+            hasData = !isNAK;
             if (isNAK)
                 isPacketPair = false;
             else
@@ -230,6 +265,8 @@ struct DatagramHeaderFormat
                 b->Read(isPacketPair);
                 b->Read(isContinuousSend);
                 b->Read(needsBAndAs);
+                b->Read(isProtected);
+                b->Read(isParity);
                 b->AlignReadToByteBoundary();
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
                 RakNet::TimeMS timeMS; b->Read(timeMS); sourceSystemTime=(CCTimeType) timeMS;
@@ -260,17 +297,10 @@ using namespace RakNet;
 
 int RakNet::SplitPacketChannelComp(SplitPacketIdType const &key, SplitPacketChannel *const &data)
 {
-#if PREALLOCATE_LARGE_MESSAGES == 1
-    if (key < data->returnedPacket->splitPacketId)
-        return -1;
-    if (key == data->returnedPacket->splitPacketId)
-        return 0;
-#else
     if (key < data->splitPacketList.id())
         return -1;
     if (key == data->splitPacketList.id())
         return 0;
-#endif
     return 1;
 }
 
@@ -336,8 +366,24 @@ ReliabilityLayer::ReliabilityLayer()
         fp = fopen("reliableorderedoutput.txt", "wt");
 #endif
 
+    tickProfiling = false;
+    activeTickPhase = 0;
+    fecReceiveHistory = 0;
+
+#if USE_SLIDING_WINDOW_CONGESTION_CONTROL == 1
+    congestionControlAlgorithm = CC_SLIDING_WINDOW;
+#else
+    congestionControlAlgorithm = CC_UDT;
+#endif
+    congestionManager = CCRakNetInterface::Allocate(congestionControlAlgorithm);
+    congestionManager->Init(RakNet::GetTimeUS(), MAXIMUM_MTU_SIZE - UDP_HEADER_SIZE);
+
+    resendBuffer = new InternalPacket *[RESEND_BUFFER_ARRAY_LENGTH];
+    resendBufferMask = RESEND_BUFFER_ARRAY_LENGTH - 1;
+    memset(resendBuffer, 0, sizeof(InternalPacket *) * RESEND_BUFFER_ARRAY_LENGTH);
+    memset(resendTimerWheel, 0, sizeof(resendTimerWheel));
+
     InitializeVariables();
-    datagramHistoryMessagePool.SetPageSize(sizeof(MessageNumberNode) * 128);
     internalPacketPool.SetPageSize(sizeof(InternalPacket) * INTERNAL_PACKET_PAGE_SIZE);
     refCountedDataPool.SetPageSize(sizeof(InternalPacketRefCountedData) * 32);
 }
@@ -348,6 +394,8 @@ ReliabilityLayer::ReliabilityLayer()
 ReliabilityLayer::~ReliabilityLayer()
 {
     FreeMemory(true); // Free all memory immediately
+    delete congestionManager;
+    delete [] resendBuffer;
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -370,7 +418,7 @@ void ReliabilityLayer::Reset(bool resetVariables, int MTUSize, bool _useSecurity
 #else
         (void) _useSecurity;
 #endif // LIBCAT_SECURITY
-        congestionManager.Init(RakNet::GetTimeUS(), MTUSize - UDP_HEADER_SIZE);
+        congestionManager->Init(RakNet::GetTimeUS(), MTUSize - UDP_HEADER_SIZE);
     }
 }
 
@@ -403,6 +451,7 @@ void ReliabilityLayer::InitializeVariables(void)
     memset(&heapIndexOffsets, 0, sizeof(heapIndexOffsets));
 
     statistics.connectionStartTime = RakNet::GetTimeUS();
+    tickProfile.Clear();
     splitPacketId = 0;
     elapsedTimeSinceLastUpdate = 0;
     throughputCapCountdown = 0;
@@ -415,6 +464,14 @@ void ReliabilityLayer::InitializeVariables(void)
     remoteSystemTime = 0;
     unreliableTimeout = 0;
     lastBpsClear = 0;
+    forwardErrorCorrectionChannels = 0;
+    datagramLossRate = 0.0;
+    coalescingWindow = 0;
+    coalescedPacket = 0;
+    coalescedMessageCount = 0;
+    memset(channelCompression, 0, sizeof(channelCompression));
+    memset(reliabilityCompression, 0, sizeof(reliabilityCompression));
+    messageCompressor = 0;
 
     // Disable packet pairs
     countdownToNextPacketPair = 15;
@@ -450,7 +507,8 @@ void ReliabilityLayer::InitializeVariables(void)
     //    histogramStart=(CCTimeType)0;
     //    histogramBitsSent=0;
     unacknowledgedBytes = 0;
-    resendLinkedListHead = 0;
+    resendTimerWheelTick = 0;
+    resendTimerWheelCount = 0;
     totalUserDataBytesAcked = 0;
 
     datagramHistoryPopCount = 0;
@@ -482,18 +540,21 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
 
     for (unsigned i = 0; i < splitPacketChannelList.Size(); i++)
     {
-        for (unsigned j = 0; j < splitPacketChannelList[i]->splitPacketList.size(); j++)
+        if (splitPacketChannelList[i]->splitPacketList.streamed())
         {
-            FreeInternalPacketData(splitPacketChannelList[i]->splitPacketList[j]);
-            ReleaseToInternalPacketPool(splitPacketChannelList[i]->splitPacketList[j]);
+            FreeInternalPacketData(splitPacketChannelList[i]->streamedPacket);
+            ReleaseToInternalPacketPool(splitPacketChannelList[i]->streamedPacket);
+            FreeInternalPacketData(splitPacketChannelList[i]->lastSplitPacket);
+            ReleaseToInternalPacketPool(splitPacketChannelList[i]->lastSplitPacket);
         }
-#if PREALLOCATE_LARGE_MESSAGES == 1
-        if (splitPacketChannelList[i]->returnedPacket)
+        else
         {
-            FreeInternalPacketData(splitPacketChannelList[i]->returnedPacket );
-            ReleaseToInternalPacketPool( splitPacketChannelList[i]->returnedPacket );
+            for (unsigned j = 0; j < splitPacketChannelList[i]->splitPacketList.size(); j++)
+            {
+                FreeInternalPacketData(splitPacketChannelList[i]->splitPacketList[j]);
+                ReleaseToInternalPacketPool(splitPacketChannelList[i]->splitPacketList[j]);
+            }
         }
-#endif
         delete splitPacketChannelList[i];
     }
     splitPacketChannelList.Clear(false);
@@ -543,14 +604,24 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
 
     //resendList.ForEachData(DeleteInternalPacket);
     //    resendTree.Clear();
-    memset(resendBuffer, 0, sizeof(resendBuffer));
+    // Back to the starting length, if a fast connection grew it
+    if (resendBufferMask != RESEND_BUFFER_ARRAY_LENGTH - 1)
+    {
+        delete [] resendBuffer;
+        resendBuffer = new InternalPacket *[RESEND_BUFFER_ARRAY_LENGTH];
+        resendBufferMask = RESEND_BUFFER_ARRAY_LENGTH - 1;
+    }
+    memset(resendBuffer, 0, sizeof(InternalPacket *) * (resendBufferMask + 1));
     statistics.messagesInResendBuffer = 0;
     statistics.bytesInResendBuffer = 0;
 
-    if (resendLinkedListHead)
+    for (unsigned int slot = 0; slot < RESEND_TIMER_WHEEL_LENGTH && resendTimerWheelCount > 0; slot++)
     {
+        if (resendTimerWheel[slot] == 0)
+            continue;
+
         InternalPacket *prev;
-        InternalPacket *iter = resendLinkedListHead;
+        InternalPacket *iter = resendTimerWheel[slot];
 
 #ifdef _MSC_VER
 #pragma warning( disable : 4127 ) // warning C4127: conditional expression is constant
@@ -561,21 +632,30 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
                 FreeInternalPacketData(iter);
             prev = iter;
             iter = iter->resendNext;
-            if (iter == resendLinkedListHead)
+            resendTimerWheelCount--;
+            if (iter == resendTimerWheel[slot])
             {
                 ReleaseToInternalPacketPool(prev);
                 break;
             }
             ReleaseToInternalPacketPool(prev);
         }
-        resendLinkedListHead = 0;
+        resendTimerWheel[slot] = 0;
     }
+    RakAssert(resendTimerWheelCount == 0);
+    resendTimerWheelCount = 0;
     unacknowledgedBytes = 0;
 
     //    acknowlegements.Clear();
 
     for (unsigned j = 0; j < outgoingPacketBuffer.Size(); j++)
     {
+        InternalPacket *splitPacketSource = outgoingPacketBuffer[j]->splitPacketSource;
+        if (splitPacketSource)
+        {
+            FreeInternalPacketData(splitPacketSource);
+            ReleaseToInternalPacketPool(splitPacketSource);
+        }
         if (outgoingPacketBuffer[j]->data)
             FreeInternalPacketData(outgoingPacketBuffer[j]);
         ReleaseToInternalPacketPool(outgoingPacketBuffer[j]);
@@ -583,6 +663,13 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
 
     outgoingPacketBuffer.Clear(true);
 
+    if (coalescedPacket)
+    {
+        FreeInternalPacketData(coalescedPacket);
+        ReleaseToInternalPacketPool(coalescedPacket);
+        coalescedPacket = 0;
+    }
+
 #ifdef _DEBUG
     for (unsigned i = 0; i < delayList.Size(); i++)
         delete delayList[i];
@@ -617,18 +704,22 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
     datagramMessageIDPool.Clear();
     */
 
-    while (datagramHistory.Size())
-    {
-        RemoveFromDatagramHistory(datagramHistoryPopCount);
-        datagramHistory.Pop();
-        datagramHistoryPopCount++;
-    }
-    datagramHistoryMessagePool.Clear();
+    datagramHistory.ClearAndFree();
+    datagramHistoryMessageNumbers.ClearAndFree();
     datagramHistoryPopCount = 0;
 
     acknowlegements.Clear();
     NAKs.Clear();
 
+    for (unsigned i = 0; i < fecSendGroups.Size(); i++)
+        delete fecSendGroups[i];
+    fecSendGroups.Clear(false);
+    for (unsigned i = 0; i < fecUnusedSendGroups.Size(); i++)
+        delete fecUnusedSendGroups[i];
+    fecUnusedSendGroups.Clear(false);
+    delete[] fecReceiveHistory;
+    fecReceiveHistory = 0;
+
     unreliableLinkedListHead = 0;
 }
 
@@ -644,15 +735,20 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
         const char *buffer, unsigned int length, SystemAddress &systemAddress,
         DataStructures::List<PluginInterface2 *> &messageHandlerList, int MTUSize,
         RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead,
-        BitStream &updateBitStream)
+        BitStream &updateBitStream, bool isRecoveredDatagram)
 {
     RakAssert(buffer != nullptr);
 
+    TickPhaseScope parseScope(this, TICK_PHASE_DATAGRAM_PARSE);
+
+    if (!isRecoveredDatagram)
+    {
 #if CC_TIME_TYPE_BYTES == 4
-    timeRead/=1000;
+        timeRead/=1000;
 #endif
 
-    bpsMetrics[(int) ACTUAL_BYTES_RECEIVED].Push1(timeRead, length);
+        bpsMetrics[(int) ACTUAL_BYTES_RECEIVED].Push1(timeRead, length);
+    }
 
     (void) MTUSize;
 
@@ -671,7 +767,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
     DatagramSequenceNumberType holeCount;
 
 #ifdef LIBCAT_SECURITY
-    if (useSecurity)
+    if (useSecurity && !isRecoveredDatagram)
     {
         unsigned int received = length;
 
@@ -701,6 +797,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
     }
     if (dhf.isACK)
     {
+        TickPhaseScope ackScope(this, TICK_PHASE_ACK_PROCESSING);
         DatagramSequenceNumberType datagramNumber;
         // datagramNumber=dhf.datagramNumber;
 
@@ -714,7 +811,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 #endif
         {
             // Sanity check. This could happen due to type overflow, especially since I only send the low 4 bytes to reduce bandwidth
-            rtt=(CCTimeType) congestionManager.GetRTT();
+            rtt=(CCTimeType) congestionManager->GetRTT();
         }
         //    RakAssert(rtt < 500000);
         //    printf("%i ", (RakNet::TimeMS)(rtt/1000));
@@ -728,11 +825,11 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
             dhf.AS = 0;
         }
 #endif
-        //        congestionManager.OnAck(timeRead, rtt, dhf.hasBAndAS, dhf.B, dhf.AS, totalUserDataBytesAcked );
+        //        congestionManager->OnAck(timeRead, rtt, dhf.hasBAndAS, dhf.B, dhf.AS, totalUserDataBytesAcked );
 
 
         incomingAcks.Clear();
-        if (!incomingAcks.Deserialize(&socketData))
+        if (!incomingAcks.DeserializeCompact(&socketData))
         {
             for (unsigned int messageHandlerIndex = 0;
                  messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
@@ -751,6 +848,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
                             "incomingAcks minIndex > maxIndex or maxIndex is max value", BYTES_TO_BITS(length), systemAddress, true);
                 return false;
             }
+            UpdateDatagramLossRate(false, (uint32_t) (incomingAcks.ranges[i].maxIndex - incomingAcks.ranges[i].minIndex) + 1);
             for (datagramNumber = incomingAcks.ranges[i].minIndex; datagramNumber <= incomingAcks.ranges[i].maxIndex;
                  datagramNumber++)
             {
@@ -762,7 +860,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
                         if (unreliableWithAckReceiptHistory[k].datagramNumber == datagramNumber)
                         {
                             InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-                            AllocInternalPacketData(ackReceipt, 5, false);
+                            AllocReceivedPacketData(ackReceipt, 5);
                             ackReceipt->dataBitLength = BYTES_TO_BITS(5);
                             ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_ACKED;
                             memcpy(ackReceipt->data + sizeof(MessageID),
@@ -777,29 +875,27 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
                     }
                 }
 
-                CCTimeType whenSent;
-                MessageNumberNode *messageNumberNode = GetMessageNumberNodeByDatagramIndex(datagramNumber, &whenSent);
-                if (messageNumberNode)
+                DatagramHistoryNode *datagramHistoryNode = GetDatagramHistoryNode(datagramNumber);
+                if (datagramHistoryNode && datagramHistoryNode->messageNumbersCount > 0)
                 {
                     //    printf("%p Got ack for %i\n", this, datagramNumber.val);
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
-                    congestionManager.OnAck(timeRead, rtt, dhf.hasBAndAS, 0, dhf.AS, totalUserDataBytesAcked, bandwidthExceededStatistic, datagramNumber );
+                    congestionManager->OnAck(timeRead, rtt, dhf.hasBAndAS, 0, dhf.AS, totalUserDataBytesAcked, bandwidthExceededStatistic, datagramNumber );
 #else
                     CCTimeType ping;
-                    if (timeRead > whenSent)
-                        ping = timeRead - whenSent;
+                    if (timeRead > datagramHistoryNode->timeSent)
+                        ping = timeRead - datagramHistoryNode->timeSent;
                     else
                         ping = 0;
-                    congestionManager.OnAck(timeRead, ping, dhf.hasBAndAS, 0, dhf.AS, totalUserDataBytesAcked,
+                    congestionManager->OnAck(timeRead, ping, dhf.hasBAndAS, 0, dhf.AS, totalUserDataBytesAcked,
                                             bandwidthExceededStatistic, datagramNumber);
 #endif
-                    while (messageNumberNode)
+                    const uint32_t messageNumbersEnd = datagramHistoryNode->messageNumbersBegin + datagramHistoryNode->messageNumbersCount;
+                    for (uint32_t position = datagramHistoryNode->messageNumbersBegin; position != messageNumbersEnd; position++)
                     {
-
-                        RemovePacketFromResendListAndDeleteOlderReliableSequenced(messageNumberNode->messageNumber,
+                        RemovePacketFromResendListAndDeleteOlderReliableSequenced(datagramHistoryMessageNumbers[position],
                                                                                   timeRead, messageHandlerList,
                                                                                   systemAddress);
-                        messageNumberNode = messageNumberNode->next;
                     }
 
                     RemoveFromDatagramHistory(datagramNumber);
@@ -809,15 +905,16 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 //                     // Previously used slot, rather than empty unreliable slot
 //                     printf("%p Ack %i is duplicate\n", this, datagramNumber.val);
 // 
-//                      congestionManager.OnDuplicateAck(timeRead, datagramNumber);
+//                      congestionManager->OnDuplicateAck(timeRead, datagramNumber);
 //                 }
             }
         }
     }
     else if (dhf.isNAK)
     {
+        TickPhaseScope nakScope(this, TICK_PHASE_ACK_PROCESSING);
         DataStructures::RangeList<DatagramSequenceNumberType> incomingNAKs;
-        if (!incomingNAKs.Deserialize(&socketData))
+        if (!incomingNAKs.DeserializeCompact(&socketData))
         {
             for (unsigned int messageHandlerIndex = 0;
                  messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
@@ -838,47 +935,59 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 
                 return false;
             }
+            UpdateDatagramLossRate(true, (uint32_t) (incomingNAKs.ranges[i].maxIndex - incomingNAKs.ranges[i].minIndex) + 1);
             // Sanity check
             //RakAssert(incomingNAKs.ranges[i].maxIndex.val-incomingNAKs.ranges[i].minIndex.val<1000);
             for (DatagramSequenceNumberType messageNumber = incomingNAKs.ranges[i].minIndex;
                  messageNumber < incomingNAKs.ranges[i].maxIndex;
                  messageNumber++)
             {
-                congestionManager.OnNAK(timeRead, messageNumber);
+                congestionManager->OnNAK(timeRead, messageNumber);
 
-                if ((messageNumber - datagramHistoryPopCount) >= datagramHistory.Size())
+                DatagramHistoryNode *datagramHistoryNode = GetDatagramHistoryNode(messageNumber);
+                if (datagramHistoryNode == nullptr)
                 {
+                    // Older datagrams are forgotten once nothing sent in them waits for an ack
+                    if (CCRakNetInterface::LessThan(messageNumber, datagramHistoryPopCount))
+                    {
+                        messageNumber = datagramHistoryPopCount - (DatagramSequenceNumberType) 1;
+                        continue;
+                    }
                     ++receivePacketCount;
                     return true;
                 }
-
-                CCTimeType timeSent;
-                MessageNumberNode *messageNumberNode = GetMessageNumberNodeByDatagramIndex(messageNumber, &timeSent);
-                while (messageNumberNode != nullptr)
+                const uint32_t messageNumbersEnd = datagramHistoryNode->messageNumbersBegin + datagramHistoryNode->messageNumbersCount;
+                for (uint32_t position = datagramHistoryNode->messageNumbersBegin; position != messageNumbersEnd; position++)
                 {
                     // Update timers so resends occur immediately
-                    InternalPacket *internalPacket = resendBuffer[messageNumberNode->messageNumber & (uint32_t) RESEND_BUFFER_ARRAY_MASK];
-                    if ((internalPacket != nullptr) && internalPacket->nextActionTime != 0)
+                    DatagramSequenceNumberType nakedMessageNumber = datagramHistoryMessageNumbers[position];
+                    InternalPacket *internalPacket = resendBuffer[nakedMessageNumber & resendBufferMask];
+                    if ((internalPacket != nullptr) && internalPacket->reliableMessageNumber == nakedMessageNumber &&
+                        internalPacket->nextActionTime != 0)
+                    {
+                        // Moves it to the slot of the timer wheel for its new time
+                        RemoveFromList(internalPacket, false);
                         internalPacket->nextActionTime = timeRead;
-
-                    messageNumberNode = messageNumberNode->next;
+                        AddToList(internalPacket, false);
+                    }
                 }
             }
         }
     }
-    else
+
+    if (dhf.hasData)
     {
         uint32_t skippedMessageCount;
-        if (!congestionManager.OnGotPacket(dhf.datagramNumber, dhf.isContinuousSend, timeRead, length, &skippedMessageCount))
+        if (!congestionManager->OnGotPacket(dhf.datagramNumber, dhf.isContinuousSend, timeRead, length, &skippedMessageCount))
         {
             for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
                 messageHandlerList[messageHandlerIndex]->OnReliabilityLayerNotification(
-                        "congestionManager.OnGotPacket failed", BYTES_TO_BITS(length), systemAddress, true);
+                        "congestionManager->OnGotPacket failed", BYTES_TO_BITS(length), systemAddress, true);
 
             return true;
         }
         if (dhf.isPacketPair)
-            congestionManager.OnGotPacketPair(dhf.datagramNumber, length, timeRead);
+            congestionManager->OnGotPacketPair(dhf.datagramNumber, length, timeRead);
 
         for (uint32_t skippedMessageOffset = skippedMessageCount; skippedMessageOffset > 0; skippedMessageOffset--)
             NAKs.Insert(dhf.datagramNumber - skippedMessageOffset);
@@ -892,6 +1001,28 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
         SendAcknowledgementPacket(dhf.datagramNumber, 0);
 #endif
 
+        if (dhf.isParity)
+        {
+#if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
+            RecoverFromForwardErrorCorrectionParity(&socketData, dhf.sourceSystemTime, systemAddress, messageHandlerList, MTUSize, s, rnr, timeRead, updateBitStream);
+#else
+            RecoverFromForwardErrorCorrectionParity(&socketData, 0, systemAddress, messageHandlerList, MTUSize, s, rnr, timeRead, updateBitStream);
+#endif
+            receivePacketCount++;
+            return true;
+        }
+
+        // A datagram rebuilt from parity was stored when it was rebuilt
+        if (dhf.isProtected && !isRecoveredDatagram)
+        {
+            unsigned int headerLength = BITS_TO_BYTES(socketData.GetReadOffset());
+            if (!StoreForwardErrorCorrectionDatagram(dhf.datagramNumber, (const unsigned char *) buffer + headerLength, length - headerLength, false))
+            {
+                receivePacketCount++;
+                return true;
+            }
+        }
+
         InternalPacket *internalPacket = CreateInternalPacketFromBitStream(&socketData, timeRead);
         if (internalPacket == nullptr)
         {
@@ -904,17 +1035,21 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 
         while (internalPacket)
         {
-            for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+            if (messageHandlerList.Size() > 0)
             {
+                TickPhaseScope pluginScope(this, TICK_PHASE_PLUGIN_CALLBACKS);
+                for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+                {
 #if CC_TIME_TYPE_BYTES == 4
-                messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket, receivePacketCount, systemAddress, timeRead, false);
+                    messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket, receivePacketCount, systemAddress, timeRead, false);
 #else
-                messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
-                                                                          receivePacketCount,
-                                                                          systemAddress,
-                                                                          (RakNet::TimeMS) (timeRead / (CCTimeType) 1000),
-                                                                          false);
+                    messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
+                                                                              receivePacketCount,
+                                                                              systemAddress,
+                                                                              (RakNet::TimeMS) (timeRead / (CCTimeType) 1000),
+                                                                              false);
 #endif
+                }
             }
 
 
@@ -1248,9 +1383,11 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
                     internalPacket->reliability != UNRELIABLE_SEQUENCED)
                     internalPacket->orderingChannel = 255; // Use 255 to designate not sequenced and not ordered
 
+                // The split packet may be released when it is inserted, such as when its data is copied into a streamed message
+                SplitPacketIdType insertedSplitPacketId = internalPacket->splitPacketId;
                 InsertIntoSplitPacketList(internalPacket, timeRead);
 
-                internalPacket = BuildPacketFromSplitPacketList(internalPacket->splitPacketId, timeRead, s,
+                internalPacket = BuildPacketFromSplitPacketList(insertedSplitPacketId, timeRead, s,
                                                                 systemAddress, rnr, updateBitStream);
 
                 if (internalPacket == nullptr)
@@ -1531,10 +1668,27 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 //-------------------------------------------------------------------------------------------------------
 // This gets an end-user packet already parsed out. Returns number of BITS put into the buffer
 //-------------------------------------------------------------------------------------------------------
-BitSize_t ReliabilityLayer::Receive(unsigned char **data)
+BitSize_t ReliabilityLayer::Receive(unsigned char **data, RakNet::TimeUS *timeRead)
 {
     InternalPacket *internalPacket;
 
+    // Each message in a coalesced message is returned on its own, and compressed messages as they were sent
+    while (outputQueue.Size() > 0 && (outputQueue.Peek()->isCoalesced || outputQueue.Peek()->compressionCodec != MC_NONE))
+    {
+        internalPacket = outputQueue.Pop();
+        if (internalPacket->compressionCodec != MC_NONE && !DecompressMessage(internalPacket))
+        {
+            // The remote system used another dictionary, or a codec that was not compiled in here. It can't be resent, since it was acked
+            statistics.messagesNotDecompressed++;
+            FreeInternalPacketData(internalPacket);
+            ReleaseToInternalPacketPool(internalPacket);
+        }
+        else if (internalPacket->isCoalesced)
+            SplitCoalescedMessage(internalPacket);
+        else
+            outputQueue.PushAtHead(internalPacket, 0);
+    }
+
     if (outputQueue.Size() > 0)
     {
         //  #ifdef _DEBUG
@@ -1545,6 +1699,15 @@ BitSize_t ReliabilityLayer::Receive(unsigned char **data)
         BitSize_t bitLength;
         *data = internalPacket->data;
         bitLength = internalPacket->dataBitLength;
+        if (timeRead)
+        {
+            // Received packets are created with the time their datagram was read
+#if CC_TIME_TYPE_BYTES == 4
+            *timeRead = internalPacket->creationTime * 1000;
+#else
+            *timeRead = internalPacket->creationTime;
+#endif
+        }
         ReleaseToInternalPacketPool(internalPacket);
         return bitLength;
     }
@@ -1564,7 +1727,7 @@ BitSize_t ReliabilityLayer::Receive(unsigned char **data)
 bool
 ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability,
                        unsigned char orderingChannel, bool makeDataCopy, int MTUSize, CCTimeType currentTime,
-                       uint32_t receipt)
+                       uint32_t receipt, InternalPacketSharedData *sharedData, RakNet::TimeUS queueTime)
 {
 #ifdef _DEBUG
     RakAssert(!(reliability >= NUMBER_OF_RELIABILITIES || reliability < 0));
@@ -1594,6 +1757,29 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
     unsigned int numberOfBytesToSend = (unsigned int) BITS_TO_BYTES(numberOfBitsToSend);
     if (numberOfBitsToSend == 0)
         return false;
+
+    // Coalescing and compression read the message as one block, so gather the buffers of RakPeer::SendGather() into one
+    if (sharedData != 0 && sharedData->buffers != 0 &&
+        ((coalescingWindow > 0 && numberOfBytesToSend <= COALESCED_MESSAGE_MAX_SIZE) ||
+         GetCompressionCodec(reliability, orderingChannel) != MC_NONE))
+    {
+        data = (char *) malloc(numberOfBytesToSend);
+        GatherSharedData(sharedData, 0, numberOfBytesToSend, (unsigned char *) data);
+        makeDataCopy = false;
+        sharedData = 0;
+    }
+
+    // Small messages wait for the ones after them. Any other message sends those first, so the order is kept
+    if (coalescingWindow > 0 &&
+        CoalesceMessage(data, numberOfBitsToSend, priority, reliability, orderingChannel, currentTime, queueTime))
+    {
+        bpsMetrics[(int) USER_MESSAGE_BYTES_PUSHED].Push1(currentTime, numberOfBytesToSend);
+        if (!makeDataCopy)
+            free(data);
+        return true;
+    }
+    FlushCoalescedMessages();
+
     InternalPacket *internalPacket = AllocateFromInternalPacketPool();
     if (internalPacket == 0)
     {
@@ -1603,9 +1789,42 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
 
     bpsMetrics[(int) USER_MESSAGE_BYTES_PUSHED].Push1(currentTime, numberOfBytesToSend);
 
+    // The compressed message is sent in place of the original, which is not needed after this
+    RakNet::BitStream compressedMessage;
+    internalPacket->compressionCodec = CompressMessage((const unsigned char *) data, numberOfBitsToSend, reliability,
+                                                       orderingChannel, &compressedMessage);
+    if (internalPacket->compressionCodec != MC_NONE)
+    {
+        if (!makeDataCopy)
+            free(data);
+        data = (char *) compressedMessage.GetData();
+        numberOfBitsToSend = compressedMessage.GetNumberOfBitsUsed();
+        numberOfBytesToSend = (unsigned int) compressedMessage.GetNumberOfBytesUsed();
+        makeDataCopy = true;
+        sharedData = 0;
+    }
+
     internalPacket->creationTime = currentTime;
+    internalPacket->queueTime = tickProfiling ? queueTime : 0;
 
-    if (makeDataCopy)
+    // Calculate if I need to split the packet
+    //    int headerLength = BITS_TO_BYTES( GetMessageHeaderLengthBits( internalPacket, true ) );
+
+    unsigned int maxDataSizeBytes =
+            GetMaxDatagramSizeExcludingMessageHeaderBytes() - BITS_TO_BYTES(GetMaxMessageHeaderLengthBits());
+
+    bool splitPacket = numberOfBytesToSend > maxDataSizeBytes;
+
+    // The buffers are only read when written to a datagram, so this holds them whether it is split or not
+    if (sharedData != 0 && sharedData->buffers != 0)
+        AllocInternalPacketData(internalPacket, sharedData, 0);
+    // SplitPacket() references the data of the original, so it has to be our own
+    else if (sharedData != 0 && !splitPacket && numberOfBytesToSend > sizeof(internalPacket->stackData))
+    {
+        RakAssert((unsigned char *) data == sharedData->sharedDataBlock);
+        AllocInternalPacketData(internalPacket, sharedData);
+    }
+    else if (makeDataCopy)
     {
         AllocInternalPacketData(internalPacket, numberOfBytesToSend, true);
         //internalPacket->data = (unsigned char*) malloc(( numberOfBytesToSend);
@@ -1619,18 +1838,17 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
     }
 
     internalPacket->dataBitLength = numberOfBitsToSend;
-    internalPacket->messageInternalOrder = internalOrderIndex++;
     internalPacket->priority = priority;
     internalPacket->reliability = reliability;
     internalPacket->sendReceiptSerial = receipt;
+    QueueOutgoingMessage(internalPacket, orderingChannel, splitPacket);
+    return true;
+}
 
-    // Calculate if I need to split the packet
-    //    int headerLength = BITS_TO_BYTES( GetMessageHeaderLengthBits( internalPacket, true ) );
-
-    unsigned int maxDataSizeBytes =
-            GetMaxDatagramSizeExcludingMessageHeaderBytes() - BITS_TO_BYTES(GetMaxMessageHeaderLengthBits());
-
-    bool splitPacket = numberOfBytesToSend > maxDataSizeBytes;
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::QueueOutgoingMessage(InternalPacket *internalPacket, unsigned char orderingChannel, bool splitPacket)
+{
+    internalPacket->messageInternalOrder = internalOrderIndex++;
 
     // If a split packet, we might have to upgrade the reliability
     if (splitPacket)
@@ -1693,7 +1911,7 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
         //SplitPacket( &packetCopy, MTUSize );
         SplitPacket(internalPacket);
         //delete[] packetCopy.data;
-        return true;
+        return;
     }
 
     RakAssert(internalPacket->dataBitLength < BYTES_TO_BITS(MAXIMUM_MTU_SIZE));
@@ -1709,9 +1927,274 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
             internalPacket->dataBitLength);
 
     //    sendPacketSet[priority].WriteUnlock();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Coalesced messages are preceded by their length in bits, 7 bits per byte, with the high bit set on all but the last byte
+//-------------------------------------------------------------------------------------------------------
+static unsigned int GetCoalescedLengthBytes(BitSize_t bitLength)
+{
+    return bitLength < 128 ? 1 : 2;
+}
+
+static unsigned char *WriteCoalescedLength(unsigned char *out, BitSize_t bitLength)
+{
+    RakAssert(bitLength < 16384);
+    if (bitLength >= 128)
+        *out++ = (unsigned char) (0x80 | (bitLength >> 7));
+    *out++ = (unsigned char) (bitLength & 0x7F);
+    return out;
+}
+
+static const unsigned char *ReadCoalescedLength(const unsigned char *in, const unsigned char *end, BitSize_t *bitLength)
+{
+    if (in == end)
+        return nullptr;
+    *bitLength = 0;
+    if (*in & 0x80)
+    {
+        *bitLength = (BitSize_t) (*in++ & 0x7F) << 7;
+        if (in == end)
+            return nullptr;
+    }
+    *bitLength |= *in++ & 0x7F;
+    return in;
+}
+
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::CoalesceMessage(const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority,
+                                       PacketReliability reliability, unsigned char orderingChannel, CCTimeType time,
+                                       RakNet::TimeUS queueTime)
+{
+    // Receipts are for single messages, and IMMEDIATE_PRIORITY is not held back
+    unsigned int numberOfBytesToSend = (unsigned int) BITS_TO_BYTES(numberOfBitsToSend);
+    if (numberOfBytesToSend > COALESCED_MESSAGE_MAX_SIZE || priority == IMMEDIATE_PRIORITY ||
+        reliability == UNRELIABLE_WITH_ACK_RECEIPT ||
+        reliability == RELIABLE_WITH_ACK_RECEIPT ||
+        reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT)
+        return false;
+
+    // Never split, so the remote system gets the flag that it is coalesced
+    unsigned int maxDataSizeBytes =
+            GetMaxDatagramSizeExcludingMessageHeaderBytes() - BITS_TO_BYTES(GetMaxMessageHeaderLengthBits());
+    unsigned int length = GetCoalescedLengthBytes(numberOfBitsToSend) + numberOfBytesToSend;
+    if (coalescedPacket != 0 &&
+        (coalescedPacket->priority != priority || coalescedPacket->reliability != reliability ||
+         coalescedPacket->orderingChannel != orderingChannel ||
+         BITS_TO_BYTES(coalescedPacket->dataBitLength) + length > maxDataSizeBytes))
+        FlushCoalescedMessages();
+
+    if (coalescedPacket == 0)
+    {
+        coalescedPacket = AllocateFromInternalPacketPool();
+        if (coalescedPacket == 0)
+        {
+            RakAssert(0)
+            return false; // Out of memory
+        }
+        AllocInternalPacketData(coalescedPacket, maxDataSizeBytes, false);
+        coalescedPacket->creationTime = time;
+        coalescedPacket->queueTime = tickProfiling ? queueTime : 0;
+        coalescedPacket->dataBitLength = 0;
+        coalescedPacket->priority = priority;
+        coalescedPacket->reliability = reliability;
+        coalescedPacket->orderingChannel = orderingChannel;
+        coalescedPacket->sendReceiptSerial = 0;
+        coalescedMessageCount = 0;
+#if CC_TIME_TYPE_BYTES == 4
+        coalescedPacketSendTime = time + (CCTimeType) (coalescingWindow / 1000);
+#else
+        coalescedPacketSendTime = time + coalescingWindow;
+#endif
+    }
+
+    unsigned char *out = coalescedPacket->data + BITS_TO_BYTES(coalescedPacket->dataBitLength);
+    out = WriteCoalescedLength(out, numberOfBitsToSend);
+    memcpy(out, data, numberOfBytesToSend);
+    coalescedPacket->dataBitLength += BYTES_TO_BITS(length);
+    coalescedMessageCount++;
     return true;
 }
 
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::FlushCoalescedMessages(void)
+{
+    if (coalescedPacket == 0)
+        return;
+
+    InternalPacket *internalPacket = coalescedPacket;
+    coalescedPacket = 0;
+    if (coalescedMessageCount == 1)
+    {
+        // Nothing joined it, so it goes as it was sent
+        const unsigned char *end = internalPacket->data + BITS_TO_BYTES(internalPacket->dataBitLength);
+        BitSize_t bitLength;
+        const unsigned char *in = ReadCoalescedLength(internalPacket->data, end, &bitLength);
+        memmove(internalPacket->data, in, end - in);
+        internalPacket->dataBitLength = bitLength;
+    }
+    else
+        internalPacket->isCoalesced = true;
+
+    RakNet::BitStream compressedMessage;
+    internalPacket->compressionCodec = CompressMessage(internalPacket->data, internalPacket->dataBitLength, internalPacket->reliability,
+                                                       internalPacket->orderingChannel, &compressedMessage);
+    if (internalPacket->compressionCodec != MC_NONE)
+    {
+        // Smaller, so it fits where the messages were
+        memcpy(internalPacket->data, compressedMessage.GetData(), (size_t) compressedMessage.GetNumberOfBytesUsed());
+        internalPacket->dataBitLength = compressedMessage.GetNumberOfBitsUsed();
+    }
+    QueueOutgoingMessage(internalPacket, internalPacket->orderingChannel, false);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SplitCoalescedMessage(InternalPacket *internalPacket)
+{
+    const unsigned char *start = internalPacket->data;
+    const unsigned char *end = start + BITS_TO_BYTES(internalPacket->dataBitLength);
+    const unsigned char *in = start;
+    BitSize_t bitLength;
+
+    // This comes from the remote system, so check every length first and drop the whole message if any is wrong
+    while (in < end)
+    {
+        in = ReadCoalescedLength(in, end, &bitLength);
+        if (in == nullptr || bitLength == 0 || (BitSize_t) (end - in) < BITS_TO_BYTES(bitLength))
+        {
+            FreeInternalPacketData(internalPacket);
+            ReleaseToInternalPacketPool(internalPacket);
+            return;
+        }
+        in += BITS_TO_BYTES(bitLength);
+    }
+
+    unsigned int messageCount = 0;
+    in = start;
+    while (in < end)
+    {
+        in = ReadCoalescedLength(in, end, &bitLength);
+
+        InternalPacket *message = AllocateFromInternalPacketPool();
+        message->creationTime = internalPacket->creationTime;
+        message->reliability = internalPacket->reliability;
+        message->orderingChannel = internalPacket->orderingChannel;
+        message->dataBitLength = bitLength;
+        AllocReceivedPacketData(message, (unsigned int) BITS_TO_BYTES(bitLength));
+        memcpy(message->data, in, BITS_TO_BYTES(bitLength));
+        outputQueue.PushAtHead(message, messageCount++);
+        in += BITS_TO_BYTES(bitLength);
+    }
+
+    FreeInternalPacketData(internalPacket);
+    ReleaseToInternalPacketPool(internalPacket);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Compressed messages start with their length in bits, 7 bits per byte, low bits first, with the high bit set on all but the last byte
+//-------------------------------------------------------------------------------------------------------
+static void WriteCompressedMessageLength(RakNet::BitStream *output, BitSize_t bitLength)
+{
+    while (bitLength >= 0x80)
+    {
+        output->Write((unsigned char) (0x80 | (bitLength & 0x7F)));
+        bitLength >>= 7;
+    }
+    output->Write((unsigned char) bitLength);
+}
+
+static const unsigned char *ReadCompressedMessageLength(const unsigned char *in, const unsigned char *end, BitSize_t *bitLength)
+{
+    *bitLength = 0;
+    for (unsigned int shift = 0; in != end && shift < sizeof(BitSize_t) * 8; shift += 7)
+    {
+        unsigned char byte = *in++;
+        *bitLength |= (BitSize_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return in;
+    }
+    return nullptr;
+}
+
+//-------------------------------------------------------------------------------------------------------
+MessageCompressionCodec ReliabilityLayer::GetCompressionCodec(PacketReliability reliability, unsigned char orderingChannel) const
+{
+    if ((reliability == UNRELIABLE_SEQUENCED || reliability == RELIABLE_SEQUENCED || reliability == RELIABLE_ORDERED ||
+         reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT) && channelCompression[orderingChannel].codec != MC_NONE)
+        return channelCompression[orderingChannel].codec;
+    return reliabilityCompression[reliability].codec;
+}
+
+//-------------------------------------------------------------------------------------------------------
+MessageCompressionCodec ReliabilityLayer::CompressMessage(const unsigned char *data, BitSize_t bitLength,
+                                                          PacketReliability reliability, unsigned char orderingChannel,
+                                                          RakNet::BitStream *output)
+{
+    // The codec of the ordering channel comes first, for the reliability types that have one
+    CompressionSetting *setting = &reliabilityCompression[reliability];
+    if ((reliability == UNRELIABLE_SEQUENCED || reliability == RELIABLE_SEQUENCED || reliability == RELIABLE_ORDERED ||
+         reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT) && channelCompression[orderingChannel].codec != MC_NONE)
+        setting = &channelCompression[orderingChannel];
+    const MessageCompressionCodec codec = setting->codec;
+    if (codec == MC_NONE)
+        return MC_NONE;
+
+    unsigned int numberOfBytes = (unsigned int) BITS_TO_BYTES(bitLength);
+    statistics.compressionBytesIn += numberOfBytes;
+    bool compressed = false;
+    if (setting->messagesToSkip > 0)
+        setting->messagesToSkip--;
+    else if (messageCompressor != 0 && numberOfBytes <= MAX_DECOMPRESSED_MESSAGE_SIZE)
+    {
+        RakNet::TimeUS startTime = RakNet::GetTimeUS();
+        WriteCompressedMessageLength(output, bitLength);
+        compressed = messageCompressor->Compress(codec, data, numberOfBytes, output) &&
+                     output->GetNumberOfBytesUsed() < numberOfBytes;
+        statistics.compressionTimeUS += RakNet::GetTimeUS() - startTime;
+
+        // Data that doesn't compress is tried less and less often, so it costs little
+        if (compressed)
+            setting->failures = 0;
+        else
+        {
+            if (setting->failures < COMPRESSION_MAX_BACKOFF_SHIFT)
+                setting->failures++;
+            setting->messagesToSkip = (unsigned char) ((1 << setting->failures) - 1);
+        }
+    }
+
+    if (!compressed)
+    {
+        statistics.compressionBytesOut += numberOfBytes;
+        statistics.messagesNotCompressed++;
+        return MC_NONE;
+    }
+    statistics.compressionBytesOut += output->GetNumberOfBytesUsed();
+    return codec;
+}
+
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::DecompressMessage(InternalPacket *internalPacket)
+{
+    const unsigned char *in = internalPacket->data;
+    const unsigned char *end = in + BITS_TO_BYTES(internalPacket->dataBitLength);
+    BitSize_t bitLength;
+    in = ReadCompressedMessageLength(in, end, &bitLength);
+    if (in == nullptr || bitLength == 0 || BITS_TO_BYTES(bitLength) > MAX_DECOMPRESSED_MESSAGE_SIZE || messageCompressor == 0)
+        return false;
+
+    RakNet::TimeUS startTime = RakNet::GetTimeUS();
+    InternalPacket compressed = *internalPacket;
+    AllocReceivedPacketData(internalPacket, (unsigned int) BITS_TO_BYTES(bitLength));
+    bool decompressed = messageCompressor->Decompress(compressed.compressionCodec, in, (unsigned int) (end - in),
+                                                      internalPacket->data, (unsigned int) BITS_TO_BYTES(bitLength));
+    FreeInternalPacketData(&compressed);
+    internalPacket->dataBitLength = bitLength;
+    internalPacket->compressionCodec = MC_NONE;
+    statistics.decompressionTimeUS += RakNet::GetTimeUS() - startTime;
+    return decompressed;
+}
+
 //-------------------------------------------------------------------------------------------------------
 // Run this once per game cycle.  Handles internal lists and actually does the send
 //-------------------------------------------------------------------------------------------------------
@@ -1752,6 +2235,9 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
     }
 #endif
 
+    if (coalescedPacket != 0 && time >= coalescedPacketSendTime)
+        FlushCoalescedMessages();
+
     // This line is necessary because the timer isn't accurate
     if (time <= lastUpdateTime)
     {
@@ -1829,9 +2315,6 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
         return;
     }
 
-    if (congestionManager.ShouldSendACKs(time, timeSinceLastTick))
-        SendACKs(s, systemAddress, time, rnr, updateBitStream);
-
     if (NAKs.Size() > 0)
     {
         updateBitStream.Reset();
@@ -1840,13 +2323,14 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
         dhfNAK.isACK = false;
         dhfNAK.isPacketPair = false;
         dhfNAK.Serialize(&updateBitStream);
-        NAKs.Serialize(&updateBitStream, GetMaxDatagramSizeExcludingMessageHeaderBits(), true);
+        NAKs.SerializeCompact(&updateBitStream, GetMaxDatagramSizeExcludingMessageHeaderBits(), true);
         SendBitStream(s, systemAddress, &updateBitStream, rnr, time);
     }
 
     DatagramHeaderFormat dhf;
-    dhf.needsBAndAs = congestionManager.GetIsInSlowStart();
+    dhf.needsBAndAs = congestionManager->GetIsInSlowStart();
     dhf.isContinuousSend = bandwidthExceededStatistic;
+    dhf.isParity = false;
     //     bandwidthExceededStatistic=sendPacketSet[0].IsEmpty()==false ||
     //         sendPacketSet[1].IsEmpty()==false ||
     //         sendPacketSet[2].IsEmpty()==false ||
@@ -1855,10 +2339,10 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
 
     const bool hasDataToSendOrResend = !IsResendQueueEmpty() || bandwidthExceededStatistic;
     RakAssert(NUMBER_OF_PRIORITIES == 4);
-    congestionManager.Update(time, hasDataToSendOrResend);
+    congestionManager->Update(time, hasDataToSendOrResend);
 
     statistics.BPSLimitByOutgoingBandwidthLimit = BITS_TO_BYTES(bitsPerSecondLimit);
-    statistics.BPSLimitByCongestionControl = congestionManager.GetBytesPerSecondLimitByCongestionControl();
+    statistics.BPSLimitByCongestionControl = congestionManager->GetBytesPerSecondLimitByCongestionControl();
 
     if (time > lastBpsClear +
                #if CC_TIME_TYPE_BYTES == 4
@@ -1882,7 +2366,7 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
             if (time - unreliableWithAckReceiptHistory[i].nextActionTime < (((CCTimeType) -1) / 2))
             {
                 InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-                AllocInternalPacketData(ackReceipt, 5, false);
+                AllocReceivedPacketData(ackReceipt, 5);
                 ackReceipt->dataBitLength = BYTES_TO_BITS(5);
                 ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_LOSS;
                 memcpy(ackReceipt->data + sizeof(MessageID), &unreliableWithAckReceiptHistory[i].sendReceiptSerial, sizeof(uint32_t));
@@ -1904,12 +2388,13 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
         dhf.hasBAndAS = false;
         ResetPacketsAndDatagrams();
 
-        int transmissionBandwidth = congestionManager.GetTransmissionBandwidth(time, timeSinceLastTick, unacknowledgedBytes, dhf.isContinuousSend);
-        int retransmissionBandwidth = congestionManager.GetRetransmissionBandwidth(time, timeSinceLastTick, unacknowledgedBytes, dhf.isContinuousSend);
+        int transmissionBandwidth = congestionManager->GetTransmissionBandwidth(time, timeSinceLastTick, unacknowledgedBytes, dhf.isContinuousSend);
+        int retransmissionBandwidth = congestionManager->GetRetransmissionBandwidth(time, timeSinceLastTick, unacknowledgedBytes, dhf.isContinuousSend);
         if (retransmissionBandwidth > 0 || transmissionBandwidth > 0)
         {
             statistics.isLimitedByCongestionControl = false;
 
+            TickPhaseScope resendScope(this, TICK_PHASE_RESEND_SCAN);
             allDatagramSizesSoFar = 0;
 
             // Keep filling datagrams until we exceed retransmission bandwidth
@@ -1920,12 +2405,12 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                 // Fill one datagram, then break
                 while (!IsResendQueueEmpty())
                 {
-                    InternalPacket *internalPacket = resendLinkedListHead;
-                    RakAssert(internalPacket->messageNumberAssigned);
+                    InternalPacket *internalPacket = GetNextResend(time);
 
                     //if ( internalPacket->nextActionTime < time )
-                    if (time - internalPacket->nextActionTime < (((CCTimeType) -1) / 2))
+                    if (internalPacket != 0)
                     {
+                        RakAssert(internalPacket->messageNumberAssigned);
                         BitSize_t nextPacketBitLength = internalPacket->headerLength + internalPacket->dataBitLength;
                         if (datagramSizeSoFar + nextPacketBitLength > GetMaxDatagramSizeExcludingMessageHeaderBits())
                         {
@@ -1934,7 +2419,7 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                             break;
                         }
 
-                        PopListHead(false);
+                        RemoveFromList(internalPacket, false);
 
                         CC_DEBUG_PRINTF_2("Rs %i ", internalPacket->reliableMessageNumber.val);
 
@@ -1942,18 +2427,22 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
 
                         PushPacket(time, internalPacket, true); // Affects GetNewTransmissionBandwidth()
                         internalPacket->timesSent++;
-                        congestionManager.OnResend(time, internalPacket->nextActionTime);
-                        internalPacket->retransmissionTime = congestionManager.GetRTOForRetransmission(
+                        congestionManager->OnResend(time, internalPacket->nextActionTime);
+                        internalPacket->retransmissionTime = congestionManager->GetRTOForRetransmission(
                                 internalPacket->timesSent);
                         internalPacket->nextActionTime = internalPacket->retransmissionTime + time;
 
                         pushedAnything = true;
 
-                        for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
-                            messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
-                                                                                      packetsToSendThisUpdateDatagramBoundaries.Size() +
-                                                                                      congestionManager.GetNextDatagramSequenceNumber(),
-                                                                                      systemAddress, timeMs, true);
+                        if (messageHandlerList.Size() > 0)
+                        {
+                            TickPhaseScope pluginScope(this, TICK_PHASE_PLUGIN_CALLBACKS);
+                            for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+                                messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
+                                                                                          packetsToSendThisUpdateDatagramBoundaries.Size() +
+                                                                                          congestionManager->GetNextDatagramSequenceNumber(),
+                                                                                          systemAddress, timeMs, true);
+                        }
 
                         // Put the packet back into the resend list at the correct spot
                         // Don't make a copy since I'm reinserting an allocated struct
@@ -2036,12 +2525,20 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                                       internalPacket->reliability == RELIABLE_ORDERED_WITH_ACK_RECEIPT;
 
                     //sendPacketSet[ i ].Pop();
+                    reliabilityHeapWeightType weight = outgoingPacketBuffer.PeekWeight();
                     outgoingPacketBuffer.Pop(0);
                     RakAssert(outgoingPacketBuffer.Size() == 0 || outgoingPacketBuffer.Peek()->dataBitLength < BYTES_TO_BITS(MAXIMUM_MTU_SIZE));
                     RakAssert(!internalPacket->messageNumberAssigned);
                     statistics.messageInSendBuffer[(int) internalPacket->priority]--;
                     statistics.bytesInSendBuffer[(int) internalPacket->priority] -= (double) BITS_TO_BYTES(internalPacket->dataBitLength);
 
+                    // This split packet of a streamed message is going out, so cut the next one. It takes the same place in the heap
+                    if (internalPacket->splitPacketSource)
+                    {
+                        PushNextSplitPacket(internalPacket->splitPacketSource, weight);
+                        internalPacket->splitPacketSource = 0;
+                    }
+
                     if (isReliable
                         // ||
                         /*
@@ -2072,7 +2569,7 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                     {
                         internalPacket->messageNumberAssigned = true;
                         internalPacket->reliableMessageNumber = sendReliableMessageNumberIndex;
-                        internalPacket->retransmissionTime = congestionManager.GetRTOForRetransmission(internalPacket->timesSent + 1);
+                        internalPacket->retransmissionTime = congestionManager->GetRTOForRetransmission(internalPacket->timesSent + 1);
                         internalPacket->nextActionTime = internalPacket->retransmissionTime + time;
 #if CC_TIME_TYPE_BYTES == 4
                         const CCTimeType threshhold = 10000;
@@ -2083,13 +2580,10 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                             RakAssert(time - internalPacket->nextActionTime < threshhold);
 
                         //resendTree.Insert( internalPacket->reliableMessageNumber, internalPacket);
-                        if (resendBuffer[internalPacket->reliableMessageNumber & (uint32_t) RESEND_BUFFER_ARRAY_MASK] != 0)
-                        {
-                            // bool overflow = ResendBufferOverflow();
-                            RakAssert(0);
-                        }
-                        resendBuffer[internalPacket->reliableMessageNumber &
-                                     (uint32_t) RESEND_BUFFER_ARRAY_MASK] = internalPacket;
+                        if (resendBuffer[internalPacket->reliableMessageNumber & resendBufferMask] != 0)
+                            GrowResendBuffer();
+                        RakAssert(resendBuffer[internalPacket->reliableMessageNumber & resendBufferMask] == 0);
+                        resendBuffer[internalPacket->reliableMessageNumber & resendBufferMask] = internalPacket;
                         statistics.messagesInResendBuffer++;
                         statistics.bytesInResendBuffer += BITS_TO_BYTES(internalPacket->dataBitLength);
 
@@ -2103,24 +2597,39 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                     }
                     else if (internalPacket->reliability == UNRELIABLE_WITH_ACK_RECEIPT)
                         unreliableWithAckReceiptHistory.Push(UnreliableWithAckReceiptNode(
-                                congestionManager.GetNextDatagramSequenceNumber() + packetsToSendThisUpdateDatagramBoundaries.Size(),
+                                congestionManager->GetNextDatagramSequenceNumber() + packetsToSendThisUpdateDatagramBoundaries.Size(),
                                 internalPacket->sendReceiptSerial,
-                                congestionManager.GetRTOForRetransmission(internalPacket->timesSent + 1) + time));
+                                congestionManager->GetRTOForRetransmission(internalPacket->timesSent + 1) + time));
 
                     // If isReliable is false, the packet and its contents will be added to a list to be freed in ClearPacketsAndDatagrams
                     // However, the internalPacket structure will remain allocated and be in the resendBuffer list if it requires a receipt
                     bpsMetrics[(int) USER_MESSAGE_BYTES_SENT].Push1(time, BITS_TO_BYTES(internalPacket->dataBitLength));
 
+                    // Split messages count once, when their first part goes out
+                    if (internalPacket->queueTime != 0 && internalPacket->splitPacketIndex == 0)
+                    {
+#if CC_TIME_TYPE_BYTES == 4
+                        RakNet::TimeUS timeUS = (RakNet::TimeUS) time * 1000;
+#else
+                        RakNet::TimeUS timeUS = time;
+#endif
+                        RecordLatency(LATENCY_SEND_TO_WIRE, timeUS > internalPacket->queueTime ? timeUS - internalPacket->queueTime : 0);
+                    }
+
                     PushPacket(time, internalPacket, isReliable);
                     internalPacket->timesSent++;
 
-                    for (unsigned int messageHandlerIndex = 0;
-                         messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+                    if (messageHandlerList.Size() > 0)
                     {
-                        messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
-                                                                                  packetsToSendThisUpdateDatagramBoundaries.Size() +
-                                                                                  congestionManager.GetNextDatagramSequenceNumber(),
-                                                                                  systemAddress, timeMs, true);
+                        TickPhaseScope pluginScope(this, TICK_PHASE_PLUGIN_CALLBACKS);
+                        for (unsigned int messageHandlerIndex = 0;
+                             messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+                        {
+                            messageHandlerList[messageHandlerIndex]->OnInternalPacket(internalPacket,
+                                                                                      packetsToSendThisUpdateDatagramBoundaries.Size() +
+                                                                                      congestionManager->GetNextDatagramSequenceNumber(),
+                                                                                      systemAddress, timeMs, true);
+                        }
                     }
 
                     if (ResendBufferOverflow())
@@ -2141,12 +2650,19 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
         }
 
 
+        unsigned int fecGroupSize = 0, fecMaxLength = 0;
+        if (forwardErrorCorrectionChannels != 0)
+        {
+            fecGroupSize = GetForwardErrorCorrectionGroupSize();
+            fecMaxLength = GetMaxDatagramSizeExcludingMessageHeaderBytes();
+        }
+        const BitSize_t maxDatagramBits = GetMaxDatagramSizeExcludingMessageHeaderBits() + DatagramHeaderFormat::GetDataHeaderBitLength();
+
         for (unsigned int datagramIndex = 0; datagramIndex < packetsToSendThisUpdateDatagramBoundaries.Size(); datagramIndex++)
         {
             if (datagramIndex > 0)
                 dhf.isContinuousSend = true;
-            MessageNumberNode *messageNumberNode = 0;
-            dhf.datagramNumber = congestionManager.GetAndIncrementNextDatagramSequenceNumber();
+            dhf.datagramNumber = congestionManager->GetAndIncrementNextDatagramSequenceNumber();
             dhf.isPacketPair = datagramsToSendThisUpdateIsPair[datagramIndex];
 
             //printf("%p pushing datagram %i\n", this, dhf.datagramNumber.val);
@@ -2164,26 +2680,73 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                 msgTerm = packetsToSendThisUpdateDatagramBoundaries[datagramIndex];
             }
 
+            // Protect datagrams with UNRELIABLE_SEQUENCED messages on the chosen channels, if their parity would fit in a datagram
+            // Split UNRELIABLE_SEQUENCED messages were sent as RELIABLE_SEQUENCED, and are protected so they need not wait for a resend
+            dhf.isProtected = false;
+            if (fecGroupSize > 0 && datagramSizesInBytes[datagramIndex] <= fecMaxLength)
+            {
+                for (unsigned int i = msgIndex; i < msgTerm; i++)
+                {
+                    const InternalPacket *packet = packetsToSendThisUpdate[i];
+                    if ((packet->reliability == UNRELIABLE_SEQUENCED || (packet->reliability == RELIABLE_SEQUENCED && packet->splitPacketCount > 0)) &&
+                        (forwardErrorCorrectionChannels & (1u << packet->orderingChannel)) != 0)
+                    {
+                        dhf.isProtected = true;
+                        break;
+                    }
+                }
+            }
+
             // More accurate time to reset here
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
             dhf.sourceSystemTime=RakNet::GetTimeUS();
 #endif
             updateBitStream.Reset();
-            dhf.Serialize(&updateBitStream);
-            CC_DEBUG_PRINTF_2("S%i ", dhf.datagramNumber.val);
-
-            while (msgIndex < msgTerm)
+            dhf.isACK = false;
+            dhf.hasBAndAS = false;
+#if INCLUDE_TIMESTAMP_WITH_DATAGRAMS != 1
+            // Acks waiting to go out are sent with the first datagram that has room for them, rather than in a datagram of their own
+            // Not with packet pairs, which have to be the same size, nor with protected datagrams, whose parity covers what follows the header
+            if (acknowlegements.Size() > 0 && !dhf.isPacketPair && !dhf.isProtected)
             {
-                auto &packet = packetsToSendThisUpdate[msgIndex];
-                // If reliable or needs receipt
-                if (packet->reliability != UNRELIABLE && packet->reliability != UNRELIABLE_SEQUENCED
-                        )
+                dhf.isACK = true;
+                dhf.hasData = true;
+                if (remoteSystemNeedsBAndAS)
                 {
-                    if (messageNumberNode == 0)
-                        messageNumberNode = AddFirstToDatagramHistory(dhf.datagramNumber, packet->reliableMessageNumber, time);
-                    else
-                        messageNumberNode = AddSubsequentToDatagramHistory(messageNumberNode, packet->reliableMessageNumber);
+                    double B;
+                    double AS;
+                    congestionManager->OnSendAckGetBAndAS(time, &dhf.hasBAndAS, &B, &AS);
+                    dhf.AS = (float) AS;
+                }
+                dhf.Serialize(&updateBitStream);
+                const BitSize_t usedBits = updateBitStream.GetNumberOfBitsUsed() + BYTES_TO_BITS(datagramSizesInBytes[datagramIndex]);
+                if (usedBits + BYTES_TO_BITS(PIGGYBACKED_ACK_MINIMUM_BYTES) <= maxDatagramBits)
+                {
+                    BitSize_t ackBits = acknowlegements.SerializeCompact(&updateBitStream, maxDatagramBits - usedBits, true);
+                    if (acknowlegements.Size() == 0)
+                        congestionManager->OnSendAck(time, BITS_TO_BYTES(ackBits));
                 }
+                else
+                {
+                    updateBitStream.Reset();
+                    dhf.isACK = false;
+                    dhf.hasBAndAS = false;
+                }
+            }
+#endif
+            if (!dhf.isACK)
+                dhf.Serialize(&updateBitStream);
+            unsigned int datagramHeaderLength = updateBitStream.GetNumberOfBytesUsed();
+            CC_DEBUG_PRINTF_2("S%i ", dhf.datagramNumber.val);
+
+            AddToDatagramHistory(dhf.datagramNumber, time);
+            while (msgIndex < msgTerm)
+            {
+                auto &packet = packetsToSendThisUpdate[msgIndex];
+                // If reliable or needs receipt
+                if (packet->reliability != UNRELIABLE && packet->reliability != UNRELIABLE_SEQUENCED
+                        )
+                    AddMessageToDatagramHistory(packet->reliableMessageNumber);
 
                 RakAssert(updateBitStream.GetNumberOfBytesUsed() <= MAXIMUM_MTU_SIZE - UDP_HEADER_SIZE);
                 WriteToBitStreamFromInternalPacket(&updateBitStream, packet, time);
@@ -2199,13 +2762,15 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                 RakAssert(updateBitStream.GetNumberOfBytesUsed() <= MAXIMUM_MTU_SIZE - UDP_HEADER_SIZE);
             }
 
-            if (messageNumberNode == 0)
-                AddFirstToDatagramHistory(dhf.datagramNumber, time);  // Unreliable, add dummy node
-
             // Store what message ids were sent with this datagram
             //    datagramMessageIDTree.Insert(dhf.datagramNumber,idList);
 
-            congestionManager.OnSendBytes(time, UDP_HEADER_SIZE + DatagramHeaderFormat::GetDataHeaderByteLength());
+            congestionManager->OnSendBytes(time, UDP_HEADER_SIZE + DatagramHeaderFormat::GetDataHeaderByteLength());
+
+            // Before SendBitStream(), which may encrypt in place
+            if (dhf.isProtected)
+                AddToForwardErrorCorrectionGroup(dhf.datagramNumber, updateBitStream.GetData() + datagramHeaderLength,
+                                                 updateBitStream.GetNumberOfBytesUsed() - datagramHeaderLength, fecGroupSize);
 
             SendBitStream(s, systemAddress, &updateBitStream, rnr, time);
 
@@ -2223,6 +2788,9 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
                 timeOfLastContinualSend = 0;
         }
 
+        if (fecSendGroups.Size() > 0)
+            SendForwardErrorCorrectionParity(s, systemAddress, rnr, time, dhf.needsBAndAs, fecGroupSize, updateBitStream);
+
         ClearPacketsAndDatagrams();
 
         // Any data waiting to send after attempting to send, then bandwidth is exceeded
@@ -2233,6 +2801,9 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
         //             sendPacketSet[3].IsEmpty()==false;
     }
 
+    // After sending data, which takes the acks with it if there is room
+    if (acknowlegements.Size() > 0 && congestionManager->ShouldSendACKs(time, timeSinceLastTick))
+        SendACKs(s, systemAddress, time, rnr, updateBitStream);
 
     // Keep on top of deleting old unreliable split packets so they don't clog the list.
     //DeleteOldUnreliableSplitPackets( time );
@@ -2247,6 +2818,8 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
     (void) systemAddress;
     (void) rnr;
 
+    TickPhaseScope sendScope(this, TICK_PHASE_SEND_BITSTREAM);
+
     unsigned int length = (unsigned int) bitStream->GetNumberOfBytesUsed();
 
 #ifdef _DEBUG
@@ -2312,7 +2885,7 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
 
     bpsMetrics[(int) ACTUAL_BYTES_SENT].Push1(currentTime, length);
 
-    RakAssert(length <= congestionManager.GetMTU());
+    RakAssert(length <= congestionManager->GetMTU());
 
 #ifdef USE_THREADED_SEND
     SendToThread::SendToThreadBlock *block = SendToThread::AllocateBlock();
@@ -2330,7 +2903,8 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
     bsp.data = (char *) bitStream->GetData();
     bsp.length = length;
     bsp.systemAddress = systemAddress;
-    s->Send(&bsp);
+    // Written with the rest of the update cycle when RakPeer flushes the socket
+    s->SendBatched(&bsp);
 #endif
 }
 
@@ -2339,7 +2913,7 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
 //-------------------------------------------------------------------------------------------------------
 bool ReliabilityLayer::IsOutgoingDataWaiting(void)
 {
-    if (outgoingPacketBuffer.Size() > 0)
+    if (outgoingPacketBuffer.Size() > 0 || coalescedPacket != 0)
         return true;
 
     //     unsigned i;
@@ -2383,6 +2957,43 @@ void ReliabilityLayer::SetSplitMessageProgressInterval(int interval)
     splitMessageProgressInterval = interval;
 }
 
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetTickProfiling(bool enabled)
+{
+    if (enabled && !tickProfiling)
+        tickProfile.Clear();
+    tickProfiling = enabled;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::RecordLatency(RNSLatencyMetric metric, RakNet::TimeUS latencyUS)
+{
+    if (tickProfiling)
+        tickProfile.latency[metric].Record(latencyUS);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void TickPhaseScope::Start(ReliabilityLayer *reliabilityLayer, RNSTickPhase phase)
+{
+    owner = reliabilityLayer;
+    tickPhase = phase;
+    parent = owner->activeTickPhase;
+    owner->activeTickPhase = this;
+    nestedTime = 0;
+    startTime = RakNet::GetTimeUS();
+}
+
+//-------------------------------------------------------------------------------------------------------
+void TickPhaseScope::Stop(void)
+{
+    RakNet::TimeUS elapsed = RakNet::GetTimeUS() - startTime;
+    owner->tickProfile.phaseTimeUS[tickPhase] += elapsed > nestedTime ? elapsed - nestedTime : 0;
+    owner->tickProfile.phaseCount[tickPhase]++;
+    if (parent)
+        parent->nestedTime += elapsed;
+    owner->activeTickPhase = parent;
+}
+
 //-------------------------------------------------------------------------------------------------------
 void ReliabilityLayer::SetUnreliableTimeout(RakNet::TimeMS timeoutMS)
 {
@@ -2393,6 +3004,331 @@ void ReliabilityLayer::SetUnreliableTimeout(RakNet::TimeMS timeoutMS)
 #endif
 }
 
+#if FEC_MAX_GROUP_SIZE > 32
+#error FEC_MAX_GROUP_SIZE must be at most 32, the number of bits in the parity member mask
+#endif
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetForwardErrorCorrectionChannels(uint32_t channelMask)
+{
+    forwardErrorCorrectionChannels = channelMask;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetCongestionControl(CongestionControlAlgorithm algorithm)
+{
+    if (algorithm == congestionControlAlgorithm)
+        return;
+
+    CCRakNetInterface *previous = congestionManager;
+    congestionManager = CCRakNetInterface::Allocate(algorithm);
+    congestionManager->Init(RakNet::GetTimeUS(), previous->GetMTU());
+    congestionManager->ContinueFrom(*previous);
+    delete previous;
+    congestionControlAlgorithm = algorithm;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::OnAddressChanged(CCTimeType time)
+{
+    CCRakNetInterface *previous = congestionManager;
+    congestionManager = CCRakNetInterface::Allocate(congestionControlAlgorithm);
+    congestionManager->Init(time, previous->GetMTU());
+    congestionManager->ContinueFrom(*previous);
+    delete previous;
+
+    // Moving a resend to the slot for its new time changes the lists being walked, so find them all first
+    DataStructures::List<InternalPacket *> resends;
+    for (unsigned int slot = 0; slot < RESEND_TIMER_WHEEL_LENGTH; slot++)
+    {
+        InternalPacket *slotHead = resendTimerWheel[slot];
+        if (slotHead == 0)
+            continue;
+        InternalPacket *internalPacket = slotHead;
+        do
+        {
+            resends.Push(internalPacket);
+            internalPacket = internalPacket->resendNext;
+        } while (internalPacket != slotHead);
+    }
+
+    for (unsigned int i = 0; i < resends.Size(); i++)
+    {
+        RemoveFromList(resends[i], false);
+        resends[i]->nextActionTime = time;
+        AddToList(resends[i], false);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetMessageCoalescing(RakNet::TimeUS windowUS)
+{
+    coalescingWindow = windowUS;
+    if (coalescingWindow == 0)
+        FlushCoalescedMessages();
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetChannelCompression(unsigned char orderingChannel, MessageCompressionCodec codec)
+{
+    channelCompression[orderingChannel].codec = codec;
+    channelCompression[orderingChannel].failures = 0;
+    channelCompression[orderingChannel].messagesToSkip = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetReliabilityCompression(PacketReliability reliability, MessageCompressionCodec codec)
+{
+    reliabilityCompression[reliability].codec = codec;
+    reliabilityCompression[reliability].failures = 0;
+    reliabilityCompression[reliability].messagesToSkip = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetMessageCompressor(const MessageCompressor *compressor)
+{
+    messageCompressor = compressor;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::UpdateDatagramLossRate(bool lost, unsigned int count)
+{
+    // Weighted over about the last 64 datagrams, so a range longer than a few hundred says no more than that
+    if (count > 256)
+        count = 256;
+    double target = lost ? 1.0 : 0.0;
+    for (unsigned int i = 0; i < count; i++)
+        datagramLossRate += (target - datagramLossRate) / 64.0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned int ReliabilityLayer::GetForwardErrorCorrectionGroupSize(void) const
+{
+    if (datagramLossRate < FEC_MIN_DATAGRAM_LOSS)
+        return 0;
+
+    // A group is only rebuilt if at most one of its datagrams and parity is lost. Aim for about one loss per 4 groups
+    double groupSize = 0.25 / datagramLossRate;
+    if (groupSize >= FEC_MAX_GROUP_SIZE)
+        return FEC_MAX_GROUP_SIZE;
+    if (groupSize < 1.0)
+        return 1;
+    return (unsigned int) groupSize;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::AddToForwardErrorCorrectionGroup(DatagramSequenceNumberType datagramNumber, const unsigned char *data,
+                                                        unsigned int length, unsigned int groupSize)
+{
+    RakAssert(length <= MAXIMUM_MTU_SIZE);
+    if (length > MAXIMUM_MTU_SIZE)
+        return;
+
+    FECSendGroup *group = 0;
+    uint32_t offset = 0;
+    if (fecSendGroups.Size() > 0)
+    {
+        group = fecSendGroups[fecSendGroups.Size() - 1];
+        offset = (uint32_t) (datagramNumber - group->firstDatagramNumber);
+        if (offset >= 32)
+        {
+            // The member mask cannot reach this datagram. A lone datagram from an earlier update is not worth its own parity
+            if (group->memberCount < 2 && groupSize > 1)
+            {
+                fecSendGroups.RemoveFromEnd();
+                fecUnusedSendGroups.Push(group);
+            }
+            group = 0;
+        }
+        else if (group->memberCount >= groupSize)
+            group = 0;
+    }
+
+    if (group == 0)
+    {
+        if (fecUnusedSendGroups.Size() > 0)
+            group = fecUnusedSendGroups.Pop();
+        else
+            group = new FECSendGroup;
+        group->parityLength = 0;
+        group->lengthXor = 0;
+        group->firstDatagramNumber = datagramNumber;
+        group->memberMask = 0;
+        group->memberCount = 0;
+        fecSendGroups.Push(group);
+        offset = 0;
+    }
+
+    unsigned int overlap = length < group->parityLength ? length : group->parityLength;
+    for (unsigned int i = 0; i < overlap; i++)
+        group->parity[i] ^= data[i];
+    if (length > group->parityLength)
+    {
+        memcpy(group->parity + group->parityLength, data + group->parityLength, length - group->parityLength);
+        group->parityLength = length;
+    }
+    group->lengthXor ^= (uint16_t) length;
+    group->memberMask |= 1u << offset;
+    group->memberCount++;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SendForwardErrorCorrectionParity(RakNetSocket2 *s, SystemAddress &systemAddress, RakNetRandom *rnr, CCTimeType time,
+                                                        bool needsBAndAs, unsigned int groupSize, BitStream &updateBitStream)
+{
+    FECSendGroup *openGroup = 0;
+    for (unsigned int i = 0; i < fecSendGroups.Size(); i++)
+    {
+        FECSendGroup *group = fecSendGroups[i];
+        if (group->memberCount < 2 && groupSize != 1)
+        {
+            if (i + 1 == fecSendGroups.Size() && groupSize > 1)
+                openGroup = group;
+            else
+                fecUnusedSendGroups.Push(group);
+            continue;
+        }
+
+        DatagramHeaderFormat dhf;
+        dhf.isACK = false;
+        dhf.isNAK = false;
+        dhf.isPacketPair = false;
+        dhf.isContinuousSend = false;
+        dhf.needsBAndAs = needsBAndAs;
+        dhf.isProtected = false;
+        dhf.isParity = true;
+        dhf.datagramNumber = congestionManager->GetAndIncrementNextDatagramSequenceNumber();
+#if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
+        dhf.sourceSystemTime=RakNet::GetTimeUS();
+#endif
+        updateBitStream.Reset();
+        dhf.Serialize(&updateBitStream);
+        updateBitStream.Write(group->firstDatagramNumber);
+        updateBitStream.Write(group->memberMask);
+        updateBitStream.Write(group->lengthXor);
+        updateBitStream.WriteAlignedBytes(group->parity, group->parityLength);
+        RakAssert(updateBitStream.GetNumberOfBytesUsed() <= MAXIMUM_MTU_SIZE - UDP_HEADER_SIZE);
+
+        // Acked like an unreliable datagram and never resent
+        AddToDatagramHistory(dhf.datagramNumber, time);
+        congestionManager->OnSendBytes(time, UDP_HEADER_SIZE + updateBitStream.GetNumberOfBytesUsed());
+        SendBitStream(s, systemAddress, &updateBitStream, rnr, time);
+        statistics.parityDatagramsSent++;
+
+        fecUnusedSendGroups.Push(group);
+    }
+
+    fecSendGroups.Clear(true);
+    if (openGroup)
+        fecSendGroups.Push(openGroup);
+}
+
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::StoreForwardErrorCorrectionDatagram(DatagramSequenceNumberType datagramNumber, const unsigned char *data,
+                                                           unsigned int length, bool wasRecovered)
+{
+    if (length > MAXIMUM_MTU_SIZE)
+        return true;
+
+    if (fecReceiveHistory == 0)
+    {
+        fecReceiveHistory = new FECReceivedDatagram[FEC_HISTORY_LENGTH];
+        for (unsigned int i = 0; i < FEC_HISTORY_LENGTH; i++)
+            fecReceiveHistory[i].isValid = false;
+    }
+
+    FECReceivedDatagram &slot = fecReceiveHistory[datagramNumber.val & (FEC_HISTORY_LENGTH - 1)];
+    if (slot.isValid && slot.datagramNumber == datagramNumber)
+        return !slot.wasRecovered;
+
+    slot.datagramNumber = datagramNumber;
+    slot.isValid = true;
+    slot.wasRecovered = wasRecovered;
+    slot.length = length;
+    memcpy(slot.data, data, length);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::RecoverFromForwardErrorCorrectionParity(RakNet::BitStream *parityData, CCTimeType sourceSystemTime,
+                                                               SystemAddress &systemAddress,
+                                                               DataStructures::List<PluginInterface2 *> &messageHandlerList,
+                                                               int MTUSize, RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead,
+                                                               BitStream &updateBitStream)
+{
+    (void) sourceSystemTime;
+
+    DatagramSequenceNumberType firstDatagramNumber;
+    uint32_t memberMask;
+    uint16_t lengthXor;
+    parityData->Read(firstDatagramNumber);
+    parityData->Read(memberMask);
+    if (!parityData->Read(lengthXor) || fecReceiveHistory == 0)
+        return;
+
+    const unsigned char *parity = parityData->GetData() + BITS_TO_BYTES(parityData->GetReadOffset());
+    unsigned int parityLength = parityData->GetNumberOfBytesUsed() - BITS_TO_BYTES(parityData->GetReadOffset());
+
+    // Only one missing datagram can be rebuilt
+    DatagramSequenceNumberType missingDatagramNumber;
+    unsigned int numMissing = 0;
+    for (uint32_t offset = 0; offset < 32; offset++)
+    {
+        if ((memberMask & (1u << offset)) == 0)
+            continue;
+        DatagramSequenceNumberType datagramNumber = firstDatagramNumber + offset;
+        const FECReceivedDatagram &slot = fecReceiveHistory[datagramNumber.val & (FEC_HISTORY_LENGTH - 1)];
+        if (!slot.isValid || slot.datagramNumber != datagramNumber)
+        {
+            missingDatagramNumber = datagramNumber;
+            if (++numMissing > 1)
+                return;
+        }
+        else if (slot.length > parityLength)
+            return;
+    }
+    if (numMissing == 0)
+        return;
+
+    DatagramHeaderFormat dhf;
+    dhf.isACK = false;
+    dhf.isNAK = false;
+    dhf.isPacketPair = false;
+    dhf.isContinuousSend = false;
+    dhf.needsBAndAs = remoteSystemNeedsBAndAS;
+    dhf.isProtected = true;
+    dhf.isParity = false;
+    dhf.datagramNumber = missingDatagramNumber;
+#if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
+    dhf.sourceSystemTime = sourceSystemTime;
+#endif
+    RakNet::BitStream recoveredData;
+    dhf.Serialize(&recoveredData);
+    unsigned int headerLength = recoveredData.GetNumberOfBytesUsed();
+    recoveredData.WriteAlignedBytes(parity, parityLength);
+
+    unsigned char *recovered = recoveredData.GetData() + headerLength;
+    unsigned int recoveredLength = lengthXor;
+    for (uint32_t offset = 0; offset < 32; offset++)
+    {
+        DatagramSequenceNumberType datagramNumber = firstDatagramNumber + offset;
+        if ((memberMask & (1u << offset)) == 0 || datagramNumber == missingDatagramNumber)
+            continue;
+        const FECReceivedDatagram &slot = fecReceiveHistory[datagramNumber.val & (FEC_HISTORY_LENGTH - 1)];
+        for (unsigned int i = 0; i < slot.length; i++)
+            recovered[i] ^= slot.data[i];
+        recoveredLength ^= slot.length;
+    }
+    if (recoveredLength == 0 || recoveredLength > parityLength)
+        return;
+
+    StoreForwardErrorCorrectionDatagram(missingDatagramNumber, recovered, recoveredLength, true);
+    statistics.datagramsRecovered++;
+
+    HandleSocketReceiveFromConnectedPlayer((const char *) recoveredData.GetData(), headerLength + recoveredLength, systemAddress,
+                                           messageHandlerList, MTUSize, s, rnr, timeRead, updateBitStream, true);
+}
+
 //-------------------------------------------------------------------------------------------------------
 // This will return true if we should not send at this time
 //-------------------------------------------------------------------------------------------------------
@@ -2447,23 +3383,27 @@ ReliabilityLayer::RemovePacketFromResendListAndDeleteOlderReliableSequenced(cons
 //    unsigned char orderingChannel; // What ordering channel this packet is on, if the reliability type uses ordering channels
 //    OrderingIndexType orderingIndex; // The ID used as identification for ordering channels
 
-    for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+    if (messageHandlerList.Size() > 0)
     {
+        TickPhaseScope pluginScope(this, TICK_PHASE_PLUGIN_CALLBACKS);
+        for (unsigned int messageHandlerIndex = 0; messageHandlerIndex < messageHandlerList.Size(); messageHandlerIndex++)
+        {
 #if CC_TIME_TYPE_BYTES == 4
-        messageHandlerList[messageHandlerIndex]->OnAck(messageNumber, systemAddress, time);
+            messageHandlerList[messageHandlerIndex]->OnAck(messageNumber, systemAddress, time);
 #else
-        messageHandlerList[messageHandlerIndex]->OnAck(messageNumber, systemAddress, (RakNet::TimeMS) (time / (CCTimeType) 1000));
+            messageHandlerList[messageHandlerIndex]->OnAck(messageNumber, systemAddress, (RakNet::TimeMS) (time / (CCTimeType) 1000));
 #endif
+        }
     }
 
     //    bool deleted;
     //    deleted=resendTree.Delete(messageNumber, internalPacket);
-    InternalPacket *internalPacket = resendBuffer[messageNumber & RESEND_BUFFER_ARRAY_MASK];
+    InternalPacket *internalPacket = resendBuffer[messageNumber & resendBufferMask];
     // May ask to remove twice, for example resend twice, then second ack
     if (internalPacket && internalPacket->reliableMessageNumber == messageNumber)
     {
         //    ValidateResendList();
-        resendBuffer[messageNumber & RESEND_BUFFER_ARRAY_MASK] = 0;
+        resendBuffer[messageNumber & resendBufferMask] = 0;
         CC_DEBUG_PRINTF_2("AckRcv %i ", messageNumber);
 
         statistics.messagesInResendBuffer--;
@@ -2478,7 +3418,7 @@ ReliabilityLayer::RemovePacketFromResendListAndDeleteOlderReliableSequenced(cons
              internalPacket->splitPacketIndex + 1 == internalPacket->splitPacketCount))
         {
             InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-            AllocInternalPacketData(ackReceipt, 5, false);
+            AllocReceivedPacketData(ackReceipt, 5);
             ackReceipt->dataBitLength = BYTES_TO_BITS(5);
             ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_ACKED;
             memcpy(ackReceipt->data + sizeof(MessageID), &internalPacket->sendReceiptSerial, sizeof(internalPacket->sendReceiptSerial));
@@ -2602,6 +3542,9 @@ BitSize_t ReliabilityLayer::WriteToBitStreamFromInternalPacket(RakNet::BitStream
 
     bool hasSplitPacket = internalPacket->splitPacketCount > 0;
     bitStream->Write(hasSplitPacket); // Write 1 bit to indicate if splitPacketCount>0
+    bitStream->Write(internalPacket->isCoalesced); // Write 1 bit to indicate if data holds several messages
+    tempChar = (unsigned char) internalPacket->compressionCodec;
+    bitStream->WriteBits((const unsigned char *) &tempChar, 2, true); // 2 bits to write the compression codec
     bitStream->AlignWriteToByteBoundary();
     RakAssert(internalPacket->dataBitLength < 65535);
     unsigned short s = (unsigned short) internalPacket->dataBitLength;
@@ -2643,7 +3586,17 @@ BitSize_t ReliabilityLayer::WriteToBitStreamFromInternalPacket(RakNet::BitStream
     }
 
     // Write the actual data.
-    bitStream->WriteAlignedBytes(internalPacket->data, BITS_TO_BYTES(internalPacket->dataBitLength));
+    if (internalPacket->allocationScheme == InternalPacket::GATHER)
+    {
+        // The only copy of a message from RakPeer::SendGather(), straight from its buffers
+        unsigned int numberOfBytes = (unsigned int) BITS_TO_BYTES(internalPacket->dataBitLength);
+        bitStream->AddBitsAndReallocate(BYTES_TO_BITS(numberOfBytes));
+        GatherSharedData(internalPacket->sharedData, internalPacket->gatherOffset, numberOfBytes,
+                         bitStream->GetData() + BITS_TO_BYTES(bitStream->GetNumberOfBitsUsed()));
+        bitStream->SetWriteOffset(bitStream->GetNumberOfBitsUsed() + BYTES_TO_BITS(numberOfBytes));
+    }
+    else
+        bitStream->WriteAlignedBytes(internalPacket->data, BITS_TO_BYTES(internalPacket->dataBitLength));
 
     return bitStream->GetNumberOfBitsUsed() - start;
 }
@@ -2672,6 +3625,10 @@ InternalPacket *ReliabilityLayer::CreateInternalPacketFromBitStream(RakNet::BitS
     internalPacket->reliability = (const PacketReliability) tempChar;
     bool hasSplitPacket = false;
     bool readSuccess = bitStream->Read(hasSplitPacket); // Read 1 bit to indicate if splitPacketCount>0
+    bitStream->Read(internalPacket->isCoalesced); // Read 1 bit to indicate if data holds several messages
+    tempChar = 0;
+    bitStream->ReadBits(&tempChar, 2); // Read 2 bits for the compression codec
+    internalPacket->compressionCodec = (MessageCompressionCodec) tempChar;
     bitStream->AlignReadToByteBoundary();
     unsigned short s;
     bitStream->ReadAlignedVar16((char *) &s);
@@ -2724,7 +3681,9 @@ InternalPacket *ReliabilityLayer::CreateInternalPacketFromBitStream(RakNet::BitS
 
     if (!readSuccess || internalPacket->dataBitLength == 0 || internalPacket->reliability >= NUMBER_OF_RELIABILITIES ||
         internalPacket->orderingChannel >= 32 ||
-        (hasSplitPacket && (internalPacket->splitPacketIndex >= internalPacket->splitPacketCount)))
+        (hasSplitPacket && (internalPacket->splitPacketIndex >= internalPacket->splitPacketCount)) ||
+        (hasSplitPacket && internalPacket->isCoalesced) ||
+        internalPacket->compressionCodec >= MC_CODEC_COUNT)
     {
         // If this assert hits, encoding is garbage
         RakAssert("Encoding is garbage" && 0);
@@ -2734,7 +3693,7 @@ InternalPacket *ReliabilityLayer::CreateInternalPacketFromBitStream(RakNet::BitS
     }
 
     // Allocate memory to hold our data
-    AllocInternalPacketData(internalPacket, BITS_TO_BYTES(internalPacket->dataBitLength), false);
+    AllocReceivedPacketData(internalPacket, BITS_TO_BYTES(internalPacket->dataBitLength));
     RakAssert(BITS_TO_BYTES(internalPacket->dataBitLength) < MAXIMUM_MTU_SIZE);
 
     if (internalPacket->data == 0)
@@ -2896,6 +3855,26 @@ void ReliabilityLayer::SplitPacket(InternalPacket *internalPacket)
     // Calculate how many packets we need to create
     internalPacket->splitPacketCount = ((dataByteLength - 1) / (maximumSendBlockBytes) + 1);
 
+    if (STREAMED_SPLIT_PACKET_COUNT > 0 && internalPacket->splitPacketCount >= STREAMED_SPLIT_PACKET_COUNT)
+    {
+        // Stream it. internalPacket stays as the source of the split packets, and holds a reference to the data until the last one is cut
+        internalPacket->splitPacketIndex = 0;
+        internalPacket->splitPacketId = splitPacketId++; // It's ok if this wraps to 0
+        internalPacket->headerLength = headerLength;
+        if (internalPacket->allocationScheme != InternalPacket::GATHER)
+        {
+            InternalPacketRefCountedData *refCounter = nullptr;
+            AllocInternalPacketData(internalPacket, &refCounter, internalPacket->data, internalPacket->data);
+        }
+
+        // Counted as if all split packets were pushed now, the same as when not streaming
+        statistics.messageInSendBuffer[(int) internalPacket->priority] += internalPacket->splitPacketCount;
+        statistics.bytesInSendBuffer[(int) internalPacket->priority] += (double) dataByteLength;
+
+        PushNextSplitPacket(internalPacket, GetNextWeight(internalPacket->priority));
+        return;
+    }
+
     // Optimization
     // internalPacketArray =new InternalPacket*;
     bool usedAlloca = false;
@@ -2938,8 +3917,11 @@ void ReliabilityLayer::SplitPacket(InternalPacket *internalPacket)
 
         // Copy over our chunk of data
 
-        AllocInternalPacketData(internalPacketArray[splitPacketIndex], &refCounter, internalPacket->data,
-                                internalPacket->data + byteOffset);
+        if (internalPacket->allocationScheme == InternalPacket::GATHER)
+            AllocInternalPacketData(internalPacketArray[splitPacketIndex], internalPacket->sharedData, byteOffset);
+        else
+            AllocInternalPacketData(internalPacketArray[splitPacketIndex], &refCounter, internalPacket->data,
+                                    internalPacket->data + byteOffset);
         //        internalPacketArray[ splitPacketIndex ]->data = (unsigned char*) malloc(( bytesToSend);
         //        memcpy( internalPacketArray[ splitPacketIndex ]->data, internalPacket->data + byteOffset, bytesToSend );
 
@@ -2984,12 +3966,54 @@ void ReliabilityLayer::SplitPacket(InternalPacket *internalPacket)
 
     // Do not delete, original is referenced by all split packets to avoid numerous allocations. See AllocInternalPacketData above
     //    FreeInternalPacketData(internalPacket,  );
+    // Split packets of gathered buffers hold their own references, so only the one of the original is released
+    if (internalPacket->allocationScheme == InternalPacket::GATHER)
+        FreeInternalPacketData(internalPacket);
     ReleaseToInternalPacketPool(internalPacket);
 
     if (!usedAlloca)
         free(internalPacketArray);
 }
 
+//-------------------------------------------------------------------------------------------------------
+// Cut the next split packet from a streamed message. Only one of its split packets is in outgoingPacketBuffer at a time
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::PushNextSplitPacket(InternalPacket *source, reliabilityHeapWeightType weight)
+{
+    unsigned int maximumSendBlockBytes = GetMaxDatagramSizeExcludingMessageHeaderBytes() - BITS_TO_BYTES(GetMaxMessageHeaderLengthBits());
+    SplitPacketIndexType splitPacketIndex = source->splitPacketIndex;
+    BitSize_t bitOffset = (BitSize_t) splitPacketIndex * (maximumSendBlockBytes << 3);
+    bool isLast = splitPacketIndex + 1 == source->splitPacketCount;
+
+    InternalPacket *splitPacket = AllocateFromInternalPacketPool();
+    *splitPacket = *source;
+    splitPacket->messageNumberAssigned = false;
+    if (splitPacketIndex != 0)
+        splitPacket->messageInternalOrder = internalOrderIndex++;
+    if (source->allocationScheme == InternalPacket::GATHER)
+        AllocInternalPacketData(splitPacket, source->sharedData, source->gatherOffset + BITS_TO_BYTES(bitOffset));
+    else
+        AllocInternalPacketData(splitPacket, &source->refCountedData, source->data, source->data + BITS_TO_BYTES(bitOffset));
+    if (isLast)
+        splitPacket->dataBitLength = source->dataBitLength - bitOffset;
+    else
+        splitPacket->dataBitLength = maximumSendBlockBytes << 3;
+    splitPacket->splitPacketSource = isLast ? 0 : source;
+    RakAssert(splitPacket->dataBitLength < BYTES_TO_BITS(MAXIMUM_MTU_SIZE));
+
+    AddToUnreliableLinkedList(splitPacket);
+    outgoingPacketBuffer.Push(weight, splitPacket);
+
+    if (isLast)
+    {
+        // Each split packet holds its own reference to the data
+        FreeInternalPacketData(source);
+        ReleaseToInternalPacketPool(source);
+    }
+    else
+        source->splitPacketIndex++;
+}
+
 //-------------------------------------------------------------------------------------------------------
 // Insert a packet into the split packet list
 //-------------------------------------------------------------------------------------------------------
@@ -3001,140 +4025,145 @@ void ReliabilityLayer::InsertIntoSplitPacketList(InternalPacket *internalPacket,
     if (!objectExists)
     {
         auto newChannel = new SplitPacketChannel;
-#if PREALLOCATE_LARGE_MESSAGES == 1
-        index=splitPacketChannelList.Insert(internalPacket->splitPacketId, newChannel, true, );
-        newChannel->returnedPacket=CreateInternalPacketCopy( internalPacket, 0, 0, time );
-        newChannel->gotFirstPacket=false;
-        newChannel->splitPacketsArrived=0;
-        AllocInternalPacketData(newChannel->returnedPacket, BITS_TO_BYTES( internalPacket->dataBitLength*internalPacket->splitPacketCount ),  false );
-        RakAssert(newChannel->returnedPacket->data);
-#else
         newChannel->firstPacket = nullptr;
+        newChannel->streamedPacket = nullptr;
+        newChannel->stride = 0;
+        newChannel->lastSplitPacket = nullptr;
         index = splitPacketChannelList.Insert(internalPacket->splitPacketId, newChannel, true);
-        // Preallocate to the final size, to avoid runtime copies
+        // Preallocate to the final size, to avoid runtime copies. No split packet is larger than a datagram, so the memory a streamed
+        // message needs is known to be under MAX_STREAMED_MESSAGE_SIZE before any of it is allocated
+        bool streamed = STREAMED_SPLIT_PACKET_COUNT > 0 && internalPacket->splitPacketCount >= STREAMED_SPLIT_PACKET_COUNT &&
+                        (uint64_t) internalPacket->splitPacketCount * MAXIMUM_MTU_SIZE <= MAX_STREAMED_MESSAGE_SIZE;
         newChannel->splitPacketList.reliabilityLayer = this;
-        newChannel->splitPacketList.prealloc(internalPacket->splitPacketCount, internalPacket->splitPacketId);
-
-#endif
+        newChannel->splitPacketList.prealloc(internalPacket->splitPacketCount, internalPacket->splitPacketId, streamed);
     }
 
-#if PREALLOCATE_LARGE_MESSAGES == 1
-    splitPacketChannelList[index]->lastUpdateTime=time;
-    splitPacketChannelList[index]->splitPacketsArrived++;
-    splitPacketChannelList[index]->returnedPacket->dataBitLength+=internalPacket->dataBitLength;
+    SplitPacketChannel *splitPacketChannel = splitPacketChannelList[index];
+    SplitPacketList &splitPacketList = splitPacketChannel->splitPacketList;
+    const unsigned char *firstPacketData = nullptr;
+    unsigned int firstPacketBytes = 0;
 
-    bool dealloc;
-    if (internalPacket->splitPacketIndex==0)
+    if (splitPacketList.streamed())
     {
-        splitPacketChannelList[index]->gotFirstPacket=true;
-        splitPacketChannelList[index]->stride=BITS_TO_BYTES(internalPacket->dataBitLength);
+        // Every split packet but the last has the same size, so anything else could write past the end of the message
+        unsigned int byteLength = (unsigned int) BITS_TO_BYTES(internalPacket->dataBitLength);
+        bool isLast = internalPacket->splitPacketIndex + 1 == splitPacketList.size();
+        bool holdLast = isLast && splitPacketChannel->streamedPacket == nullptr;
+        if (internalPacket->splitPacketCount != splitPacketList.size() || byteLength > MAXIMUM_MTU_SIZE ||
+            (splitPacketChannel->stride != 0 &&
+             (isLast ? byteLength > splitPacketChannel->stride : byteLength != splitPacketChannel->stride)) ||
+            (holdLast ? splitPacketChannel->lastSplitPacket != nullptr : !splitPacketList.markArrived(internalPacket->splitPacketIndex)))
+        {
+            FreeInternalPacketData(internalPacket);
+            ReleaseToInternalPacketPool(internalPacket);
+            return;
+        }
+        splitPacketChannel->lastUpdateTime = time;
 
-        for (unsigned int j=0; j < splitPacketChannelList[index]->splitPacketList.size(); j++)
+        if (holdLast)
         {
-            memcpy(splitPacketChannelList[index]->returnedPacket->data+internalPacket->splitPacketIndex*splitPacketChannelList[index]->stride, internalPacket->data, (size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
-            FreeInternalPacketData(splitPacketChannelList[index]->splitPacketList[j] );
-            ReleaseToInternalPacketPool(splitPacketChannelList[index]->splitPacketList[j]);
+            // Can't place it until a split packet that is not the last gives the stride. Counted as arrived once placed
+            splitPacketChannel->lastSplitPacket = internalPacket;
+            return;
         }
 
-        memcpy(splitPacketChannelList[index]->returnedPacket->data, internalPacket->data, (size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
-        splitPacketChannelList[index]->splitPacketList.Clear(true);
-        dealloc=true;
-    }
-    else
-    {
-        if (splitPacketChannelList[index]->gotFirstPacket==true)
+        if (splitPacketChannel->streamedPacket == nullptr)
         {
-            memcpy(splitPacketChannelList[index]->returnedPacket->data+internalPacket->splitPacketIndex*splitPacketChannelList[index]->stride, internalPacket->data, (size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
-            dealloc=true;
+            splitPacketChannel->stride = byteLength;
+            splitPacketChannel->streamedPacket = CreateInternalPacketCopy(internalPacket, 0, 0, time);
+            splitPacketChannel->streamedPacket->dataBitLength = 0;
+            AllocReceivedPacketData(splitPacketChannel->streamedPacket, (unsigned int) ((size_t) byteLength * splitPacketList.size()));
+            if (splitPacketChannel->streamedPacket->data == nullptr)
+            {
+                // Out of memory, so the message can't be received. Drop what arrived of it
+                ReleaseToInternalPacketPool(splitPacketChannel->streamedPacket);
+                FreeInternalPacketData(splitPacketChannel->lastSplitPacket);
+                ReleaseToInternalPacketPool(splitPacketChannel->lastSplitPacket);
+                FreeInternalPacketData(internalPacket);
+                ReleaseToInternalPacketPool(internalPacket);
+                delete splitPacketChannel;
+                splitPacketChannelList.RemoveAtIndex(index);
+                return;
+            }
+
+            InternalPacket *lastSplitPacket = splitPacketChannel->lastSplitPacket;
+            splitPacketChannel->lastSplitPacket = nullptr;
+            if (lastSplitPacket != nullptr)
+            {
+                if (BITS_TO_BYTES(lastSplitPacket->dataBitLength) <= byteLength &&
+                    splitPacketList.markArrived(lastSplitPacket->splitPacketIndex))
+                    WriteStreamedSplitPacket(splitPacketChannel, lastSplitPacket);
+                else
+                {
+                    // Larger than the others, so the message can't be completed
+                    FreeInternalPacketData(lastSplitPacket);
+                    ReleaseToInternalPacketPool(lastSplitPacket);
+                }
+            }
         }
-        else
+
+        WriteStreamedSplitPacket(splitPacketChannel, internalPacket);
+
+        if (splitPacketList.hasArrived(0))
         {
-            splitPacketChannelList[index]->splitPacketList.Push(internalPacket);
-            dealloc=false;
+            firstPacketData = splitPacketChannel->streamedPacket->data;
+            firstPacketBytes = splitPacketChannel->stride;
         }
     }
-
-    if (splitPacketChannelList[index]->gotFirstPacket==true &&
-        splitMessageProgressInterval &&
-        //         splitPacketChannelList[index]->firstPacket &&
-        //         splitPacketChannelList[index]->splitPacketList.size()!=splitPacketChannelList[index]->firstPacket->splitPacketCount &&
-        //         (splitPacketChannelList[index]->splitPacketList.size()%splitMessageProgressInterval)==0
-        splitPacketChannelList[index]->gotFirstPacket &&
-        splitPacketChannelList[index]->splitPacketsArrived!=splitPacketChannelList[index]->returnedPacket->splitPacketCount &&
-        (splitPacketChannelList[index]->splitPacketsArrived%splitMessageProgressInterval)==0
-        )
+    else
     {
-        // Return ID_DOWNLOAD_PROGRESS
-        // Write splitPacketIndex (SplitPacketIndexType)
-        // Write splitPacketCount (SplitPacketIndexType)
-        // Write byteLength (4)
-        // Write data, splitPacketChannelList[index]->splitPacketList[0]->data
-        InternalPacket *progressIndicator = AllocateFromInternalPacketPool();
-        //        unsigned int len = sizeof(MessageID) + sizeof(unsigned int)*2 + sizeof(unsigned int) + (unsigned int) BITS_TO_BYTES(splitPacketChannelList[index]->firstPacket->dataBitLength);
-        unsigned int l = (unsigned int) splitPacketChannelList[index]->stride;
-        const unsigned int len = sizeof(MessageID) + sizeof(unsigned int)*2 + sizeof(unsigned int) + l;
-        AllocInternalPacketData(progressIndicator, len,  false );
-        progressIndicator->dataBitLength=BYTES_TO_BITS(len);
-        progressIndicator->data[0]=(MessageID)ID_DOWNLOAD_PROGRESS;
-        unsigned int temp;
-        //    temp=splitPacketChannelList[index]->splitPacketList.size();
-        temp=splitPacketChannelList[index]->splitPacketsArrived;
-        memcpy(progressIndicator->data+sizeof(MessageID), &temp, sizeof(unsigned int));
-        temp=(unsigned int)internalPacket->splitPacketCount;
-        memcpy(progressIndicator->data+sizeof(MessageID)+sizeof(unsigned int)*1, &temp, sizeof(unsigned int));
-        //        temp=(unsigned int) BITS_TO_BYTES(splitPacketChannelList[index]->firstPacket->dataBitLength);
-        temp=(unsigned int) BITS_TO_BYTES(l);
-        memcpy(progressIndicator->data+sizeof(MessageID)+sizeof(unsigned int)*2, &temp, sizeof(unsigned int));
-        //memcpy(progressIndicator->data+sizeof(MessageID)+sizeof(unsigned int)*3, splitPacketChannelList[index]->firstPacket->data, (size_t) BITS_TO_BYTES(splitPacketChannelList[index]->firstPacket->dataBitLength));
-        memcpy(progressIndicator->data+sizeof(MessageID)+sizeof(unsigned int)*3, splitPacketChannelList[index]->returnedPacket->data, (size_t) BITS_TO_BYTES(l));
-    }
-
-    if (dealloc)
-    {
-        FreeInternalPacketData(internalPacket );
-        ReleaseToInternalPacketPool(internalPacket);
-    }
-#else
-    // Insert the packet into the SplitPacketChannel
-    if(!splitPacketChannelList[index]->splitPacketList.insert(internalPacket))
-        return;
-    splitPacketChannelList[index]->lastUpdateTime = time;
+        // Insert the packet into the SplitPacketChannel
+        if (!splitPacketList.insert(internalPacket))
+            return;
+        splitPacketChannel->lastUpdateTime = time;
 
-    // If the index is 0, then this is the first packet. Record this so it can be returned to the user with download progress
-    if (internalPacket->splitPacketIndex == 0)
-        splitPacketChannelList[index]->firstPacket = internalPacket;
+        // If the index is 0, then this is the first packet. Record this so it can be returned to the user with download progress
+        if (internalPacket->splitPacketIndex == 0)
+            splitPacketChannel->firstPacket = internalPacket;
 
-    auto &firstPacket = splitPacketChannelList[index]->firstPacket;
+        if (splitPacketChannel->firstPacket)
+        {
+            firstPacketData = splitPacketChannel->firstPacket->data;
+            firstPacketBytes = (unsigned int) BITS_TO_BYTES(splitPacketChannel->firstPacket->dataBitLength);
+        }
+    }
 
     // Return download progress if we have the first packet, the list is not complete, and there are enough packets to justify it
-    if (splitMessageProgressInterval && firstPacket &&
-        splitPacketChannelList[index]->splitPacketList.count() != firstPacket->splitPacketCount &&
-        (splitPacketChannelList[index]->splitPacketList.count() % splitMessageProgressInterval) == 0)
+    if (splitMessageProgressInterval && firstPacketData &&
+        splitPacketList.count() != splitPacketList.size() &&
+        (splitPacketList.count() % splitMessageProgressInterval) == 0)
     {
         // Return ID_DOWNLOAD_PROGRESS
         // Write splitPacketIndex (SplitPacketIndexType)
         // Write splitPacketCount (SplitPacketIndexType)
         // Write byteLength (4)
-        // Write data, splitPacketChannelList[index]->splitPacketList[0]->data
+        // Write data, the data of the first split packet
         InternalPacket *progressIndicator = AllocateFromInternalPacketPool();
-        unsigned int length = sizeof(MessageID) + sizeof(unsigned int) * 2 + sizeof(unsigned int) +
-                              (unsigned int) BITS_TO_BYTES(firstPacket->dataBitLength);
-        AllocInternalPacketData(progressIndicator, length, false);
+        unsigned int length = sizeof(MessageID) + sizeof(unsigned int) * 2 + sizeof(unsigned int) + firstPacketBytes;
+        AllocReceivedPacketData(progressIndicator, length);
         progressIndicator->dataBitLength = BYTES_TO_BITS(length);
         progressIndicator->data[0] = (MessageID) ID_DOWNLOAD_PROGRESS;
-        unsigned int temp = splitPacketChannelList[index]->splitPacketList.count();
+        unsigned int temp = splitPacketList.count();
         memcpy(progressIndicator->data + sizeof(MessageID), &temp, sizeof(unsigned int));
-        temp = (unsigned int) internalPacket->splitPacketCount;
+        temp = splitPacketList.size();
         memcpy(progressIndicator->data + sizeof(MessageID) + sizeof(unsigned int) * 1, &temp, sizeof(unsigned int));
-        temp = (unsigned int) BITS_TO_BYTES(firstPacket->dataBitLength);
+        temp = firstPacketBytes;
         memcpy(progressIndicator->data + sizeof(MessageID) + sizeof(unsigned int) * 2, &temp, sizeof(unsigned int));
 
-        memcpy(progressIndicator->data + sizeof(MessageID) + sizeof(unsigned int) * 3, firstPacket->data,
-               (size_t) BITS_TO_BYTES(firstPacket->dataBitLength));
+        memcpy(progressIndicator->data + sizeof(MessageID) + sizeof(unsigned int) * 3, firstPacketData, (size_t) firstPacketBytes);
         outputQueue.Push(progressIndicator);
     }
+}
 
-#endif
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::WriteStreamedSplitPacket(SplitPacketChannel *splitPacketChannel, InternalPacket *internalPacket)
+{
+    InternalPacket *streamedPacket = splitPacketChannel->streamedPacket;
+    memcpy(streamedPacket->data + (size_t) internalPacket->splitPacketIndex * splitPacketChannel->stride, internalPacket->data,
+           (size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
+    streamedPacket->dataBitLength += internalPacket->dataBitLength;
+    FreeInternalPacketData(internalPacket);
+    ReleaseToInternalPacketPool(internalPacket);
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -3145,21 +4174,22 @@ void ReliabilityLayer::InsertIntoSplitPacketList(InternalPacket *internalPacket,
 InternalPacket *
 ReliabilityLayer::BuildPacketFromSplitPacketList(SplitPacketChannel *splitPacketChannel, CCTimeType time)
 {
-#if PREALLOCATE_LARGE_MESSAGES == 1
-    InternalPacket *returnedPacket=splitPacketChannel->returnedPacket;
-    delete splitPacketChannel;
-    (void) time;
-    return returnedPacket;
-#else
+    if (splitPacketChannel->splitPacketList.streamed())
+    {
+        // Already written into place as the split packets arrived
+        InternalPacket *streamedPacket = splitPacketChannel->streamedPacket;
+        delete splitPacketChannel;
+        return streamedPacket;
+    }
+
     // Reconstruct
     InternalPacket *internalPacket = CreateInternalPacketCopy(splitPacketChannel->splitPacketList[0], 0, 0, time);
     internalPacket->dataBitLength = 0;
     for (unsigned j = 0; j < splitPacketChannel->splitPacketList.size(); j++)
         internalPacket->dataBitLength += splitPacketChannel->splitPacketList[j]->dataBitLength;
 
-    internalPacket->data = (unsigned char *) malloc((size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
+    AllocReceivedPacketData(internalPacket, (unsigned int) BITS_TO_BYTES(internalPacket->dataBitLength));
     RakAssert(internalPacket->data);
-    internalPacket->allocationScheme = InternalPacket::NORMAL;
 
     BitSize_t offset = 0;
     for (unsigned j = 0; j < splitPacketChannel->splitPacketList.size(); j++)
@@ -3178,7 +4208,6 @@ ReliabilityLayer::BuildPacketFromSplitPacketList(SplitPacketChannel *splitPacket
     delete splitPacketChannel;
 
     return internalPacket;
-#endif
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -3190,13 +4219,12 @@ InternalPacket *ReliabilityLayer::BuildPacketFromSplitPacketList(SplitPacketIdTy
     bool objectExists;
     // Find in splitPacketChannelList the SplitPacketChannel with this splitPacketId
     unsigned int i = splitPacketChannelList.GetIndexFromKey(splitPacketId, &objectExists);
+    // Inserting the split packet may have dropped its message
+    if (!objectExists)
+        return 0;
     SplitPacketChannel *splitPacketChannel = splitPacketChannelList[i];
 
-#if PREALLOCATE_LARGE_MESSAGES == 1
-    if (splitPacketChannel->splitPacketsArrived==splitPacketChannel->returnedPacket->splitPacketCount)
-#else
     if (splitPacketChannel->splitPacketList.count() == splitPacketChannel->splitPacketList.size())
-#endif
     {
         // Ack immediately, because for large files this can take a long time
         SendACKs(s, systemAddress, time, rnr, updateBitStream);
@@ -3262,6 +4290,7 @@ ReliabilityLayer::CreateInternalPacketCopy(InternalPacket *original, int dataByt
 
     copy->dataBitLength = dataByteLength << 3;
     copy->creationTime = time;
+    copy->queueTime = original->queueTime;
     copy->nextActionTime = 0;
     copy->orderingIndex = original->orderingIndex;
     copy->sequencingIndex = original->sequencingIndex;
@@ -3269,11 +4298,8 @@ ReliabilityLayer::CreateInternalPacketCopy(InternalPacket *original, int dataByt
     copy->reliableMessageNumber = original->reliableMessageNumber;
     copy->priority = original->priority;
     copy->reliability = original->reliability;
-#if PREALLOCATE_LARGE_MESSAGES == 1
-    copy->splitPacketCount = original->splitPacketCount;
-    copy->splitPacketId = original->splitPacketId;
-    copy->splitPacketIndex = original->splitPacketIndex;
-#endif
+    copy->isCoalesced = original->isCoalesced;
+    copy->compressionCodec = original->compressionCodec;
 
     return copy;
 }
@@ -3307,7 +4333,7 @@ void ReliabilityLayer::InsertPacketIntoResendList(InternalPacket *internalPacket
     (void) firstResend;
     (void) time;
 
-    AddToListTail(internalPacket, modifyUnacknowledgedBytes);
+    AddToList(internalPacket, modifyUnacknowledgedBytes);
     RakAssert(internalPacket->nextActionTime != 0);
 
 }
@@ -3367,6 +4393,7 @@ RakNetStatistics *ReliabilityLayer::GetStatistics(RakNetStatistics *rns)
     rns->BPSLimitByCongestionControl = statistics.BPSLimitByCongestionControl;
     rns->isLimitedByOutgoingBandwidthLimit = statistics.isLimitedByOutgoingBandwidthLimit;
     rns->BPSLimitByOutgoingBandwidthLimit = statistics.BPSLimitByOutgoingBandwidthLimit;
+    rns->datagramLossRate = (float) datagramLossRate;
 
     return rns;
 }
@@ -3389,6 +4416,70 @@ bool ReliabilityLayer::AckTimeout(RakNet::Time curTime)
     return (timeLastDatagramArrived - curTime) > 10000 && curTime - timeLastDatagramArrived > timeoutTime;
 }
 
+//-------------------------------------------------------------------------------------------------------
+// Lowers untilNext to the time from now until actionTime, in microseconds. Compared as an offset from now since the times can wrap
+template <class TimeType>
+static void ReduceTimeUntil(TimeType time, TimeType actionTime, RakNet::TimeUS microsecondsPerUnit, RakNet::TimeUS &untilNext)
+{
+    if ((TimeType) (time - actionTime) < ((TimeType) -1) / 2)
+    {
+        untilNext = 0;
+        return;
+    }
+
+    RakNet::TimeUS until = (RakNet::TimeUS) (TimeType) (actionTime - time) * microsecondsPerUnit;
+    if (until < untilNext)
+        untilNext = until;
+}
+
+//-------------------------------------------------------------------------------------------------------
+RakNet::TimeUS ReliabilityLayer::GetTimeUntilNextUpdate(RakNet::TimeUS timeUS, RakNet::TimeUS maxTime) const
+{
+    if (deadConnection || NAKs.Size() > 0)
+        return 0;
+
+#if CC_TIME_TYPE_BYTES == 4
+    CCTimeType time = (CCTimeType) (timeUS / 1000);
+    const RakNet::TimeUS microsecondsPerCCTime = 1000;
+#else
+    CCTimeType time = timeUS;
+    const RakNet::TimeUS microsecondsPerCCTime = 1;
+#endif
+    RakNet::TimeMS timeMS = (RakNet::TimeMS) (timeUS / 1000);
+    RakNet::TimeUS untilNext = maxTime;
+
+    if (!IsResendQueueEmpty())
+        ReduceTimeUntil(time, GetNextResendTime(), microsecondsPerCCTime, untilNext);
+
+    if (acknowlegements.Size() > 0)
+        ReduceTimeUntil(time, congestionManager->GetTimeToSendACKs(time), microsecondsPerCCTime, untilNext);
+
+    if (coalescedPacket != 0)
+        ReduceTimeUntil(time, coalescedPacketSendTime, microsecondsPerCCTime, untilNext);
+
+    for (unsigned int i = 0; i < unreliableWithAckReceiptHistory.Size(); i++)
+        ReduceTimeUntil(time, unreliableWithAckReceiptHistory[i].nextActionTime, microsecondsPerCCTime, untilNext);
+
+    // Same as AckTimeout()
+    if (statistics.messagesInResendBuffer != 0)
+        ReduceTimeUntil(timeMS, timeLastDatagramArrived + timeoutTime + 1, 1000, untilNext);
+
+    // Anything still buffered after Update() is waiting on pacing, on the congestion window, which opens when acks arrive,
+    // or on the outgoing bandwidth limit
+    CCTimeType sendTime;
+    if (outgoingPacketBuffer.Size() > 0 && congestionManager->GetTimeToSendData(time, &sendTime))
+        ReduceTimeUntil(time, sendTime, microsecondsPerCCTime, untilNext);
+    if (outgoingPacketBuffer.Size() > 0 && untilNext > UPDATE_THREAD_MAX_SLEEP_MS * 1000)
+        untilNext = UPDATE_THREAD_MAX_SLEEP_MS * 1000;
+
+#ifdef _DEBUG
+    if (delayList.Size() > 0)
+        ReduceTimeUntil(timeMS, delayList.Peek()->sendTime, 1000, untilNext);
+#endif
+
+    return untilNext;
+}
+
 //-------------------------------------------------------------------------------------------------------
 CCTimeType ReliabilityLayer::GetNextSendTime(void) const
 {
@@ -3441,7 +4532,7 @@ void ReliabilityLayer::PushPacket(CCTimeType time, InternalPacket *internalPacke
 //         RakNet::TimeMS diff = curTime-t;
 //     }
 
-    congestionManager.OnSendBytes(time, BITS_TO_BYTES(internalPacket->dataBitLength) +
+    congestionManager->OnSendBytes(time, BITS_TO_BYTES(internalPacket->dataBitLength) +
                                         BITS_TO_BYTES(internalPacket->headerLength));
 }
 
@@ -3498,41 +4589,19 @@ void ReliabilityLayer::ClearPacketsAndDatagrams(void)
     packetsToDeallocThisUpdate.Clear(true);
 }
 
-//-------------------------------------------------------------------------------------------------------
-void ReliabilityLayer::MoveToListHead(InternalPacket *internalPacket)
-{
-    if (internalPacket == resendLinkedListHead)
-        return;
-    if (resendLinkedListHead == 0)
-    {
-        internalPacket->resendNext = internalPacket;
-        internalPacket->resendPrev = internalPacket;
-        resendLinkedListHead = internalPacket;
-        return;
-    }
-    internalPacket->resendPrev->resendNext = internalPacket->resendNext;
-    internalPacket->resendNext->resendPrev = internalPacket->resendPrev;
-    internalPacket->resendNext = resendLinkedListHead;
-    internalPacket->resendPrev = resendLinkedListHead->resendPrev;
-    internalPacket->resendPrev->resendNext = internalPacket;
-    resendLinkedListHead->resendPrev = internalPacket;
-    resendLinkedListHead = internalPacket;
-    RakAssert(internalPacket->headerLength + internalPacket->dataBitLength > 0);
-
-    //ValidateResendList();
-}
-
 //-------------------------------------------------------------------------------------------------------
 void ReliabilityLayer::RemoveFromList(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes)
 {
-    InternalPacket *newPosition;
+    InternalPacket *&slotHead = resendTimerWheel[(internalPacket->nextActionTime / RESEND_TIMER_WHEEL_TICK) &
+                                                 (RESEND_TIMER_WHEEL_LENGTH - 1)];
+    RakAssert(slotHead != 0);
     internalPacket->resendPrev->resendNext = internalPacket->resendNext;
     internalPacket->resendNext->resendPrev = internalPacket->resendPrev;
-    newPosition = internalPacket->resendNext;
-    if (internalPacket == resendLinkedListHead)
-        resendLinkedListHead = newPosition;
-    if (resendLinkedListHead == internalPacket)
-        resendLinkedListHead = 0;
+    if (internalPacket == slotHead)
+        slotHead = internalPacket->resendNext;
+    if (slotHead == internalPacket)
+        slotHead = 0;
+    resendTimerWheelCount--;
 
     if (modifyUnacknowledgedBytes)
     {
@@ -3543,40 +4612,99 @@ void ReliabilityLayer::RemoveFromList(InternalPacket *internalPacket, bool modif
 }
 
 //-------------------------------------------------------------------------------------------------------
-void ReliabilityLayer::AddToListTail(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes)
+void ReliabilityLayer::AddToList(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes)
 {
     if (modifyUnacknowledgedBytes)
         unacknowledgedBytes += BITS_TO_BYTES(internalPacket->headerLength + internalPacket->dataBitLength);
 
-    if (resendLinkedListHead == 0)
+    // A resend due before the slots already looked at, such as after a NAK, moves the wheel back so it is found
+    CCTimeType tick = internalPacket->nextActionTime / RESEND_TIMER_WHEEL_TICK;
+    if (resendTimerWheelCount == 0 || resendTimerWheelTick - tick < (((CCTimeType) -1) / 2))
+        resendTimerWheelTick = tick;
+    resendTimerWheelCount++;
+
+    InternalPacket *&slotHead = resendTimerWheel[tick & (RESEND_TIMER_WHEEL_LENGTH - 1)];
+    if (slotHead == 0)
     {
         internalPacket->resendNext = internalPacket;
         internalPacket->resendPrev = internalPacket;
-        resendLinkedListHead = internalPacket;
+        slotHead = internalPacket;
         return;
     }
-    internalPacket->resendNext = resendLinkedListHead;
-    internalPacket->resendPrev = resendLinkedListHead->resendPrev;
+    internalPacket->resendNext = slotHead;
+    internalPacket->resendPrev = slotHead->resendPrev;
     internalPacket->resendPrev->resendNext = internalPacket;
-    resendLinkedListHead->resendPrev = internalPacket;
+    slotHead->resendPrev = internalPacket;
+
+    // Kept roughly in time order, so only the head of a slot is checked until its tick is over
+    if (slotHead->nextActionTime - internalPacket->nextActionTime < (((CCTimeType) -1) / 2))
+        slotHead = internalPacket;
 
 //    ValidateResendList();
 
 }
 
 //-------------------------------------------------------------------------------------------------------
-void ReliabilityLayer::PopListHead(bool modifyUnacknowledgedBytes)
+bool ReliabilityLayer::IsResendQueueEmpty(void) const
 {
-    RakAssert(resendLinkedListHead != 0);
-    RemoveFromList(resendLinkedListHead, modifyUnacknowledgedBytes);
+    return resendTimerWheelCount == 0;
 }
 
 //-------------------------------------------------------------------------------------------------------
-bool ReliabilityLayer::IsResendQueueEmpty(void) const
+InternalPacket *ReliabilityLayer::GetNextResend(CCTimeType time)
 {
-    return resendLinkedListHead == 0;
+    const CCTimeType currentTick = time / RESEND_TIMER_WHEEL_TICK;
+    unsigned int slotsVisited = 0;
+    while (resendTimerWheelCount > 0 && currentTick - resendTimerWheelTick < (((CCTimeType) -1) / 2))
+    {
+        InternalPacket *slotHead = resendTimerWheel[resendTimerWheelTick & (RESEND_TIMER_WHEEL_LENGTH - 1)];
+        if (resendTimerWheelTick == currentTick)
+        {
+            if (slotHead != 0 && time - slotHead->nextActionTime < (((CCTimeType) -1) / 2))
+                return slotHead;
+            return 0;
+        }
+
+        // The tick is over, so everything in the slot is due, except resends a turn or more of the wheel ahead
+        if (slotHead != 0)
+        {
+            InternalPacket *internalPacket = slotHead;
+            do
+            {
+                if (time - internalPacket->nextActionTime < (((CCTimeType) -1) / 2))
+                    return internalPacket;
+                internalPacket = internalPacket->resendNext;
+            } while (internalPacket != slotHead);
+        }
+
+        // After a whole turn every slot was looked at, so the ticks in between can be skipped
+        if (++slotsVisited >= RESEND_TIMER_WHEEL_LENGTH)
+            resendTimerWheelTick = currentTick;
+        else
+            resendTimerWheelTick++;
+    }
+    return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+CCTimeType ReliabilityLayer::GetNextResendTime(void) const
+{
+    for (CCTimeType tick = resendTimerWheelTick; tick != resendTimerWheelTick + RESEND_TIMER_WHEEL_LENGTH; tick++)
+    {
+        InternalPacket *slotHead = resendTimerWheel[tick & (RESEND_TIMER_WHEEL_LENGTH - 1)];
+        if (slotHead == 0)
+            continue;
+
+        // A resend a turn of the wheel ahead is passed over at the end of the tick
+        CCTimeType tickEnd = (tick + 1) * RESEND_TIMER_WHEEL_TICK;
+        if (slotHead->nextActionTime - tickEnd < (((CCTimeType) -1) / 2))
+            return tickEnd;
+        return slotHead->nextActionTime;
+    }
+    return resendTimerWheelTick * RESEND_TIMER_WHEEL_TICK;
 }
 
+
 //-------------------------------------------------------------------------------------------------------
 void ReliabilityLayer::SendACKs(RakNetSocket2 *s, SystemAddress &systemAddress, CCTimeType time, RakNetRandom *rnr,
                                 BitStream &updateBitStream)
@@ -3591,6 +4719,7 @@ void ReliabilityLayer::SendACKs(RakNetSocket2 *s, SystemAddress &systemAddress,
         dhf.isACK = true;
         dhf.isNAK = false;
         dhf.isPacketPair = false;
+        dhf.hasData = false;
 #if INCLUDE_TIMESTAMP_WITH_DATAGRAMS == 1
         dhf.sourceSystemTime=time;
 #endif
@@ -3599,7 +4728,7 @@ void ReliabilityLayer::SendACKs(RakNetSocket2 *s, SystemAddress &systemAddress,
         bool hasBAndAS;
         if (remoteSystemNeedsBAndAS)
         {
-            congestionManager.OnSendAckGetBAndAS(time, &hasBAndAS, &B, &AS);
+            congestionManager->OnSendAckGetBAndAS(time, &hasBAndAS, &B, &AS);
             dhf.AS = (float) AS;
             dhf.hasBAndAS = hasBAndAS;
         }
@@ -3612,12 +4741,12 @@ void ReliabilityLayer::SendACKs(RakNetSocket2 *s, SystemAddress &systemAddress,
         updateBitStream.Reset();
         dhf.Serialize(&updateBitStream);
         CC_DEBUG_PRINTF_1("AckSnd ");
-        acknowlegements.Serialize(&updateBitStream, maxDatagramPayload, true);
+        acknowlegements.SerializeCompact(&updateBitStream, maxDatagramPayload, true);
         SendBitStream(s, systemAddress, &updateBitStream, rnr, time);
-        congestionManager.OnSendAck(time, updateBitStream.GetNumberOfBytesUsed());
+        congestionManager->OnSendAck(time, updateBitStream.GetNumberOfBytesUsed());
 
         // I think this is causing a bug where if the estimated bandwidth is very low for the recipient, only acks ever get sent
-        //    congestionManager.OnSendBytes(time,UDP_HEADER_SIZE+updateBitStream.GetNumberOfBytesUsed());
+        //    congestionManager->OnSendBytes(time,UDP_HEADER_SIZE+updateBitStream.GetNumberOfBytesUsed());
     }
 }
 /*
@@ -3647,9 +4776,13 @@ InternalPacket *ReliabilityLayer::AllocateFromInternalPacketPool(void)
     ip->splitPacketCount = 0;
     ip->splitPacketIndex = 0;
     ip->splitPacketId = 0;
+    ip->isCoalesced = false;
+    ip->compressionCodec = MC_NONE;
     ip->allocationScheme = InternalPacket::NORMAL;
     ip->data = 0;
+    ip->splitPacketSource = 0;
     ip->timesSent = 0;
+    ip->queueTime = 0;
     return ip;
 }
 
@@ -3729,91 +4862,111 @@ void ReliabilityLayer::ValidateResendList(void) const
 //-------------------------------------------------------------------------------------------------------
 bool ReliabilityLayer::ResendBufferOverflow(void) const
 {
-    int index1 = sendReliableMessageNumberIndex & (uint32_t) RESEND_BUFFER_ARRAY_MASK;
-    //    int index2 = (sendReliableMessageNumberIndex+(uint32_t)1) & (uint32_t) RESEND_BUFFER_ARRAY_MASK;
-    RakAssert(index1 < RESEND_BUFFER_ARRAY_LENGTH);
-    return resendBuffer[index1] != 0; // || resendBuffer[index2]!=0;
+    // Until it cannot grow any more
+    if (resendBufferMask + 1 < RESEND_BUFFER_ARRAY_MAX_LENGTH)
+        return false;
+    return resendBuffer[sendReliableMessageNumberIndex & resendBufferMask] != 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::GrowResendBuffer(void)
+{
+    // Messages in the buffer are numbered from sendReliableMessageNumberIndex-length up, so each has its own slot at twice the length
+    uint32_t newMask = resendBufferMask * 2 + 1;
+    InternalPacket **newResendBuffer = new InternalPacket *[newMask + 1];
+    memset(newResendBuffer, 0, sizeof(InternalPacket *) * (newMask + 1));
+    for (uint32_t i = 0; i <= resendBufferMask; i++)
+    {
+        if (resendBuffer[i])
+            newResendBuffer[resendBuffer[i]->reliableMessageNumber & newMask] = resendBuffer[i];
+    }
+    delete [] resendBuffer;
+    resendBuffer = newResendBuffer;
+    resendBufferMask = newMask;
+}
 
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::IsAwaitingAck(DatagramSequenceNumberType messageNumber) const
+{
+    InternalPacket *internalPacket = resendBuffer[messageNumber & resendBufferMask];
+    return internalPacket != 0 && internalPacket->reliableMessageNumber == messageNumber;
 }
 
 //-------------------------------------------------------------------------------------------------------
-ReliabilityLayer::MessageNumberNode *ReliabilityLayer::GetMessageNumberNodeByDatagramIndex(DatagramSequenceNumberType index, CCTimeType *timeSent)
+ReliabilityLayer::DatagramHistoryNode *ReliabilityLayer::GetDatagramHistoryNode(DatagramSequenceNumberType index)
 {
     if (datagramHistory.IsEmpty())
         return 0;
 
-    if (congestionManager.LessThan(index, datagramHistoryPopCount))
+    if (CCRakNetInterface::LessThan(index, datagramHistoryPopCount))
         return 0;
 
     DatagramSequenceNumberType offsetIntoList = index - datagramHistoryPopCount;
     if (offsetIntoList >= datagramHistory.Size())
         return 0;
 
-    *timeSent = datagramHistory[offsetIntoList].timeSent;
-    return datagramHistory[offsetIntoList].head;
+    return &datagramHistory[datagramHistory.Begin() + offsetIntoList];
 }
 
 //-------------------------------------------------------------------------------------------------------
 void ReliabilityLayer::RemoveFromDatagramHistory(DatagramSequenceNumberType index)
 {
     DatagramSequenceNumberType offsetIntoList = index - datagramHistoryPopCount;
-    MessageNumberNode *mnm = datagramHistory[offsetIntoList].head;
-    MessageNumberNode *next;
-    while (mnm)
-    {
-        next = mnm->next;
-        datagramHistoryMessagePool.Release(mnm);
-        mnm = next;
-    }
-    datagramHistory[offsetIntoList].head = 0;
+    datagramHistory[datagramHistory.Begin() + offsetIntoList].messageNumbersCount = 0;
 }
 
 //-------------------------------------------------------------------------------------------------------
-void ReliabilityLayer::AddFirstToDatagramHistory(DatagramSequenceNumberType datagramNumber, CCTimeType timeSent)
+void ReliabilityLayer::AddToDatagramHistory(DatagramSequenceNumberType datagramNumber, CCTimeType timeSent)
 {
     (void) datagramNumber;
-    if (datagramHistory.Size() > DATAGRAM_MESSAGE_ID_ARRAY_LENGTH)
+//    RakAssert(datagramHistoryPopCount+(unsigned int) datagramHistory.Size()==datagramNumber);
+    TrimDatagramHistory();
+    if (datagramHistory.Size() >= DATAGRAM_MESSAGE_ID_ARRAY_LENGTH)
     {
-        RemoveFromDatagramHistory(datagramHistoryPopCount);
-        datagramHistory.Pop();
-        datagramHistoryPopCount++;
+        // Acks for the oldest datagram will be ignored, and its messages resent when they time out
+        datagramHistory[datagramHistory.Begin()].messageNumbersCount = 0;
+        TrimDatagramHistory();
     }
 
-    datagramHistory.Push(DatagramHistoryNode(0, timeSent));
-    // printf("%p Pushed empty DatagramHistoryNode to datagram history at index %i\n", this, datagramHistory.Size()-1);
+    datagramHistory.Push(DatagramHistoryNode(datagramHistoryMessageNumbers.End(), timeSent));
+    // printf("%p Pushed DatagramHistoryNode to datagram history at index %i\n", this, datagramHistory.Size()-1);
 }
 
 //-------------------------------------------------------------------------------------------------------
-ReliabilityLayer::MessageNumberNode *
-ReliabilityLayer::AddFirstToDatagramHistory(DatagramSequenceNumberType datagramNumber,
-                                            DatagramSequenceNumberType messageNumber, CCTimeType timeSent)
+void ReliabilityLayer::AddMessageToDatagramHistory(DatagramSequenceNumberType messageNumber)
 {
-    (void) datagramNumber;
-//    RakAssert(datagramHistoryPopCount+(unsigned int) datagramHistory.Size()==datagramNumber);
-    if (datagramHistory.Size() > DATAGRAM_MESSAGE_ID_ARRAY_LENGTH)
+    // Messages are added to the datagram pushed last
+    datagramHistoryMessageNumbers.Push(messageNumber);
+    datagramHistory[datagramHistory.End() - 1].messageNumbersCount++;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::TrimDatagramHistory(void)
+{
+    while (!datagramHistory.IsEmpty())
     {
-        RemoveFromDatagramHistory(datagramHistoryPopCount);
+        // A lost datagram is kept until its messages are acked in the datagrams they were resent in.
+        // Messages acked so far are dropped from its front, so each is only looked at once
+        DatagramHistoryNode &oldest = datagramHistory[datagramHistory.Begin()];
+        while (oldest.messageNumbersCount > 0 && !IsAwaitingAck(datagramHistoryMessageNumbers[oldest.messageNumbersBegin]))
+        {
+            oldest.messageNumbersBegin++;
+            oldest.messageNumbersCount--;
+        }
+        if (oldest.messageNumbersCount > 0)
+            break;
+
         datagramHistory.Pop();
         datagramHistoryPopCount++;
     }
 
-    MessageNumberNode *mnm = datagramHistoryMessagePool.Allocate();
-    mnm->next = 0;
-    mnm->messageNumber = messageNumber;
-    datagramHistory.Push(DatagramHistoryNode(mnm, timeSent));
-    // printf("%p Pushed message %i to DatagramHistoryNode to datagram history at index %i\n", this, messageNumber.val, datagramHistory.Size()-1);
-    return mnm;
-}
-
-//-------------------------------------------------------------------------------------------------------
-ReliabilityLayer::MessageNumberNode *
-ReliabilityLayer::AddSubsequentToDatagramHistory(MessageNumberNode *messageNumberNode,
-                                                 DatagramSequenceNumberType messageNumber)
-{
-    messageNumberNode->next = datagramHistoryMessagePool.Allocate();
-    messageNumberNode->next->messageNumber = messageNumber;
-    messageNumberNode->next->next = 0;
-    return messageNumberNode->next;
+    if (datagramHistory.IsEmpty())
+        datagramHistoryMessageNumbers.Clear(datagramHistoryMessageNumbers.End());
+    else
+    {
+        while (datagramHistoryMessageNumbers.Begin() != datagramHistory[datagramHistory.Begin()].messageNumbersBegin)
+            datagramHistoryMessageNumbers.Pop();
+    }
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -3857,6 +5010,116 @@ void ReliabilityLayer::AllocInternalPacketData(InternalPacket *internalPacket, u
     }
 }
 
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::AllocReceivedPacketData(InternalPacket *internalPacket, unsigned int numBytes)
+{
+    internalPacket->allocationScheme = InternalPacket::PACKET_ARENA;
+    internalPacket->data = PacketArena::AllocateData(numBytes);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::AllocInternalPacketData(InternalPacket *internalPacket, InternalPacketSharedData *sharedData)
+{
+    internalPacket->allocationScheme = InternalPacket::SHARED;
+    internalPacket->data = sharedData->sharedDataBlock;
+    internalPacket->sharedData = sharedData;
+    sharedData->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::AllocInternalPacketData(InternalPacket *internalPacket, InternalPacketSharedData *sharedData,
+                                               unsigned int gatherOffset)
+{
+    internalPacket->allocationScheme = InternalPacket::GATHER;
+    internalPacket->sharedData = sharedData;
+    internalPacket->gatherOffset = gatherOffset;
+    sharedData->refCount.fetch_add(1, std::memory_order_relaxed);
+
+    unsigned int i = 0;
+    while (gatherOffset >= sharedData->buffers[i].length)
+        gatherOffset -= sharedData->buffers[i++].length;
+    internalPacket->data = (unsigned char *) sharedData->buffers[i].data + gatherOffset;
+}
+
+//-------------------------------------------------------------------------------------------------------
+InternalPacketSharedData *ReliabilityLayer::AllocateSharedData(char *data, unsigned int numberOfBytes, bool makeDataCopy)
+{
+    InternalPacketSharedData *sharedData = new InternalPacketSharedData;
+    if (makeDataCopy)
+    {
+        sharedData->sharedDataBlock = (unsigned char *) malloc(numberOfBytes);
+        memcpy(sharedData->sharedDataBlock, data, numberOfBytes);
+    }
+    else
+        sharedData->sharedDataBlock = (unsigned char *) data;
+    sharedData->refCount = 1;
+    sharedData->buffers = 0;
+    sharedData->bufferCount = 0;
+    sharedData->releaseCallback = 0;
+    sharedData->releaseContext = 0;
+    return sharedData;
+}
+
+//-------------------------------------------------------------------------------------------------------
+InternalPacketSharedData *ReliabilityLayer::AllocateGatherData(const SendBuffer *buffers, unsigned int bufferCount,
+                                                               SendBufferReleaseCallback releaseCallback, void *releaseContext)
+{
+    InternalPacketSharedData *sharedData = new InternalPacketSharedData;
+    sharedData->sharedDataBlock = 0;
+    sharedData->refCount = 1;
+    // Empty buffers are left out, so every buffer has at least one byte of the message
+    sharedData->buffers = (SendBuffer *) malloc(sizeof(SendBuffer) * bufferCount);
+    sharedData->bufferCount = 0;
+    for (unsigned int i = 0; i < bufferCount; i++)
+    {
+        if (buffers[i].length > 0)
+            sharedData->buffers[sharedData->bufferCount++] = buffers[i];
+    }
+    sharedData->releaseCallback = releaseCallback;
+    sharedData->releaseContext = releaseContext;
+    return sharedData;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::ReleaseSharedData(InternalPacketSharedData *sharedData)
+{
+    // Whoever releases last frees it. acq_rel so their reads of the data happen before the free
+    if (sharedData->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        if (sharedData->buffers != 0)
+        {
+            free(sharedData->buffers);
+            if (sharedData->releaseCallback != 0)
+                sharedData->releaseCallback(sharedData->releaseContext);
+        }
+        else
+            free(sharedData->sharedDataBlock);
+        delete sharedData;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::GatherSharedData(const InternalPacketSharedData *sharedData, unsigned int offset,
+                                        unsigned int numberOfBytes, unsigned char *output)
+{
+    unsigned int i = 0;
+    while (offset >= sharedData->buffers[i].length)
+        offset -= sharedData->buffers[i++].length;
+
+    while (numberOfBytes > 0)
+    {
+        RakAssert(i < sharedData->bufferCount);
+        unsigned int length = sharedData->buffers[i].length - offset;
+        if (length > numberOfBytes)
+            length = numberOfBytes;
+        memcpy(output, sharedData->buffers[i].data + offset, length);
+        output += length;
+        numberOfBytes -= length;
+        offset = 0;
+        i++;
+    }
+}
+
 //-------------------------------------------------------------------------------------------------------
 void ReliabilityLayer::FreeInternalPacketData(InternalPacket *internalPacket)
 {
@@ -3878,6 +5141,16 @@ void ReliabilityLayer::FreeInternalPacketData(InternalPacket *internalPacket)
             internalPacket->refCountedData = 0;
         }
     }
+    else if (internalPacket->allocationScheme == InternalPacket::SHARED ||
+             internalPacket->allocationScheme == InternalPacket::GATHER)
+    {
+        if (internalPacket->sharedData == 0)
+            return;
+
+        ReleaseSharedData(internalPacket->sharedData);
+        internalPacket->sharedData = 0;
+        internalPacket->data = 0;
+    }
     else if (internalPacket->allocationScheme == InternalPacket::NORMAL)
     {
         if (internalPacket->data == 0)
@@ -3886,6 +5159,11 @@ void ReliabilityLayer::FreeInternalPacketData(InternalPacket *internalPacket)
         free(internalPacket->data);
         internalPacket->data = 0;
     }
+    else if (internalPacket->allocationScheme == InternalPacket::PACKET_ARENA)
+    {
+        PacketArena::FreeData(internalPacket->data);
+        internalPacket->data = 0;
+    }
     else // Data was on stack
         internalPacket->data = 0;
 }
@@ -3893,7 +5171,11 @@ void ReliabilityLayer::FreeInternalPacketData(InternalPacket *internalPacket)
 //-------------------------------------------------------------------------------------------------------
 unsigned int ReliabilityLayer::GetMaxDatagramSizeExcludingMessageHeaderBytes(void)
 {
-    unsigned int val = congestionManager.GetMTU() - DatagramHeaderFormat::GetDataHeaderByteLength();
+    unsigned int val = congestionManager->GetMTU() - DatagramHeaderFormat::GetDataHeaderByteLength();
+
+    // Leave room for the parity header, since parity is as long as the longest datagram it covers
+    if (forwardErrorCorrectionChannels != 0)
+        val -= FEC_PARITY_HEADER_BYTES;
 
 #ifdef LIBCAT_SECURITY
     if (useSecurity)
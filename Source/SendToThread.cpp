@@ -15,11 +15,7 @@
 #include "InternalPacket.h"
 #include "GetTime.h"
 
-#if USE_SLIDING_WINDOW_CONGESTION_CONTROL!=1
-#include "CCRakNetUDT.h"
-#else
-#include "CCRakNetSlidingWindow.h"
-#endif
+#include "CCRakNetInterface.h"
 
 using namespace RakNet;
 
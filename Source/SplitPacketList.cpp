@@ -5,20 +5,26 @@
 #include "SplitPacketList.h"
 #include <ReliabilityLayer.h>
 
-RakNet::SplitPacketList::SplitPacketList() : splitPacketId(0), inUse(0), reliabilityLayer(nullptr)
+RakNet::SplitPacketList::SplitPacketList() : splitPacketId(0), total(0), inUse(0), isStreamed(false), reliabilityLayer(nullptr)
 {
 
 }
 
-void RakNet::SplitPacketList::prealloc(unsigned count, SplitPacketIdType splitPacketId)
+void RakNet::SplitPacketList::prealloc(unsigned count, SplitPacketIdType splitPacketId, bool streamed)
 {
     RakAssert(count > 0);
     this->splitPacketId = splitPacketId;
-    packets.resize(count);
+    total = count;
+    isStreamed = streamed;
+    if (streamed)
+        arrived.resize(count);
+    else
+        packets.resize(count);
 }
 
 bool RakNet::SplitPacketList::insert(RakNet::InternalPacket *internalPacket)
 {
+    RakAssert(!isStreamed);
     RakAssert(internalPacket->splitPacketIndex < size());
     RakAssert(splitPacketId == internalPacket->splitPacketId);
 
@@ -37,7 +43,7 @@ bool RakNet::SplitPacketList::insert(RakNet::InternalPacket *internalPacket)
 
 unsigned RakNet::SplitPacketList::size() const
 {
-    return static_cast<unsigned>(packets.size());
+    return total;
 }
 
 unsigned RakNet::SplitPacketList::count() const
@@ -45,8 +51,32 @@ unsigned RakNet::SplitPacketList::count() const
     return inUse;
 }
 
+bool RakNet::SplitPacketList::streamed() const
+{
+    return isStreamed;
+}
+
+bool RakNet::SplitPacketList::markArrived(SplitPacketIndexType splitPacketIndex)
+{
+    RakAssert(isStreamed);
+    RakAssert(splitPacketIndex < size());
+
+    if (arrived[splitPacketIndex])
+        return false;
+    arrived[splitPacketIndex] = true;
+    ++inUse;
+    return true;
+}
+
+bool RakNet::SplitPacketList::hasArrived(SplitPacketIndexType splitPacketIndex) const
+{
+    RakAssert(isStreamed);
+    return splitPacketIndex < size() && arrived[splitPacketIndex];
+}
+
 RakNet::InternalPacket *RakNet::SplitPacketList::operator[](unsigned n)
 {
+    RakAssert(!isStreamed);
     RakAssert(n < size());
     return packets[n];
 }
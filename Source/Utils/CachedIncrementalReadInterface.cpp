@@ -0,0 +1,273 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant 
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "CachedIncrementalReadInterface.h"
+#include "RakAssert.h"
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace RakNet;
+
+CachedIncrementalReadInterface::CachedIncrementalReadInterface()
+{
+    maxOpenFiles=64;
+    mapFiles=false;
+    readCount=0;
+}
+
+CachedIncrementalReadInterface::~CachedIncrementalReadInterface()
+{
+    openFilesMutex.Lock();
+    while (openFiles.Size())
+    {
+        // A part still being sent means this was destroyed before the RakPeerInterface sending it shut down, which
+        // releases the part through this. Leave the file mapped so the send does not read unmapped memory
+        RakAssert(openFiles[openFiles.Size()-1]->references==0);
+        if (openFiles[openFiles.Size()-1]->references==0)
+            CloseFile(openFiles.Size()-1);
+        else
+            openFiles.RemoveAtIndexFast(openFiles.Size()-1);
+    }
+    openFilesMutex.Unlock();
+}
+
+void CachedIncrementalReadInterface::SetMaxOpenFiles(unsigned int count)
+{
+    openFilesMutex.Lock();
+    maxOpenFiles=count;
+    openFilesMutex.Unlock();
+}
+
+unsigned int CachedIncrementalReadInterface::GetMaxOpenFiles(void) const
+{
+    return maxOpenFiles;
+}
+
+void CachedIncrementalReadInterface::SetMapFiles(bool enabled)
+{
+    openFilesMutex.Lock();
+    mapFiles=enabled;
+    openFilesMutex.Unlock();
+}
+
+bool CachedIncrementalReadInterface::GetMapFiles(void) const
+{
+    return mapFiles;
+}
+
+void CachedIncrementalReadInterface::CloseFiles(void)
+{
+    openFilesMutex.Lock();
+    unsigned int i=openFiles.Size();
+    while (i-- > 0)
+    {
+        if (openFiles[i]->references==0)
+            CloseFile(i);
+        else
+            openFiles[i]->closeWhenReleased=true;
+    }
+    openFilesMutex.Unlock();
+}
+
+unsigned int CachedIncrementalReadInterface::GetNumberOfOpenFiles(void)
+{
+    openFilesMutex.Lock();
+    unsigned int count=openFiles.Size();
+    openFilesMutex.Unlock();
+    return count;
+}
+
+unsigned int CachedIncrementalReadInterface::GetFilePart(const char *filename, unsigned int startReadBytes,
+                                                         unsigned int numBytesToRead, void *preallocatedDestination,
+                                                         FileListNodeContext &/*context*/)
+{
+    openFilesMutex.Lock();
+    OpenFile *file = GetOpenFile(filename);
+    if (file == nullptr || startReadBytes >= file->length)
+    {
+        openFilesMutex.Unlock();
+        return 0;
+    }
+    if (numBytesToRead > file->length - startReadBytes)
+        numBytesToRead = (unsigned int) (file->length - startReadBytes);
+
+#if defined(_WIN32)
+    // The file position is shared, so read while locked
+    unsigned int numRead = 0;
+    if (_fseeki64(file->fp, startReadBytes, SEEK_SET) == 0)
+        numRead = (unsigned int) fread(preallocatedDestination, 1, numBytesToRead, file->fp);
+    openFilesMutex.Unlock();
+    return numRead;
+#else
+    // Read unlocked so other threads can read at the same time. The reference keeps the file open
+    file->references++;
+    openFilesMutex.Unlock();
+
+    unsigned int numRead = 0;
+    if (file->mapping)
+    {
+        memcpy(preallocatedDestination, file->mapping + startReadBytes, numBytesToRead);
+        numRead = numBytesToRead;
+    }
+    else
+    {
+        while (numRead < numBytesToRead)
+        {
+            ssize_t result = pread(file->fd, (char*) preallocatedDestination + numRead, numBytesToRead - numRead, (off_t) startReadBytes + numRead);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                break;
+            numRead += (unsigned int) result;
+        }
+    }
+
+    ReleaseFilePart(file);
+    return numRead;
+#endif
+}
+
+bool CachedIncrementalReadInterface::GetFilePartReference(const char *filename, unsigned int startReadBytes,
+                                                          unsigned int numBytesToRead, const char **data,
+                                                          unsigned int *numBytesRead, void **partContext,
+                                                          FileListNodeContext &/*context*/)
+{
+    openFilesMutex.Lock();
+    OpenFile *file = GetOpenFile(filename);
+    if (file == nullptr || file->mapping == nullptr)
+    {
+        openFilesMutex.Unlock();
+        return false;
+    }
+
+    if (startReadBytes >= file->length)
+        numBytesToRead = 0;
+    else if (numBytesToRead > file->length - startReadBytes)
+        numBytesToRead = (unsigned int) (file->length - startReadBytes);
+    *data = file->mapping + (numBytesToRead ? startReadBytes : 0);
+    *numBytesRead = numBytesToRead;
+    *partContext = file;
+    file->references++;
+    openFilesMutex.Unlock();
+    return true;
+}
+
+void CachedIncrementalReadInterface::ReleaseFilePart(void *partContext)
+{
+    OpenFile *file = (OpenFile*) partContext;
+    openFilesMutex.Lock();
+    RakAssert(file->references > 0);
+    file->references--;
+    if (file->references == 0 && file->closeWhenReleased)
+    {
+        for (unsigned int i = 0; i < openFiles.Size(); i++)
+        {
+            if (openFiles[i] == file)
+            {
+                CloseFile(i);
+                break;
+            }
+        }
+    }
+    // Files being sent are kept open even past the limit, so close any extra once they are not
+    else if (file->references == 0 && openFiles.Size() > maxOpenFiles)
+        CloseUnusedFiles(maxOpenFiles);
+    openFilesMutex.Unlock();
+}
+
+CachedIncrementalReadInterface::OpenFile *CachedIncrementalReadInterface::GetOpenFile(const char *filename)
+{
+    unsigned int i;
+    for (i = 0; i < openFiles.Size(); i++)
+    {
+        if (openFiles[i]->closeWhenReleased == false && openFiles[i]->filename == filename)
+        {
+            openFiles[i]->lastRead = ++readCount;
+            return openFiles[i];
+        }
+    }
+
+    OpenFile *file = new OpenFile;
+    file->mapping = nullptr;
+    file->length = 0;
+#if defined(_WIN32)
+    file->fp = fopen(filename, "rb");
+    if (file->fp == nullptr)
+    {
+        delete file;
+        return nullptr;
+    }
+    _fseeki64(file->fp, 0, SEEK_END);
+    file->length = (size_t) _ftelli64(file->fp);
+#else
+    file->fd = open(filename, O_RDONLY);
+    if (file->fd < 0)
+    {
+        delete file;
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(file->fd, &fileStat) == 0)
+        file->length = (size_t) fileStat.st_size;
+    if (mapFiles && file->length > 0)
+    {
+        // Fall back to pread if the file does not fit in the address space
+        void *mapping = mmap(nullptr, file->length, PROT_READ, MAP_SHARED, file->fd, 0);
+        if (mapping != MAP_FAILED)
+            file->mapping = (char*) mapping;
+    }
+#endif
+    file->filename = filename;
+    file->references = 0;
+    file->lastRead = ++readCount;
+    file->closeWhenReleased = false;
+
+    CloseUnusedFiles(maxOpenFiles > 0 ? maxOpenFiles - 1 : 0);
+    openFiles.Push(file);
+    return file;
+}
+
+void CachedIncrementalReadInterface::CloseUnusedFiles(unsigned int count)
+{
+    while (openFiles.Size() > count)
+    {
+        unsigned int oldest = openFiles.Size();
+        for (unsigned int i = 0; i < openFiles.Size(); i++)
+        {
+            if (openFiles[i]->references == 0 && (oldest == openFiles.Size() || openFiles[i]->lastRead < openFiles[oldest]->lastRead))
+                oldest = i;
+        }
+        if (oldest == openFiles.Size())
+            break;
+        CloseFile(oldest);
+    }
+}
+
+void CachedIncrementalReadInterface::CloseFile(unsigned int index)
+{
+    OpenFile *file = openFiles[index];
+#if defined(_WIN32)
+    fclose(file->fp);
+#else
+    if (file->mapping)
+        munmap(file->mapping, file->length);
+    close(file->fd);
+#endif
+    delete file;
+    openFiles.RemoveAtIndexFast(index);
+}
@@ -26,3 +26,15 @@ unsigned int IncrementalReadInterface::GetFilePart(const char *filename, unsigne
     fclose(fp);
     return numRead;
 }
+
+bool IncrementalReadInterface::GetFilePartReference(const char * /*filename*/, unsigned int /*startReadBytes*/,
+                                                    unsigned int /*numBytesToRead*/, const char ** /*data*/,
+                                                    unsigned int * /*numBytesRead*/, void ** /*partContext*/,
+                                                    FileListNodeContext &/*context*/)
+{
+    return false;
+}
+
+void IncrementalReadInterface::ReleaseFilePart(void * /*partContext*/)
+{
+}
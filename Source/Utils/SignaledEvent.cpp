@@ -16,6 +16,7 @@
 #if defined(__GNUC__) 
 #include <sys/time.h>
 #include <unistd.h>
+#include <errno.h>
 #endif
 
 using namespace RakNet;
@@ -76,15 +77,13 @@ void SignaledEvent::SetEvent()
 #else
     // Different from SetEvent which stays signaled.
     // We have to record manually that the event was signaled
-    isSignaledMutex.Lock();
+    pthread_mutex_lock(&hMutex);
     isSignaled = true;
-    isSignaledMutex.Unlock();
-
     // Unblock waiting threads
     pthread_cond_broadcast(&eventList);
+    pthread_mutex_unlock(&hMutex);
 #endif
 }
-
 void SignaledEvent::WaitOnEvent(int timeoutMs)
 {
 #ifdef _WIN32
@@ -95,72 +94,26 @@ void SignaledEvent::WaitOnEvent(int timeoutMs)
 //        timeoutMs);
     WaitForSingleObjectEx(eventList, timeoutMs, FALSE);
 #else
-
-    // If was previously set signaled, just unset and return
-    isSignaledMutex.Lock();
-    if (isSignaled)
-    {
-        isSignaled = false;
-        isSignaledMutex.Unlock();
-        return;
-    }
-    isSignaledMutex.Unlock();
-
     struct timespec   ts{};
     struct timeval    tp{};
     gettimeofday(&tp, nullptr);
-    ts.tv_sec  = tp.tv_sec;
-    ts.tv_nsec = tp.tv_usec * 1000;
-
-    while (timeoutMs > 30)
-    {
-        // Wait 30 milliseconds for the signal, then check again.
-        // This is in case we  missed the signal between the top of this function and pthread_cond_timedwait,
-        // or after the end of the loop and pthread_cond_timedwait
-        ts.tv_nsec += 30*1000000;
-        if (ts.tv_nsec >= 1000000000)
-        {
-                ts.tv_nsec -= 1000000000;
-                ts.tv_sec++;
-        }
-
-        // [SBC] added mutex lock/unlock around cond_timedwait.
-        // this prevents airplay from generating a whole much of errors.
-        // not sure how this works on other platforms since according to
-        // the docs you are suppost to hold the lock before you wait
-        // on the cond.
-        pthread_mutex_lock(&hMutex);
-        pthread_cond_timedwait(&eventList, &hMutex, &ts);
-        pthread_mutex_unlock(&hMutex);
-
-        timeoutMs-=30;
-
-        isSignaledMutex.Lock();
-        if (isSignaled)
-        {
-            isSignaled=false;
-            isSignaledMutex.Unlock();
-            return;
-        }
-
-        isSignaledMutex.Unlock();
-    }
-
-    // Wait the remaining time, and turn off the signal in case it was set
-    ts.tv_nsec += timeoutMs*1000000;
+    ts.tv_sec  = tp.tv_sec + timeoutMs / 1000;
+    ts.tv_nsec = tp.tv_usec * 1000 + (long) (timeoutMs % 1000) * 1000000;
     if (ts.tv_nsec >= 1000000000)
     {
-            ts.tv_nsec -= 1000000000;
-            ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec++;
     }
-
+    // isSignaled is checked with hMutex locked, and pthread_cond_timedwait unlocks it only once waiting.
+    // So a SetEvent() after the check wakes this rather than being missed until the timeout
     pthread_mutex_lock(&hMutex);
-    pthread_cond_timedwait(&eventList, &hMutex, &ts);
+    while (isSignaled == false)
+    {
+        if (pthread_cond_timedwait(&eventList, &hMutex, &ts) == ETIMEDOUT)
+            break;
+    }
+    // Turn off the signal in case it was set
+    isSignaled = false;
     pthread_mutex_unlock(&hMutex);
-
-    isSignaledMutex.Lock();
-    isSignaled=false;
-    isSignaledMutex.Unlock();
-
 #endif
 }
@@ -0,0 +1,161 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/*
+https://queue.acm.org/detail.cfm?id=3022184
+
+Models the path with two numbers, measured from acks:
+btlBw = max delivery rate over the last 10 round trips
+minRtt = min round trip time over the last 10 seconds
+
+Datagrams are paced at pacingGain*btlBw, and at most cwndGain*btlBw*minRtt bytes are in flight
+
+Startup: pacingGain=cwndGain=2/ln(2), doubling the rate each round trip until btlBw stops growing by 25% for 3 round trips
+Drain: pacingGain=ln(2)/2, until in flight is down to btlBw*minRtt
+ProbeBandwidth: pacingGain cycles through 1.25, 0.75, 1, 1, 1, 1, 1, 1, one minRtt each. cwndGain=2
+ProbeRTT: when minRtt is 10 seconds old, cwnd=4 datagrams for 200 ms and a round trip, so the queue empties and minRtt is measured again
+
+Loss does not change the rate, so random loss does not slow it down, and queues at the bottleneck stay short
+*/
+
+#ifndef __CONGESTION_CONTROL_BBR_H
+#define __CONGESTION_CONTROL_BBR_H
+
+#include "CCRakNetSlidingWindow.h"
+#include "DS_RingBuffer.h"
+
+/// Most datagrams whose send time and delivery count are kept until they are acked, lost, or time out
+/// Acks for datagrams older than this give no bandwidth sample, so it should cover the datagrams in flight
+#define CC_CRABNET_BBR_SEND_HISTORY_LENGTH 65536
+
+/// Round trips the bottleneck bandwidth is the maximum over
+#define CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH 10
+
+namespace RakNet
+{
+
+/// \brief Paces datagrams at the measured bottleneck bandwidth, as BBR does
+/// \details Acks, NAKs and retransmission timeouts are handled as by CCRakNetSlidingWindow.
+/// Only datagrams with reliable messages are acked to the sender, so those are what the bandwidth and round trip time are measured from
+class CCRakNetBBR : public CCRakNetSlidingWindow
+{
+    public:
+
+    CCRakNetBBR() = default;
+    ~CCRakNetBBR() = default;
+
+    virtual void Init(CCTimeType curTime, uint32_t maxDatagramPayload);
+
+    /// Bytes that can be resent this tick, from the pacing budget only. Resent data is already in flight
+    virtual int GetRetransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick, uint32_t unacknowledgedBytes, bool isContinuousSend);
+    /// Bytes that can be sent this tick, from the pacing budget and the congestion window
+    virtual int GetTransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick, uint32_t unacknowledgedBytes, bool isContinuousSend);
+    virtual bool GetTimeToSendData(CCTimeType curTime, CCTimeType *sendTime) const;
+
+    /// Also records the delivery state when the datagram is sent, for the bandwidth sample when it is acked
+    virtual DatagramSequenceNumberType GetAndIncrementNextDatagramSequenceNumber(void);
+    /// Spends the pacing budget
+    virtual void OnSendBytes(CCTimeType curTime, uint32_t numBytes);
+
+    virtual void OnResend(CCTimeType curTime, RakNet::TimeUS nextActionTime);
+    virtual void OnNAK(CCTimeType curTime, DatagramSequenceNumberType nakSequenceNumber);
+    virtual void OnAck(CCTimeType curTime, CCTimeType rtt, bool hasBAndAS, BytesPerMicrosecond _B, BytesPerMicrosecond _AS, double totalUserDataBytesAcked, bool isContinuousSend, DatagramSequenceNumberType sequenceNumber );
+
+    virtual bool GetIsInSlowStart(void) const {return mode == MODE_STARTUP;}
+    /// The pacing rate, in bytes per second
+    virtual uint64_t GetBytesPerSecondLimitByCongestionControl(void) const;
+
+    protected:
+
+    enum Mode
+    {
+        MODE_STARTUP,
+        MODE_DRAIN,
+        MODE_PROBE_BANDWIDTH,
+        MODE_PROBE_RTT
+    };
+
+    /// Delivery state when a datagram was sent
+    struct SendState
+    {
+        DatagramSequenceNumberType datagramNumber;
+        CCTimeType sentTime;
+        /// Send time of the datagram most recently acked, when this one was sent
+        CCTimeType firstSentTime;
+        /// When the datagram most recently acked was acked
+        CCTimeType deliveredTime;
+        double delivered;
+        bool isAppLimited;
+        bool isValid;
+    };
+
+    // Bandwidth-delay product, in bytes
+    double GetBDP(double gain) const;
+    void UpdateBandwidth(CCTimeType curTime, const SendState &state);
+    void UpdateMinRTT(CCTimeType curTime, CCTimeType rtt);
+    void UpdateMode(CCTimeType curTime);
+    void EnterProbeBandwidth(CCTimeType curTime);
+    void SetGains(void);
+    void UpdatePacingBudget(CCTimeType curTime);
+    SendState *GetSendState(DatagramSequenceNumberType datagramNumber);
+    // Forgets the oldest datagrams once they are acked, lost, or too old to be acked
+    void TrimSendStates(void);
+
+    Mode mode;
+    double pacingGain, cwndGain;
+    /// Bytes per microsecond
+    BytesPerMicrosecond pacingRate;
+    /// Bytes that can be sent now. Negative after sending a datagram ahead of the pacing rate
+    double pacingBudget;
+    CCTimeType lastPacingTime;
+
+    /// Datagrams from sendStatesBegin on, at the position of their datagram number
+    DataStructures::RingBuffer<SendState> sendStates;
+    DatagramSequenceNumberType sendStatesBegin;
+    /// Bytes acked, and the time and send time of the last ack, when the next datagram is sent
+    double delivered;
+    CCTimeType deliveredTime, firstSentTime;
+    /// Tick time and bytes in flight, from the last call to GetTransmissionBandwidth()
+    CCTimeType tickTime;
+    uint32_t bytesInFlight;
+
+    /// Round trips are counted from acks for datagrams sent after the previous round trip ended
+    uint32_t roundCount;
+    CCTimeType roundStartTime;
+    bool isRoundStart;
+
+    /// Max delivery rate over each of the last round trips, and the max of those
+    BytesPerMicrosecond bandwidthSamples[CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH];
+    BytesPerMicrosecond bottleneckBandwidth;
+    /// Longest time between acks while sending continuously over each of the last round trips.
+    /// The remote system holds acks to send them together, so this much more data is in flight than the round trip time alone needs
+    CCTimeType ackIntervalSamples[CC_CRABNET_BBR_BANDWIDTH_FILTER_LENGTH];
+    CCTimeType maxAckInterval;
+    CCTimeType lastAckTime;
+
+    CCTimeType minRtt, minRttTime;
+    bool hasMinRtt;
+
+    /// Startup ends once the bandwidth stops growing
+    BytesPerMicrosecond fullBandwidth;
+    uint32_t fullBandwidthRounds;
+    bool isPipeFilled;
+
+    uint32_t cycleIndex;
+    CCTimeType cycleStartTime;
+
+    CCTimeType probeRttDoneTime;
+    uint32_t probeRttRoundCount;
+};
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file CCRakNetInterface.h
+/// \internal
+/// What ReliabilityLayer needs from a congestion control algorithm
+///
+
+#ifndef __CONGESTION_CONTROL_INTERFACE_H
+#define __CONGESTION_CONTROL_INTERFACE_H
+
+#include "RakNetDefines.h"
+#include <stdint.h>
+#include "RakNetTime.h"
+#include "RakNetTypes.h"
+
+/// Sizeof an UDP header in byte
+#define UDP_HEADER_SIZE 28
+
+#define CC_DEBUG_PRINTF_1(x)
+#define CC_DEBUG_PRINTF_2(x,y)
+#define CC_DEBUG_PRINTF_3(x,y,z)
+#define CC_DEBUG_PRINTF_4(x,y,z,a)
+#define CC_DEBUG_PRINTF_5(x,y,z,a,b)
+//#define CC_DEBUG_PRINTF_1(x) printf(x)
+//#define CC_DEBUG_PRINTF_2(x,y) printf(x,y)
+//#define CC_DEBUG_PRINTF_3(x,y,z) printf(x,y,z)
+//#define CC_DEBUG_PRINTF_4(x,y,z,a) printf(x,y,z,a)
+//#define CC_DEBUG_PRINTF_5(x,y,z,a,b) printf(x,y,z,a,b)
+
+#define CC_TIME_TYPE_BYTES 8
+
+#if CC_TIME_TYPE_BYTES==8
+typedef RakNet::TimeUS CCTimeType;
+#else
+typedef RakNet::TimeMS CCTimeType;
+#endif
+
+typedef RakNet::uint24_t DatagramSequenceNumberType;
+typedef double BytesPerMicrosecond;
+typedef double BytesPerSecond;
+typedef double MicrosecondsPerByte;
+
+namespace RakNet
+{
+
+/// Base class of the congestion control algorithms. ReliabilityLayer owns one per connection, and can swap it for another
+/// algorithm while connected, since the datagram header is the same for all of them
+class CCRakNetInterface
+{
+    public:
+
+    CCRakNetInterface() = default;
+    virtual ~CCRakNetInterface() = default;
+
+    /// Allocates the class for \a algorithm. Free with delete
+    static CCRakNetInterface *Allocate(CongestionControlAlgorithm algorithm);
+
+    /// Reset all variables to their initial states, for a new connection
+    virtual void Init(CCTimeType curTime, uint32_t maxDatagramPayload) = 0;
+
+    /// Carries on the datagram numbering of \a previous, after Init(), so the remote system does not see a gap
+    void ContinueFrom(const CCRakNetInterface &previous);
+
+    /// Update over time
+    virtual void Update(CCTimeType curTime, bool hasDataToSendOrResend) = 0;
+
+    virtual int GetRetransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick, uint32_t unacknowledgedBytes, bool isContinuousSend) = 0;
+    virtual int GetTransmissionBandwidth(CCTimeType curTime, CCTimeType timeSinceLastTick, uint32_t unacknowledgedBytes, bool isContinuousSend) = 0;
+
+    /// When new data waiting to go out can be sent, if that depends on time rather than on acks arriving
+    /// \return false if sending waits on acks, or is not limited
+    virtual bool GetTimeToSendData(CCTimeType curTime, CCTimeType *sendTime) const {(void) curTime; (void) sendTime; return false;}
+
+    /// Acks do not have to be sent immediately. Instead, they can be buffered up such that groups of acks are sent at a time
+    /// Should call once per update tick, and send if needed
+    virtual bool ShouldSendACKs(CCTimeType curTime, CCTimeType estimatedTimeToNextTick) = 0;
+
+    /// Earliest time ShouldSendACKs() can return true, if acks are waiting
+    virtual CCTimeType GetTimeToSendACKs(CCTimeType curTime) const = 0;
+
+    /// Every data packet sent must contain a sequence number
+    /// Call this function to get it. The sequence number is passed into OnGotPacketPair()
+    virtual DatagramSequenceNumberType GetAndIncrementNextDatagramSequenceNumber(void);
+    DatagramSequenceNumberType GetNextDatagramSequenceNumber(void) const {return nextDatagramSequenceNumber;}
+
+    /// Call this when you send packets
+    virtual void OnSendBytes(CCTimeType curTime, uint32_t numBytes) = 0;
+
+    /// Call this when you get a packet pair
+    virtual void OnGotPacketPair(DatagramSequenceNumberType datagramSequenceNumber, uint32_t sizeInBytes, CCTimeType curTime) = 0;
+
+    /// Call this when you get a packet (including packet pairs)
+    /// If the DatagramSequenceNumberType is out of order, skippedMessageCount will be non-zero
+    /// In that case, send a NAK for every sequence number up to that count
+    virtual bool OnGotPacket(DatagramSequenceNumberType datagramSequenceNumber, bool isContinuousSend, CCTimeType curTime, uint32_t sizeInBytes, uint32_t *skippedMessageCount) = 0;
+
+    /// Call when you get a NAK, with the sequence number of the lost message
+    virtual void OnResend(CCTimeType curTime, RakNet::TimeUS nextActionTime) = 0;
+    virtual void OnNAK(CCTimeType curTime, DatagramSequenceNumberType nakSequenceNumber) = 0;
+
+    /// Call this when an ACK arrives for a datagram with reliable messages
+    /// \param[in] totalUserDataBytesAcked Bytes of reliable messages acknowledged so far, not counting this datagram
+    virtual void OnAck(CCTimeType curTime, CCTimeType rtt, bool hasBAndAS, BytesPerMicrosecond _B, BytesPerMicrosecond _AS, double totalUserDataBytesAcked, bool isContinuousSend, DatagramSequenceNumberType sequenceNumber ) = 0;
+    virtual void OnDuplicateAck( CCTimeType curTime, DatagramSequenceNumberType sequenceNumber ) = 0;
+
+    /// Call when you send an ack, to see if the ack should have the B and AS parameters transmitted
+    /// Call before calling OnSendAck()
+    virtual void OnSendAckGetBAndAS(CCTimeType curTime, bool *hasBAndAS, BytesPerMicrosecond *_B, BytesPerMicrosecond *_AS) = 0;
+
+    /// Call when we send an ack, to write B and AS if needed
+    virtual void OnSendAck(CCTimeType curTime, uint32_t numBytes) = 0;
+
+    /// Call when we send a NACK
+    virtual void OnSendNACK(CCTimeType curTime, uint32_t numBytes) = 0;
+
+    /// Retransmission time out for the sender
+    /// If the time difference between when a message was last transmitted, and the current time is greater than RTO then packet is eligible for retransmission, pending congestion control
+    virtual CCTimeType GetRTOForRetransmission(unsigned char timesSent) const = 0;
+
+    /// Set the maximum amount of data that can be sent in one datagram
+    virtual void SetMTU(uint32_t bytes) = 0;
+
+    /// Return what was set by SetMTU()
+    virtual uint32_t GetMTU(void) const = 0;
+
+    /// Query for statistics
+    virtual double GetRTT(void) const = 0;
+    virtual bool GetIsInSlowStart(void) const = 0;
+    virtual uint64_t GetBytesPerSecondLimitByCongestionControl(void) const = 0;
+
+    /// Is a > b, accounting for variable overflow?
+    static bool GreaterThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b);
+    /// Is a < b, accounting for variable overflow?
+    static bool LessThan(DatagramSequenceNumberType a, DatagramSequenceNumberType b);
+
+    protected:
+
+    /// Every outgoing datagram is assigned a sequence number, which increments by 1 every assignment
+    DatagramSequenceNumberType nextDatagramSequenceNumber;
+    /// Track which datagram sequence numbers have arrived.
+    /// If a sequence number is skipped, send a NAK for all skipped messages
+    DatagramSequenceNumberType expectedNextSequenceNumber;
+};
+
+}
+
+#endif
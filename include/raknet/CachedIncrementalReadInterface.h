@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant 
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file CachedIncrementalReadInterface.h
+/// \brief An IncrementalReadInterface that keeps files open between reads, and can send them from memory mappings
+///
+
+#ifndef __CACHED_INCREMENTAL_READ_INTERFACE_H
+#define __CACHED_INCREMENTAL_READ_INTERFACE_H
+
+#include "IncrementalReadInterface.h"
+#include "DS_List.h"
+#include "SimpleMutex.h"
+#include "RakString.h"
+#include "Export.h"
+#include <stdio.h>
+
+namespace RakNet
+{
+
+/// Keeps the most recently read files open, rather than opening and closing a file for every chunk as IncrementalReadInterface does
+/// By default each chunk is read from the open file. With SetMapFiles(true), on systems with mmap, each file is instead mapped
+/// into memory once and chunks are sent from the mapping without being copied
+/// Files must not be changed while open, so call CloseFiles() before changing them
+/// Chunks being sent hold a reference into this, and are released through it once every system has them. So this must
+/// outlive every transfer using it. Destroy it only after the RakPeerInterface sending it has called Shutdown()
+class RAK_DLL_EXPORT CachedIncrementalReadInterface : public IncrementalReadInterface
+{
+public:
+    CachedIncrementalReadInterface();
+    virtual ~CachedIncrementalReadInterface();
+
+    /// Set how many files to keep open. When more are needed, the least recently read file that is not being sent is closed
+    /// \param[in] count How many files to keep open. Defaults to 64
+    void SetMaxOpenFiles(unsigned int count);
+
+    /// \return What was passed to SetMaxOpenFiles()
+    unsigned int GetMaxOpenFiles(void) const;
+
+    /// Send chunks from memory mappings of the files, rather than copying each chunk into the message
+    /// Only enable this for files nothing else writes to while they are sent. If a mapped file is truncated, reading the
+    /// part past its new end raises SIGBUS and terminates the process
+    /// Applies to files opened afterwards. Call CloseFiles() to apply it to files already open
+    /// \param[in] enabled True to map files. Defaults to false. Has no effect on Windows
+    void SetMapFiles(bool enabled);
+
+    /// \return What was passed to SetMapFiles()
+    bool GetMapFiles(void) const;
+
+    /// Close every open file. Files still being sent are closed once they have been sent
+    void CloseFiles(void);
+
+    /// \return How many files are open
+    unsigned int GetNumberOfOpenFiles(void);
+
+    /// Read part of a file, from its mapping or with pread
+    virtual unsigned int GetFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, void *preallocatedDestination, FileListNodeContext &context);
+
+    /// Return part of a file in its mapping. Returns false when the file is not mapped, so the part is copied with GetFilePart()
+    virtual bool GetFilePartReference( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, const char **data, unsigned int *numBytesRead, void **partContext, FileListNodeContext &context);
+
+    /// Release part of a file returned by GetFilePartReference()
+    virtual void ReleaseFilePart( void *partContext );
+
+protected:
+    struct OpenFile
+    {
+        RakString filename;
+#if defined(_WIN32)
+        FILE *fp;
+#else
+        int fd;
+#endif
+        // 0 if the file could not be mapped
+        char *mapping;
+        size_t length;
+        // Parts returned by GetFilePartReference() and not yet released
+        unsigned int references;
+        uint64_t lastRead;
+        // Set once closed while it had references, so it is closed by the last ReleaseFilePart()
+        bool closeWhenReleased;
+    };
+
+    // Find or open a file, closing the least recently read file if too many are open. Call with openFilesMutex locked
+    OpenFile *GetOpenFile(const char *filename);
+    // Close the least recently read files that are not being sent until no more than count are open. Call with openFilesMutex locked
+    void CloseUnusedFiles(unsigned int count);
+    void CloseFile(unsigned int index);
+
+    DataStructures::List<OpenFile*> openFiles;
+    SimpleMutex openFilesMutex;
+    unsigned int maxOpenFiles;
+    bool mapFiles;
+    uint64_t readCount;
+};
+
+} // namespace RakNet
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_BanTable.h
+/// \internal
+/// Banned IPv4 and IPv6 address prefixes, looked up by binary address without locks
+///
+
+#ifndef __BAN_TABLE_H
+#define __BAN_TABLE_H
+
+#include "Export.h"
+#include "RakNetTime.h"
+#include "RakNetTypes.h"
+#include <atomic>
+
+namespace DataStructures
+{
+    /// \brief A binary trie of banned address prefixes, one for IPv4 and one for IPv6.
+    /// \details Each node is one bit of the address, most significant bit first. A lookup walks at most 32 or 128 nodes,
+    /// however many bans there are, and stops at the first banned prefix it passes. IPv4-mapped IPv6 addresses are looked up as IPv4.
+    /// The port is ignored.
+    /// IsBanned() takes no lock and may run on any number of threads while one other thread adds or removes bans.
+    /// Nodes are published with atomic stores, and removed nodes are only freed once every lookup that could still see them is done.
+    /// Add(), Remove(), RemoveExpired() and Clear() must not be called at the same time as each other.
+    class RAK_DLL_EXPORT BanTable
+    {
+    public:
+        BanTable();
+        ~BanTable();
+
+        /// Bans every address that starts with the first \a prefixLength bits of \a address
+        /// If the prefix is already banned, only its timeout changes
+        /// \param[in] prefixLength Clamped to 32 for IPv4 and 128 for IPv6 addresses
+        /// \param[in] timeout Time the ban expires, or 0 for a permanent ban
+        void Add(const RakNet::SystemAddress &address, unsigned int prefixLength, RakNet::TimeMS timeout);
+
+        /// Removes a ban added with the same \a address and \a prefixLength. Longer and shorter prefixes are left banned
+        /// \return false if that prefix was not banned
+        bool Remove(const RakNet::SystemAddress &address, unsigned int prefixLength);
+
+        /// Removes bans whose timeout is before \a time
+        /// \return The number of bans removed
+        unsigned int RemoveExpired(RakNet::TimeMS time);
+
+        /// Removes all bans
+        void Clear(void);
+
+        /// \return true if any banned prefix that has not expired at \a time matches \a address
+        bool IsBanned(const RakNet::SystemAddress &address, RakNet::TimeMS time) const;
+
+        /// \return The number of banned prefixes, including expired ones not yet removed
+        unsigned int Size(void) const;
+
+        /// Reads an IPv4 address with an optional wildcard for the trailing octets, such as 128.0.0.1, 128.0.0.* or 128.*
+        /// Wildcards anywhere else, and IPv6 addresses, are not read
+        /// \param[out] address The address, with the wildcard octets set to 0
+        /// \param[out] prefixLength 8 for each octet before the wildcard, or 32 without one
+        /// \return false if \a str is not in that form
+        static bool ParseIPv4Prefix(const char *str, RakNet::SystemAddress &address, unsigned int &prefixLength);
+
+    protected:
+        struct Node
+        {
+            Node();
+
+            std::atomic<Node*> children[2];
+            std::atomic<RakNet::TimeMS> timeout;
+            std::atomic<bool> banned;
+        };
+
+        // Returns the trie for the address and writes the address bits, most significant byte first
+        Node *GetRoot(const RakNet::SystemAddress &address, unsigned char key[16], unsigned int &keyBits) const;
+        // Detaches expired and empty nodes below node. Returns true if node is left with no ban and no children
+        bool RemoveExpiredRecursive(Node *node, RakNet::TimeMS time, unsigned int &numRemoved);
+        // Waits until no lookup that started before this call is still running
+        void WaitForReaders(void);
+        // Keeps a detached subtree until FreeRetired()
+        void Retire(Node *node);
+        void FreeRetired(void);
+        static void FreeSubtree(Node *node);
+        static bool IsEmpty(const Node *node);
+
+        Node root4, root6;
+        std::atomic<unsigned int> numBans;
+
+        // Lookups register in the counter of the epoch they started in. Writers advance the epoch and wait for the old counter to drain
+        std::atomic<unsigned int> epoch;
+        mutable std::atomic<unsigned int> readers[2];
+
+        // Subtrees detached from the trie, freed after WaitForReaders()
+        Node **retired;
+        unsigned int retiredSize, retiredCapacity;
+    };
+}
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_LocklessQueue.h
+/// \internal
+/// A bounded queue for passing pointers between threads without locks or allocations
+
+#ifndef __LOCKLESS_QUEUE_H
+#define __LOCKLESS_QUEUE_H
+
+#include "RakAssert.h"
+#include "Export.h"
+#include <atomic>
+#include <stddef.h>
+
+namespace DataStructures
+{
+    /// \brief A fixed size circular buffer that any number of threads can push to and pop from at the same time.
+    /// Each element has a sequence number, which tells a thread whether the element is ready to be written or read,
+    /// so the only shared writes are one compare-and-swap on the read or write position per call.
+    /// \note queueType must be cheap to copy, such as a pointer. Elements are copied in and out
+    template <class queueType>
+    class RAK_DLL_EXPORT LocklessQueue
+    {
+    public:
+        LocklessQueue();
+        ~LocklessQueue();
+
+        /// Allocates the buffer. Not thread safe, call before any other function.
+        /// \param[in] capacity Maximum number of elements, rounded up to a power of two
+        void Init(unsigned int capacity);
+
+        /// \return false if the queue is full, in which case \a input was not added
+        bool Push(const queueType &input);
+
+        /// \return false if the queue is empty
+        bool Pop(queueType &output);
+
+        /// Pops up to \a maxElements elements that are ready to be read, in the order they were pushed, with one compare-and-swap
+        /// \return The number of elements written to \a output
+        unsigned int PopMultiple(queueType *output, unsigned int maxElements);
+
+        /// An estimate, since other threads may push or pop at the same time
+        unsigned int Size(void) const;
+        unsigned int Capacity(void) const;
+
+    protected:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            queueType data;
+        };
+
+        Cell *cells;
+        size_t mask;
+        // Keep the read and write positions on different cache lines, since they are written by different threads
+        char pad0[64];
+        std::atomic<size_t> writePosition;
+        char pad1[64];
+        std::atomic<size_t> readPosition;
+        char pad2[64];
+    };
+
+    template <class queueType>
+    LocklessQueue<queueType>::LocklessQueue()
+    {
+        cells = 0;
+        mask = 0;
+        writePosition = 0;
+        readPosition = 0;
+    }
+
+    template <class queueType>
+    LocklessQueue<queueType>::~LocklessQueue()
+    {
+        delete [] cells;
+    }
+
+    template <class queueType>
+    void LocklessQueue<queueType>::Init(unsigned int capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        delete [] cells;
+        cells = new Cell[size];
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        writePosition.store(0, std::memory_order_relaxed);
+        readPosition.store(0, std::memory_order_relaxed);
+    }
+
+    template <class queueType>
+    bool LocklessQueue<queueType>::Push(const queueType &input)
+    {
+        RakAssert(cells);
+        size_t position = writePosition.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            ptrdiff_t difference = (ptrdiff_t) sequence - (ptrdiff_t) position;
+            if (difference == 0)
+            {
+                // Free to write. On failure, position is reloaded with the current value
+                if (writePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+                return false; // Full, the reader has not freed this cell yet
+            else
+                position = writePosition.load(std::memory_order_relaxed);
+        }
+
+        cell->data = input;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <class queueType>
+    bool LocklessQueue<queueType>::Pop(queueType &output)
+    {
+        return PopMultiple(&output, 1) == 1;
+    }
+
+    template <class queueType>
+    unsigned int LocklessQueue<queueType>::PopMultiple(queueType *output, unsigned int maxElements)
+    {
+        RakAssert(cells);
+        size_t position = readPosition.load(std::memory_order_relaxed);
+        unsigned int count;
+        while (true)
+        {
+            // Count how many elements from position on have been written
+            for (count = 0; count < maxElements && count <= mask; count++)
+            {
+                size_t sequence = cells[(position + count) & mask].sequence.load(std::memory_order_acquire);
+                if ((ptrdiff_t) sequence - (ptrdiff_t) (position + count + 1) != 0)
+                    break;
+            }
+
+            if (count == 0)
+            {
+                size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+                if ((ptrdiff_t) sequence - (ptrdiff_t) (position + 1) < 0)
+                    return 0; // Empty
+                // Another reader took this element, try again from the new position
+                position = readPosition.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            // Claim all of them at once. On failure, position is reloaded with the current value
+            if (readPosition.compare_exchange_weak(position, position + count, std::memory_order_relaxed))
+                break;
+        }
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            Cell *cell = &cells[(position + i) & mask];
+            output[i] = cell->data;
+            // Ready to be written again on the next pass around the buffer
+            cell->sequence.store(position + i + mask + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    template <class queueType>
+    unsigned int LocklessQueue<queueType>::Size(void) const
+    {
+        size_t write = writePosition.load(std::memory_order_relaxed);
+        size_t read = readPosition.load(std::memory_order_relaxed);
+        return write > read ? (unsigned int) (write - read) : 0;
+    }
+
+    template <class queueType>
+    unsigned int LocklessQueue<queueType>::Capacity(void) const
+    {
+        return cells ? (unsigned int) (mask + 1) : 0;
+    }
+}
+
+#endif
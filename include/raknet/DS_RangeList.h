@@ -57,8 +57,17 @@ namespace DataStructures
         unsigned RangeSum(void) const;
         RakNet::BitSize_t Serialize(RakNet::BitStream *in, RakNet::BitSize_t maxBits, bool clearSerialized);
         bool Deserialize(RakNet::BitStream *out);
+        /// Like Serialize(), but writes the first index, then each range as its length and the gap before it, in as few bytes as each needs
+        RakNet::BitSize_t SerializeCompact(RakNet::BitStream *in, RakNet::BitSize_t maxBits, bool clearSerialized);
+        bool DeserializeCompact(RakNet::BitStream *out);
 
         DataStructures::OrderedList<range_type, RangeNode<range_type> , RangeNodeComp<range_type> > ranges{};
+
+    private:
+        // Seven bits per byte, low bits first. The high bit is set if more bytes follow
+        static void WriteVariableLength(RakNet::BitStream *in, uint32_t value);
+        static bool ReadVariableLength(RakNet::BitStream *out, uint32_t &value);
+        static unsigned GetVariableLengthBytes(uint32_t value);
     };
 
     template <class range_type>
@@ -143,6 +152,130 @@ namespace DataStructures
         return true;
     }
 
+    template <class range_type>
+    RakNet::BitSize_t RangeList<range_type>::SerializeCompact(RakNet::BitStream *in, RakNet::BitSize_t maxBits, bool clearSerialized)
+    {
+        RakNet::BitStream tempBS;
+        unsigned countWritten=0;
+        unsigned i;
+        for (i=0; i < ranges.Size(); i++)
+        {
+            uint32_t gap;
+            if (i==0)
+                gap=0;
+            else
+                gap=(uint32_t) (range_type) (ranges[i].minIndex-ranges[i-1].maxIndex-(range_type)1);
+            uint32_t length=(uint32_t) (range_type) (ranges[i].maxIndex-ranges[i].minIndex);
+            RakNet::BitSize_t rangeBits;
+            if (i==0)
+                rangeBits=BYTES_TO_BITS(sizeof(range_type)+GetVariableLengthBytes(length));
+            else
+                rangeBits=BYTES_TO_BITS(GetVariableLengthBytes(gap)+GetVariableLengthBytes(length));
+            if (BYTES_TO_BITS(GetVariableLengthBytes(countWritten+1))+tempBS.GetNumberOfBitsUsed()+rangeBits>maxBits)
+                break;
+
+            if (i==0)
+                tempBS.Write(ranges[i].minIndex);
+            else
+                WriteVariableLength(&tempBS, gap);
+            WriteVariableLength(&tempBS, length);
+            countWritten++;
+        }
+
+        in->AlignWriteToByteBoundary();
+        RakNet::BitSize_t before=in->GetWriteOffset();
+        WriteVariableLength(in, countWritten);
+        in->Write(&tempBS, tempBS.GetNumberOfBitsUsed());
+
+        if (clearSerialized && countWritten)
+        {
+            unsigned rangeSize=ranges.Size();
+            for (i=0; i < rangeSize-countWritten; i++)
+            {
+                ranges[i]=ranges[i+countWritten];
+            }
+            ranges.RemoveFromEnd(countWritten);
+        }
+
+        return in->GetWriteOffset()-before;
+    }
+    template <class range_type>
+    bool RangeList<range_type>::DeserializeCompact(RakNet::BitStream *out)
+    {
+        ranges.Clear(true);
+        uint32_t count;
+        out->AlignReadToByteBoundary();
+        if (ReadVariableLength(out, count)==false)
+            return false;
+        // Each range takes at least two bytes, so a larger count is corrupt
+        if (count > BITS_TO_BYTES(out->GetNumberOfUnreadBits()))
+            return false;
+
+        range_type min,max;
+        for (uint32_t i=0; i < count; i++)
+        {
+            uint32_t gap, length;
+            if (i==0)
+            {
+                if (out->Read(min)==false)
+                    return false;
+            }
+            else
+            {
+                if (ReadVariableLength(out, gap)==false)
+                    return false;
+                min=max+(range_type)1+(range_type)gap;
+            }
+            if (ReadVariableLength(out, length)==false)
+                return false;
+            max=min+(range_type)length;
+            if (max<min)
+                return false;
+
+            ranges.InsertAtEnd(RangeNode<range_type>(min,max));
+        }
+        return true;
+    }
+
+    template <class range_type>
+    void RangeList<range_type>::WriteVariableLength(RakNet::BitStream *in, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            in->Write((unsigned char) (value | 0x80));
+            value>>=7;
+        }
+        in->Write((unsigned char) value);
+    }
+
+    template <class range_type>
+    bool RangeList<range_type>::ReadVariableLength(RakNet::BitStream *out, uint32_t &value)
+    {
+        value=0;
+        for (unsigned shift=0; shift < 32; shift+=7)
+        {
+            unsigned char byte;
+            if (out->Read(byte)==false)
+                return false;
+            value|=(uint32_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80)==0)
+                return true;
+        }
+        return false;
+    }
+
+    template <class range_type>
+    unsigned RangeList<range_type>::GetVariableLengthBytes(uint32_t value)
+    {
+        unsigned bytes=1;
+        while (value >= 0x80)
+        {
+            value>>=7;
+            bytes++;
+        }
+        return bytes;
+    }
+
     template <class range_type>
     RangeList<range_type>::RangeList()
     {
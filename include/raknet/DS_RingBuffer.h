@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_RingBuffer.h
+/// \internal
+/// \brief A queue whose elements are looked up by a running position, such as a sequence number
+///
+
+#ifndef __RING_BUFFER_H
+#define __RING_BUFFER_H
+
+// Template classes have to have all the code in the header file
+#include "RakAssert.h"
+#include "Export.h"
+#include <stdint.h>
+
+namespace DataStructures
+{
+    /// \brief A queue implemented as an array a power of two long, indexed by position
+    /// \details Each element keeps the position it was pushed at, counting up from Begin() to End()-1 and wrapping at 2^32.
+    /// Looking up a position is a mask, and the array doubles when it is full, so Push(), Pop() and operator[] are O(1)
+    template <class ring_type>
+    class RAK_DLL_EXPORT RingBuffer
+    {
+    public:
+        RingBuffer();
+        ~RingBuffer();
+
+        /// Element at \a position, which must be from Begin() to End()-1
+        inline ring_type& operator[] ( uint32_t position ) const;
+        /// Position of the oldest element
+        inline uint32_t Begin( void ) const;
+        /// Position the next element pushed will have
+        inline uint32_t End( void ) const;
+        inline uint32_t Size( void ) const;
+        inline bool IsEmpty( void ) const;
+        /// Adds an element at End()
+        void Push( const ring_type& input );
+        /// Removes the element at Begin()
+        inline void Pop( void );
+        /// Removes all elements, and numbers the next one pushed \a position. Keeps the memory
+        void Clear( uint32_t position );
+        /// Removes all elements, and frees the memory
+        void ClearAndFree( void );
+
+    private:
+        RingBuffer( const RingBuffer& );
+        RingBuffer& operator= ( const RingBuffer& );
+
+        ring_type* array;
+        // Array length minus 1
+        uint32_t mask;
+        uint32_t begin, end;
+    };
+
+    template <class ring_type>
+        RingBuffer<ring_type>::RingBuffer()
+    {
+        array = 0;
+        mask = 0;
+        begin = 0;
+        end = 0;
+    }
+
+    template <class ring_type>
+        RingBuffer<ring_type>::~RingBuffer()
+    {
+        delete [] array;
+    }
+
+    template <class ring_type>
+        inline ring_type& RingBuffer<ring_type>::operator[] ( uint32_t position ) const
+    {
+#ifdef _DEBUG
+        RakAssert( position - begin < end - begin );
+#endif
+        return array[ position & mask ];
+    }
+
+    template <class ring_type>
+        inline uint32_t RingBuffer<ring_type>::Begin( void ) const
+    {
+        return begin;
+    }
+
+    template <class ring_type>
+        inline uint32_t RingBuffer<ring_type>::End( void ) const
+    {
+        return end;
+    }
+
+    template <class ring_type>
+        inline uint32_t RingBuffer<ring_type>::Size( void ) const
+    {
+        return end - begin;
+    }
+
+    template <class ring_type>
+        inline bool RingBuffer<ring_type>::IsEmpty( void ) const
+    {
+        return begin == end;
+    }
+
+    template <class ring_type>
+        void RingBuffer<ring_type>::Push( const ring_type& input )
+    {
+        if ( array == 0 || end - begin > mask )
+        {
+            // Double the array. Every position goes to the same slot modulo the new length
+            uint32_t newMask = array == 0 ? 15 : mask * 2 + 1;
+            ring_type *newArray = new ring_type[ newMask + 1 ];
+            for ( uint32_t position = begin; position != end; position++ )
+                newArray[ position & newMask ] = array[ position & mask ];
+            delete [] array;
+            array = newArray;
+            mask = newMask;
+        }
+
+        array[ end & mask ] = input;
+        end++;
+    }
+
+    template <class ring_type>
+        inline void RingBuffer<ring_type>::Pop( void )
+    {
+        RakAssert( begin != end );
+        begin++;
+    }
+
+    template <class ring_type>
+        void RingBuffer<ring_type>::Clear( uint32_t position )
+    {
+        begin = position;
+        end = position;
+    }
+
+    template <class ring_type>
+        void RingBuffer<ring_type>::ClearAndFree( void )
+    {
+        delete [] array;
+        array = 0;
+        mask = 0;
+        begin = 0;
+        end = 0;
+    }
+} // End namespace
+
+#endif
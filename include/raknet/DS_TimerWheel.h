@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_TimerWheel.h
+/// \internal
+/// Tracks when each of a fixed number of timers next fires, so only the ones that are due have to be visited
+///
+
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+#include "Export.h"
+#include "RakNetTime.h"
+
+namespace DataStructures
+{
+    /// \brief A hashed timer wheel.
+    /// \details Time is divided into ticks of equal length, and each tick maps to one slot of a circular array of slots.
+    /// A timer is kept in a linked list in the slot of the tick it fires on, so scheduling, cancelling and finding the timers
+    /// that are due cost time proportional to the number of ticks passed, not the number of timers.
+    /// Timers that fire more than one revolution ahead share a slot with earlier ones, and are skipped until their turn comes.
+    /// Not thread safe.
+    class RAK_DLL_EXPORT TimerWheel
+    {
+    public:
+        TimerWheel();
+        ~TimerWheel();
+
+        /// \param[in] numTimers Timers are numbered from 0 to numTimers-1
+        /// \param[in] tickLength Resolution of the wheel. Timers fire on the first call to PopExpired() at or after their time
+        /// \param[in] numSlots Number of ticks in one revolution, rounded up to a power of two
+        /// \param[in] time Current time
+        void Init(unsigned int numTimers, RakNet::TimeUS tickLength, unsigned int numSlots, RakNet::TimeUS time);
+
+        /// Frees all memory
+        void Clear(void);
+
+        /// Sets \a timer to fire at \a time. If it is already set to fire earlier, it is left unchanged
+        void Schedule(unsigned int timer, RakNet::TimeUS time);
+
+        /// Stops \a timer from firing, if it was scheduled
+        void Cancel(unsigned int timer);
+
+        bool IsScheduled(unsigned int timer) const;
+
+        /// Unschedules all timers that fire at or before \a time, and writes them to \a output
+        /// \param[out] output Must have room for every timer
+        /// \return The number of timers written to \a output
+        unsigned int PopExpired(RakNet::TimeUS time, unsigned int *output);
+
+        /// \return How long from \a time until the next timer fires, 0 if one is already due, or \a maxTime if none fires before then
+        RakNet::TimeUS GetTimeUntilNextTimer(RakNet::TimeUS time, RakNet::TimeUS maxTime) const;
+
+    protected:
+        struct Timer
+        {
+            RakNet::TimeUS fireTime;
+            unsigned int slot;
+            unsigned int next, prev;
+        };
+
+        void Link(unsigned int timer, unsigned int slot);
+        void Unlink(unsigned int timer);
+
+        Timer *timers;
+        unsigned int numTimers;
+        // Index of the first timer in each slot
+        unsigned int *slots;
+        unsigned int slotMask;
+        RakNet::TimeUS tickLength;
+        // Every slot before this tick was emptied of expired timers by PopExpired()
+        RakNet::TimeUS currentTick;
+    };
+}
+
+#endif
@@ -83,7 +83,7 @@ public:
     /// \param[in] setID The return value of SetupReceive() which was previously called on \a recipient
     /// \param[in] priority Passed to RakPeerInterface::Send()
     /// \param[in] orderingChannel Passed to RakPeerInterface::Send()
-    /// \param[in] _incrementalReadInterface If a file in \a fileList has no data, _incrementalReadInterface will be used to read the file in chunks of size \a chunkSize
+    /// \param[in] _incrementalReadInterface If a file in \a fileList has no data, _incrementalReadInterface will be used to read the file in chunks of size \a chunkSize. Use CachedIncrementalReadInterface to keep files open between chunks and send chunks without copying them
     /// \param[in] _chunkSize How large of a block of a file to read/send at once. Large values use more memory but transfer slightly faster.
     void Send(FileList *fileList, RakNet::RakPeerInterface *rakPeer, SystemAddress recipient, unsigned short setID, PacketPriority priority, char orderingChannel, IncrementalReadInterface *_incrementalReadInterface=0, unsigned int _chunkSize=262144*4*16);
 
@@ -175,6 +175,22 @@ protected:
 
     ThreadPool<ThreadData, int> threadPool;
 
+    // A chunk is read on every call to SendIRIToAddressCB, so the buffers are reused rather than allocated each time
+    struct ChunkBuffer
+    {
+        char *data;
+        unsigned int size;
+    };
+    DataStructures::List<ChunkBuffer> chunkBufferPool;
+    SimpleMutex chunkBufferPoolMutex;
+    char *AllocateChunkBuffer(unsigned int size);
+    void DeallocateChunkBuffer(char *data, unsigned int size);
+
+    // Read the next chunk of a file, in place if its IncrementalReadInterface allows it, otherwise into buffer
+    unsigned int ReadFilePart(FileToPush *ftp, char *buffer, unsigned int bufferSize, const char **data, void **partContext);
+    // Send header followed by a chunk. A chunk read in place is sent without copying it, and released once sent
+    void SendFilePart(RakNet::BitStream *header, const char *data, unsigned int length, IncrementalReadInterface *incrementalReadInterface, void *partContext, PacketPriority priority, char orderingChannel, SystemAddress systemAddress);
+
     friend int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutput, void* perThreadData);
 };
 
@@ -32,6 +32,21 @@ public:
     /// \param[out] preallocatedDestination Write your data here
     /// \return The number of bytes read, or 0 if none
     virtual unsigned int GetFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, void *preallocatedDestination, FileListNodeContext &context);
+
+    /// Get part of a file without copying it, for implementations that hold the file in memory
+    /// The part is sent straight from \a data, so it must not change until ReleaseFilePart() is called with \a partContext, which may be from another thread
+    /// \param[in] filename Filename to read
+    /// \param[in] startReadBytes What offset from the start of the file to read from
+    /// \param[in] numBytesToRead The most bytes to return
+    /// \param[out] data Set to the start of the part
+    /// \param[out] numBytesRead Set to the number of bytes at \a data, or 0 if none
+    /// \param[out] partContext Set to what to pass to ReleaseFilePart(), which must not be 0
+    /// \return false if parts cannot be referenced, in which case GetFilePart() is used instead. The default implementation always returns false
+    virtual bool GetFilePartReference( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, const char **data, unsigned int *numBytesRead, void **partContext, FileListNodeContext &context);
+
+    /// Called once for each part returned by GetFilePartReference(), when it is no longer needed
+    /// \param[in] partContext What GetFilePartReference() set \a partContext to
+    virtual void ReleaseFilePart( void *partContext );
 };
 
 } // namespace RakNet
@@ -20,12 +20,9 @@
 #include "RakNetTypes.h"
 #include "RakNetDefines.h"
 #include <stdint.h>
+#include <atomic>
 #include "RakNetDefines.h"
-#if USE_SLIDING_WINDOW_CONGESTION_CONTROL!=1
-#include "CCRakNetUDT.h"
-#else
-#include "CCRakNetSlidingWindow.h"
-#endif
+#include "CCRakNetInterface.h"
 
 namespace RakNet {
 
@@ -62,6 +59,10 @@ struct InternalPacketFixedSizeTransmissionHeader
     BitSize_t dataBitLength;
     ///What type of reliability algorithm to use with this packet
     PacketReliability reliability;
+    ///If true, data holds several messages, each preceded by its length in bits. See ReliabilityLayer::CoalesceMessage()
+    bool isCoalesced;
+    ///How data is compressed. Split packets have the codec of the message they were cut from. See ReliabilityLayer::CompressMessage()
+    MessageCompressionCodec compressionCodec;
     // Not endian safe
     // unsigned char priority : 3;
     // unsigned char reliability : 5;
@@ -74,6 +75,22 @@ struct InternalPacketRefCountedData
     unsigned int refCount;
 };
 
+/// Same as InternalPacketRefCountedData, but shared by the reliability layers of every remote system a message is broadcast to
+/// Those may be updated from different threads, so the count is atomic, and the last one to release it frees it
+/// See ReliabilityLayer::AllocateSharedData()
+/// Also holds the buffers of RakPeer::SendGather(), which are not copied into one block. See ReliabilityLayer::AllocateGatherData()
+struct InternalPacketSharedData
+{
+    unsigned char *sharedDataBlock;
+    std::atomic<unsigned int> refCount;
+    /// If not 0, the message is these buffers one after another, and sharedDataBlock is 0
+    SendBuffer *buffers;
+    unsigned int bufferCount;
+    /// Called with releaseContext when the last reference to buffers is released
+    SendBufferReleaseCallback releaseCallback;
+    void *releaseContext;
+};
+
 /// Holds a user message, and related information
 /// Don't use a constructor or destructor, due to the memory pool I am using
 struct InternalPacket : public InternalPacketFixedSizeTransmissionHeader
@@ -88,6 +105,8 @@ struct InternalPacket : public InternalPacketFixedSizeTransmissionHeader
 //    bool allowWindowUpdate;
     ///When this packet was created
     RakNet::TimeUS creationTime;
+    /// When RakPeer::Send() queued the message, in microseconds, or 0 if not profiled. Only used when sending
+    RakNet::TimeUS queueTime;
     ///The resendNext time to take action on this packet
     RakNet::TimeUS nextActionTime;
     // For debugging
@@ -105,11 +124,27 @@ struct InternalPacket : public InternalPacketFixedSizeTransmissionHeader
         /// data points to a larger block of data, where the larger block is reference counted. internalPacketRefCountedData is used in this case
         REF_COUNTED,
 
+        /// data points to a block shared with other reliability layers. sharedData is used in this case
+        SHARED,
+
+        /// The message is in sharedData->buffers, starting gatherOffset bytes in, and data points to that byte. It continues
+        /// in the buffers after it, so it is only read with ReliabilityLayer::GatherSharedData(). This is only used when sending
+        GATHER,
+
+        /// data is the data of a Packet block from PacketArena. Used for received messages, so RakPeer can return them without a copy
+        PACKET_ARENA,
+
         /// If allocation scheme is STACK, data points to stackData and should not be deallocated
         /// This is only used when sending. Received packets are deallocated in RakPeer
         STACK
     } allocationScheme;
     InternalPacketRefCountedData *refCountedData;
+    InternalPacketSharedData *sharedData;
+    /// Where this packet starts in sharedData->buffers, if allocationScheme is GATHER
+    unsigned int gatherOffset;
+    /// Set on the queued split packet of a streamed message, to the message the next split packet is cut from when this one is sent
+    /// See ReliabilityLayer::PushNextSplitPacket()
+    InternalPacket *splitPacketSource;
     /// How many attempts we made at sending this message
     unsigned char timesSent;
     /// The priority level of this packet
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file MessageCompressor.h
+/// \brief Compresses single messages, with a dictionary trained ahead of time or with bzip2.
+/// \details Used by the reliability layer for the channels and reliability types set with RakPeerInterface::SetChannelCompression()
+/// and RakPeerInterface::SetReliabilityCompression().
+///
+
+
+#ifndef __MESSAGE_COMPRESSOR_H
+#define __MESSAGE_COMPRESSOR_H
+
+#include "RakNetTypes.h"
+#include "Export.h"
+
+namespace RakNet
+{
+/// Forward declarations
+class BitStream;
+class HuffmanEncodingTree;
+
+/// \brief Compresses single messages.
+/// \details Messages are small, so rather than sending a frequency table with each one as DataCompressor does, MC_HUFFMAN
+/// codes them with a table that both systems already have. Train() it on typical traffic, for example from
+/// PacketLogger::SetCompressionTrainer(), and ship the result of SaveDictionary() with the game.
+/// Compress() and Decompress() only read the dictionary, so they may be called from several threads at once.
+class RAK_DLL_EXPORT MessageCompressor
+{
+public:
+    // GetInstance() and DestroyInstance(instance*)
+    STATIC_FACTORY_DECLARATIONS(MessageCompressor)
+
+    MessageCompressor();
+    ~MessageCompressor();
+
+    /// Counts how often each byte value occurs in \a data, toward the dictionary made by GenerateDictionary()
+    void Train( const unsigned char *data, unsigned int length );
+
+    /// Forgets what was counted by Train()
+    void ClearTraining( void );
+
+    /// Makes the dictionary for MC_HUFFMAN from what was counted by Train(). Byte values that were never seen still get a code
+    void GenerateDictionary( void );
+
+    /// Makes the dictionary for MC_HUFFMAN from how often each byte value occurs
+    void SetDictionary( const unsigned int frequencyTable[256] );
+
+    /// \return The frequency table of the dictionary, or 0 if there is none
+    const unsigned int *GetDictionary( void ) const;
+
+    /// \return If MC_HUFFMAN can be used
+    bool HasDictionary( void ) const;
+
+    /// Writes the dictionary to \a output, to be read with ReadDictionary()
+    void WriteDictionary( RakNet::BitStream *output ) const;
+
+    /// Reads a dictionary written by WriteDictionary(). Returns false if \a input is too short
+    bool ReadDictionary( RakNet::BitStream *input );
+
+    /// Writes the dictionary to a file. Returns false if the file can't be written
+    bool SaveDictionary( const char *filename ) const;
+
+    /// Reads a dictionary saved with SaveDictionary(). Returns false if the file can't be read
+    bool LoadDictionary( const char *filename );
+
+    /// Appends \a input compressed with \a codec to \a output
+    /// \return False if \a codec can't be used, or the result is not smaller than \a input. What was appended should then be discarded
+    bool Compress( MessageCompressionCodec codec, const unsigned char *input, unsigned int length, RakNet::BitStream *output ) const;
+
+    /// Writes the \a length bytes that \a input was compressed from to \a output
+    /// \return False if \a codec can't be used, or \a input does not decompress to \a length bytes
+    bool Decompress( MessageCompressionCodec codec, const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int length ) const;
+
+    /// \return If \a codec was compiled in. MC_BZIP2 needs CRABNET_SUPPORT_BZIP2
+    static bool IsCodecAvailable( MessageCompressionCodec codec );
+
+private:
+    MessageCompressor( const MessageCompressor& );
+    MessageCompressor& operator= ( const MessageCompressor& );
+
+    uint64_t trainingCounts[256];
+    unsigned int frequencyTable[256];
+    HuffmanEncodingTree *huffmanTree;
+};
+
+} // namespace RakNet
+
+#endif
@@ -419,11 +419,18 @@ enum DefaultMessageIDTypes
     ID_NAT_REQUEST_BOUND_ADDRESSES,
     ID_NAT_RESPOND_BOUND_ADDRESSES,
     ID_FCM2_UPDATE_USER_CONTEXT,
-    ID_RESERVED_3,
-    ID_RESERVED_4,
-    ID_RESERVED_5,
-    ID_RESERVED_6,
-    ID_RESERVED_7,
+    /// \internal RakPeer - Token the other system proves it knows when it moves the connection to a new address. See RakPeerInterface::AllowSessionResumption()
+    ID_SESSION_TOKEN,
+    /// \internal RakPeer - Asks a system we are connected to to send to the address this came from
+    ID_SESSION_RESUME_REQUEST,
+    /// RakPeer - A system we are connected to moved to a new IP address or port. Packet::systemAddress is the new address.
+    /// Read the old one as follows:
+    /// RakNet::BitStream bs(packet->data, packet->length, false); bs.IgnoreBytes(sizeof(MessageID)); RakNet::SystemAddress oldAddress; bs.Read(oldAddress);
+    ID_SESSION_RESUMED,
+    /// ReplicaManager3 plugin - State of an object, as the difference from an earlier state. See ReplicaManager3::SetSnapshotReplication()
+    ID_REPLICA_MANAGER_SNAPSHOT,
+    /// \internal ReplicaManager3 plugin - A snapshot could not be decoded, so the next one should be sent whole
+    ID_REPLICA_MANAGER_SNAPSHOT_RESET,
     ID_RESERVED_8,
     ID_RESERVED_9,
 
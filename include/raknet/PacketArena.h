@@ -0,0 +1,54 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  Copyright (c) 2016-2018, TES3MP Team
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file PacketArena.h
+/// \internal
+/// Allocates a Packet and its data as one block, from free lists kept by each thread
+///
+
+#ifndef __PACKET_ARENA_H
+#define __PACKET_ARENA_H
+
+#include "Export.h"
+#include "RakNetTypes.h"
+
+namespace RakNet
+{
+    /// \brief Allocates Packet structures with their data following them in the same block.
+    /// \details Blocks come in a few size classes. Each thread keeps the blocks it freed in a free list per class, so allocating
+    /// and freeing on one thread take no lock. A block freed on another thread is pushed onto a list owned by the thread that
+    /// allocated it with one atomic operation, and taken back when that thread runs out of free blocks.
+    /// Blocks freed after the thread that allocated them has exited go straight back to the system.
+    /// Data larger than the biggest size class still shares one block with its Packet, but the block is not kept for reuse.
+    class RAK_DLL_EXPORT PacketArena
+    {
+    public:
+        /// \return A Packet with \a dataSize bytes of data after it. Only data, length, bitSize and deleteData are set
+        static Packet *Allocate(unsigned int dataSize);
+
+        /// Allocates the block for a Packet that is filled in later, such as a message being received
+        /// \return Where the data of the Packet goes. Pass it to GetPacket() or FreeData()
+        static unsigned char *AllocateData(unsigned int dataSize);
+
+        /// \param[in] data Returned by AllocateData()
+        /// \param[in] dataSize Length of the data, no more than was passed to AllocateData()
+        /// \return The Packet of the block, set up as by Allocate()
+        static Packet *GetPacket(unsigned char *data, unsigned int dataSize);
+
+        /// Frees a Packet from Allocate() or GetPacket(), and its data. May be called on any thread
+        static void Free(Packet *packet);
+
+        /// Frees a block from AllocateData() that was never passed to GetPacket(). May be called on any thread
+        static void FreeData(unsigned char *data);
+    };
+}
+
+#endif
@@ -23,11 +23,13 @@
 #include "RakNetTypes.h"
 #include "PluginInterface2.h"
 #include "Export.h"
+#include "SimpleMutex.h"
 
 namespace RakNet
 {
 /// Forward declarations
 class RakPeerInterface;
+class MessageCompressor;
 
 /// \defgroup PACKETLOGGER_GROUP PacketLogger
 /// \brief Print out incoming messages to a target destination
@@ -88,6 +90,10 @@ public:
 
     /// Log the direct sends and receives or not. Default true
     void SetLogDirectMessages(bool send);
+
+    /// Passes the data of every message sent and received to MessageCompressor::Train(), to make a compression dictionary from a capture of typical traffic.
+    /// Messages that were already compressed are skipped, so capture with compression off. Pass 0 to stop
+    void SetCompressionTrainer(MessageCompressor *trainer);
 protected:
 
     virtual bool UsesReliabilityLayer(void) const {return true;}
@@ -97,6 +103,8 @@ protected:
     virtual const char* UserIDTOString(unsigned char Id);
     void GetLocalTime(char buffer[128]);
     bool logDirectMessages;
+    MessageCompressor *compressionTrainer;
+    SimpleMutex compressionTrainerMutex;
 
     bool printId, printAcks;
     char prefix[256];
@@ -60,6 +60,16 @@
 #define BITSTREAM_STACK_ALLOCATION_SIZE 256
 #endif
 
+/// If defined to 1, BitStream shifts long runs of bytes that are not on a byte boundary with SSE2, or with AVX2 when the compiler targets it.
+/// Otherwise, and for the remainder, it shifts 64 bits at a time
+#ifndef BITSTREAM_USE_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITSTREAM_USE_SIMD 1
+#else
+#define BITSTREAM_USE_SIMD 0
+#endif
+#endif
+
 // Redefine if you want to disable or change the target for debug CRABNET_DEBUG_PRINTF
 #ifndef CRABNET_DEBUG_PRINTF
 #define CRABNET_DEBUG_PRINTF printf
@@ -84,18 +94,29 @@
 #endif
 
 /// This controls the amount of memory used per connection.
-/// This many datagrams are tracked by datagramNumber. If more than this many datagrams are sent, then an ack for an older datagram would be ignored
+/// Datagrams are tracked by datagramNumber until they are acked, or until the reliable messages in them are acked after a resend.
+/// If more than this many datagrams are tracked, then an ack for an older datagram would be ignored
 /// This results in an unnecessary resend in that case
 #ifndef DATAGRAM_MESSAGE_ID_ARRAY_LENGTH
-#define DATAGRAM_MESSAGE_ID_ARRAY_LENGTH 512
+#define DATAGRAM_MESSAGE_ID_ARRAY_LENGTH 65536
 #endif
 
-/// This is the maximum number of reliable user messages that can be on the wire at a time
-/// If this is too low, then high ping connections with a large throughput will be underutilized
-/// This will be evident because RakNetStatistics::messagesInSend buffer will increase over time, yet at the same time the outgoing bandwidth per second is less than your connection supports
+/// This is the number of reliable user messages that can be on the wire at a time before the resend buffer grows. A power of 2
 #ifndef RESEND_BUFFER_ARRAY_LENGTH
 #define RESEND_BUFFER_ARRAY_LENGTH 512
-#define RESEND_BUFFER_ARRAY_MASK 511
+#endif
+
+/// This is the maximum number of reliable user messages that can be on the wire at a time. A power of 2
+/// If this is too low, then high ping connections with a large throughput will be underutilized
+/// This will be evident because RakNetStatistics::messagesInSend buffer will increase over time, yet at the same time the outgoing bandwidth per second is less than your connection supports
+#ifndef RESEND_BUFFER_ARRAY_MAX_LENGTH
+#define RESEND_BUFFER_ARRAY_MAX_LENGTH 262144
+#endif
+
+/// Reliable messages waiting to be resent are kept in a timer wheel with this many slots, each 2 milliseconds long
+/// Resends more than one turn of the wheel ahead are passed over once per turn, so it should cover the longest retransmission timeout
+#ifndef RESEND_TIMER_WHEEL_LENGTH
+#define RESEND_TIMER_WHEEL_LENGTH 1024
 #endif
 
 /// Uncomment if you want to link in the DLMalloc library to use with RakMemoryOverride
@@ -109,15 +130,29 @@
 #define GET_TIME_SPIKE_LIMIT 0
 #endif
 
-// Use sliding window congestion control instead of ping based congestion control
+// Use sliding window congestion control instead of ping based congestion control, unless RakPeerInterface::SetCongestionControl() chooses another
 #ifndef USE_SLIDING_WINDOW_CONGESTION_CONTROL
 #define USE_SLIDING_WINDOW_CONGESTION_CONTROL 1
 #endif
 
-// When a large message is arriving, preallocate the memory for the entire block
-// This results in large messages not taking up time to reassembly with memcpy, but is vulnerable to attackers causing the host to run out of memory
-#ifndef PREALLOCATE_LARGE_MESSAGES
-#define PREALLOCATE_LARGE_MESSAGES 0
+// Messages split into at least this many split packets are streamed.
+// When sending, only the next split packet waits in the send queue, and the one after it is cut from the message when it goes out.
+// When receiving, the memory for the entire message is allocated when the first split packet arrives, and each split packet is written straight into it.
+// This avoids reassembly with memcpy, but lets a peer make the host allocate up to MAX_STREAMED_MESSAGE_SIZE for each message it starts
+// Set to 0 to split all messages when they are sent and reassemble them when they are complete
+// Replaces PREALLOCATE_LARGE_MESSAGES, which preallocated every split message when set to 1
+#ifndef STREAMED_SPLIT_PACKET_COUNT
+#if defined(PREALLOCATE_LARGE_MESSAGES) && PREALLOCATE_LARGE_MESSAGES == 1
+#define STREAMED_SPLIT_PACKET_COUNT 1
+#else
+#define STREAMED_SPLIT_PACKET_COUNT 0
+#endif
+#endif
+
+// Largest size in bytes that a received message may have to be streamed. Its memory is allocated before it arrives, so larger messages are
+// reassembled when they are complete instead. Only used if STREAMED_SPLIT_PACKET_COUNT is not 0
+#ifndef MAX_STREAMED_MESSAGE_SIZE
+#define MAX_STREAMED_MESSAGE_SIZE 67108864
 #endif
 
 #ifndef CRABNET_SUPPORT_IPV6
@@ -148,6 +183,23 @@
 #define BUFFERED_PACKETS_PAGE_SIZE 8
 #endif
 
+// Number of datagrams that can wait between the recvfrom thread and the main update thread without taking a lock. Rounded up to a power of two
+// Also the most RNS2RecvStruct kept for reuse after the update thread is done with them. Past this, datagrams wait in a queue protected by a mutex
+#ifndef BUFFERED_PACKETS_QUEUE_SIZE
+#define BUFFERED_PACKETS_QUEUE_SIZE 4096
+#endif
+
+// Longest the update thread sleeps between update cycles. It wakes sooner when a datagram arrives or a remote system has a resend, ack or other timer due
+// Sends that are not IMMEDIATE_PRIORITY are buffered until the next cycle, so more of them fit in a datagram
+#ifndef UPDATE_THREAD_MAX_SLEEP_MS
+#define UPDATE_THREAD_MAX_SLEEP_MS 10
+#endif
+
+// A remote system with nothing due is still updated this often, to keep statistics current and pick up changes such as SetTimeoutTime()
+#ifndef REMOTE_SYSTEM_MAX_UPDATE_INTERVAL_MS
+#define REMOTE_SYSTEM_MAX_UPDATE_INTERVAL_MS 100
+#endif
+
 // Controls how many allocations occur at once for the memory pool of incoming or outgoing datagrams.
 // Has small effect on memory usage per connection. Uses about 256 bytes*INTERNAL_PACKET_PAGE_SIZE per connection
 #ifndef INTERNAL_PACKET_PAGE_SIZE
@@ -163,6 +215,100 @@
 #define USE_ALLOCA 1
 #endif
 
+// If defined to 1, RNS2_Berkley can read datagrams with recvmmsg and write the datagrams of an update cycle with sendmmsg
+// Only available on Linux. Enable at runtime with RakPeerInterface::SetBatchedDatagramIO()
+#ifndef CRABNET_SUPPORT_BATCHED_IO
+#if defined(__linux__) && !defined(__native_client__)
+#define CRABNET_SUPPORT_BATCHED_IO 1
+#else
+#define CRABNET_SUPPORT_BATCHED_IO 0
+#endif
+#endif
+
+// Maximum number of datagrams read by one recvmmsg call or written by one sendmmsg call
+// Uses about MAXIMUM_MTU_SIZE*BATCHED_IO_MAX_DATAGRAMS bytes per socket when batched I/O is enabled
+#ifndef BATCHED_IO_MAX_DATAGRAMS
+#define BATCHED_IO_MAX_DATAGRAMS 32
+#endif
+
+// If defined to 1, RNS2_Berkley can write runs of equal size datagrams to one address as a single buffer with UDP_SEGMENT (Linux 4.18),
+// and read datagrams the kernel coalesced with UDP_GRO (Linux 5.0). Enable at runtime with RakPeerInterface::SetUDPSegmentationOffload()
+// Requires CRABNET_SUPPORT_BATCHED_IO
+#ifndef CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD
+#define CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD CRABNET_SUPPORT_BATCHED_IO
+#endif
+
+// Coalesced datagrams are read into UDP_GRO_MAX_BUFFERS buffers of 64 KB each per recvmmsg call
+// Uses about 64 KB*UDP_GRO_MAX_BUFFERS bytes per socket when UDP_GRO is enabled
+#ifndef UDP_GRO_MAX_BUFFERS
+#define UDP_GRO_MAX_BUFFERS 8
+#endif
+
+// Largest number of datagrams covered by one forward error correction parity datagram. See RakPeerInterface::SetForwardErrorCorrection()
+// Fewer datagrams are grouped as the measured datagram loss rises. At most 32
+#ifndef FEC_MAX_GROUP_SIZE
+#define FEC_MAX_GROUP_SIZE 16
+#endif
+
+// Forward error correction sends no parity while the measured datagram loss is below this fraction
+#ifndef FEC_MIN_DATAGRAM_LOSS
+#define FEC_MIN_DATAGRAM_LOSS 0.005
+#endif
+
+// Largest message, in bytes, that waits to be sent in one message with others. See RakPeerInterface::SetMessageCoalescing()
+// Each coalesced message is preceded by its length, in one byte up to 15 bytes long and two bytes up to 2047 bytes long
+#ifndef COALESCED_MESSAGE_MAX_SIZE
+#define COALESCED_MESSAGE_MAX_SIZE 255
+#endif
+
+// Connection cookies from RakPeer::SetConnectionCookies() are accepted until the end of the time window after the one they were sent in
+// So a cookie is valid for between one and two windows
+#ifndef CONNECTION_COOKIE_WINDOW_MS
+#define CONNECTION_COOKIE_WINDOW_MS 10000
+#endif
+
+// Number of random bytes in the key of the connection cookie HMAC
+#ifndef CONNECTION_COOKIE_SECRET_LENGTH
+#define CONNECTION_COOKIE_SECRET_LENGTH 32
+#endif
+
+// Number of random bytes in the session token of RakPeer::AllowSessionResumption()
+#ifndef SESSION_TOKEN_LENGTH
+#define SESSION_TOKEN_LENGTH 16
+#endif
+
+// A connection that has heard nothing from the other system for this long, while messages wait for an ack, asks it to send to the address we now send from
+// Lower it to move sooner after a network change. Keep it above the round trip time, or requests are sent that were not needed
+#ifndef SESSION_RESUME_SILENCE_MS
+#define SESSION_RESUME_SILENCE_MS 1000
+#endif
+
+// Least time between session resume requests to the same system
+#ifndef SESSION_RESUME_INTERVAL_MS
+#define SESSION_RESUME_INTERVAL_MS 250
+#endif
+
+// How often RakPeer frees the memory of expired temporary bans. Lookups ignore a ban as soon as it expires
+#ifndef BAN_TABLE_PRUNE_INTERVAL_MS
+#define BAN_TABLE_PRUNE_INTERVAL_MS 10000
+#endif
+
+// Bytes of free Packet blocks of each size class that a thread keeps for reuse. Blocks freed beyond this go back to the system
+#ifndef PACKET_ARENA_MAX_CACHED_BYTES
+#define PACKET_ARENA_MAX_CACHED_BYTES 262144
+#endif
+
+// Compile the bundled bzip2 into the library, for MC_BZIP2 message compression. Set by CRABNET_ENABLE_BZIP2 in CMake
+#ifndef CRABNET_SUPPORT_BZIP2
+#define CRABNET_SUPPORT_BZIP2 0
+#endif
+
+// Largest size in bytes that a received compressed message may claim to decompress to. Larger ones are dropped, so a few bytes can't make
+// the receiver allocate gigabytes. Larger messages are sent uncompressed
+#ifndef MAX_DECOMPRESSED_MESSAGE_SIZE
+#define MAX_DECOMPRESSED_MESSAGE_SIZE 67108864
+#endif
+
 //#define USE_THREADED_SEND
 
 #endif // __CRABNET_DEFINES_H
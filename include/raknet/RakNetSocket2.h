@@ -85,6 +85,15 @@ struct RNS2RecvStruct
     RakNetSocket2 *socket;
 };
 
+/// Datagram and system call counters for one socket, see RNS2_Berkley::GetSocketStatistics()
+struct RNS2SocketStatistics
+{
+    uint64_t datagramsSent;
+    uint64_t sendCalls;
+    uint64_t datagramsReceived;
+    uint64_t recvCalls;
+};
+
 class RakNetSocket2Allocator
 {
 public:
@@ -117,6 +126,10 @@ public:
     // In order for the handler to trigger, some platforms must call PollRecvFrom, some platforms this create an internal thread.
     void SetRecvEventHandler(RNS2EventHandler *_eventHandler);
     virtual RNS2SendResult Send( RNS2_SendParameters *sendParameters )=0;
+    // Like Send, but the datagram may be held until FlushSendBatch() is called, so it can go out with other datagrams in one system call
+    // Sockets that do not support batching send immediately
+    virtual RNS2SendResult SendBatched( RNS2_SendParameters *sendParameters );
+    virtual void FlushSendBatch(void);
     RNS2Type GetSocketType(void) const;
     void SetSocketType(RNS2Type t);
     bool IsBerkleySocket(void) const;
@@ -245,6 +258,26 @@ public:
     const RNS2_BerkleyBindParameters *GetBindings(void) const;
     RNS2Socket GetSocket(void) const;
     void SetDoNotFragment( int opt );
+    void GetSocketStatistics( RNS2SocketStatistics *rns2s ) const;
+
+#if CRABNET_SUPPORT_BATCHED_IO==1
+    // When enabled, the polling thread reads up to BATCHED_IO_MAX_DATAGRAMS datagrams per recvmmsg call,
+    // and SendBatched() queues datagrams until FlushSendBatch() writes them with sendmmsg
+    void SetBatchedIO( bool enabled );
+    bool GetBatchedIO(void) const;
+    RNS2SendResult SendBatched( RNS2_SendParameters *sendParameters );
+    void FlushSendBatch(void);
+#endif
+
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    // When enabled, FlushSendBatch() writes each run of equal size datagrams to the same address as one buffer with UDP_SEGMENT,
+    // and the polling thread reads with UDP_GRO, splitting each coalesced buffer into one RNS2RecvStruct per datagram.
+    // Only datagrams queued by SendBatched() are coalesced, so sending needs batched I/O as well.
+    // If the kernel rejects a coalesced write, sending falls back to one datagram per message. Reading does the same if UDP_GRO is not supported
+    // \return false if the kernel does not support UDP_SEGMENT. The socket is left unchanged
+    bool SetSegmentationOffload( bool enabled );
+    bool GetSegmentationOffload(void) const;
+#endif
 
 protected:
     // Used by other classes
@@ -270,6 +303,35 @@ protected:
     unsigned RecvFromLoopInt(void);
     std::atomic<uint32_t> isRecvFromLoopThreadActive;
     std::atomic<bool> endThreads;
+
+    std::atomic<uint64_t> datagramsSent, sendCalls, datagramsReceived, recvCalls;
+
+#if CRABNET_SUPPORT_BATCHED_IO==1
+    struct RNS2DatagramBatch;
+    static RNS2DatagramBatch *AllocDatagramBatch(void);
+    void RecvFromBatched(void);
+    void ReleaseRecvBatch(void);
+
+    std::atomic<bool> batchedIO;
+    // Written by the thread calling SendBatched() and FlushSendBatch()
+    RNS2DatagramBatch *sendBatch;
+    SimpleMutex sendBatchMutex;
+    // Only used by the recv polling thread
+    RNS2DatagramBatch *recvBatch;
+#endif
+
+#if CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD==1
+    struct RNS2CoalescedRecvBatch;
+    // Writes the datagrams of batch with UDP_SEGMENT. Returns the index of the first datagram not written, if the kernel rejected a coalesced write
+    unsigned int FlushSendBatchSegmented( RNS2DatagramBatch *batch );
+    void RecvFromCoalesced(void);
+
+    std::atomic<bool> segmentationOffload;
+    // UDP_GRO is set on the socket, so datagrams must be read into buffers large enough for coalesced ones
+    std::atomic<bool> receiveOffload;
+    // Only used by the recv polling thread
+    RNS2CoalescedRecvBatch *coalescedRecvBatch;
+#endif
     // Constructor not called!
 
 #if defined(__APPLE__)
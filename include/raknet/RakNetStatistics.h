@@ -100,6 +100,35 @@ struct RAK_DLL_EXPORT RakNetStatistics
     /// What is the average total packetloss over the lifetime of the connection?
     float packetlossTotal;
 
+    /// Fraction of recent datagrams the remote system reported lost, weighted over about the last 64 datagrams
+    /// Unlike \a packetlossLastSecond, this includes unreliable datagrams. Forward error correction sizes its groups from it
+    float datagramLossRate;
+
+    /// Forward error correction parity datagrams sent. See RakPeerInterface::SetForwardErrorCorrection()
+    uint64_t parityDatagramsSent;
+
+    /// Lost datagrams rebuilt from forward error correction parity, without a resend
+    uint64_t datagramsRecovered;
+
+    /// Bytes of sent messages that had a compression codec, before compression. See RakPeerInterface::SetChannelCompression()
+    uint64_t compressionBytesIn;
+
+    /// Bytes those messages were sent as. compressionBytesOut / compressionBytesIn is the compression ratio
+    uint64_t compressionBytesOut;
+
+    /// Messages that had a codec but were sent uncompressed, because compressing them did not make them smaller, or had not for recent messages
+    uint64_t messagesNotCompressed;
+
+    /// Received messages dropped because they could not be decompressed, such as when the remote system used another MC_HUFFMAN dictionary
+    /// or a codec that was not compiled in here. They were already acknowledged, so they are not resent
+    uint64_t messagesNotDecompressed;
+
+    /// Microseconds spent compressing sent messages
+    uint64_t compressionTimeUS;
+
+    /// Microseconds spent decompressing received messages
+    uint64_t decompressionTimeUS;
+
     RakNetStatistics& operator +=(const RakNetStatistics& other)
     {
         unsigned i;
@@ -129,6 +158,120 @@ struct RAK_DLL_EXPORT RakNetStatistics
 /// 3 debugging congestion control
 void RAK_DLL_EXPORT StatisticsToString( RakNetStatistics *s, char *buffer, int verbosityLevel );
 
+/// Phases of RakPeer::RunUpdateCycle() timed per connection when tick profiling is on
+/// \sa RakPeerInterface::SetTickProfiling()
+enum RNSTickPhase
+{
+    /// Parsing datagrams in ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(), excluding the phases below
+    TICK_PHASE_DATAGRAM_PARSE,
+
+    /// Processing received ACKs and NAKs
+    TICK_PHASE_ACK_PROCESSING,
+
+    /// Scanning the resend list for messages to retransmit
+    TICK_PHASE_RESEND_SCAN,
+
+    /// Writing datagrams to the socket in ReliabilityLayer::SendBitStream()
+    TICK_PHASE_SEND_BITSTREAM,
+
+    /// Plugin callbacks made by the reliability layer, such as PluginInterface2::OnInternalPacket() and OnAck()
+    TICK_PHASE_PLUGIN_CALLBACKS,
+
+    /// Taking completed messages out of the reliability layer and handing them to the user or internal handlers
+    TICK_PHASE_RECEIVE_HANDOFF,
+
+    /// \internal
+    RNS_TICK_PHASE_COUNT
+};
+
+/// Message latencies recorded per connection when tick profiling is on
+enum RNSLatencyMetric
+{
+    /// From RakPeerInterface::Send() until the message is first written to the wire
+    LATENCY_SEND_TO_WIRE,
+
+    /// From the datagram carrying the message arriving until RakPeerInterface::Receive() returns it
+    LATENCY_WIRE_TO_RECEIVE,
+
+    /// \internal
+    RNS_LATENCY_METRIC_COUNT
+};
+
+/// \brief Histogram of microsecond latencies with bounded relative error
+/// \details Values below 8 get a bucket each. Above that, every power of two is split into 8 linear sub-buckets,
+/// so a percentile is accurate to within 12.5% up to 2^32 microseconds. Recording is a few shifts and an increment.
+struct RAK_DLL_EXPORT LatencyHistogram
+{
+    enum
+    {
+        SUB_BUCKET_BITS=3,
+        SUB_BUCKET_COUNT=1<<SUB_BUCKET_BITS,
+        BUCKET_COUNT=SUB_BUCKET_COUNT+(32-SUB_BUCKET_BITS)*SUB_BUCKET_COUNT
+    };
+
+    /// Number of values recorded in each bucket
+    uint32_t counts[BUCKET_COUNT];
+
+    /// Number of values recorded
+    uint64_t totalCount;
+
+    /// Sum of the values recorded, to get the mean
+    uint64_t sum;
+
+    /// Largest value recorded
+    uint64_t max;
+
+    LatencyHistogram() {Clear();}
+
+    void Clear(void);
+
+    /// Adds one value, in microseconds
+    void Record(uint64_t valueUS);
+
+    /// \param[in] percentile 0 to 100
+    /// \return The upper bound of the bucket holding that percentile, in microseconds, or 0 if nothing was recorded
+    uint64_t GetPercentile(double percentile) const;
+
+    /// \return The mean of the values recorded, in microseconds
+    uint64_t GetMean(void) const {return totalCount==0 ? 0 : sum/totalCount;}
+
+    static unsigned int GetBucketIndex(uint64_t valueUS);
+    static uint64_t GetBucketUpperBound(unsigned int bucketIndex);
+
+    LatencyHistogram& operator +=(const LatencyHistogram& other);
+
+    /// Subtracts an earlier copy of the same histogram, leaving what was recorded in between. \a max is kept
+    LatencyHistogram& operator -=(const LatencyHistogram& other);
+};
+
+/// \brief Where the time of one connection went inside RakPeer::RunUpdateCycle()
+/// \details Times are exclusive, so a plugin callback made while parsing a datagram counts only towards TICK_PHASE_PLUGIN_CALLBACKS.
+/// All values are running totals since tick profiling was turned on. Subtract an earlier copy to get the values for an interval.
+/// \sa RakPeerInterface::GetTickProfile()
+struct RAK_DLL_EXPORT RakNetTickProfile
+{
+    /// For each RNSTickPhase, how many microseconds were spent in it?
+    uint64_t phaseTimeUS[RNS_TICK_PHASE_COUNT];
+
+    /// For each RNSTickPhase, how many times was it entered?
+    uint64_t phaseCount[RNS_TICK_PHASE_COUNT];
+
+    /// For each RNSLatencyMetric, the latencies of user messages
+    LatencyHistogram latency[RNS_LATENCY_METRIC_COUNT];
+
+    RakNetTickProfile() {Clear();}
+
+    void Clear(void);
+
+    RakNetTickProfile& operator +=(const RakNetTickProfile& other);
+    RakNetTickProfile& operator -=(const RakNetTickProfile& other);
+};
+
+/// Formats a RakNetTickProfile as one line per phase and per latency metric
+/// \param[in] p The profile to format
+/// \param[out] buffer Must hold at least 1024 bytes
+void RAK_DLL_EXPORT TickProfileToString( const RakNetTickProfile *p, char *buffer );
+
 } // namespace RakNet
 
 #endif
@@ -76,6 +76,33 @@ enum ConnectionState
     IS_NOT_CONNECTED
 };
 
+/// Congestion control for a connection, set with RakPeerInterface::SetCongestionControl()
+enum CongestionControlAlgorithm
+{
+    /// Window of unacknowledged bytes, halved on loss. The default, unless USE_SLIDING_WINDOW_CONGESTION_CONTROL is 0
+    CC_SLIDING_WINDOW,
+    /// Sets the time between datagrams from the data arrival rate the remote system reports, as UDT does
+    CC_UDT,
+    /// Paces datagrams at the measured bottleneck bandwidth and keeps about two round trips of data in flight, as BBR does.
+    /// Random loss does not slow it down, and it keeps queues at the bottleneck short
+    CC_BBR,
+    CC_ALGORITHM_COUNT
+};
+
+/// Compression of sent messages, set with RakPeerInterface::SetChannelCompression() and RakPeerInterface::SetReliabilityCompression()
+enum MessageCompressionCodec
+{
+    /// Messages are sent as they are
+    MC_NONE,
+    /// Each byte is coded with a static Huffman code, from the dictionary set with RakPeerInterface::SetCompressionDictionary().
+    /// Fast, and pays off even for messages of a few bytes if the dictionary was trained on similar ones
+    MC_HUFFMAN,
+    /// The bundled bzip2. Slow, and only pays off for messages of a few hundred bytes or more, such as on bulk transfer channels.
+    /// Only available when the library is built with CRABNET_SUPPORT_BZIP2
+    MC_BZIP2,
+    MC_CODEC_COUNT
+};
+
 /// Given a number of bits, return how many bytes are needed to represent that.
 #define BITS_TO_BYTES(x) (((x)+7)>>3)
 #define BYTES_TO_BITS(x) ((x)<<3)
@@ -398,6 +425,16 @@ struct RAK_DLL_EXPORT AddressOrGUID
 
 typedef uint64_t NetworkID;
 
+/// One of the buffers of a message sent with RakPeerInterface::SendGather()
+struct RAK_DLL_EXPORT SendBuffer
+{
+    const char *data;
+    unsigned int length;
+};
+
+/// Called with the context given to RakPeerInterface::SendGather() once its buffers are no longer needed
+typedef void (*SendBufferReleaseCallback)(void *context);
+
 /// This represents a user message from another system.
 struct Packet
 {
@@ -425,6 +462,10 @@ struct Packet
     /// @internal
     /// If true, this message is meant for the user, not for the plugins, so do not process it through plugins
     bool wasGeneratedLocally;
+
+    /// @internal
+    /// When the datagram completing this message arrived, in microseconds. Only set while tick profiling
+    RakNet::TimeUS timeRead;
 };
 
 ///  Index of an unassigned player
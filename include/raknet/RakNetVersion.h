@@ -17,4 +17,4 @@
 
 // What compatible protocol version RakNet is using. When this value changes, it indicates this version of RakNet cannot connection to an older version.
 // ID_INCOMPATIBLE_PROTOCOL_VERSION will be returned on connection attempt in this case
-#define CRABNET_PROTOCOL_VERSION 7
+#define CRABNET_PROTOCOL_VERSION 11
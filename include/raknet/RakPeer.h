@@ -36,6 +36,10 @@
 #include "NativeFeatureIncludes.h"
 #include "SecureHandshake.h"
 #include "DS_Queue.h"
+#include "DS_LocklessQueue.h"
+#include "DS_TimerWheel.h"
+#include "DS_BanTable.h"
+#include "MessageCompressor.h"
 
 namespace RakNet {
 /// Forward declarations
@@ -265,6 +269,25 @@ public:
     /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
     uint32_t SendList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, uint32_t forceReceiptNumber=0 );
 
+    /// \brief Sends a message made of several buffers, such as a header and blocks kept elsewhere, without first copying them into one as SendList() does.
+    /// The buffers are copied only when the message is written into datagrams, so they must not change until \a releaseCallback is called.
+    /// That is once no system needs them, which for a reliable message is when every split packet of it has been acknowledged.
+    /// It is called exactly once, from the thread that updates the connection, from Shutdown(), or from SendGather() itself if the message is not queued.
+    /// Messages that are coalesced or compressed, or are sent while a plugin such as PacketLogger sees each InternalPacket, are gathered into one block first
+    /// \note This function only works while connected.
+    /// \param[in] buffers The message, one buffer after another. Only the array is copied, so it may be on the stack
+    /// \param[in] numberOfBuffers The number of elements in \a buffers
+    /// \param[in] priority What priority level to send on.  See PacketPriority.h
+    /// \param[in] reliability How reliably to send this data.  See PacketPriority.h
+    /// \param[in] orderingChannel When using ordered or sequenced messages, what channel to order these on. Messages are only ordered relative to other messages on the same stream
+    /// \param[in] systemIdentifier Who to send this packet to, or in the case of broadcasting who not to send it to. Pass either a SystemAddress structure or a RakNetGUID structure. Use UNASSIGNED_SYSTEM_ADDRESS or to specify none
+    /// \param[in] broadcast True to send this packet to all connected systems. If true, then systemAddress specifies who not to send the packet to.
+    /// \param[in] releaseCallback Called with \a releaseContext when the buffers are no longer needed. May be 0
+    /// \param[in] releaseContext Passed to \a releaseCallback
+    /// \param[in] forceReceipt If 0, will automatically determine the receipt number to return. If non-zero, will return what you give it.
+    /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
+    uint32_t SendGather( const SendBuffer *buffers, const int numberOfBuffers, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, SendBufferReleaseCallback releaseCallback, void *releaseContext, uint32_t forceReceiptNumber=0 );
+
     /// \brief Gets a message from the incoming message queue.
     /// \details Use DeallocatePacket() to deallocate the message after you are done with it.
     /// User-thread functions, such as RPC calls and the plugin function PluginInterface::Update occur here.
@@ -331,10 +354,20 @@ public:
     /// \param[in] milliseconds Gives time in milli seconds for a temporary ban of the IP address.  Use 0 for a permanent ban.
     void AddToBanList( const char *IP, RakNet::TimeMS milliseconds=0 );
 
+    /// \brief Bans every address that starts with the first \a prefixLength bits of \a address.
+    /// \details For example, 10.1.0.0 with a \a prefixLength of 16 bans 10.1.*. Works with IPv6 addresses, and lookups need no string formatting.
+    /// \param[in] address IPv4 or IPv6 address. The port is ignored.
+    /// \param[in] prefixLength Number of leading address bits to match. 32 or more bans only \a address for IPv4, 128 for IPv6.
+    /// \param[in] milliseconds Gives time in milli seconds for a temporary ban of the address prefix.  Use 0 for a permanent ban.
+    void AddToBanList( const SystemAddress &address, unsigned int prefixLength, RakNet::TimeMS milliseconds=0 );
+
     /// \brief Allows a previously banned IP to connect.
     /// param[in] Dotted IP address. You can use * as a wildcard. An IP such as 128.0.0.* will ban all IP addresses starting with 128.0.0.
     void RemoveFromBanList( const char *IP );
 
+    /// \brief Removes a ban added with AddToBanList() with the same \a address and \a prefixLength.
+    void RemoveFromBanList( const SystemAddress &address, unsigned int prefixLength );
+
     /// \brief Allows all previously banned IPs to connect.
     void ClearBanList( void );
 
@@ -343,11 +376,25 @@ public:
     /// \return True if IP matches any IPs in the ban list, accounting for any wildcards. False otherwise.
     bool IsBanned( const char *IP );
 
+    /// \brief Returns true or false indicating if a particular address is banned.
+    /// \details Does not lock or format \a address as a string unless the ban list holds wildcards that are not address prefixes, such as 128.0.1*
+    /// \param[in] address IPv4 or IPv6 address. The port is ignored.
+    /// \return True if \a address matches any banned address prefix or any IPs in the ban list. False otherwise.
+    bool IsBanned( const SystemAddress &address );
+
     /// \brief Enable or disable allowing frequent connections from the same IP adderss
     /// \details This is a security measure which is disabled by default, but can be set to true to prevent attackers from using up all connection slots.
     /// \param[in] b True to limit connections from the same ip to at most 1 per 100 milliseconds.
     void SetLimitIPConnectionFrequency(bool b);
 
+    /// \brief Enable or disable stateless connection cookies. Disabled by default.
+    /// \details When enabled, ID_OPEN_CONNECTION_REPLY_1 carries an HMAC of the client's address and the current CONNECTION_COOKIE_WINDOW_MS time window,
+    /// which the client must echo in ID_OPEN_CONNECTION_REQUEST_2. Requests with a bad or expired cookie are dropped before any connection slot is assigned.
+    /// Has no effect when InitializeSecurity() was called, because secure connections already verify a cookie.
+    /// Clients built with LIBCAT_SECURITY from before this option cannot connect while it is enabled.
+    /// \param[in] b True to require connection cookies
+    void SetConnectionCookies(bool b);
+
     // --------------------------------------------------------------------------------------------Pinging Functions - Functions dealing with the automatic ping mechanism--------------------------------------------------------------------------------------------
     /// Send a ping to the specified connected system.
     /// \pre The sender and recipient must already be started via a successful call to Startup()
@@ -488,6 +535,17 @@ public:
     /// \param[in] allow - True to allow this behavior, false to not allow. Defaults to false. Value persists between connections.
     void AllowConnectionResponseIPMigration( bool allow );
 
+    /// \brief Lets systems connected to us move to a new IP address or port without reconnecting.
+    /// \details Each new connection is sent a random session token. The other system proves it has the token with ID_SESSION_RESUME_REQUEST
+    /// when it hears nothing from us, and if that arrives from a new address the connection is moved there, keeping the messages waiting for an ack.
+    /// You get ID_SESSION_RESUMED when a system moves.
+    /// \param[in] allow True to send session tokens on new connections. Defaults to false. Value persists between connections.
+    void AllowSessionResumption( bool allow );
+
+    /// \brief Sends ID_SESSION_RESUME_REQUEST to a system that gave us a session token, without waiting for the connection to go quiet.
+    /// \param[in] systemIdentifier The system to send the request to. Does nothing if it did not call AllowSessionResumption()
+    void ResumeSession( const AddressOrGUID systemIdentifier );
+
     /// \brief Sends a one byte message ID_ADVERTISE_SYSTEM to the remote unconnected system.
     /// This will send our external IP outside the LAN along with some user data to the remote system.
     /// \pre The sender and recipient must already be started via a successful call to Initialize
@@ -516,6 +574,55 @@ public:
     /// \param[in] timeoutMS How many ms to wait before simply not sending an unreliable message.
     void SetUnreliableTimeout(RakNet::TimeMS timeoutMS);
 
+    /// \brief Turns forward error correction on or off for UNRELIABLE_SEQUENCED messages sent on \a orderingChannel.
+    /// \details Once some datagrams are lost, each group of datagrams carrying these messages is followed by a parity datagram,
+    /// and the remote system rebuilds one lost datagram per group without waiting for a resend. This includes the parts of split messages.
+    /// Groups shrink as loss rises, from FEC_MAX_GROUP_SIZE datagrams down to one. Applies to all current and future connections.
+    /// Off by default. Both systems must run a version that understands parity datagrams.
+    /// \param[in] orderingChannel Ordering channel, less than NUMBER_OF_ORDERED_STREAMS
+    /// \param[in] enabled True to send parity for this channel
+    void SetForwardErrorCorrection(unsigned char orderingChannel, bool enabled);
+
+    /// \brief Chooses how fast to send to a connection.
+    /// \details Each system chooses for what it sends, so the two sides of a connection may differ.
+    /// A connection can be switched at any time. The new algorithm measures the connection again from the start.
+    /// Defaults to CC_SLIDING_WINDOW, or CC_UDT if USE_SLIDING_WINDOW_CONGESTION_CONTROL is 0
+    /// \param[in] algorithm The congestion control to use
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all current and future connections.
+    void SetCongestionControl( CongestionControlAlgorithm algorithm, const SystemAddress target );
+
+    /// \brief Sends small messages together.
+    /// \details Consecutive messages of up to COALESCED_MESSAGE_MAX_SIZE bytes with the same priority, reliability and ordering channel
+    /// are sent as one message, with their lengths in place of a message header each, and returned one at a time by Receive() on the remote system.
+    /// The first message waits at most \a windowUS microseconds for the others, rounded up to the next update of the network thread.
+    /// IMMEDIATE_PRIORITY messages and messages with ack receipts are never held. Off by default. The remote system must run a version that understands coalesced messages.
+    /// \param[in] windowUS Longest time a message waits, in microseconds. 0 to send every message on its own
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all current and future connections.
+    void SetMessageCoalescing( RakNet::TimeUS windowUS, const SystemAddress target );
+
+    /// \brief Compresses the sequenced and ordered messages sent on \a orderingChannel with \a codec.
+    /// \details Each message is sent compressed only if that makes it smaller, and after a few that don't get smaller, compression is tried less often.
+    /// Coalesced messages are compressed together. A codec set for a channel comes before the codec set for the reliability type with SetReliabilityCompression().
+    /// Applies to all current and future connections. Off by default. The remote system must run a version that understands compressed messages,
+    /// have the codec compiled in, and for MC_HUFFMAN have the same dictionary. Otherwise it drops the messages after acknowledging them, and counts them
+    /// in RakNetStatistics::messagesNotDecompressed. See RakNetStatistics::compressionBytesOut for the ratio, and the time it costs
+    /// \param[in] orderingChannel Ordering channel, less than NUMBER_OF_ORDERED_STREAMS
+    /// \param[in] codec How to compress. MC_NONE to use the codec of the reliability type
+    void SetChannelCompression( unsigned char orderingChannel, MessageCompressionCodec codec );
+
+    /// \brief Compresses the messages sent with \a reliability with \a codec, unless their ordering channel has a codec.
+    /// \details The same as SetChannelCompression() otherwise.
+    /// \param[in] reliability Reliability type of the messages
+    /// \param[in] codec How to compress. MC_NONE to send them uncompressed
+    void SetReliabilityCompression( PacketReliability reliability, MessageCompressionCodec codec );
+
+    /// \brief Sets the dictionary MC_HUFFMAN codes sent messages with, and decodes received messages with.
+    /// \details Make it with MessageCompressor::Train() from typical traffic, such as a capture with PacketLogger::SetCompressionTrainer(), and use the same one on every system.
+    /// Messages coded with another dictionary decode to the wrong bytes or not at all, and those that don't decode are dropped.
+    /// \pre Call before Startup()
+    /// \param[in] frequencyTable How often each byte value occurs, as returned by MessageCompressor::GetDictionary()
+    void SetCompressionDictionary( const unsigned int frequencyTable[256] );
+
     /// \brief Send a message to a host, with the IP socket option TTL set to 3.
     /// \details This message will not reach the host, but will open the router.
     /// \param[in] host The address of the remote host in dotted notation.
@@ -583,6 +690,31 @@ public:
     /// RNS2RecvStruct will only remain valid for the duration of the call
     virtual void SetIncomingDatagramEventHandler( bool (*_incomingDatagramEventHandler)(RNS2RecvStruct *) );
 
+    /// Read and write datagrams in batches, with one recvmmsg or sendmmsg system call per batch, rather than one system call per datagram.
+    /// Datagrams sent by the reliability layer during an update cycle are queued and written together at the end of the cycle.
+    /// Only supported on Linux, when CRABNET_SUPPORT_BATCHED_IO is 1 in RakNetDefines.h. Otherwise this has no effect.
+    /// \param[in] enable True to use batched I/O. Defaults to false. Can be called before or after Startup()
+    virtual void SetBatchedDatagramIO( bool enable );
+
+    /// Use UDP generic segmentation offload. Runs of equal size datagrams to the same system, such as the pieces of a large message,
+    /// are written to the kernel as one buffer and split into datagrams by the kernel or network card. Datagrams the kernel coalesced on receipt are read the same way.
+    /// Only applies to datagrams written with batched I/O, so also call SetBatchedDatagramIO(). Receiving works either way.
+    /// Only supported on Linux 4.18 or later, when CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD is 1 in RakNetDefines.h. Otherwise this has no effect.
+    /// If the kernel rejects a coalesced write, that socket goes back to writing one datagram per message.
+    /// \param[in] enable True to use segmentation offload. Defaults to false. Can be called before or after Startup()
+    virtual void SetUDPSegmentationOffload( bool enable );
+
+    /// Split the remote systems into groups by address, and update each group on its own thread.
+    /// Datagrams from connected systems, unicast sends, acks and resends for a remote system are handled by the thread that owns its group.
+    /// Connections, disconnections, broadcasts and the messages returned by Receive() are still handled by the main update thread, which also updates the first group.
+    /// When this is greater than 1, plugins are called from several threads in OnReliabilityLayerNotification(), OnInternalPacket() and OnAck(), so those must be thread safe.
+    /// \pre Call before Startup(). Takes effect on the next call to Startup()
+    /// \param[in] numberOfShards Number of groups, and threads, to update remote systems on. Defaults to 1, which updates every remote system on the main update thread
+    virtual void SetNumberOfUpdateShards( unsigned int numberOfShards );
+
+    /// \return The value passed to SetNumberOfUpdateShards()
+    virtual unsigned int GetNumberOfUpdateShards( void ) const;
+
     // --------------------------------------------------------------------------------------------Network Simulator Functions--------------------------------------------------------------------------------------------
     /// Adds simulated ping and packet loss to the outgoing data flow.
     /// To simulate bi-directional ping and packet loss, you should call this on both the sender and the recipient, with half the total ping and packetloss value on each.
@@ -623,6 +755,18 @@ public:
     /// \param[out] statistics Calculated RakNetStatistics for each connected system
     virtual void GetStatisticsList(DataStructures::List<SystemAddress> &addresses, DataStructures::List<RakNetGUID> &guids, DataStructures::List<RakNetStatistics> &statistics);
 
+    /// \brief Times the phases of the update cycle for each connection, and records histograms of message latency.
+    /// Costs two clock reads per phase while on. Turning it on clears the profile of every connection
+    /// \param[in] enabled true to turn tick profiling on. Off by default
+    virtual void SetTickProfiling( bool enabled );
+    /// \return What was passed to SetTickProfiling()
+    virtual bool GetTickProfiling( void ) const;
+    /// \brief Returns where the update cycle spent its time for one connection, and the latencies of its messages
+    /// \param[in] systemAddress Which connected system to get the profile for, or UNASSIGNED_SYSTEM_ADDRESS for the sum over all connections
+    /// \param[out] profile Written with the running totals since the connection started or tick profiling was turned on
+    /// \return false if tick profiling is off or the system can't be found
+    virtual bool GetTickProfile( const SystemAddress systemAddress, RakNetTickProfile *profile );
+
     /// \Returns how many messages are waiting when you call Receive()
     virtual unsigned int GetReceiveBufferSize(void);
 
@@ -648,8 +792,6 @@ public:
     /// \internal
     bool SendOutOfBand(const char *host, unsigned short remotePort, const char *data, BitSize_t dataLength, unsigned connectionSocketIndex=0 );
 
-    // static Packet *AllocPacket(unsigned dataSize);
-
     /// \internal
     /// \brief Holds the clock differences between systems, along with the ping
     struct PingAndClockDifferential
@@ -681,6 +823,15 @@ public:
         RakNetSocket2* rakNetSocket;
         SystemIndex remoteSystemIndex;
 
+        // See AllowSessionResumption()
+        bool sentSessionToken; /// True if we gave them sessionToken
+        unsigned char sessionToken[SESSION_TOKEN_LENGTH]; /// They prove they have this to move to a new address
+        uint32_t lastSessionResumeSequence; /// Of the last resume request accepted from them, so requests can't be replayed
+        bool hasRemoteSessionToken; /// True if they gave us remoteSessionToken
+        unsigned char remoteSessionToken[SESSION_TOKEN_LENGTH]; /// We prove we have this to move to a new address
+        uint32_t sessionResumeSequence; /// Of the last resume request we sent them
+        RakNet::TimeMS lastSessionResumeRequestTime; /// When we last sent them a resume request
+
 #ifdef LIBCAT_SECURITY
         // Cached answer used internally by RakPeer to prevent DoS attacks based on the connexion handshake
         char answer[cat::EasyHandshake::ANSWER_BYTES];
@@ -699,6 +850,7 @@ public:
 protected:
 
     friend RAK_THREAD_DECLARATION(UpdateNetworkLoop);
+    friend RAK_THREAD_DECLARATION(UpdateShardLoop);
     //friend RAK_THREAD_DECLARATION(RecvFromLoop);
     friend RAK_THREAD_DECLARATION(UDTConnect);
 
@@ -785,6 +937,14 @@ protected:
     RemoteSystemIndex **remoteSystemLookup;
     unsigned int RemoteSystemLookupHashIndex(const SystemAddress &sa) const;
     void ReferenceRemoteSystem(const SystemAddress &sa, unsigned int remoteSystemListIndex);
+    /// Gives \a remoteSystem a new session token, if AllowSessionResumption() is on and it does not have one yet
+    void SendSessionToken(RemoteSystemStruct *remoteSystem);
+    /// Asks \a remoteSystem to send to the address we now send from
+    void SendSessionResumeRequest(RemoteSystemStruct *remoteSystem, RakNet::TimeMS timeMS);
+    /// Moves the connection of the system that sent \a data to \a systemAddress, if it proves it has our session token
+    void OnSessionResumeRequest(const SystemAddress &systemAddress, const char *data, unsigned int length, RakNetSocket2 *rakNetSocket);
+    /// HMAC of \a guid and \a sequence, keyed with \a sessionToken
+    static void GenerateSessionResumeProof(const unsigned char *sessionToken, RakNetGUID guid, uint32_t sequence, unsigned char proof[SHA1_LENGTH]);
     void DereferenceRemoteSystem(const SystemAddress &sa);
     RemoteSystemStruct* GetRemoteSystem(const SystemAddress &sa) const;
     unsigned int GetRemoteSystemIndex(const SystemAddress &sa) const;
@@ -794,6 +954,18 @@ protected:
     void AddToActiveSystemList(unsigned int remoteSystemListIndex);
     void RemoveFromActiveSystemList(const SystemAddress &sa);
 
+    /// When each remote system next needs ReliabilityLayer::Update() or a connection check, by index into remoteSystemList
+    /// Only the systems that are due are visited each update cycle. Not used with update shards, which visit every system
+    DataStructures::TimerWheel remoteSystemUpdateTimers;
+    /// Indices into remoteSystemList visited this update cycle. Preallocated to be the same size as remoteSystemList
+    unsigned int *remoteSystemsToUpdate;
+    /// Visit \a remoteSystem no later than \a time. Pass the current time when it has something new to send or has received data
+    void ScheduleRemoteSystemUpdate(RemoteSystemStruct *remoteSystem, RakNet::TimeUS time);
+    /// How long until \a remoteSystem next has anything to do, after it was visited
+    RakNet::TimeUS GetTimeUntilRemoteSystemUpdate(RemoteSystemStruct *remoteSystem, RakNet::TimeUS timeNS);
+    /// How long the update thread can sleep before the next remote system is due, up to UPDATE_THREAD_MAX_SLEEP_MS
+    int GetUpdateThreadSleepTime(void) const;
+
 //    unsigned int LookupIndexUsingHashIndex(const SystemAddress &sa) const;
 //    unsigned int RemoteSystemListIndexUsingHashIndex(const SystemAddress &sa) const;
 //    unsigned int FirstFreeRemoteSystemLookupIndex(const SystemAddress &sa) const;
@@ -858,7 +1030,14 @@ protected:
 #endif
 
     //DataStructures::List<DataStructures::List<MemoryBlock>* > automaticVariableSynchronizationList;
+    /// Wildcard bans that are not address prefixes, such as 128.0.1*, matched against the address string
     DataStructures::List<BanStruct*> banList;
+    /// Banned address prefixes, including dotted IPs and trailing wildcards passed to AddToBanList. Written with banListMutex locked
+    DataStructures::BanTable banTable;
+    /// When RunUpdateCycle next removes expired bans from banTable
+    RakNet::TimeMS nextBanTablePruneTime;
+    /// Matches the string form of an address against banList
+    bool IsBannedByPattern(const char *IP);
     // Threadsafe, and not thread safe
     DataStructures::List<PluginInterface2*> pluginListTS, pluginListNTS;
 
@@ -879,6 +1058,7 @@ protected:
         NetworkID networkID;
         bool blockingCommand; // Only used for RPC
         char *data;
+        InternalPacketSharedData *sharedData; // The buffers of SendGather(), in which case data is 0
         bool haveRakNetCloseSocket;
         unsigned connectionSocketIndex;
         unsigned short remotePortRakNetWasStartedOn_PS3;
@@ -886,7 +1066,12 @@ protected:
         RakNetSocket2* socket;
         unsigned short port;
         uint32_t receipt;
-        enum {BCS_SEND, BCS_CLOSE_CONNECTION, BCS_GET_SOCKET, BCS_CHANGE_SYSTEM_ADDRESS,/* BCS_USE_USER_SOCKET, BCS_REBIND_SOCKET_ADDRESS, BCS_RPC, BCS_RPC_SHIFT,*/ BCS_DO_NOTHING} command;
+        RakNet::TimeUS queueTime; // When Send() was called, if tick profiling is on
+        CongestionControlAlgorithm congestionControl;
+        RakNet::TimeUS coalescingWindow;
+        MessageCompressionCodec compressionCodec; // With orderingChannel or reliability
+        bool tickProfiling;
+        enum {BCS_SEND, BCS_CLOSE_CONNECTION, BCS_GET_SOCKET, BCS_CHANGE_SYSTEM_ADDRESS, BCS_SET_CONGESTION_CONTROL, BCS_SET_MESSAGE_COALESCING, BCS_SET_CHANNEL_COMPRESSION, BCS_SET_RELIABILITY_COMPRESSION, BCS_SET_TICK_PROFILING, BCS_RESUME_SESSION,/* BCS_USE_USER_SOCKET, BCS_REBIND_SOCKET_ADDRESS, BCS_RPC, BCS_RPC_SHIFT,*/ BCS_DO_NOTHING} command;
     };
 
     // Single producer single consumer queue using a linked list
@@ -897,16 +1082,54 @@ protected:
 
     // DataStructures::ThreadsafeAllocatingQueue<RNS2RecvStruct> bufferedPackets;
 
-    DataStructures::Queue<RNS2RecvStruct*> bufferedPacketsFreePool;
-    RakNet::SimpleMutex bufferedPacketsFreePoolMutex;
-    DataStructures::Queue<RNS2RecvStruct*> bufferedPacketsQueue;
-    RakNet::SimpleMutex bufferedPacketsQueueMutex;
+    // Passes datagrams from the recvfrom threads to the update thread, and back for reuse, without locks
+    DataStructures::LocklessQueue<RNS2RecvStruct*> bufferedPacketsFreePool;
+    DataStructures::LocklessQueue<RNS2RecvStruct*> bufferedPacketsQueue;
+    // Only used when bufferedPacketsQueue is full
+    DataStructures::Queue<RNS2RecvStruct*> bufferedPacketsOverflowQueue;
+    RakNet::SimpleMutex bufferedPacketsOverflowQueueMutex;
+    std::atomic<unsigned int> bufferedPacketsOverflowQueueSize;
 
     virtual void DeallocRNS2RecvStruct(RNS2RecvStruct *s);
     virtual RNS2RecvStruct *AllocRNS2RecvStruct();
     void SetupBufferedPackets(void);
     void PushBufferedPacket(RNS2RecvStruct * p);
     RNS2RecvStruct *PopBufferedPacket(void);
+    unsigned int PopBufferedPackets(RNS2RecvStruct **output, unsigned int maxPackets);
+
+    /// A group of remote systems updated by its own thread, see SetNumberOfUpdateShards()
+    /// Remote systems belong to the shard given by GetUpdateShardIndex() for their systemAddress
+    struct UpdateShard
+    {
+        RakPeer *rakPeer;
+        unsigned int shardIndex;
+        // Datagrams from connected systems, routed by source address in OnRNS2Recv()
+        DataStructures::LocklessQueue<RNS2RecvStruct*> bufferedPacketsQueue;
+        // Unicast sends to systems in this shard, in the order the main update thread read them from bufferedCommands
+        DataStructures::List<BufferedCommandStruct*> bufferedCommands;
+        // Incremented by the main update thread to start a cycle
+        std::atomic<unsigned int> updateCycle;
+        std::atomic<bool> isThreadActive;
+        SignaledEvent updateEvent;
+    };
+
+    // Empty unless numberOfUpdateShards is greater than 1. Shard 0 is updated by the main update thread
+    DataStructures::List<UpdateShard*> updateShards;
+    unsigned int numberOfUpdateShards;
+    std::atomic<bool> endUpdateShardThreads;
+    std::atomic<unsigned int> updateShardsRunning;
+    // Set by the shard thread that finishes last, so RunUpdateShards() can stop waiting
+    SignaledEvent updateShardsDoneEvent;
+    RakNet::TimeUS updateShardsTime;
+
+    bool StartUpdateShards(int threadPriority);
+    void StopUpdateShards(void);
+    unsigned int GetUpdateShardIndex(const SystemAddress &sa) const;
+    bool PushBufferedCommandToUpdateShard(BufferedCommandStruct *bcs);
+    void SendBufferedCommand(BufferedCommandStruct *bcs, RakNet::TimeUS timeNS);
+    void FlushUpdateShardCommands(RakNet::TimeUS timeNS);
+    void RunUpdateShards(RakNet::TimeUS timeNS, BitStream &updateBitStream);
+    void UpdateShardCycle(UpdateShard *shard, RakNet::TimeUS timeNS, BitStream &updateBitStream);
 
     struct SocketQueryOutput
     {
@@ -925,7 +1148,7 @@ protected:
     void CloseConnectionInternal( const AddressOrGUID& systemIdentifier, bool sendDisconnectionNotification, bool performImmediate, unsigned char orderingChannel, PacketPriority disconnectionNotificationPriority );
     void SendBuffered( const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, RemoteSystemStruct::ConnectMode connectionMode, uint32_t receipt );
     void SendBufferedList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, RemoteSystemStruct::ConnectMode connectionMode, uint32_t receipt );
-    bool SendImmediate( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, bool useCallerDataAllocation, RakNet::TimeUS currentTime, uint32_t receipt );
+    bool SendImmediate( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, bool useCallerDataAllocation, RakNet::TimeUS currentTime, uint32_t receipt, RakNet::TimeUS queueTime=0, InternalPacketSharedData *gatherData=0 );
     //bool HandleBufferedRPC(BufferedCommandStruct *bcs, RakNet::TimeMS time);
     void ClearBufferedCommands(void);
     void ClearBufferedPackets(void);
@@ -964,12 +1187,26 @@ protected:
     //unsigned int lastUserUpdateCycle;
     /// True to allow connection accepted packets from anyone.  False to only allow these packets from servers we requested a connection to.
     bool allowConnectionResponseIPMigration;
+    /// True to give new connections a session token, so they can move to a new address
+    bool allowSessionResumption;
 
     SystemAddress firstExternalID;
     int splitMessageProgressInterval;
     RakNet::TimeMS unreliableTimeout;
+    // Bit n is set if forward error correction is on for ordering channel n
+    uint32_t forwardErrorCorrectionChannels;
+    // For new connections
+    CongestionControlAlgorithm defaultCongestionControl;
+    RakNet::TimeUS defaultCoalescingWindow;
+    MessageCompressionCodec channelCompression[NUMBER_OF_ORDERED_STREAMS];
+    MessageCompressionCodec reliabilityCompression[NUMBER_OF_RELIABILITIES];
+    // Shared by the reliability layers of all connections
+    MessageCompressor messageCompressor;
+    bool tickProfiling;
 
     bool (*incomingDatagramEventHandler)(RNS2RecvStruct *);
+    bool batchedDatagramIO;
+    bool udpSegmentationOffload;
 
     // Systems in this list will not go through the secure connection process, even when secure connections are turned on. Wildcards are accepted.
     DataStructures::List<RakNet::RakString> securityExceptionList;
@@ -985,8 +1222,13 @@ protected:
     SignaledEvent quitAndDataEvents;
     bool limitConnectionFrequencyFromTheSameIP;
 
-    SimpleMutex packetAllocationPoolMutex;
-    DataStructures::MemoryPool<Packet> packetAllocationPool;
+    bool useConnectionCookies;
+    /// Key of the connection cookie HMAC. Random per instance, so cookies cannot be computed by anyone else
+    unsigned char connectionCookieSecret[CONNECTION_COOKIE_SECRET_LENGTH];
+    /// HMAC of the address and port of \a systemAddress and \a window, truncated to 32 bits
+    uint32_t GenerateConnectionCookie(const SystemAddress &systemAddress, uint32_t window);
+    /// True if \a cookie was generated for \a systemAddress in the current or previous time window
+    bool VerifyConnectionCookie(const SystemAddress &systemAddress, uint32_t cookie);
 
     SimpleMutex packetReturnMutex;
     DataStructures::Queue<Packet*> packetReturnQueue;
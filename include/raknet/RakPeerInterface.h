@@ -32,6 +32,7 @@ class BitStream;
 class PluginInterface2;
 struct RPCMap;
 struct RakNetStatistics;
+struct RakNetTickProfile;
 struct RakNetBandwidth;
 class RouterInterface;
 class NetworkIDManager;
@@ -238,6 +239,25 @@ public:
     /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
     virtual uint32_t SendList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, uint32_t forceReceiptNumber=0 )=0;
 
+    /// Sends a message made of several buffers, such as a header and blocks kept elsewhere, without first copying them into one as SendList() does.
+    /// The buffers are copied only when the message is written into datagrams, so they must not change until \a releaseCallback is called.
+    /// That is once no system needs them, which for a reliable message is when every split packet of it has been acknowledged.
+    /// It is called exactly once, from the thread that updates the connection, from Shutdown(), or from SendGather() itself if the message is not queued.
+    /// Messages that are coalesced or compressed, or are sent while a plugin such as PacketLogger sees each InternalPacket, are gathered into one block first
+    /// This function only works while connected
+    /// \param[in] buffers The message, one buffer after another. Only the array is copied, so it may be on the stack
+    /// \param[in] numberOfBuffers The number of elements in \a buffers
+    /// \param[in] priority What priority level to send on.  See PacketPriority.h
+    /// \param[in] reliability How reliability to send this data.  See PacketPriority.h
+    /// \param[in] orderingChannel When using ordered or sequenced messages, what channel to order these on. Messages are only ordered relative to other messages on the same stream
+    /// \param[in] systemIdentifier Who to send this packet to, or in the case of broadcasting who not to send it to. Pass either a SystemAddress structure or a RakNetGUID structure. Use UNASSIGNED_SYSTEM_ADDRESS or to specify none
+    /// \param[in] broadcast True to send this packet to all connected systems. If true, then systemAddress specifies who not to send the packet to.
+    /// \param[in] releaseCallback Called with \a releaseContext when the buffers are no longer needed. May be 0
+    /// \param[in] releaseContext Passed to \a releaseCallback
+    /// \param[in] forceReceipt If 0, will automatically determine the receipt number to return. If non-zero, will return what you give it.
+    /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
+    virtual uint32_t SendGather( const SendBuffer *buffers, const int numberOfBuffers, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, SendBufferReleaseCallback releaseCallback, void *releaseContext, uint32_t forceReceiptNumber=0 )=0;
+
     /// Gets a message from the incoming message queue.
     /// Use DeallocatePacket() to deallocate the message after you are done with it.
     /// User-thread functions, such as RPC calls and the plugin function PluginInterface::Update occur here.
@@ -299,10 +319,19 @@ public:
     /// \param[in] milliseconds how many ms for a temporary ban.  Use 0 for a permanent ban
     virtual void AddToBanList( const char *IP, RakNet::TimeMS milliseconds=0 )=0;
 
+    /// Bans every address that starts with the first \a prefixLength bits of \a address, such as 10.1.0.0 with 16 for 10.1.*
+    /// \param[in] address IPv4 or IPv6 address. The port is ignored
+    /// \param[in] prefixLength Number of leading address bits to match. 32 or more bans only \a address for IPv4, 128 for IPv6
+    /// \param[in] milliseconds how many ms for a temporary ban.  Use 0 for a permanent ban
+    virtual void AddToBanList( const SystemAddress &address, unsigned int prefixLength, RakNet::TimeMS milliseconds=0 )=0;
+
     /// Allows a previously banned IP to connect.
     /// param[in] Dotted IP address. Can use * as a wildcard, such as 128.0.0.* will banAll IP addresses starting with 128.0.0
     virtual void RemoveFromBanList( const char *IP )=0;
 
+    /// Removes a ban added with AddToBanList() with the same \a address and \a prefixLength
+    virtual void RemoveFromBanList( const SystemAddress &address, unsigned int prefixLength )=0;
+
     /// Allows all previously banned IPs to connect.
     virtual void ClearBanList( void )=0;
 
@@ -311,11 +340,23 @@ public:
     /// \return true if IP matches any IPs in the ban list, accounting for any wildcards. False otherwise.
     virtual bool IsBanned( const char *IP )=0;
 
+    /// Returns true or false indicating if a particular address is banned, without formatting it as a string
+    /// \param[in] address IPv4 or IPv6 address. The port is ignored
+    /// \return true if \a address matches any banned address prefix or any IPs in the ban list. False otherwise.
+    virtual bool IsBanned( const SystemAddress &address )=0;
+
     /// Enable or disable allowing frequent connections from the same IP adderss
     /// This is a security measure which is disabled by default, but can be set to true to prevent attackers from using up all connection slots
     /// \param[in] b True to limit connections from the same ip to at most 1 per 100 milliseconds.
     virtual void SetLimitIPConnectionFrequency(bool b)=0;
 
+    /// Enable or disable stateless connection cookies. Disabled by default
+    /// When enabled, ID_OPEN_CONNECTION_REPLY_1 carries a cookie keyed on the client's address and the time, which the client must echo in ID_OPEN_CONNECTION_REQUEST_2.
+    /// Requests with a bad or expired cookie are dropped before any connection slot is assigned, so floods from spoofed addresses cannot use up slots or update thread time.
+    /// Has no effect when InitializeSecurity() was called, because secure connections already verify a cookie.
+    /// \param[in] b True to require connection cookies
+    virtual void SetConnectionCookies(bool b)=0;
+
     // --------------------------------------------------------------------------------------------Pinging Functions - Functions dealing with the automatic ping mechanism--------------------------------------------------------------------------------------------
     /// Send a ping to the specified connected system.
     /// \pre The sender and recipient must already be started via a successful call to Startup()
@@ -455,6 +496,19 @@ public:
     /// \param[in] allow - True to allow this behavior, false to not allow. Defaults to false. Value persists between connections
     virtual void AllowConnectionResponseIPMigration( bool allow )=0;
 
+    /// Lets systems connected to us move to a new IP address or port without reconnecting, such as a phone going from Wi-Fi to a mobile network, or a NAT giving it a new port.
+    /// Each new connection is sent a random session token. When the other system hears nothing from us for SESSION_RESUME_SILENCE_MS while its messages wait for an ack, it proves it has the token with ID_SESSION_RESUME_REQUEST.
+    /// If that arrives from a new address, the connection is moved there. Messages that were not acked are resent to the new address right away, so nothing is lost and the ordering channels carry on.
+    /// You get ID_SESSION_RESUMED when a system moves. Only the system being moved to needs this. The one that moves must bind to the any address, so it can send on the new network.
+    /// \note The token is sent in the clear unless InitializeSecurity() was called, so anyone who can read the traffic can move the connection
+    /// \param[in] allow True to send session tokens on new connections. Defaults to false. Value persists between connections
+    virtual void AllowSessionResumption( bool allow )=0;
+
+    /// Sends ID_SESSION_RESUME_REQUEST to a system that gave us a session token, without waiting for the connection to go quiet.
+    /// Call it when the platform tells you the network changed, to shorten the time nothing arrives.
+    /// \param[in] systemIdentifier The system to send the request to. Does nothing if it did not call AllowSessionResumption()
+    virtual void ResumeSession( const AddressOrGUID systemIdentifier )=0;
+
     /// Sends a one byte message ID_ADVERTISE_SYSTEM to the remote unconnected system.
     /// This will tell the remote system our external IP outside the LAN along with some user data.
     /// \pre The sender and recipient must already be started via a successful call to Initialize
@@ -483,6 +537,52 @@ public:
     /// \param[in] timeoutMS How many ms to wait before simply not sending an unreliable message.
     virtual void SetUnreliableTimeout(RakNet::TimeMS timeoutMS)=0;
 
+    /// Turns forward error correction on or off for UNRELIABLE_SEQUENCED messages sent on \a orderingChannel
+    /// Once some datagrams are lost, each group of datagrams carrying these messages is followed by a parity datagram,
+    /// and the remote system rebuilds one lost datagram per group without waiting for a resend. This includes the parts of split messages.
+    /// Groups shrink as loss rises, from FEC_MAX_GROUP_SIZE datagrams down to one. Applies to all current and future connections.
+    /// Off by default. Both systems must run a version that understands parity datagrams.
+    /// \param[in] orderingChannel Ordering channel, less than NUMBER_OF_ORDERED_STREAMS
+    /// \param[in] enabled True to send parity for this channel
+    virtual void SetForwardErrorCorrection(unsigned char orderingChannel, bool enabled)=0;
+
+    /// Chooses how fast to send to a connection. Each system chooses for what it sends, so the two sides of a connection may differ.
+    /// A connection can be switched at any time. The new algorithm measures the connection again from the start.
+    /// Defaults to CC_SLIDING_WINDOW, or CC_UDT if USE_SLIDING_WINDOW_CONGESTION_CONTROL is 0
+    /// \param[in] algorithm The congestion control to use
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all current and future connections.
+    virtual void SetCongestionControl( CongestionControlAlgorithm algorithm, const SystemAddress target )=0;
+
+    /// Sends small messages together. Consecutive messages of up to COALESCED_MESSAGE_MAX_SIZE bytes with the same priority, reliability and ordering channel
+    /// are sent as one message, with their lengths in place of a message header each, and returned one at a time by Receive() on the remote system.
+    /// The first message waits at most \a windowUS microseconds for the others, rounded up to the next update of the network thread.
+    /// IMMEDIATE_PRIORITY messages and messages with ack receipts are never held. Off by default. The remote system must run a version that understands coalesced messages.
+    /// \param[in] windowUS Longest time a message waits, in microseconds. 0 to send every message on its own
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all current and future connections.
+    virtual void SetMessageCoalescing( RakNet::TimeUS windowUS, const SystemAddress target )=0;
+
+    /// Compresses the sequenced and ordered messages sent on \a orderingChannel with \a codec.
+    /// Each message is sent compressed only if that makes it smaller, and after a few that don't get smaller, compression is tried less often.
+    /// Coalesced messages are compressed together. A codec set for a channel comes before the codec set for the reliability type with SetReliabilityCompression().
+    /// Applies to all current and future connections. Off by default. The remote system must run a version that understands compressed messages,
+    /// have the codec compiled in, and for MC_HUFFMAN have the same dictionary. Otherwise it drops the messages after acknowledging them, and counts them
+    /// in RakNetStatistics::messagesNotDecompressed. See RakNetStatistics::compressionBytesOut for the ratio, and the time it costs
+    /// \param[in] orderingChannel Ordering channel, less than NUMBER_OF_ORDERED_STREAMS
+    /// \param[in] codec How to compress. MC_NONE to use the codec of the reliability type
+    virtual void SetChannelCompression( unsigned char orderingChannel, MessageCompressionCodec codec )=0;
+
+    /// Compresses the messages sent with \a reliability with \a codec, unless their ordering channel has a codec. The same as SetChannelCompression() otherwise.
+    /// \param[in] reliability Reliability type of the messages
+    /// \param[in] codec How to compress. MC_NONE to send them uncompressed
+    virtual void SetReliabilityCompression( PacketReliability reliability, MessageCompressionCodec codec )=0;
+
+    /// Sets the dictionary MC_HUFFMAN codes sent messages with, and decodes received messages with.
+    /// Make it with MessageCompressor::Train() from typical traffic, such as a capture with PacketLogger::SetCompressionTrainer(), and use the same one on every system.
+    /// Messages coded with another dictionary decode to the wrong bytes or not at all, and those that don't decode are dropped.
+    /// \pre Call before Startup()
+    /// \param[in] frequencyTable How often each byte value occurs, as returned by MessageCompressor::GetDictionary()
+    virtual void SetCompressionDictionary( const unsigned int frequencyTable[256] )=0;
+
     /// Send a message to host, with the IP socket option TTL set to 3
     /// This message will not reach the host, but will open the router.
     /// Used for NAT-Punchthrough
@@ -547,6 +647,31 @@ public:
     /// For RakNet connected systems, the first bit is always 1. So for your own game packets, make sure the first bit is always 0.
     virtual void SetIncomingDatagramEventHandler( bool (*_incomingDatagramEventHandler)(RNS2RecvStruct *) )=0;
 
+    /// Read and write datagrams in batches, with one recvmmsg or sendmmsg system call per batch, rather than one system call per datagram.
+    /// Datagrams sent by the reliability layer during an update cycle are queued and written together at the end of the cycle.
+    /// Only supported on Linux, when CRABNET_SUPPORT_BATCHED_IO is 1 in RakNetDefines.h. Otherwise this has no effect.
+    /// \param[in] enable True to use batched I/O. Defaults to false. Can be called before or after Startup()
+    virtual void SetBatchedDatagramIO( bool enable )=0;
+
+    /// Use UDP generic segmentation offload. Runs of equal size datagrams to the same system, such as the pieces of a large message,
+    /// are written to the kernel as one buffer and split into datagrams by the kernel or network card. Datagrams the kernel coalesced on receipt are read the same way.
+    /// Only applies to datagrams written with batched I/O, so also call SetBatchedDatagramIO(). Receiving works either way.
+    /// Only supported on Linux 4.18 or later, when CRABNET_SUPPORT_UDP_SEGMENTATION_OFFLOAD is 1 in RakNetDefines.h. Otherwise this has no effect.
+    /// If the kernel rejects a coalesced write, that socket goes back to writing one datagram per message.
+    /// \param[in] enable True to use segmentation offload. Defaults to false. Can be called before or after Startup()
+    virtual void SetUDPSegmentationOffload( bool enable )=0;
+
+    /// Split the remote systems into groups by address, and update each group on its own thread.
+    /// Datagrams from connected systems, unicast sends, acks and resends for a remote system are handled by the thread that owns its group.
+    /// Connections, disconnections, broadcasts and the messages returned by Receive() are still handled by the main update thread, which also updates the first group.
+    /// When this is greater than 1, plugins are called from several threads in OnReliabilityLayerNotification(), OnInternalPacket() and OnAck(), so those must be thread safe.
+    /// \pre Call before Startup(). Takes effect on the next call to Startup()
+    /// \param[in] numberOfShards Number of groups, and threads, to update remote systems on. Defaults to 1, which updates every remote system on the main update thread
+    virtual void SetNumberOfUpdateShards( unsigned int numberOfShards )=0;
+
+    /// \return The value passed to SetNumberOfUpdateShards()
+    virtual unsigned int GetNumberOfUpdateShards( void ) const=0;
+
     // --------------------------------------------------------------------------------------------Network Simulator Functions--------------------------------------------------------------------------------------------
     /// Adds simulated ping and packet loss to the outgoing data flow.
     /// To simulate bi-directional ping and packet loss, you should call this on both the sender and the recipient, with half the total ping and packetloss value on each.
@@ -587,6 +712,20 @@ public:
     /// \param[out] statistics Calculated RakNetStatistics for each connected system
     virtual void GetStatisticsList(DataStructures::List<SystemAddress> &addresses, DataStructures::List<RakNetGUID> &guids, DataStructures::List<RakNetStatistics> &statistics)=0;
 
+    /// \brief Times the phases of the update cycle for each connection, and records histograms of message latency.
+    /// Costs two clock reads per phase while on. Turning it on clears the profile of every connection
+    /// \param[in] enabled true to turn tick profiling on. Off by default
+    /// \sa GetTickProfile()
+    virtual void SetTickProfiling( bool enabled )=0;
+    /// \return What was passed to SetTickProfiling()
+    virtual bool GetTickProfiling( void ) const=0;
+    /// \brief Returns where the update cycle spent its time for one connection, and the latencies of its messages
+    /// You can map this data to a string using the C style TickProfileToString() function
+    /// \param[in] systemAddress Which connected system to get the profile for, or UNASSIGNED_SYSTEM_ADDRESS for the sum over all connections
+    /// \param[out] profile Written with the running totals since the connection started or tick profiling was turned on
+    /// \return false if tick profiling is off or the system can't be found
+    virtual bool GetTickProfile( const SystemAddress systemAddress, RakNetTickProfile *profile )=0;
+
     /// \Returns how many messages are waiting when you call Receive()
     virtual unsigned int GetReceiveBufferSize(void)=0;
 
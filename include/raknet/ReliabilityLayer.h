@@ -23,6 +23,7 @@
 #include "SocketLayer.h"
 #include "PacketPriority.h"
 #include "DS_Queue.h"
+#include "DS_RingBuffer.h"
 #include "BitStream.h"
 #include "InternalPacket.h"
 #include "RakNetStatistics.h"
@@ -41,13 +42,9 @@
 #include "RakNetSocket2.h"
 #include "SplitPacketList.h"
 
-#if USE_SLIDING_WINDOW_CONGESTION_CONTROL!=1
-#include "CCRakNetUDT.h"
-#define INCLUDE_TIMESTAMP_WITH_DATAGRAMS 1
-#else
-#include "CCRakNetSlidingWindow.h"
+#include "CCRakNetInterface.h"
+// Part of the datagram header, so it cannot depend on the congestion control of the connection
 #define INCLUDE_TIMESTAMP_WITH_DATAGRAMS 0
-#endif
 
 /// Number of ordered streams available. You can use up to 32 ordered streams
 #define NUMBER_OF_ORDERED_STREAMS 32 // 2^5
@@ -59,6 +56,8 @@ namespace RakNet {
     /// Forward declarations
 class PluginInterface2;
 class RakNetRandom;
+class TickPhaseScope;
+class MessageCompressor;
 typedef uint64_t reliabilityHeapWeightType;
 
 // int SplitPacketIndexComp( SplitPacketIndexType const &key, InternalPacket* const &data );
@@ -68,15 +67,16 @@ struct SplitPacketChannel//<SplitPacketChannel>
 
     SplitPacketList splitPacketList;
 
-#if PREALLOCATE_LARGE_MESSAGES==1
-    InternalPacket *returnedPacket;
-    bool gotFirstPacket;
-    unsigned int stride;
-    unsigned int splitPacketsArrived;
-#else
     // This is here for progress notifications, since progress notifications return the first packet data, if available
     InternalPacket *firstPacket;
-#endif
+
+    // Only used if splitPacketList.streamed()
+    // The whole message, allocated when the first split packet that is not the last arrives
+    InternalPacket *streamedPacket;
+    // Bytes in each split packet but the last
+    unsigned int stride;
+    // The last split packet, if it arrived before the stride was known
+    InternalPacket *lastSplitPacket;
 
 };
 int RAK_DLL_EXPORT SplitPacketChannelComp( SplitPacketIdType const &key, SplitPacketChannel* const &data );
@@ -145,16 +145,18 @@ public:
     /// \param[in] systemAddress The player that this data is from
     /// \param[in] messageHandlerList A list of registered plugins
     /// \param[in] MTUSize maximum datagram size
+    /// \param[in] isRecoveredDatagram True for a datagram rebuilt from forward error correction parity, which is already decrypted and counted
     /// \retval true Success
     /// \retval false Modified packet
     bool HandleSocketReceiveFromConnectedPlayer(
         const char *buffer, unsigned int length, SystemAddress &systemAddress, DataStructures::List<PluginInterface2*> &messageHandlerList, int MTUSize,
-        RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead, BitStream &updateBitStream);
+        RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead, BitStream &updateBitStream, bool isRecoveredDatagram=false);
 
     /// This allocates bytes and writes a user-level message to those bytes.
     /// \param[out] data The message
+    /// \param[out] timeRead If not 0, set to when the datagram completing the message arrived, in microseconds
     /// \return Returns number of BITS put into the buffer
-    BitSize_t Receive( unsigned char**data );
+    BitSize_t Receive( unsigned char**data, RakNet::TimeUS *timeRead = 0 );
 
     /// Puts data on the send queue
     /// \param[in] data The data to send
@@ -166,8 +168,29 @@ public:
     /// \param[in] MTUSize maximum datagram size
     /// \param[in] currentTime Current time, as per RakNet::GetTimeMS()
     /// \param[in] receipt This number will be returned back with ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS and is only returned with the reliability types that contain RECEIPT in the name
+    /// \param[in] sharedData If not 0, \a data is sharedData->sharedDataBlock, and a reference to it is stored instead of a copy. Messages that are split, or small enough to be stored in the InternalPacket, still use \a makeDataCopy
+    /// If sharedData has buffers, \a data is 0, and they are referenced until written to datagrams, split or not. Messages that are coalesced or compressed are gathered into one block first
+    /// \param[in] queueTime When the user queued the message, in microseconds. If not 0 and tick profiling is on, the time until it is first sent is recorded
     /// \return True or false for success or failure.
-    bool Send( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, unsigned char orderingChannel, bool makeDataCopy, int MTUSize, CCTimeType currentTime, uint32_t receipt );
+    bool Send( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, unsigned char orderingChannel, bool makeDataCopy, int MTUSize, CCTimeType currentTime, uint32_t receipt, InternalPacketSharedData *sharedData = 0, RakNet::TimeUS queueTime = 0 );
+
+    /// Holds one message for Send() to any number of reliability layers, so it is not copied for each
+    /// \param[in] data The message
+    /// \param[in] numberOfBytes The length of \a data
+    /// \param[in] makeDataCopy If true \a data will be copied. Otherwise \a data must have been allocated with malloc, and will be freed with the last reference
+    /// \return The caller holds one reference, to be released with ReleaseSharedData()
+    static InternalPacketSharedData *AllocateSharedData( char *data, unsigned int numberOfBytes, bool makeDataCopy );
+
+    /// Holds the buffers of one message for Send(), which are copied only into the datagrams it is written to
+    /// \param[in] buffers The message, one buffer after another. The array is copied, but not what it points to
+    /// \param[in] bufferCount The number of elements in \a buffers
+    /// \param[in] releaseCallback If not 0, called with \a releaseContext when the last reference is released
+    /// \return The caller holds one reference, to be released with ReleaseSharedData()
+    static InternalPacketSharedData *AllocateGatherData( const SendBuffer *buffers, unsigned int bufferCount, SendBufferReleaseCallback releaseCallback, void *releaseContext );
+    static void ReleaseSharedData( InternalPacketSharedData *sharedData );
+
+    /// Copies \a numberOfBytes of the message in the buffers of \a sharedData, starting \a offset bytes in, to \a output
+    static void GatherSharedData( const InternalPacketSharedData *sharedData, unsigned int offset, unsigned int numberOfBytes, unsigned char *output );
 
     /// Call once per game cycle.  Handles internal lists and actually does the send.
     /// \param[in] s the communication  end point
@@ -181,6 +204,12 @@ public:
         DataStructures::List<PluginInterface2*> &messageHandlerList,
         RakNetRandom *rnr, BitStream &updateBitStream);
 
+    /// How long until Update() next has something to do, such as a resend, sending buffered acks or checking for a dead connection
+    /// \param[in] time current system time
+    /// \param[in] maxTime returned if nothing is due sooner
+    /// \return 0 if Update() should be called right away
+    RakNet::TimeUS GetTimeUntilNextUpdate( RakNet::TimeUS time, RakNet::TimeUS maxTime ) const;
+
     /// Were you ever unable to deliver a packet despite retries?
     /// \return true means the connection has been lost.  Otherwise not.
     bool IsDeadConnection( void ) const;
@@ -192,9 +221,25 @@ public:
     /// \return A pointer to a static struct, filled out with current statistical information.
     RakNetStatistics * GetStatistics( RakNetStatistics *rns );
 
+    /// Turns timing of the phases in RakNetTickProfile on or off. Off by default
+    void SetTickProfiling( bool enabled );
+    bool GetTickProfiling( void ) const {return tickProfiling;}
+
+    /// Running totals since the connection started or tick profiling was turned on
+    const RakNetTickProfile &GetTickProfile( void ) const {return tickProfile;}
+
+    /// Adds one latency to the histogram of \a metric, if tick profiling is on
+    void RecordLatency( RNSLatencyMetric metric, RakNet::TimeUS latencyUS );
+
     ///Are we waiting for any data to be sent out or be processed by the player?
     bool IsOutgoingDataWaiting(void);
     bool AreAcksWaiting(void);
+    /// True if no reliable message we sent waits for an ack
+    bool IsResendQueueEmpty(void) const;
+
+    /// The remote system now sends from, and is sent to at, a new address. What was learned about the old path no longer holds,
+    /// so congestion control starts over on its estimates, and every message waiting for an ack is resent right away
+    void OnAddressChanged(CCTimeType time);
 
     // Set outgoing lag and packet loss properties
     void ApplyNetworkSimulator( double _maxSendBPS, RakNet::TimeMS _minExtraPing, RakNet::TimeMS _extraPingVariance );
@@ -205,6 +250,20 @@ public:
 
     void SetSplitMessageProgressInterval(int interval);
     void SetUnreliableTimeout(RakNet::TimeMS timeoutMS);
+    /// Bit n of \a channelMask turns forward error correction on for UNRELIABLE_SEQUENCED messages on ordering channel n
+    void SetForwardErrorCorrectionChannels(uint32_t channelMask);
+    /// Replaces the congestion control. The connection carries on, with the new algorithm starting over on its estimates
+    void SetCongestionControl(CongestionControlAlgorithm algorithm);
+    CongestionControlAlgorithm GetCongestionControl(void) const {return congestionControlAlgorithm;}
+    /// Holds sends of up to COALESCED_MESSAGE_MAX_SIZE bytes for up to \a windowUS microseconds, so the ones after them with the same
+    /// priority, reliability and ordering channel go out in the same message. 0 to send each message on its own
+    void SetMessageCoalescing(RakNet::TimeUS windowUS);
+    /// Sequenced and ordered messages on \a orderingChannel are compressed with \a codec when that makes them smaller. MC_NONE to use the codec of their reliability
+    void SetChannelCompression(unsigned char orderingChannel, MessageCompressionCodec codec);
+    /// Messages sent with \a reliability are compressed with \a codec when that makes them smaller, unless their ordering channel has a codec
+    void SetReliabilityCompression(PacketReliability reliability, MessageCompressionCodec codec);
+    /// Holds the dictionary for MC_HUFFMAN, for sent and received messages. Shared by every connection, so it must not change while connected
+    void SetMessageCompressor(const MessageCompressor *compressor);
     /// Has a lot of time passed since the last ack
     bool AckTimeout(RakNet::Time curTime);
     CCTimeType GetNextSendTime(void) const;
@@ -269,12 +328,44 @@ private:
     /// Returns true if newPacketOrderingIndex is older than the waitingForPacketOrderingIndex
     bool IsOlderOrderedPacket( OrderingIndexType newPacketOrderingIndex, OrderingIndexType waitingForPacketOrderingIndex );
 
+    /// Assigns the message number and ordering index of a message from Send(), then splits it or adds it to outgoingPacketBuffer
+    void QueueOutgoingMessage( InternalPacket *internalPacket, unsigned char orderingChannel, bool splitPacket );
+
+    /// Appends a message to coalescedPacket, first sending the messages already there if it does not fit with them
+    /// Returns false if the message cannot be coalesced
+    bool CoalesceMessage( const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability,
+        unsigned char orderingChannel, CCTimeType time, RakNet::TimeUS queueTime );
+
+    /// Queues coalescedPacket, if there is one
+    void FlushCoalescedMessages( void );
+
+    /// Replaces a coalesced message at the head of outputQueue with the messages in it, or drops it if it is malformed
+    void SplitCoalescedMessage( InternalPacket *internalPacket );
+
+    /// Writes \a data compressed with the codec for \a reliability and \a orderingChannel to \a output, preceded by its length in bits
+    /// Returns the codec, or MC_NONE if there is none or the compressed message would not be smaller
+    MessageCompressionCodec CompressMessage( const unsigned char *data, BitSize_t bitLength, PacketReliability reliability,
+        unsigned char orderingChannel, RakNet::BitStream *output );
+
+    /// The codec set for \a reliability and \a orderingChannel, which CompressMessage() tries
+    MessageCompressionCodec GetCompressionCodec( PacketReliability reliability, unsigned char orderingChannel ) const;
+
+    /// Replaces the data of a received compressed message with what it was compressed from. Returns false if that fails
+    bool DecompressMessage( InternalPacket *internalPacket );
+
     /// Split the passed packet into chunks under MTU_SIZE bytes (including headers) and save those new chunks
     void SplitPacket( InternalPacket *internalPacket );
 
+    /// Cuts the next split packet from a streamed message, and pushes it to outgoingPacketBuffer with \a weight
+    /// Releases \a source once the last split packet is cut
+    void PushNextSplitPacket( InternalPacket *source, reliabilityHeapWeightType weight );
+
     /// Insert a packet into the split packet list
     void InsertIntoSplitPacketList( InternalPacket * internalPacket, CCTimeType time );
 
+    /// Copies a split packet of a streamed message into the message, then frees it
+    void WriteStreamedSplitPacket( SplitPacketChannel *splitPacketChannel, InternalPacket *internalPacket );
+
     /// Take all split chunks with the specified splitPacketId and try to reconstruct a packet. If we can, allocate and return it.  Otherwise return 0
     InternalPacket * BuildPacketFromSplitPacketList( SplitPacketIdType splitPacketId, CCTimeType time,
         RakNetSocket2 *s, SystemAddress &systemAddress, RakNetRandom *rnr, BitStream &updateBitStream);
@@ -333,26 +424,24 @@ private:
     int splitMessageProgressInterval;
     CCTimeType unreliableTimeout;
 
-    struct MessageNumberNode
-    {
-        DatagramSequenceNumberType messageNumber;
-        MessageNumberNode *next;
-    };
     struct DatagramHistoryNode
     {
-        DatagramHistoryNode(): head(nullptr), timeSent(0) {}
-        DatagramHistoryNode(MessageNumberNode *_head, CCTimeType ts
+        DatagramHistoryNode(): messageNumbersBegin(0), messageNumbersCount(0), timeSent(0) {}
+        DatagramHistoryNode(uint32_t _messageNumbersBegin, CCTimeType ts
             ) :
-        head(_head), timeSent(ts)
+        messageNumbersBegin(_messageNumbersBegin), messageNumbersCount(0), timeSent(ts)
         {}
-        MessageNumberNode *head;
+        // Position in datagramHistoryMessageNumbers of the first reliable message sent in this datagram
+        uint32_t messageNumbersBegin;
+        // 0 if the datagram had no reliable messages, was acked, or all its messages were acked after a resend
+        uint32_t messageNumbersCount;
         CCTimeType timeSent;
     };
-    // Queue length is programmatically restricted to DATAGRAM_MESSAGE_ID_ARRAY_LENGTH
-    // This is essentially an O(1) lookup to get a DatagramHistoryNode given an index
-    // datagramHistory holds a linked list of MessageNumberNode. Each MessageNumberNode refers to one element in resendList which can be cleared on an ack.
-    DataStructures::Queue<DatagramHistoryNode> datagramHistory;
-    DataStructures::MemoryPool<MessageNumberNode> datagramHistoryMessagePool;
+    // Datagrams from datagramHistoryPopCount on, at the position of their datagramNumber. Length is restricted to DATAGRAM_MESSAGE_ID_ARRAY_LENGTH
+    // This is an O(1) lookup to get a DatagramHistoryNode given an index
+    // Each DatagramHistoryNode refers to a run of datagramHistoryMessageNumbers. Each message number refers to one element in resendBuffer which can be cleared on an ack.
+    DataStructures::RingBuffer<DatagramHistoryNode> datagramHistory;
+    DataStructures::RingBuffer<DatagramSequenceNumberType> datagramHistoryMessageNumbers;
 
     struct UnreliableWithAckReceiptNode
     {
@@ -367,16 +456,30 @@ private:
     DataStructures::List<UnreliableWithAckReceiptNode> unreliableWithAckReceiptHistory;
 
     void RemoveFromDatagramHistory(DatagramSequenceNumberType index);
-    MessageNumberNode* GetMessageNumberNodeByDatagramIndex(DatagramSequenceNumberType index, CCTimeType *timeSent);
-    void AddFirstToDatagramHistory(DatagramSequenceNumberType datagramNumber, CCTimeType timeSent);
-    MessageNumberNode* AddFirstToDatagramHistory(DatagramSequenceNumberType datagramNumber, DatagramSequenceNumberType messageNumber, CCTimeType timeSent);
-    MessageNumberNode* AddSubsequentToDatagramHistory(MessageNumberNode *messageNumberNode, DatagramSequenceNumberType messageNumber);
+    DatagramHistoryNode* GetDatagramHistoryNode(DatagramSequenceNumberType index);
+    void AddToDatagramHistory(DatagramSequenceNumberType datagramNumber, CCTimeType timeSent);
+    void AddMessageToDatagramHistory(DatagramSequenceNumberType messageNumber);
+    // Forgets the oldest datagrams once nothing sent in them waits for an ack
+    void TrimDatagramHistory(void);
+    bool IsAwaitingAck(DatagramSequenceNumberType messageNumber) const;
     DatagramSequenceNumberType datagramHistoryPopCount;
 
     DataStructures::MemoryPool<InternalPacket> internalPacketPool;
     // DataStructures::BPlusTree<DatagramSequenceNumberType, InternalPacket*, RESEND_TREE_ORDER> resendTree;
-    InternalPacket *resendBuffer[RESEND_BUFFER_ARRAY_LENGTH];
-    InternalPacket *resendLinkedListHead;
+    // Reliable messages waiting for an ack, at reliableMessageNumber & resendBufferMask
+    // Starts RESEND_BUFFER_ARRAY_LENGTH long, and doubles up to RESEND_BUFFER_ARRAY_MAX_LENGTH when the next message number is still in use
+    InternalPacket **resendBuffer;
+    uint32_t resendBufferMask;
+    void GrowResendBuffer(void);
+    // The same messages, by nextActionTime. Each slot is a circular list through resendNext and resendPrev
+    // of the messages whose nextActionTime falls in one tick, so finding the ones due for a resend does not depend on how many there are
+    InternalPacket *resendTimerWheel[RESEND_TIMER_WHEEL_LENGTH];
+    // Slots before this tick have no messages due, except ones a turn or more of the wheel ahead
+    CCTimeType resendTimerWheelTick;
+    unsigned int resendTimerWheelCount;
+    // The reliable message whose resend is due soonest, if one is due at \a time
+    InternalPacket *GetNextResend(CCTimeType time);
+    CCTimeType GetNextResendTime(void) const;
     InternalPacket *unreliableLinkedListHead;
     void RemoveFromUnreliableLinkedList(InternalPacket *internalPacket);
     void AddToUnreliableLinkedList(InternalPacket *internalPacket);
@@ -520,11 +623,8 @@ private:
     CCTimeType nextAckTimeToSend;
 
 
-#if USE_SLIDING_WINDOW_CONGESTION_CONTROL==1
-    RakNet::CCRakNetSlidingWindow congestionManager;
-#else
-    RakNet::CCRakNetUDT congestionManager;
-#endif
+    RakNet::CCRakNetInterface *congestionManager;
+    CongestionControlAlgorithm congestionControlAlgorithm;
 
 
     uint32_t unacknowledgedBytes;
@@ -536,11 +636,8 @@ private:
     void PushDatagram(void);
     bool TagMostRecentPushAsSecondOfPacketPair(void);
     void ClearPacketsAndDatagrams(void);
-    void MoveToListHead(InternalPacket *internalPacket);
     void RemoveFromList(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes);
-    void AddToListTail(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes);
-    void PopListHead(bool modifyUnacknowledgedBytes);
-    bool IsResendQueueEmpty(void) const;
+    void AddToList(InternalPacket *internalPacket, bool modifyUnacknowledgedBytes);
     void SortSplitPacketList(DataStructures::List<InternalPacket*> &data, unsigned int leftEdge, unsigned int rightEdge) const;
     void SendACKs(RakNetSocket2 *s, SystemAddress &systemAddress, CCTimeType time, RakNetRandom *rnr, BitStream &updateBitStream);
 
@@ -577,12 +674,94 @@ private:
     void AllocInternalPacketData(InternalPacket *internalPacket, unsigned char *externallyAllocatedPtr);
     // Allocate new
     void AllocInternalPacketData(InternalPacket *internalPacket, unsigned int numBytes, bool allowStack);
+    // Add a reference to sharedData, do not allocate
+    void AllocInternalPacketData(InternalPacket *internalPacket, InternalPacketSharedData *sharedData);
+    // Add a reference to the buffers of sharedData, starting gatherOffset bytes in, do not allocate
+    void AllocInternalPacketData(InternalPacket *internalPacket, InternalPacketSharedData *sharedData, unsigned int gatherOffset);
+    // Allocate new in a block that RakPeer can return as a Packet
+    void AllocReceivedPacketData(InternalPacket *internalPacket, unsigned int numBytes);
     void FreeInternalPacketData(InternalPacket *internalPacket);
     DataStructures::MemoryPool<InternalPacketRefCountedData> refCountedDataPool;
 
     BPSTracker bpsMetrics[RNS_PER_SECOND_METRICS_COUNT];
     CCTimeType lastBpsClear;
 
+    // Forward error correction: datagrams carrying UNRELIABLE_SEQUENCED messages on the channels in forwardErrorCorrectionChannels
+    // are grouped, and each group is followed by a parity datagram holding the XOR of their bytes after the datagram header.
+    // The receiver rebuilds any one datagram of a group that was lost from the others and the parity
+    enum
+    {
+        // First datagram number, member mask and XOR of member lengths
+        FEC_PARITY_HEADER_BYTES = 3 + 4 + 2,
+        // Protected datagrams kept by the receiver, indexed by datagram number. Must be a power of 2
+        FEC_HISTORY_LENGTH = 64
+    };
+    struct FECSendGroup
+    {
+        unsigned char parity[MAXIMUM_MTU_SIZE];
+        // Length of the longest member. Shorter members are XORed in as if padded with zeros
+        unsigned int parityLength;
+        uint16_t lengthXor;
+        DatagramSequenceNumberType firstDatagramNumber;
+        // Bit n is set if firstDatagramNumber+n is in the group
+        uint32_t memberMask;
+        unsigned int memberCount;
+    };
+    struct FECReceivedDatagram
+    {
+        DatagramSequenceNumberType datagramNumber;
+        bool isValid;
+        // Rebuilt from parity, so the original is ignored if it arrives late
+        bool wasRecovered;
+        unsigned int length;
+        unsigned char data[MAXIMUM_MTU_SIZE];
+    };
+    // Moves datagramLossRate toward 1 for each lost datagram or toward 0 for each delivered one
+    void UpdateDatagramLossRate(bool lost, unsigned int count);
+    // Datagrams per parity datagram for the current loss rate, or 0 to send no parity
+    unsigned int GetForwardErrorCorrectionGroupSize(void) const;
+    void AddToForwardErrorCorrectionGroup(DatagramSequenceNumberType datagramNumber, const unsigned char *data, unsigned int length, unsigned int groupSize);
+    // Sends the parity of every group that is full or has no more datagrams this update. A group of one datagram is kept open for the next update
+    void SendForwardErrorCorrectionParity(RakNetSocket2 *s, SystemAddress &systemAddress, RakNetRandom *rnr, CCTimeType time, bool needsBAndAs,
+        unsigned int groupSize, BitStream &updateBitStream);
+    // Stores a protected datagram. Returns false if it was already rebuilt from parity and should not be processed again
+    bool StoreForwardErrorCorrectionDatagram(DatagramSequenceNumberType datagramNumber, const unsigned char *data, unsigned int length, bool wasRecovered);
+    // Rebuilds the missing member of a parity datagram's group, if exactly one is missing, and processes it
+    void RecoverFromForwardErrorCorrectionParity(RakNet::BitStream *parityData, CCTimeType sourceSystemTime, SystemAddress &systemAddress,
+        DataStructures::List<PluginInterface2*> &messageHandlerList, int MTUSize, RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead,
+        BitStream &updateBitStream);
+    uint32_t forwardErrorCorrectionChannels;
+    double datagramLossRate;
+
+    RakNet::TimeUS coalescingWindow;
+    // Small messages waiting to be sent together, each preceded by its length. See CoalesceMessage()
+    InternalPacket *coalescedPacket;
+    unsigned int coalescedMessageCount;
+    CCTimeType coalescedPacketSendTime;
+    // Compression of sent messages. A setting stops trying for a while when messages don't get smaller. See CompressMessage()
+    struct CompressionSetting
+    {
+        MessageCompressionCodec codec;
+        // Tries in a row that did not pay off, and how many messages to send before the next try
+        unsigned char failures;
+        unsigned char messagesToSkip;
+    };
+    CompressionSetting channelCompression[NUMBER_OF_ORDERED_STREAMS];
+    CompressionSetting reliabilityCompression[NUMBER_OF_RELIABILITIES];
+    const MessageCompressor *messageCompressor;
+    // Groups whose parity is not sent yet. Parity goes out after the datagrams of an update, so it does not change their numbers.
+    // Only the last group can take more datagrams
+    DataStructures::List<FECSendGroup*> fecSendGroups;
+    DataStructures::List<FECSendGroup*> fecUnusedSendGroups;
+    // Allocated when the first protected datagram arrives
+    FECReceivedDatagram *fecReceiveHistory;
+
+    friend class TickPhaseScope;
+    bool tickProfiling;
+    RakNetTickProfile tickProfile;
+    // Innermost TickPhaseScope that is timing, so it can exclude the time of scopes nested inside it
+    TickPhaseScope *activeTickPhase;
+
 #ifdef LIBCAT_SECURITY
 public:
     cat::AuthenticatedEncryption* GetAuthenticatedEncryption(void) { return &auth_enc; }
@@ -593,6 +772,34 @@ protected:
 #endif // LIBCAT_SECURITY
 };
 
+/// Adds the time until it goes out of scope to one phase of ReliabilityLayer::GetTickProfile(), if tick profiling is on
+/// Time spent in scopes nested inside it is counted only towards the nested phase
+class TickPhaseScope
+{
+public:
+    TickPhaseScope( ReliabilityLayer *reliabilityLayer, RNSTickPhase phase )
+    {
+        if (reliabilityLayer->tickProfiling)
+            Start(reliabilityLayer, phase);
+        else
+            owner=0;
+    }
+    ~TickPhaseScope()
+    {
+        if (owner)
+            Stop();
+    }
+
+private:
+    void Start( ReliabilityLayer *reliabilityLayer, RNSTickPhase phase );
+    void Stop( void );
+
+    ReliabilityLayer *owner;
+    TickPhaseScope *parent;
+    RNSTickPhase tickPhase;
+    RakNet::TimeUS startTime, nestedTime;
+};
+
 } // namespace RakNet
 
 #endif
@@ -28,6 +28,10 @@
 #include "NetworkIDObject.h"
 #include "DS_OrderedList.h"
 #include "DS_Queue.h"
+#include "ThreadPool.h"
+#include "SignaledEvent.h"
+#include "SimpleMutex.h"
+#include <atomic>
 
 /// \defgroup REPLICA_MANAGER_GROUP3 ReplicaManager3
 /// \brief Third implementation of object replication
@@ -38,6 +42,9 @@ namespace RakNet
 {
 class Connection_RM3;
 class Replica3;
+struct RM3SerializedMessage;
+struct RM3ViewClassSerialization;
+struct SerializeParameters;
 
 /// \ingroup REPLICA_MANAGER_GROUP3
 /// Used for multiple worlds. World 0 is created automatically by default
@@ -64,6 +71,26 @@ struct PRO
     bool operator!=( const PRO& right ) const;
 };
 
+/// \internal
+/// A square of the interest grid, and the replicas whose position is in it. See ReplicaManager3::SetInterestManagement()
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3InterestCell
+{
+    int x, y;
+    // Holds the replicas without a position, which every connection is interested in
+    bool everywhere;
+    DataStructures::List<Replica3*> replicas;
+};
+
+/// \internal
+/// A replica that changed cells this tick. \a from is 0 for a replica that was just added to the grid
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3InterestMove
+{
+    Replica3 *replica;
+    RM3InterestCell *from, *to;
+};
+
 
 /// \brief System to help automate game object construction, destruction, and serialization
 /// \details ReplicaManager3 tracks your game objects and automates the networking for replicating them across the network<BR>
@@ -236,6 +263,56 @@ public:
     /// \param[in] intervalMS How frequently to autoserialize all objects. This controls the maximum number of game object updates per second.
     void SetAutoSerializeInterval(RakNet::Time intervalMS);
 
+    /// \brief Serialize each replica at most once per autoserialize tick for each view class, and send the result to every connection of that class
+    /// \details Normally Replica3::Serialize() is called, and its output compared against the last send, once per replica per connection.<BR>
+    /// With this enabled, connections are grouped by Connection_RM3::QueryViewClass(). The first connection of a view class to need a replica in a tick calls Serialize(), with that connection as SerializeParameters::destinationConnection.<BR>
+    /// The output is compared against what was last sent to the view class, and the changed channels are written to a message once. Every other connection of the view class that serializes this replica in the same tick sends that message, without copying it, through RakPeerInterface::SendGather().<BR>
+    /// Replica3::QuerySerialization() is still called per connection. Replica3::OnSerializeTransmission() is called once per message, with the connection that caused the serialization.<BR>
+    /// Every RM3SerializationResult applies to the whole view class: RM3SR_SERIALIZED_UNIQUELY compares against the last send to the view class rather than to the connection, and RM3SR_NEVER_SERIALIZE_FOR_THIS_CONNECTION stops serializing to every connection in it.<BR>
+    /// As with RM3SR_BROADCAST_IDENTICALLY, a connection that skips a tick through QuerySerialization() does not get the changes made that tick later.
+    /// \param[in] enabled True to serialize once per view class. Defaults to false.
+    void SetSerializeOncePerViewClass(bool enabled);
+
+    /// \return What was passed to SetSerializeOncePerViewClass()
+    bool GetSerializeOncePerViewClass(void) const;
+
+    /// \brief Decide which replicas each connection has constructed from a grid over the replica positions
+    /// \details Each autoserialize tick, replicas are placed in a grid of square cells by Replica3::QueryInterestPosition(). Replicas without a position are relevant to every connection.<BR>
+    /// A connection whose QueryConstructionMode() returns Connection_RM3::QUERY_CONNECTION_FOR_REPLICA_LIST, and whose Connection_RM3::QueryInterestArea() returns true, is interested in every cell within the bounding square of its area.<BR>
+    /// The default Connection_RM3::QueryReplicaList() then constructs replicas as they enter those cells and destroys them as they leave. Only the replicas that changed cells are checked each tick, unless the connection moved to another cell.<BR>
+    /// Replicas created by the connection itself are never constructed or destroyed this way.<BR>
+    /// Positions are 2D. For a 3D world, pass the coordinates of the ground plane.
+    /// \param[in] cellSize Width of a grid cell, in world units. A cell about as wide as the typical view radius works well. Pass 0 to disable. Defaults to 0.
+    void SetInterestManagement(float cellSize);
+
+    /// \return What was passed to SetInterestManagement()
+    float GetInterestCellSize(void) const;
+
+    /// \brief Spread the per-connection work of Update() over several threads
+    /// \details Interest management, Connection_RM3::AutoConstructByQuery() and serialization are done for different connections at the same time. The thread calling Update() works on connections too, and returns once all of them are done.<BR>
+    /// Each connection writes its messages to its own list, and they are sent in connection order after every connection is done, so each connection gets them in the same order as without threads.<BR>
+    /// Your Replica3 and Connection_RM3 callbacks are then called from these threads, and may be called for the same replica on different connections at the same time, so they must not change state shared between connections.<BR>
+    /// Replica3::Serialize() is never called on the same replica by two threads at once, since the replica's last broadcast serialization is shared.<BR>
+    /// Replica3::OnUserReplicaPreSerializeTick(), and everything done outside Update(), is still called on the thread calling Update().
+    /// \param[in] numThreads Number of threads including the one calling Update(). Pass 0 or 1 to do everything on the thread calling Update(). Defaults to 1.
+    void SetNumberOfUpdateThreads(int numThreads);
+
+    /// \return What was passed to SetNumberOfUpdateThreads()
+    int GetNumberOfUpdateThreads(void) const;
+
+    /// \brief Send serializations unreliably, as the difference from the last state each connection acknowledged
+    /// \details Normally each changed channel is sent whole, and the reliability layer resends it if it is lost. With this enabled, everything Replica3::Serialize() writes is treated as the state of the replica.<BR>
+    /// Each state is numbered and kept per connection, along with the RM3_SNAPSHOT_HISTORY_LENGTH-1 states sent before it. It is sent as ID_REPLICA_MANAGER_SNAPSHOT with UNRELIABLE_WITH_ACK_RECEIPT, holding only the bytes that differ from the newest state for which ID_SND_RECEIPT_ACKED came back. Nothing is sent if the state equals that one.<BR>
+    /// A lost message is not resent. The next tick sends the current state against the same baseline instead, so it costs no added latency. States that arrive out of order are not passed to Replica3::Deserialize().<BR>
+    /// Replica3::Serialize() should write the whole state every time, and Replica3::Deserialize() gets every channel that was written. SerializeParameters::lastSentBitstream is empty. Only the priority and ordering channel of SerializeParameters::pro[0] are used.<BR>
+    /// Serialize() is called for each connection, even with SetSerializeOncePerViewClass(). The serialization sent right after construction is sent the same way, but reliably.<BR>
+    /// ReplicaManager3 consumes the receipts for its own messages. Only the sending system needs to enable this.
+    /// \param[in] enabled True to send snapshots. Defaults to false.
+    void SetSnapshotReplication(bool enabled);
+
+    /// \return What was passed to SetSnapshotReplication()
+    bool GetSnapshotReplication(void) const;
+
     /// \brief Return the connections that we think have an instance of the specified Replica3 instance
     /// \details This can be wrong, for example if that system locally deleted the outside the scope of ReplicaManager3, if QueryRemoteConstruction() returned false, or if DeserializeConstruction() returned false.
     /// \param[in] replica The replica to check against.
@@ -308,12 +385,21 @@ public:
     struct RM3World
     {
         RM3World();
+        ~RM3World();
         void Clear(ReplicaManager3 *replicaManager3);
+        void ClearInterest(void);
+        RM3InterestCell *GetInterestCell(int x, int y, bool create);
+        static int InterestCellComp( const uint64_t &key, RM3InterestCell * const &data );
 
         DataStructures::List<Connection_RM3*> connectionList;
         DataStructures::List<Replica3*> userReplicaList;
         WorldId worldId;
         NetworkIDManager *networkIDManager;
+
+        // Used by SetInterestManagement(). Cells are kept once allocated, so moves can point to them
+        DataStructures::OrderedList<uint64_t, RM3InterestCell*, RM3World::InterestCellComp> interestGrid;
+        RM3InterestCell interestEverywhere;
+        DataStructures::List<RM3InterestMove> interestMoves;
     };
 protected:
     virtual PluginReceiveResult OnReceive(Packet *packet);
@@ -326,11 +412,30 @@ protected:
     PluginReceiveResult OnSerialize(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, RakNet::Time timestamp, unsigned char packetDataOffset, WorldId worldId);
     PluginReceiveResult OnDownloadStarted(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, unsigned char packetDataOffset, WorldId worldId);
     PluginReceiveResult OnDownloadComplete(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, unsigned char packetDataOffset, WorldId worldId);
+    PluginReceiveResult OnSnapshot(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, RakNet::Time timestamp, unsigned char packetDataOffset, WorldId worldId);
+    PluginReceiveResult OnSnapshotReset(Packet *packet, unsigned char *packetData, int packetDataLength, RakNetGUID senderGuid, unsigned char packetDataOffset, WorldId worldId);
+    PluginReceiveResult OnSnapshotReceipt(Packet *packet);
 
     void DeallocReplicaNoBroadcastDestruction(RakNet::Connection_RM3 *connection, RakNet::Replica3 *replica3);
     RakNet::Connection_RM3 * PopConnection(unsigned int index, WorldId worldId);
     Replica3* GetReplicaByNetworkID(NetworkID networkId, WorldId worldId);
     unsigned int ReferenceInternal(RakNet::Replica3 *replica3, WorldId worldId);
+    void UpdateInterestGrid(RM3World *world);
+    void SerializeToConnection(Connection_RM3 *connection, SerializeParameters *sp, WorldId worldId, RakNet::Time time);
+
+    // Used by SetNumberOfUpdateThreads()
+    struct UpdateJob
+    {
+        ReplicaManager3 *replicaManager;
+        RM3World *world;
+        Connection_RM3 *connection;
+        RakNet::Time time;
+        bool updateInterest;
+    };
+    void UpdateOnThreads(RakNet::Time time);
+    void RunUpdateJobs(UpdateJob* (*jobFunction)(UpdateJob*, bool*, void*));
+    static UpdateJob* ConstructOnUpdateThread(UpdateJob *job, bool *returnOutput, void *perThreadData);
+    static UpdateJob* SerializeOnUpdateThread(UpdateJob *job, bool *returnOutput, void *perThreadData);
 
     PRO defaultSendParameters;
     RakNet::Time autoSerializeInterval;
@@ -340,6 +445,18 @@ protected:
     // Set on the first call to ReferenceInternal(), and should never be changed after that
     // Used to lookup in Replica3LSRComp. I don't want to rely on GetNetworkID() in case it changes at runtime
     uint32_t nextReferenceIndex;
+    bool serializeOncePerViewClass;
+    // Incremented every autoserialize tick, to tell if a RM3ViewClassSerialization is from this tick
+    uint32_t serializeTick;
+    float interestCellSize;
+    bool snapshotReplication;
+    int numberOfUpdateThreads;
+    // Holds numberOfUpdateThreads-1 threads, the thread calling Update() is the last one
+    ThreadPool<UpdateJob*, UpdateJob*> updateThreadPool;
+    DataStructures::List<UpdateJob> updateJobs;
+    // Jobs in updateJobs not finished yet. The thread that finishes the last one sets updateJobsDoneEvent
+    std::atomic<unsigned int> updateJobsRemaining;
+    SignaledEvent updateJobsDoneEvent;
 
     // For O(1) lookup
     RM3World *worldsArray[255];
@@ -350,6 +467,8 @@ protected:
 };
 
 static const int RM3_NUM_OUTPUT_BITSTREAM_CHANNELS=16;
+/// How many states of a replica are kept per connection by ReplicaManager3::SetSnapshotReplication(). A state acknowledged after this many newer ones were sent is no longer used as a baseline
+static const int RM3_SNAPSHOT_HISTORY_LENGTH=32;
 
 /// \ingroup REPLICA_MANAGER_GROUP3
 struct LastSerializationResultBS
@@ -359,6 +478,47 @@ struct LastSerializationResultBS
     bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS];
 };
 
+/// \internal
+/// A numbered state of a replica, see ReplicaManager3::SetSnapshotReplication()
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3Snapshot
+{
+    // 0 if unused
+    uint32_t sequence;
+    unsigned char *data;
+    unsigned int length;
+};
+
+/// \internal
+/// The last states of a replica sent to, or received from, a connection. See ReplicaManager3::SetSnapshotReplication()
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3SnapshotHistory
+{
+    RM3SnapshotHistory();
+    ~RM3SnapshotHistory();
+
+    // Returns 0 if the state is no longer kept
+    RM3Snapshot *GetSnapshot(uint32_t sequence);
+    void AddSnapshot(uint32_t sequence, const unsigned char *data, unsigned int length);
+
+    // Indexed by sequence modulus RM3_SNAPSHOT_HISTORY_LENGTH
+    RM3Snapshot snapshots[RM3_SNAPSHOT_HISTORY_LENGTH];
+    // Sending side. ackedSequence is the newest state acknowledged, 0 for none. States before firstBaselineSequence are not used as a baseline, as the remote system failed to decode one of them
+    uint32_t nextSequence, ackedSequence, firstBaselineSequence;
+    // Receiving side. The newest state passed to Replica3::Deserialize()
+    uint32_t newestSequence;
+};
+
+/// \internal
+/// Which state a send receipt is for. See ReplicaManager3::SetSnapshotReplication()
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3SnapshotReceipt
+{
+    uint32_t sendReceipt;
+    NetworkID networkId;
+    uint32_t sequence;
+};
+
 /// Represents the serialized data for an object the last time it was sent. Used by Connection_RM3::OnAutoserializeInterval() and Connection_RM3::SendSerializeIfChanged()
 /// \ingroup REPLICA_MANAGER_GROUP3
 struct LastSerializationResult
@@ -372,9 +532,19 @@ struct LastSerializationResult
     //bool neverSerialize;
 //    bool isConstructed;
     RakNet::Time whenLastSerialized;
+    // Replica3::QueryInterestPriority() added up since this replica was last serialized to this connection, see Connection_RM3::QueryBytesPerTickBudget()
+    float accumulatedPriority;
 
     void AllocBS(void);
     LastSerializationResultBS* lastSerializationResultBS;
+
+    // Used by ReplicaManager3::SetSnapshotReplication()
+    void AllocSnapshotHistory(void);
+    RM3SnapshotHistory* snapshotHistory;
+
+    // Used by ReplicaManager3::SetSerializeOncePerViewClass(). Whether this connection was sent the state of every channel, and for which view class
+    bool sentViewClassState;
+    uint32_t viewClass;
 };
 
 /// Parameters passed to Replica3::Serialize()
@@ -506,7 +676,7 @@ public:
         /// Do not call Replica3::QueryConstruction() or Replica3::QueryDestruction()
         /// Call Connection_RM3::QueryReplicaList() to determine which objects exist on remote systems
         /// This can be faster than QUERY_REPLICA_FOR_CONSTRUCTION and QUERY_REPLICA_FOR_CONSTRUCTION_AND_DESTRUCTION for large worlds
-        /// See GridSectorizer.h under /Source for code that can help with this
+        /// See ReplicaManager3::SetInterestManagement() to have the list computed from positions
         QUERY_CONNECTION_FOR_REPLICA_LIST
     };
 
@@ -531,13 +701,30 @@ public:
     /// \details This advantage of this callback is if that there are many objects that a particular connection does not have, then we do not have to iterate through those
     /// objects calling QueryConstruction() for each of them.<BR>
     ///<BR>
-    /// See GridSectorizer in the Source directory as a method to find all objects within a certain radius in a fast way.<BR>
+    /// See ReplicaManager3::SetInterestManagement() to find all objects within a certain radius in a fast way.<BR>
     ///<BR>
+    /// The default implementation returns the replicas that entered and left QueryInterestArea() since the last call, when ReplicaManager3::SetInterestManagement() is enabled
     /// \param[out] newReplicasToCreate Anything in this list will be created on the remote system
     /// \param[out] existingReplicasToDestroy Anything in this list will be destroyed on the remote system
     virtual void QueryReplicaList(
         DataStructures::List<Replica3*> &newReplicasToCreate,
-        DataStructures::List<Replica3*> &existingReplicasToDestroy) {(void) newReplicasToCreate; (void) existingReplicasToDestroy;}
+        DataStructures::List<Replica3*> &existingReplicasToDestroy);
+
+    /// \brief Where this connection is, when ReplicaManager3::SetInterestManagement() is enabled
+    /// \details Called every autoserialize tick for connections whose QueryConstructionMode() returns QUERY_CONNECTION_FOR_REPLICA_LIST. Usually the position of the player's avatar or camera.
+    /// \param[out] x Position in world units
+    /// \param[out] y Position in world units
+    /// \param[out] radius How far the connection can see, in world units
+    /// \return True to use interest management for this connection. Defaults to false, in which case override QueryReplicaList() yourself.
+    virtual bool QueryInterestArea(float *x, float *y, float *radius) const {(void) x; (void) y; (void) radius; return false;}
+
+    /// \brief How many bytes of serialization to send to this connection each autoserialize tick
+    /// \details When nonzero, and QuerySerializationList() returns false, each replica in queryToSerializeReplicaList adds Replica3::QueryInterestPriority() to what it accumulated each tick.<BR>
+    /// Replicas are then serialized from highest to lowest accumulated priority until SerializeParameters::bitsWrittenSoFar reaches the budget, and the ones serialized start accumulating again from 0.<BR>
+    /// A replica that is skipped is sent ahead of others later, so distant objects update less often instead of never.<BR>
+    /// Replicas skipped in a tick still have to be compared against what this connection was last sent, so Replica3::Serialize() should return RM3SR_SERIALIZED_UNIQUELY rather than RM3SR_BROADCAST_IDENTICALLY for them.
+    /// \return The number of bytes per tick. Defaults to 0, which serializes every replica every tick.
+    virtual unsigned int QueryBytesPerTickBudget(void) const {return 0;}
 
     /// \brief Override which replicas to serialize and in what order for a connection for a ReplicaManager3::Update() cycle
     /// \details By default, Connection_RM3 will iterate through queryToSerializeReplicaList and call QuerySerialization() on each Replica in that list
@@ -553,6 +740,12 @@ public:
     /// \return Return true to use replicasToSerialize (replicasToSerialize may be empty if desired). Otherwise return false.
     virtual bool QuerySerializationList(DataStructures::List<Replica3*> &replicasToSerialize) {(void) replicasToSerialize; return false;}
 
+    /// \brief Which view class this connection is in, when ReplicaManager3::SetSerializeOncePerViewClass() is enabled
+    /// \details Connections in the same view class are sent the same serialization of a replica. For example, return the team the player is on if Replica3::Serialize() writes more for teammates.<BR>
+    /// The value should only change between autoserialize ticks.
+    /// \return A user-defined view class. Defaults to 0, so every connection gets the same serialization.
+    virtual uint32_t QueryViewClass(void) const {return 0;}
+
     /// \internal This is used internally - however, you can also call it manually to send a data update for a remote replica.<BR>
     /// \brief Sends over a serialization update for \a replica.<BR>
     /// NetworkID::GetNetworkID() is written automatically, serializationData is the object data.<BR>
@@ -598,6 +791,7 @@ public:
     bool isFirstConstruction;
 
     static int Replica3LSRComp( Replica3 * const &replica3, LastSerializationResult * const &data );
+    static int SnapshotReceiptComp( const uint32_t &sendReceipt, const RM3SnapshotReceipt &data );
 
     // Internal
     void ClearDownloadGroup(RakPeerInterface *rakPeerInterface);
@@ -664,7 +858,25 @@ protected:
     void OnSendDestructionFromQuery(unsigned int queryToDestructIdx, ReplicaManager3 *replicaManager);
     void OnDoNotQueryDestruction(unsigned int queryToDestructIdx, ReplicaManager3 *replicaManager);
     void ValidateLists(ReplicaManager3 *replicaManager) const;
+    // Used by ReplicaManager3::SetInterestManagement()
+    void UpdateInterest(ReplicaManager3::RM3World *world, float cellSize);
+    void AddInterest(Replica3 *replica);
+    void RemoveInterest(Replica3 *replica);
+    bool IsInInterestArea(const RM3InterestCell *cell) const;
+    void SerializeByPriority(SerializeParameters *sp, ReplicaManager3 *replicaManager, WorldId worldId, RakNet::Time curTime);
     void SendSerializeHeader(RakNet::Replica3 *replica, RakNet::Time timestamp, RakNet::BitStream *bs, WorldId worldId);
+    // Same as SendSerialize(), but if messagesOut is set the messages are added to it instead of sent
+    SendSerializeIfChangedResult WriteSerialize(RakNet::Replica3 *replica, bool indicesToSend[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::BitStream serializationData[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::Time timestamp, PRO sendParameters[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::RakPeerInterface *rakPeer, unsigned char worldId, RakNet::Time curTime, DataStructures::List<RM3SerializedMessage*> *messagesOut);
+    // SendSerializeIfChanged() after the calls to QuerySerialization()
+    SendSerializeIfChangedResult SerializeIfChanged(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime);
+    // SendSerializeIfChanged() when ReplicaManager3::SetSerializeOncePerViewClass() is enabled
+    SendSerializeIfChangedResult SendViewClassSerialization(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime);
+    // SendSerializeIfChanged() when ReplicaManager3::SetSnapshotReplication() is enabled
+    SendSerializeIfChangedResult SendSnapshotSerialization(LastSerializationResult *lsr, SerializeParameters *sp, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, ReplicaManager3 *replicaManager, RakNet::Time curTime);
+    // Sends what Replica3::Serialize() wrote to sp as the next state of lsr
+    SendSerializeIfChangedResult SendSnapshot(LastSerializationResult *lsr, SerializeParameters *sp, PacketReliability reliability, RakNet::RakPeerInterface *rakPeer, unsigned char worldId, RakNet::Time curTime);
+    void SendSnapshotReset(NetworkID networkId, uint32_t sequence, RakNet::RakPeerInterface *rakPeer, WorldId worldId);
+    LastSerializationResult* GetConstructedReplica(NetworkID networkId, NetworkIDManager *networkIDManager);
 
     // The list of objects that our local system and this remote system both have
     // Either we sent this object to them, or they sent this object to us
@@ -694,6 +906,27 @@ protected:
     // Stores if we got download complete for this connection
     bool gotDownloadComplete;
 
+    // Interest management, see ReplicaManager3::SetInterestManagement()
+    // Cells in interestMinX to interestMaxX and interestMinY to interestMaxY are in the area. Only valid if hasInterestArea
+    bool hasInterestArea;
+    int interestMinX, interestMinY, interestMaxX, interestMaxY;
+    float interestX, interestY;
+    // Replicas in the area, and the changes to it not yet returned by QueryReplicaList()
+    DataStructures::OrderedList<Replica3*, Replica3*> interestReplicas;
+    DataStructures::List<Replica3*> interestToConstruct, interestToDestroy;
+    // Working list for SerializeByPriority()
+    DataStructures::List<LastSerializationResult*> prioritySerializeList;
+
+    // True while this connection is updated on a thread of ReplicaManager3::SetNumberOfUpdateThreads()
+    // Messages are then added to deferredSends, and sent by ReplicaManager3::UpdateOnThreads() once every connection is done
+    bool updatingOnThread;
+    DataStructures::List<RM3SerializedMessage*> deferredSends;
+    void SendOrDefer(RakNet::BitStream *bitStream, const PRO &sendParameters, RakNet::RakPeerInterface *rakPeer);
+    void SendDeferredMessages(RakNet::RakPeerInterface *rakPeer);
+
+    // Snapshots sent with a receipt that has not come back yet, see ReplicaManager3::SetSnapshotReplication()
+    DataStructures::OrderedList<uint32_t, RM3SnapshotReceipt, Connection_RM3::SnapshotReceiptComp> snapshotReceipts;
+
     friend class ReplicaManager3;
 private:
     Connection_RM3() {};
@@ -838,6 +1071,42 @@ enum Replica3P2PMode
 
 };
 
+/// \internal
+/// A serialization message written once and sent to several connections with RakPeerInterface::SendGather()
+/// Deleted when the last send releases it
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3SerializedMessage
+{
+    RakNet::BitStream bitStream;
+    PRO pro;
+    std::atomic<unsigned int> refCount;
+
+    static void Release(void *context);
+};
+
+/// \internal
+/// What Replica3::Serialize() returned for a view class this tick, and what was last sent to it. See ReplicaManager3::SetSerializeOncePerViewClass()
+/// \ingroup REPLICA_MANAGER_GROUP3
+struct RM3ViewClassSerialization
+{
+    RM3ViewClassSerialization();
+    ~RM3ViewClassSerialization();
+    void ClearMessages(void);
+
+    uint32_t viewClass;
+    // ReplicaManager3::serializeTick when Serialize() was last called for this view class
+    uint32_t serializeTick;
+    RM3SerializationResult serializationResult;
+    // Added to SerializeParameters::bitsWrittenSoFar for each connection the messages are sent to
+    BitSize_t bitsWritten;
+    LastSerializationResultBS lastSentSerialization;
+    // What Serialize() set in SerializeParameters this tick, for a connection that is sent every channel
+    PRO pro[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS];
+    RakNet::Time messageTimestamp;
+    // Messages to send this tick. Holds one reference to each until the next tick
+    DataStructures::List<RM3SerializedMessage*> messages;
+};
+
 /// \brief Base class for your replicated objects for the ReplicaManager3 system.
 /// \details To use, derive your class, or a member of your class, from Replica3.<BR>
 /// \ingroup REPLICA_MANAGER_GROUP3
@@ -975,6 +1244,20 @@ public:
     /// \details Use to track how much bandwidth this class it taking
     virtual void OnSerializeTransmission(RakNet::BitStream *bitStream, RakNet::Connection_RM3 *destinationConnection, BitSize_t bitsPerChannel[RM3_NUM_OUTPUT_BITSTREAM_CHANNELS], RakNet::Time curTime) {(void) bitStream; (void) destinationConnection; (void) bitsPerChannel; (void) curTime;}
 
+    /// \brief Where this object is, when ReplicaManager3::SetInterestManagement() is enabled
+    /// \details Called once per autoserialize tick.
+    /// \param[out] x Position in world units
+    /// \param[out] y Position in world units
+    /// \return True if the object has a position. Defaults to false, which makes the object relevant to every connection.
+    virtual bool QueryInterestPosition(float *x, float *y) const {(void) x; (void) y; return false;}
+
+    /// \brief How important it is to update this object on \a destinationConnection, when Connection_RM3::QueryBytesPerTickBudget() is used
+    /// \details Added up every tick the object is not serialized to that connection. Objects with the highest total are serialized first.
+    /// \param[in] destinationConnection Which system we will send to
+    /// \param[in] distance Distance from Connection_RM3::QueryInterestArea() to QueryInterestPosition(), or 0 if either is not known
+    /// \return The priority. Defaults to 1 at distance 0, halving at one interest cell away.
+    virtual float QueryInterestPriority(RakNet::Connection_RM3 *destinationConnection, float distance);
+
     /// \brief Read what was written in Serialize()
     /// \details Reads the contents of the class from SerializationParamters::serializationBitstream.<BR>
     /// Called whenever Serialize() is called with different data from the last send.
@@ -1088,9 +1371,16 @@ public:
     ReplicaManager3 *replicaManager;
 
     LastSerializationResultBS lastSentSerialization;
+    // Used when ReplicaManager3::SetSerializeOncePerViewClass() is enabled, one per view class this replica was serialized for
+    DataStructures::List<RM3ViewClassSerialization*> viewClassSerializations;
     bool forceSendUntilNextUpdate;
+    // Locked when serializing with ReplicaManager3::SetNumberOfUpdateThreads(), as lastSentSerialization, forceSendUntilNextUpdate and viewClassSerializations are shared by every connection
+    RakNet::SimpleMutex serializeMutex;
     LastSerializationResult *lsr;
     uint32_t referenceIndex;
+    // Used when ReplicaManager3::SetInterestManagement() is enabled. The grid cell this replica is in, and its last position
+    RM3InterestCell *interestCell;
+    float interestX, interestY;
 };
 
 /// \brief Use Replica3 through composition instead of inheritance by containing an instance of this templated class
@@ -19,7 +19,6 @@
 #else
     #include <pthread.h>
     #include <sys/types.h>
-    #include "SimpleMutex.h"
 #endif
 
 #include "Export.h"
@@ -42,7 +41,7 @@ protected:
 #ifdef _WIN32
     HANDLE eventList;
 #else
-    SimpleMutex isSignaledMutex;
+    // Only read and written with hMutex locked
     bool isSignaled;
 #if !defined(ANDROID)
     pthread_condattr_t condAttr;
@@ -17,17 +17,26 @@ namespace RakNet
     public:
         SplitPacketList();
         ~SplitPacketList() = default;
-        void prealloc(unsigned count, SplitPacketIdType splitPacketId);
+        void prealloc(unsigned count, SplitPacketIdType splitPacketId, bool streamed = false);
         bool insert(InternalPacket *internalPacket);
         unsigned size() const;
         unsigned count() const;
 
+        // A streamed list only records which split packets arrived. The reliability layer writes them into the message itself
+        bool streamed() const;
+        // Returns false if the split packet already arrived
+        bool markArrived(SplitPacketIndexType splitPacketIndex);
+        bool hasArrived(SplitPacketIndexType splitPacketIndex) const;
+
         InternalPacket *operator[](unsigned n);
         SplitPacketIdType id() const;
     private:
         std::vector<InternalPacket*> packets;
+        std::vector<bool> arrived;
         SplitPacketIdType splitPacketId;
+        SplitPacketIndexType total;
         SplitPacketIndexType inUse;
+        bool isStreamed;
         ReliabilityLayer *reliabilityLayer;
     };
 }
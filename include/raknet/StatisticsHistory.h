@@ -27,6 +27,7 @@
 #include "RakString.h"
 #include "DS_Queue.h"
 #include "DS_Hash.h"
+#include "RakNetStatistics.h"
 #include <float.h>
 
 namespace RakNet
@@ -223,9 +224,22 @@ protected:
 //     virtual void OnDirectSocketReceive(const char *data, const BitSize_t bitsUsed, SystemAddress remoteSystemAddress);
 
 
+    // Adds the tick profile of each connection accumulated over the last second, if tick profiling is on
+    void AddTickProfileValues(const RakNetGUID &guid, unsigned int objectIndex, Time curTime);
+
     bool addNewConnections;
     bool removeLostConnections;
     int newConnectionsObjectType;
+
+    // Tick profile of each connection when its values were last added
+    struct TickProfileSnapshot
+    {
+        uint64_t guid;
+        Time time;
+        RakNetTickProfile profile;
+    };
+    static int TickProfileSnapshotComp( const uint64_t &key, TickProfileSnapshot* const &data );
+    DataStructures::OrderedList<uint64_t, TickProfileSnapshot*, TickProfileSnapshotComp> tickProfileSnapshots;
 };
 
 } // namespace RakNet
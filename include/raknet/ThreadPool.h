@@ -291,16 +291,16 @@ void* WorkerThread( void* arguments )
         threadPool->workingThreadCountMutex.Unlock();
     }
 
-    // Decrease numThreadsRunning
-    threadPool->numThreadsRunningMutex.Lock();
-    --threadPool->numThreadsRunning;
-    threadPool->numThreadsRunningMutex.Unlock();
-
     if (threadPool->perThreadDataDestructor)
         threadPool->perThreadDataDestructor(perThreadData);
     else if (threadPool->threadDataInterface)
         threadPool->threadDataInterface->PerThreadDestructor(perThreadData, threadPool->tdiContext);
 
+    // Decrease numThreadsRunning last, as StopThreads() returns once it is 0 and the pool may then be deleted
+    threadPool->numThreadsRunningMutex.Lock();
+    --threadPool->numThreadsRunning;
+    threadPool->numThreadsRunningMutex.Unlock();
+
     return 0;
 }
 
@@ -492,6 +492,7 @@ void ThreadPool<InputType, OutputType>::Clear(void)
     }
     else
     {
+        runThreadsMutex.Unlock();
         inputFunctionQueue.Clear();
         inputQueue.Clear();
         outputQueue.Clear();